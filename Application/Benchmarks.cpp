@@ -0,0 +1,2068 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lua.hpp"
+#include "raylib.h"
+#include "raymath.h"
+
+#include "BoxBatch.h"
+#include "Bvh.h"
+#include "Collision.h"
+#include "FrustumCulling.h"
+#include "GcSweeper.h"
+#include "ScriptRuntime.h"
+#include "ScriptSystem.h"
+#include "Simulation.h"
+#include "SpatialHash.h"
+#include "TypedArray.h"
+
+#define SCALING_MAX_THREADS 16
+#define SCALING_BATCHES 32
+#define SCALING_JOBS_PER_BATCH 16
+
+#define GCSWEEP_HEAP_MB 500
+#define GCSWEEP_FRAMES 1500
+#define GCSWEEP_FRAME_US 16667
+
+#define GCBUDGET_HEAP_MB 100
+#define GCBUDGET_FRAMES 3000
+#define GCBUDGET_STEP_US 1000
+#define GCBUDGET_FRAME_US 6000
+
+#define ECS_BENCH_ENTITIES 1000000
+#define ECS_BENCH_PASSES 20
+
+#define LEVEL_BENCH_SPACING 4.0f
+#define LEVEL_BENCH_HEIGHT 20.0f
+#define LEVEL_BENCH_QUERIES 10000
+#define LEVEL_BENCH_CHECKED 200
+
+#define BVH_BENCH_RAY_LENGTH 100.0f
+#define BVH_BENCH_SWEEP_LENGTH 10.0f
+#define BVH_BENCH_SEED 12345
+
+#define BOX_BATCH_BENCH_BOXES 10000
+#define BOX_BATCH_BENCH_QUERIES 10
+
+#define CULL_BENCH_BOXES 1000000
+#define CULL_BENCH_ASPECT (16.0f / 9.0f)
+
+#define SCRIPT_BENCH_ENTITIES 10000
+#define SCRIPT_BENCH_TICKS 10
+
+#define TYPED_ARRAY_BENCH_ENTITIES 10000
+
+#define FIELD_BENCH_OBJECTS 1000
+#define FIELD_BENCH_CHECK_FRAMES 100
+
+#define MEMORY_REPORT_ENTITIES 100000
+#define MEMORY_REPORT_KINDS 6
+
+#define COROUTINE_REPORT_COUNT 10000
+#define COROUTINE_REPORT_KINDS 5
+// LUAI_THREADPOOL: dead threads the state keeps for reuse once the others are freed
+#define COROUTINE_REPORT_POOLED 256
+
+#define COROUTINE_BENCH_COUNT 100000
+#define COROUTINE_BENCH_WAITS 16
+
+#define BINDING_BENCH_CALLS 10000000
+#define BINDING_BENCH_RUNS 5
+#define BINDING_BENCH_METATABLE "BenchEntity"
+
+#define POOL_BENCH_FRAMES 3000
+#define POOL_BENCH_OBJECTS 400
+#define POOL_BENCH_RUNS 5
+
+#define FRAME_GC_BENCH_ENTITIES 5000
+#define FRAME_GC_BENCH_FRAMES 300
+#define FRAME_GC_BENCH_RUNS 5
+
+// Each batch the host submits fans out into jobs that integrate a swarm of bodies, so most of
+// the work is spawned on one worker and only spreads to the others by stealing
+static const char* scalingScript = R"(
+function batch(b)
+	for i = 1, %d do jobs.spawn("swarm", { seed = b * 100 + i, bodies = 200, frames = 60 }) end
+end
+
+function swarm(t)
+	local pos, vel = {}, {}
+	for i = 1, t.bodies do
+		pos[i] = vec.new(i, t.seed % 7, 0)
+		vel[i] = vec.new(1, 2, t.seed % 3)
+	end
+	local gravity = vec.new(0, -9.8, 0)
+	for f = 1, t.frames do
+		for i = 1, t.bodies do
+			local v = vel[i] + gravity * (1 / 60)
+			vel[i] = v
+			pos[i] = pos[i] + v * (1 / 60)
+		end
+	end
+	local sum = 0
+	for i = 1, t.bodies do sum = sum + vec.length(pos[i]) end
+	jobs.post(sum)
+end
+)";
+
+// ./Application --script-scaling: runs the same job graph on 1..16 worker states
+int RunScriptScaling()
+{
+	char script[2048];
+	snprintf(script, sizeof(script), scalingScript, SCALING_JOBS_PER_BATCH);
+
+	lua_State* L = luaL_newstate();
+	std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+	double baseline = 0.0;
+	for (int threads = 1; threads <= SCALING_MAX_THREADS; threads *= 2)
+	{
+		ScriptRuntime runtime(threads);
+		runtime.RunString(script);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int b = 0; b < SCALING_BATCHES; b++)
+		{
+			ScriptMessage message;
+			std::string error;
+			lua_pushinteger(L, b);
+			EncodeMessage(L, -1, message, error);
+			lua_pop(L, 1);
+			runtime.Submit("batch", std::move(message));
+		}
+		runtime.Wait();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		int results = 0;
+		ScriptMessage result;
+		while (runtime.PollResult(result))
+			results++;
+
+		if (threads == 1)
+			baseline = seconds;
+		std::cout << threads << " threads: " << seconds * 1000.0 << " ms, speedup " << baseline / seconds
+			<< ", " << runtime.JobsRun() << " jobs, " << runtime.JobsStolen() << " stolen, " << results << " results" << std::endl;
+	}
+	lua_close(L);
+	return 0;
+}
+
+// Keeps a large heap of entity-like tables alive and replaces a random slice of it every frame,
+// so old objects keep dying all over the heap and every cycle has most of it to sweep
+static const char* gcSweepScript = R"(
+heap = {}
+
+function build(mb)
+	local n = 0
+	while collectgarbage("count") < mb * 1024 do
+		for i = n + 1, n + 10000 do
+			heap[i] = { i, i + 1, name = "e" .. i, pos = { x = i, y = i, z = i } }
+		end
+		n = n + 10000
+	end
+	return n
+end
+
+local seed = 1
+function frame(f)
+	local n = #heap
+	for i = 1, 2000 do
+		local temporary = { f, i }
+	end
+	for i = 1, 2000 do
+		seed = (seed * 1103515245 + 12345) % 2147483648
+		local k = seed % n + 1
+		heap[k] = { k, f, name = "e" .. k .. "_" .. f, pos = { x = f, y = k, z = i } }
+	end
+end
+)";
+
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+	size_t i = (size_t)(p * sorted.size());
+	return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+// ./Application --gc-sweep: frame times on a GCSWEEP_HEAP_MB heap, with the collector freeing
+// dead objects itself and with a GcSweeper, in incremental mode and with frame regions
+int RunGcSweep()
+{
+	for (int regions = 0; regions <= 1; regions++)
+	{
+		for (int background = 0; background <= 1; background++)
+		{
+			lua_State* L = luaL_newstate();
+			luaL_openlibs(L);
+			GcSweeper sweeper;
+			if (background)
+				sweeper.Attach(L);
+			if (luaL_dostring(L, gcSweepScript) != LUA_OK)
+			{
+				DumpError(L);
+				sweeper.Detach();
+				lua_close(L);
+				return 1;
+			}
+
+			lua_getglobal(L, "build");
+			lua_pushinteger(L, GCSWEEP_HEAP_MB);
+			lua_call(L, 1, 1);
+			lua_Integer entities = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			if (regions)
+				lua_gc(L, LUA_GCGEN, 0, 0);
+
+			std::vector<double> times;
+			for (int f = 0; f < GCSWEEP_FRAMES; f++)
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				if (regions)
+					lua_beginframe(L);
+				lua_getglobal(L, "frame");
+				lua_pushinteger(L, f);
+				lua_call(L, 1, 0);
+				if (regions)
+					lua_endframe(L);
+				std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+				times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+				// Paced like the game loop, the sweeper runs in what is left of the frame
+				std::this_thread::sleep_until(start + std::chrono::microseconds(GCSWEEP_FRAME_US));
+			}
+			std::sort(times.begin(), times.end());
+
+			std::cout << (regions ? "frame regions" : "incremental") << (background ? ", background sweep: " : ", inline sweep: ")
+				<< entities << " entities, " << lua_gc(L, LUA_GCCOUNT, 0) / 1024 << " MB, frame ms p50 " << Percentile(times, 0.5)
+				<< " p99 " << Percentile(times, 0.99) << " p99.9 " << Percentile(times, 0.999) << " max " << times.back()
+				<< ", " << sweeper.BatchesFreed() << " batches" << std::endl;
+
+			sweeper.Detach();
+			lua_close(L);
+		}
+	}
+	return 0;
+}
+
+// ./Application --gc-budget: frame times of the --gc-sweep workload on a GCBUDGET_HEAP_MB heap
+// with the collector paced by bytes, by a time budget (LUA_GCBUDGET) and with frame regions.
+// Frame regions without a budget run the generational collector, whose major collections are
+// not split into steps: every couple of hundred frames one frame collects the whole heap, which
+// is where their p99.9 comes from. Only the time budget bounds those frames, at the cost of a
+// bigger heap (up to LUAI_GCBACKSTOP times what it would be otherwise).
+int RunGcBudget()
+{
+	const char* names[] = { "incremental", "time budget", "frame regions, generational" };
+	for (int mode = 0; mode < 3; mode++)
+	{
+		lua_State* L = luaL_newstate();
+		luaL_openlibs(L);
+		if (luaL_dostring(L, gcSweepScript) != LUA_OK)
+		{
+			DumpError(L);
+			lua_close(L);
+			return 1;
+		}
+
+		lua_getglobal(L, "build");
+		lua_pushinteger(L, GCBUDGET_HEAP_MB);
+		lua_call(L, 1, 1);
+		lua_pop(L, 1);
+		if (mode == 1)
+			lua_gc(L, LUA_GCBUDGET, GCBUDGET_STEP_US, GCBUDGET_FRAME_US);
+		else if (mode == 2)
+			lua_gc(L, LUA_GCGEN, 0, 0);
+
+		std::vector<double> times;
+		int peakKb = 0;
+		for (int f = 0; f < GCBUDGET_FRAMES; f++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if (mode != 0)
+				lua_beginframe(L);
+			lua_getglobal(L, "frame");
+			lua_pushinteger(L, f);
+			lua_call(L, 1, 0);
+			if (mode != 0)
+				lua_endframe(L);
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+			peakKb = std::max(peakKb, lua_gc(L, LUA_GCCOUNT, 0));
+			std::this_thread::sleep_until(start + std::chrono::microseconds(GCSWEEP_FRAME_US));
+		}
+		std::sort(times.begin(), times.end());
+
+		std::cout << names[mode] << ": peak " << peakKb / 1024 << " MB, frame ms p50 " << Percentile(times, 0.5)
+			<< " p99 " << Percentile(times, 0.99) << " p99.9 " << Percentile(times, 0.999) << " max " << times.back() << std::endl;
+		lua_close(L);
+	}
+	return 0;
+}
+
+// Best of ECS_BENCH_PASSES runs of pass, in nanoseconds per entity
+template <typename Pass>
+static double BestNsPerEntity(Pass pass, size_t entities)
+{
+	double best = 1e30;
+	for (int i = 0; i < ECS_BENCH_PASSES; i++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		pass();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		best = std::min(best, ns / entities);
+	}
+	return best;
+}
+
+// ./Application --bench-ecs: moves ECS_BENCH_ENTITIES positions by their velocity, in the fixed
+// AoS arrays main.cpp used to keep (Vector3 and Color per column), in a Registry view, and in a
+// Registry after a tenth of it was destroyed and respawned, which leaves its pools unaligned
+int RunEcsBenchmark()
+{
+	const size_t count = ECS_BENCH_ENTITIES;
+	const float dt = 1.0f / 60.0f;
+
+	std::vector<float> heights(count, 1.0f);
+	std::vector<Vector3> positions(count, Vector3{ 0.0f, 0.0f, 0.0f });
+	std::vector<Vector3> velocities(count, Vector3{ 1.0f, 2.0f, 3.0f });
+	std::vector<Color> colors(count, RED);
+	double arrays = BestNsPerEntity([&]()
+	{
+		for (size_t i = 0; i < count; i++)
+			positions[i] = Vector3Add(positions[i], Vector3Scale(velocities[i], dt));
+	}, count);
+
+	Registry world;
+	std::vector<Entity> entities;
+	for (size_t i = 0; i < count; i++)
+	{
+		Entity entity = world.Create();
+		world.Add(entity, Position{ { 0.0f, 0.0f, 0.0f } });
+		world.Add(entity, Velocity{ { 1.0f, 2.0f, 3.0f } });
+		world.Add(entity, Tint{ RED });
+		entities.push_back(entity);
+	}
+	auto move = [&]()
+	{
+		world.Each<Position, Velocity>([&](uint32_t, Position& position, Velocity& velocity)
+		{
+			position.value = Vector3Add(position.value, Vector3Scale(velocity.value, dt));
+		});
+	};
+	double view = BestNsPerEntity(move, count);
+
+	// Respawned entities reuse indices but are added to the pools in another order
+	unsigned int rng = 1;
+	for (size_t i = 0; i < count / 10; i++)
+	{
+		rng = rng * 1664525u + 1013904223u;
+		Entity& entity = entities[(rng >> 8) % count];
+		world.Destroy(entity);
+		entity = world.Create();
+		world.Add(entity, Velocity{ { 1.0f, 2.0f, 3.0f } });
+		world.Add(entity, Position{ { 0.0f, 0.0f, 0.0f } });
+	}
+	double churned = BestNsPerEntity(move, world.Pool<Position>().Size());
+	world.Group<Position, Velocity>();
+	double grouped = BestNsPerEntity(move, world.Pool<Position>().Size());
+
+	std::cout << count << " entities, position += velocity * dt, best of " << ECS_BENCH_PASSES << " passes, ns per entity:" << std::endl;
+	std::cout << "  AoS arrays        " << arrays << std::endl;
+	std::cout << "  Registry view     " << view << std::endl;
+	std::cout << "  after respawns    " << churned << std::endl;
+	std::cout << "  after Group       " << grouped << std::endl;
+	std::cout << "(checksum " << positions[count / 2].x + world.Pool<Position>().Data()[0].value.x + heights[0] + colors[0].r << ")" << std::endl;
+	return 0;
+}
+
+static float BenchRandom(unsigned int& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return (float)(state >> 8) / 16777216.0f;
+}
+
+// Column-sized boxes at a constant density, so the level grows in area with the box count
+static void GenerateLevelBoxes(size_t count, unsigned int seed, std::vector<BoundingBox>& boxes)
+{
+	float side = sqrtf((float)count) * LEVEL_BENCH_SPACING;
+	boxes.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		Vector3 center = { (BenchRandom(seed) - 0.5f) * side, BenchRandom(seed) * LEVEL_BENCH_HEIGHT, (BenchRandom(seed) - 0.5f) * side };
+		boxes.push_back(BoxAround(center, { 2.0f, 1.0f, 2.0f }));
+	}
+}
+
+// Boxes the size of the player's swept AABB (player plus one tick of movement), in the same area
+static void GenerateLevelQueries(size_t boxCount, unsigned int seed, std::vector<BoundingBox>& queries)
+{
+	float side = sqrtf((float)boxCount) * LEVEL_BENCH_SPACING;
+	queries.clear();
+	for (int i = 0; i < LEVEL_BENCH_QUERIES; i++)
+	{
+		Vector3 center = { (BenchRandom(seed) - 0.5f) * side, BenchRandom(seed) * LEVEL_BENCH_HEIGHT, (BenchRandom(seed) - 0.5f) * side };
+		queries.push_back(BoxAround(center, { 1.8f, 2.8f, 1.8f }));
+	}
+}
+
+// Every box overlapping the query, the way main.cpp tested collisions before the broad-phase
+static void BruteForceOverlap(const std::vector<BoundingBox>& boxes, BoundingBox query, std::vector<uint32_t>& out)
+{
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		if (BoxesOverlap(query, boxes[i]))
+			out.push_back((uint32_t)i);
+	}
+}
+
+// Same ids in any order
+static bool SameIds(std::vector<uint32_t> a, std::vector<uint32_t> b)
+{
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	return a == b;
+}
+
+// ./Application --bench-spatial-hash: query cost of the spatial hash against brute force as the
+// level grows from 10 to 1M boxes, checking the first LEVEL_BENCH_CHECKED queries of each size
+int RunSpatialHashBenchmark()
+{
+	std::vector<BoundingBox> boxes;
+	std::vector<BoundingBox> queries;
+	std::vector<uint32_t> found;
+	std::vector<uint32_t> expected;
+
+	std::cout << "boxes, build ms, hash ns/query, candidates/query, brute force ns/query" << std::endl;
+	for (size_t count = 10; count <= 1000000; count *= 10)
+	{
+		GenerateLevelBoxes(count, 1, boxes);
+		GenerateLevelQueries(count, 2, queries);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		SpatialHash hash;
+		for (size_t i = 0; i < count; i++)
+			hash.Insert((uint32_t)i, boxes[i]);
+		double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		size_t candidates = 0;
+		start = std::chrono::steady_clock::now();
+		for (const BoundingBox& query : queries)
+		{
+			found.clear();
+			hash.Query(query, found);
+			candidates += found.size();
+		}
+		double hashNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries.size();
+
+		// Brute force is linear in the box count, fewer queries keep the big sizes short
+		size_t bruteQueries = std::max<size_t>(LEVEL_BENCH_CHECKED, std::min<size_t>(queries.size(), 100000000 / count));
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < bruteQueries; q++)
+		{
+			expected.clear();
+			BruteForceOverlap(boxes, queries[q], expected);
+		}
+		double bruteNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / bruteQueries;
+
+		for (size_t q = 0; q < LEVEL_BENCH_CHECKED; q++)
+		{
+			found.clear();
+			expected.clear();
+			hash.Query(queries[q], found);
+			BruteForceOverlap(boxes, queries[q], expected);
+			if (!SameIds(found, expected))
+			{
+				std::cout << "FAILED: spatial hash and brute force disagree on query " << q << " with " << count << " boxes" << std::endl;
+				return 1;
+			}
+		}
+
+		std::cout << count << ", " << buildMs << ", " << hashNs << ", " << (double)candidates / queries.size() << ", " << bruteNs << std::endl;
+	}
+
+	// Coordinates far outside the cell range land in the border cells instead of overflowing
+	SpatialHash far;
+	BoundingBox distant = BoxAround({ 1e30f, -1e30f, 1e30f }, { 2.0f, 1.0f, 2.0f });
+	far.Insert(0, distant);
+	found.clear();
+	far.Query(distant, found);
+	if (found.size() != 1 || far.CellCount() != 1)
+	{
+		std::cout << "FAILED: a box at 1e30 was not stored in one border cell" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Slab test of a ray (or a sweep, with the box grown by the moving box's half extents)
+// against one box, written out plainly as the reference for the BVH queries
+static bool BruteForceSlab(BoundingBox box, Vector3 origin, Vector3 direction, Vector3 grow, float maxDistance, float& entry)
+{
+	float tNear = 0.0f;
+	float tFar = maxDistance;
+	float origins[3] = { origin.x, origin.y, origin.z };
+	float directions[3] = { direction.x, direction.y, direction.z };
+	float mins[3] = { box.min.x - grow.x, box.min.y - grow.y, box.min.z - grow.z };
+	float maxs[3] = { box.max.x + grow.x, box.max.y + grow.y, box.max.z + grow.z };
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (directions[axis] == 0.0f)
+		{
+			if (origins[axis] < mins[axis] || origins[axis] > maxs[axis])
+				return false;
+			continue;
+		}
+		float t1 = (mins[axis] - origins[axis]) / directions[axis];
+		float t2 = (maxs[axis] - origins[axis]) / directions[axis];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+	}
+	entry = tNear;
+	return tNear <= tFar;
+}
+
+// Random rays through the same area as GenerateLevelBoxes, unit length directions
+static void GenerateLevelRays(size_t boxCount, unsigned int seed, std::vector<Ray>& rays)
+{
+	float side = sqrtf((float)boxCount) * LEVEL_BENCH_SPACING;
+	rays.clear();
+	for (int i = 0; i < LEVEL_BENCH_QUERIES; i++)
+	{
+		Vector3 position = { (BenchRandom(seed) - 0.5f) * side, BenchRandom(seed) * LEVEL_BENCH_HEIGHT, (BenchRandom(seed) - 0.5f) * side };
+		Vector3 direction = { BenchRandom(seed) - 0.5f, BenchRandom(seed) - 0.5f, BenchRandom(seed) - 0.5f };
+		rays.push_back(Ray{ position, Vector3Normalize(direction) });
+	}
+}
+
+// ./Application --bench-bvh: overlap, ray cast and swept queries on the BVH against the brute
+// force CheckCollisionBoxes-style loop, for 10 to 1M static boxes. The first LEVEL_BENCH_CHECKED
+// queries of every kind are checked against the brute force answer.
+int RunBvhBenchmark()
+{
+	std::vector<BoundingBox> boxes;
+	std::vector<uint32_t> ids;
+	std::vector<BoundingBox> queries;
+	std::vector<Ray> rays;
+	std::vector<Vector3> deltas;
+	std::vector<uint32_t> found;
+	std::vector<uint32_t> expected;
+	std::vector<BvhHit> sweptHits;
+	size_t hits = 0;
+
+	std::cout << "boxes, build ms, overlap ns (brute), raycast ns (brute), swept ns (brute)" << std::endl;
+	for (size_t count = 10; count <= 1000000; count *= 10)
+	{
+		GenerateLevelBoxes(count, 1, boxes);
+		GenerateLevelQueries(count, 2, queries);
+		GenerateLevelRays(count, 3, rays);
+
+		unsigned int seed = 4;
+		deltas.clear();
+		for (size_t q = 0; q < queries.size(); q++)
+			deltas.push_back({ (BenchRandom(seed) - 0.5f) * BVH_BENCH_SWEEP_LENGTH, (BenchRandom(seed) - 0.5f) * BVH_BENCH_SWEEP_LENGTH, (BenchRandom(seed) - 0.5f) * BVH_BENCH_SWEEP_LENGTH });
+
+		ids.resize(count);
+		for (size_t i = 0; i < count; i++)
+			ids[i] = (uint32_t)i;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Bvh bvh;
+		bvh.Build(boxes.data(), ids.data(), count);
+		double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		// Brute force is linear in the box count, fewer queries keep the big sizes short
+		size_t bruteQueries = std::max<size_t>(LEVEL_BENCH_CHECKED, std::min<size_t>(queries.size(), 100000000 / count));
+
+		start = std::chrono::steady_clock::now();
+		for (const BoundingBox& query : queries)
+		{
+			found.clear();
+			bvh.QueryOverlap(query, found);
+			hits += found.size();
+		}
+		double overlapNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries.size();
+
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < bruteQueries; q++)
+		{
+			expected.clear();
+			BruteForceOverlap(boxes, queries[q], expected);
+		}
+		double bruteOverlapNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / bruteQueries;
+
+		start = std::chrono::steady_clock::now();
+		for (const Ray& ray : rays)
+		{
+			BvhHit hit;
+			hits += bvh.Raycast(ray, BVH_BENCH_RAY_LENGTH, hit) ? 1 : 0;
+		}
+		double raycastNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rays.size();
+
+		Vector3 noGrow = { 0.0f, 0.0f, 0.0f };
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < bruteQueries; q++)
+		{
+			float closest = BVH_BENCH_RAY_LENGTH;
+			for (size_t i = 0; i < count; i++)
+			{
+				float entry;
+				if (BruteForceSlab(boxes[i], rays[q].position, rays[q].direction, noGrow, closest, entry))
+					closest = entry;
+			}
+			hits += closest < BVH_BENCH_RAY_LENGTH ? 1 : 0;
+		}
+		double bruteRaycastNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / bruteQueries;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < queries.size(); q++)
+		{
+			sweptHits.clear();
+			bvh.QuerySwept(queries[q], deltas[q], sweptHits);
+			hits += sweptHits.size();
+		}
+		double sweptNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries.size();
+
+		start = std::chrono::steady_clock::now();
+		for (size_t q = 0; q < bruteQueries; q++)
+		{
+			Vector3 center = Vector3Scale(Vector3Add(queries[q].min, queries[q].max), 0.5f);
+			Vector3 grow = Vector3Scale(Vector3Subtract(queries[q].max, queries[q].min), 0.5f);
+			for (size_t i = 0; i < count; i++)
+			{
+				float entry;
+				if (BruteForceSlab(boxes[i], center, deltas[q], grow, 1.0f, entry))
+					hits++;
+			}
+		}
+		double bruteSweptNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / bruteQueries;
+
+		for (size_t q = 0; q < LEVEL_BENCH_CHECKED; q++)
+		{
+			found.clear();
+			expected.clear();
+			bvh.QueryOverlap(queries[q], found);
+			BruteForceOverlap(boxes, queries[q], expected);
+			if (!SameIds(found, expected))
+			{
+				std::cout << "FAILED: BVH overlap and brute force disagree on query " << q << " with " << count << " boxes" << std::endl;
+				return 1;
+			}
+
+			// Ties between boxes at the same distance may pick either, so compare distances
+			float closest = BVH_BENCH_RAY_LENGTH;
+			bool expectHit = false;
+			for (size_t i = 0; i < count; i++)
+			{
+				float entry;
+				if (BruteForceSlab(boxes[i], rays[q].position, rays[q].direction, noGrow, closest, entry))
+				{
+					closest = entry;
+					expectHit = true;
+				}
+			}
+			BvhHit hit;
+			bool gotHit = bvh.Raycast(rays[q], BVH_BENCH_RAY_LENGTH, hit);
+			if (gotHit != expectHit || (gotHit && fabsf(hit.distance - closest) > 1e-3f))
+			{
+				std::cout << "FAILED: BVH ray cast and brute force disagree on ray " << q << " with " << count << " boxes" << std::endl;
+				return 1;
+			}
+
+			sweptHits.clear();
+			bvh.QuerySwept(queries[q], deltas[q], sweptHits);
+			found.clear();
+			for (const BvhHit& swept : sweptHits)
+				found.push_back(swept.id);
+			expected.clear();
+			Vector3 center = Vector3Scale(Vector3Add(queries[q].min, queries[q].max), 0.5f);
+			Vector3 grow = Vector3Scale(Vector3Subtract(queries[q].max, queries[q].min), 0.5f);
+			for (size_t i = 0; i < count; i++)
+			{
+				float entry;
+				if (BruteForceSlab(boxes[i], center, deltas[q], grow, 1.0f, entry))
+					expected.push_back((uint32_t)i);
+			}
+			if (!SameIds(found, expected))
+			{
+				std::cout << "FAILED: BVH sweep and brute force disagree on query " << q << " with " << count << " boxes" << std::endl;
+				return 1;
+			}
+		}
+
+		std::cout << count << ", " << buildMs << ", " << overlapNs << " (" << bruteOverlapNs << "), " << raycastNs << " (" << bruteRaycastNs << "), "
+			<< sweptNs << " (" << bruteSweptNs << ")" << std::endl;
+	}
+
+	// Picking must not return a box destroyed since the last tick
+	Simulation simulation(BVH_BENCH_SEED, 1);
+	Registry& world = simulation.GetWorld();
+	Entity column = world.HandleOf(world.Pool<Position>().Entities()[0]);
+	Ray down = { Vector3Add(world.Get<Position>(column).value, { 0.0f, 10.0f, 0.0f }), { 0.0f, -1.0f, 0.0f } };
+	Entity picked;
+	float distance;
+	if (!simulation.PickBox(down, BVH_BENCH_RAY_LENGTH, picked, distance) || picked != column)
+	{
+		std::cout << "FAILED: picking straight down did not hit the column" << std::endl;
+		return 1;
+	}
+	simulation.DestroyBox(column);
+	Entity replacement = simulation.SpawnBox({ 1000.0f, 0.0f, 1000.0f }, { 1.0f, 1.0f, 1.0f }, BLACK, false);
+	if (simulation.PickBox(down, BVH_BENCH_RAY_LENGTH, picked, distance) && picked == replacement)
+	{
+		std::cout << "FAILED: picking returned a destroyed box under a reused index" << std::endl;
+		return 1;
+	}
+
+	std::cout << "(checksum " << hits << ")" << std::endl;
+	return 0;
+}
+
+// Tests every bit of a batch mask against raylib's CheckCollisionBoxes on the same boxes
+static bool MaskMatchesRaylib(const BoxBatch& batch, BoundingBox query, const uint32_t* mask)
+{
+	for (size_t i = 0; i < batch.MaskWords() * 32; i++)
+	{
+		bool bit = (mask[i / 32] >> (i % 32)) & 1u;
+		bool expected = i < batch.Size() && CheckCollisionBoxes(query, batch.GetBox(i));
+		if (bit != expected)
+			return false;
+	}
+	return true;
+}
+
+// ./Application --bench-box-batch: the three per-axis sweep tests against 10k boxes, one
+// CheckCollisionBoxes call per box and sweep (the old collision loop) against one
+// BoxBatchOverlap3 pass, then a check of the masks against raylib's answer
+int RunBoxBatchBenchmark()
+{
+	std::vector<BoundingBox> boxes;
+	std::vector<BoundingBox> queries;
+	GenerateLevelBoxes(BOX_BATCH_BENCH_BOXES, 1, boxes);
+	GenerateLevelQueries(BOX_BATCH_BENCH_BOXES, 2, queries);
+
+	// The old loop rebuilt both boxes from the column position on every call
+	std::vector<Vector3> centers;
+	for (const BoundingBox& box : boxes)
+		centers.push_back(Vector3Scale(Vector3Add(box.min, box.max), 0.5f));
+	Vector3 size = { 2.0f, 1.0f, 2.0f };
+
+	// Best of ECS_BENCH_PASSES, each pass sweeps BOX_BATCH_BENCH_QUERIES query boxes along
+	// the three axes like ResolveCollisions does, timings are per box tested
+	BoxBatch batch;
+	double fillNs = BestNsPerEntity([&]()
+	{
+		batch.Clear();
+		for (size_t i = 0; i < boxes.size(); i++)
+			batch.Push(boxes[i], (uint32_t)i);
+	}, boxes.size());
+
+	size_t hits = 0;
+	double perPairNs = BestNsPerEntity([&]()
+	{
+		for (int q = 0; q < BOX_BATCH_BENCH_QUERIES; q++)
+		{
+			for (size_t i = 0; i < centers.size(); i++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if (CheckCollisionBoxes(queries[q], BoxAround(centers[i], size)))
+						hits++;
+				}
+			}
+		}
+	}, boxes.size() * BOX_BATCH_BENCH_QUERIES);
+
+	std::vector<uint32_t> hitMasks(batch.MaskWords() * 3);
+	uint32_t* masks[3] = { hitMasks.data(), hitMasks.data() + batch.MaskWords(), hitMasks.data() + batch.MaskWords() * 2 };
+	double batchedNs = BestNsPerEntity([&]()
+	{
+		for (int q = 0; q < BOX_BATCH_BENCH_QUERIES; q++)
+		{
+			BoundingBox sweeps[3] = { queries[q], queries[q], queries[q] };
+			BoxBatchOverlap3(batch, sweeps, masks);
+			hits += hitMasks[q];
+		}
+	}, boxes.size() * BOX_BATCH_BENCH_QUERIES);
+
+	std::cout << BOX_BATCH_BENCH_BOXES << " boxes, ns per box for all three sweeps, " << BoxBatchKernel() << " kernel" << std::endl;
+	std::cout << "  CheckCollisionBoxes per pair  " << perPairNs << std::endl;
+	std::cout << "  BoxBatchOverlap3              " << batchedNs << " (" << perPairNs / batchedNs << "x)" << std::endl;
+	std::cout << "  filling the batch             " << fillNs << std::endl;
+	std::cout << "(checksum " << hits << ")" << std::endl;
+
+	for (int q = 0; q < LEVEL_BENCH_CHECKED; q++)
+	{
+		BoundingBox sweeps[3] = { queries[q], BoxAround(centers[q], size), queries[q + 1] };
+		BoxBatchOverlap3(batch, sweeps, masks);
+		for (int k = 0; k < 3; k++)
+		{
+			if (!MaskMatchesRaylib(batch, sweeps[k], masks[k]))
+			{
+				std::cout << "FAILED: BoxBatchOverlap3 and CheckCollisionBoxes disagree on query " << q << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	// Touching faces count as overlap, and the padding past a size that is not a whole block
+	// never shows up in the mask, even for a query covering everything or with stale boxes
+	// left there by an earlier fill
+	BoxBatch small;
+	for (uint32_t i = 0; i < 11; i++)
+		small.Push(boxes[i], i);
+	small.Clear();
+	small.Push(BoxAround({ 0.0f, 0.0f, 0.0f }, { 2.0f, 2.0f, 2.0f }), 0);
+	small.Push(BoxAround({ 5.0f, 0.0f, 0.0f }, { 2.0f, 2.0f, 2.0f }), 1);
+	small.Push(BoxAround({ 2.0f, 0.0f, 0.0f }, { 2.0f, 2.0f, 2.0f }), 2);
+	BoundingBox edgeQueries[] = {
+		BoxAround({ 2.0f, 0.0f, 0.0f }, { 2.0f, 2.0f, 2.0f }),
+		BoundingBox{ { -INFINITY, -INFINITY, -INFINITY }, { INFINITY, INFINITY, INFINITY } },
+		BoundingBox{ { -FLT_MAX, -FLT_MAX, -FLT_MAX }, { FLT_MAX, FLT_MAX, FLT_MAX } },
+	};
+	uint32_t mask = 0;
+	for (const BoundingBox& query : edgeQueries)
+	{
+		BoxBatchOverlap(small, query, &mask);
+		if (!MaskMatchesRaylib(small, query, &mask))
+		{
+			std::cout << "FAILED: BoxBatchOverlap and CheckCollisionBoxes disagree on an edge case" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Reference for CullBoxes in double precision: a box is culled when all eight corners are
+// outside the same clip plane, or its center is beyond maxDistance. Sets margin to how far the
+// deciding test was from flipping, so answers right at a boundary can be told apart.
+static bool ReferenceVisible(BoundingBox box, Matrix viewProjection, Vector3 eye, float maxDistance, double& margin)
+{
+	float16 elements = MatrixToFloatV(viewProjection);
+	const float* m = elements.v;
+	double worst = 1e300;
+	for (int plane = 0; plane < 6; plane++)
+	{
+		int axis = plane / 2;
+		double sign = (plane % 2 == 0) ? 1.0 : -1.0;
+		double best = -1e300;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			double p[3] = { (corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z };
+			double clip = m[axis] * p[0] + m[4 + axis] * p[1] + m[8 + axis] * p[2] + m[12 + axis];
+			double w = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+			best = std::max(best, (w + sign * clip) / std::max(1.0, std::fabs(w)));
+		}
+		worst = std::min(worst, best);
+	}
+
+	if (maxDistance > 0.0f)
+	{
+		double dx = (box.min.x + box.max.x) * 0.5 - eye.x;
+		double dy = (box.min.y + box.max.y) * 0.5 - eye.y;
+		double dz = (box.min.z + box.max.z) * 0.5 - eye.z;
+		double distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+		worst = std::min(worst, (maxDistance - distance) / maxDistance);
+	}
+
+	margin = std::fabs(worst);
+	return worst >= 0.0;
+}
+
+// ./Application --bench-culling: culls 1M level boxes against a camera standing in the level,
+// with and without the draw distance cutoff, and checks the visible set against the reference
+int RunCullingBenchmark()
+{
+	std::vector<BoundingBox> boxes;
+	GenerateLevelBoxes(CULL_BENCH_BOXES, 1, boxes);
+
+	BoxBatch batch;
+	for (size_t i = 0; i < boxes.size(); i++)
+		batch.Push(boxes[i], (uint32_t)i);
+
+	Camera camera = { 0 };
+	camera.position = Vector3{ 0.0f, 2.0f, 0.0f };
+	camera.target = Vector3{ 1.0f, 2.5f, 0.3f };
+	camera.up = Vector3{ 0.0f, 1.0f, 0.0f };
+	camera.fovy = 60.0f;
+	camera.projection = CAMERA_PERSPECTIVE;
+
+	Frustum frustum = FrustumFromCamera(camera, CULL_BENCH_ASPECT);
+	Matrix viewProjection = MatrixMultiply(MatrixLookAt(camera.position, camera.target, camera.up),
+		MatrixPerspective(camera.fovy * DEG2RAD, CULL_BENCH_ASPECT, FRUSTUM_NEAR_PLANE, FRUSTUM_FAR_PLANE));
+
+	std::vector<uint32_t> visible;
+	std::vector<uint32_t> expected;
+	std::cout << CULL_BENCH_BOXES << " boxes, best of " << ECS_BENCH_PASSES << " passes" << std::endl;
+
+	float distances[] = { 0.0f, COLUMN_DRAW_DISTANCE };
+	for (float maxDistance : distances)
+	{
+		double cullNs = BestNsPerEntity([&]()
+		{
+			visible.clear();
+			CullBoxes(batch, frustum, camera.position, maxDistance, visible);
+		}, boxes.size());
+
+		size_t borderline = 0;
+		expected.clear();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			double margin;
+			if (ReferenceVisible(boxes[i], viewProjection, camera.position, maxDistance, margin))
+				expected.push_back((uint32_t)i);
+		}
+		double referenceNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / boxes.size();
+
+		// Boxes both tests put on the same side must match exactly, only boxes within
+		// float rounding of a plane may differ
+		std::vector<char> inVisible(boxes.size(), 0);
+		std::vector<char> inExpected(boxes.size(), 0);
+		for (uint32_t id : visible)
+			inVisible[id] = 1;
+		for (uint32_t id : expected)
+			inExpected[id] = 1;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			if (inVisible[i] == inExpected[i])
+				continue;
+
+			double margin;
+			ReferenceVisible(boxes[i], viewProjection, camera.position, maxDistance, margin);
+			if (margin > 1e-4)
+			{
+				std::cout << "FAILED: CullBoxes and the corner test disagree on box " << i << std::endl;
+				return 1;
+			}
+			borderline++;
+		}
+
+		std::cout << "  draw distance " << (maxDistance > 0.0f ? std::to_string((int)maxDistance) : std::string("off")) << ": " << visible.size()
+			<< " visible (reference " << expected.size() << ", " << borderline << " on a plane), CullBoxes " << cullNs
+			<< " ns/box, corner test " << referenceNs << " ns/box" << std::endl;
+	}
+
+	// A box right in front of the camera is kept, one right behind it is dropped
+	BoxBatch pair;
+	pair.Push(BoxAround(Vector3Add(camera.position, { 10.0f, 5.0f, 3.0f }), { 1.0f, 1.0f, 1.0f }), 0);
+	pair.Push(BoxAround(Vector3Subtract(camera.position, { 10.0f, 5.0f, 3.0f }), { 1.0f, 1.0f, 1.0f }), 1);
+	visible.clear();
+	CullBoxes(pair, frustum, camera.position, 0.0f, visible);
+	if (visible.size() != 1 || visible[0] != 0)
+	{
+		std::cout << "FAILED: the boxes in front of and behind the camera were not culled as expected" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static const char* perEntityScript = R"(
+function move(dt, x, y, z, vx, vy, vz)
+	return x + vx * dt, y + vy * dt, z + vz * dt
+end
+)";
+
+static const char* eachScript = R"(
+ecs.each("move", { "Position", "Velocity" }, function(dt, x, y, z, vx, vy, vz)
+	return x + vx * dt, y + vy * dt, z + vz * dt
+end)
+)";
+
+static const char* batchedScript = R"(
+ecs.system("move", { "Position", "Velocity" }, function(count, dt, positions, velocities)
+	local px, py, pz = positions.x, positions.y, positions.z
+	local vx, vy, vz = velocities.x, velocities.y, velocities.z
+	for i = 1, count do
+		px[i] = px[i] + vx[i] * dt
+		py[i] = py[i] + vy[i] * dt
+		pz[i] = pz[i] + vz[i] * dt
+	end
+end)
+)";
+
+static const char* methodScript = R"(
+ecs.system("move", { "Position", "Velocity" }, function(count, dt, positions, velocities)
+	for i = 1, count do
+		local x, y, z = positions:get(i)
+		local vx, vy, vz = velocities:get(i)
+		positions:set(i, x + vx * dt, y + vy * dt, z + vz * dt)
+	end
+end)
+)";
+
+static const char* staleScript = R"(
+ecs.system("keep", { "Position" }, function(count, dt, positions)
+	kept, keptX = positions, positions.x
+end)
+)";
+
+static void SpawnMovers(Registry& world, size_t count)
+{
+	unsigned int seed = 5;
+	for (size_t i = 0; i < count; i++)
+	{
+		Entity entity = world.Create();
+		world.Add(entity, Position{ { BenchRandom(seed) * 100.0f, BenchRandom(seed) * 10.0f, BenchRandom(seed) * 100.0f } });
+		world.Add(entity, Velocity{ { BenchRandom(seed) - 0.5f, BenchRandom(seed) - 0.5f, BenchRandom(seed) - 0.5f } });
+	}
+}
+
+// One lua_pcall per entity, components passed as numbers and the new position returned
+static void UpdatePerEntity(lua_State* L, Registry& world, float dt)
+{
+	world.Each<Position, Velocity>([&](uint32_t, Position& position, Velocity& velocity)
+	{
+		lua_getglobal(L, "move");
+		lua_pushnumber(L, dt);
+		lua_pushnumber(L, position.value.x);
+		lua_pushnumber(L, position.value.y);
+		lua_pushnumber(L, position.value.z);
+		lua_pushnumber(L, velocity.value.x);
+		lua_pushnumber(L, velocity.value.y);
+		lua_pushnumber(L, velocity.value.z);
+		if (lua_pcall(L, 7, 3, 0) != LUA_OK)
+		{
+			DumpError(L);
+			return;
+		}
+		position.value = Vector3{ (float)lua_tonumber(L, -3), (float)lua_tonumber(L, -2), (float)lua_tonumber(L, -1) };
+		lua_pop(L, 3);
+	});
+}
+
+static bool SamePositions(Registry& a, Registry& b)
+{
+	ComponentPool<Position>& left = a.Pool<Position>();
+	ComponentPool<Position>& right = b.Pool<Position>();
+	return left.Size() == right.Size() && memcmp(left.Data(), right.Data(), left.Size() * sizeof(Position)) == 0;
+}
+
+// Runs code that should fail and checks the error message mentions what
+static bool FailsWith(lua_State* L, const char* code, const char* what)
+{
+	if (luaL_dostring(L, code) == LUA_OK)
+		return false;
+	bool matches = strstr(lua_tostring(L, -1), what) != NULL;
+	lua_pop(L, 1);
+	return matches;
+}
+
+// ./Application --bench-script-systems: moves SCRIPT_BENCH_ENTITIES entities by their velocity
+// from Lua, once with a lua_pcall per entity, then through ScriptSystem with ecs.each (one call
+// per entity inside one pcall) and with batched systems, checks that all of them end up with
+// the same positions and that arrays kept past their call fail
+int RunScriptSystemBenchmark()
+{
+	const float dt = SIM_FIXED_DT;
+	const char* scripts[] = { eachScript, batchedScript, methodScript };
+	const char* names[] = { "ecs.each                ", "batched, typed views    ", "batched, get/set        " };
+
+	Registry perEntityWorld;
+	SpawnMovers(perEntityWorld, SCRIPT_BENCH_ENTITIES);
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, perEntityScript);
+	double perEntityNs = BestNsPerEntity([&]() { UpdatePerEntity(L, perEntityWorld, dt); }, SCRIPT_BENCH_ENTITIES);
+	lua_close(L);
+
+	std::cout << SCRIPT_BENCH_ENTITIES << " entities, position += velocity * dt, best of " << ECS_BENCH_PASSES << " ticks, ms per tick:" << std::endl;
+	std::cout << "  lua_pcall per entity    " << perEntityNs * SCRIPT_BENCH_ENTITIES / 1e6 << std::endl;
+
+	for (int variant = 0; variant < 3; variant++)
+	{
+		Registry world;
+		SpawnMovers(world, SCRIPT_BENCH_ENTITIES);
+		L = luaL_newstate();
+		luaL_openlibs(L);
+		ScriptSystem system(L, world);
+		system.RunString(scripts[variant]);
+		double systemNs = BestNsPerEntity([&]() { system.Update(dt); }, SCRIPT_BENCH_ENTITIES);
+		std::cout << "  " << names[variant] << systemNs * SCRIPT_BENCH_ENTITIES / 1e6
+			<< " (" << perEntityNs / systemNs << "x)" << std::endl;
+
+		// Same number of ticks from the same start gives the same floats either way
+		Registry check;
+		Registry reference;
+		SpawnMovers(check, SCRIPT_BENCH_ENTITIES);
+		SpawnMovers(reference, SCRIPT_BENCH_ENTITIES);
+		lua_State* referenceL = luaL_newstate();
+		luaL_openlibs(referenceL);
+		luaL_dostring(referenceL, perEntityScript);
+		ScriptSystem checkSystem(L, check);
+		checkSystem.RunString(scripts[variant]);
+		for (int tick = 0; tick < SCRIPT_BENCH_TICKS; tick++)
+		{
+			checkSystem.Update(dt);
+			UpdatePerEntity(referenceL, reference, dt);
+		}
+		lua_close(referenceL);
+		bool same = SamePositions(check, reference);
+
+		checkSystem.Clear();
+		system.Clear();
+		lua_close(L);
+		if (!same)
+		{
+			std::cout << "FAILED: " << names[variant] << "and per-entity calls moved the entities differently" << std::endl;
+			return 1;
+		}
+	}
+
+	// An array or view kept in a global is detached once its system returns
+	Registry world;
+	SpawnMovers(world, 10);
+	L = luaL_newstate();
+	luaL_openlibs(L);
+	ScriptSystem system(L, world);
+	system.RunString(staleScript);
+	system.Update(dt);
+	bool detached = FailsWith(L, "return kept:get(1)", "outside the system call") && FailsWith(L, "return #kept", "outside the system call") &&
+		FailsWith(L, "return kept.x", "outside the system call") && FailsWith(L, "return keptX[1]", "detached") &&
+		FailsWith(L, "keptX[1] = 0", "detached") && FailsWith(L, "return #keptX", "detached");
+	system.Clear();
+	lua_close(L);
+	if (!detached)
+	{
+		std::cout << "FAILED: a component array kept past its system call still worked" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+static const char* marshalledScript = R"(
+function bob(dt, positions)
+	for i = 1, #positions do
+		local position = positions[i]
+		position.y = position.y + dt
+	end
+end
+)";
+
+static const char* bobMethodScript = R"(
+ecs.system("bob", { "Position" }, function(count, dt, positions)
+	for i = 1, count do
+		local x, y, z = positions:get(i)
+		positions:set(i, x, y + dt, z)
+	end
+end)
+)";
+
+static const char* bobViewScript = R"(
+ecs.system("bob", { "Position" }, function(count, dt, positions)
+	local y = positions.y
+	for i = 1, count do
+		y[i] = y[i] + dt
+	end
+end)
+)";
+
+// Forwards to the state's own allocator and adds up every byte it hands out
+struct CountingAllocator
+{
+	lua_Alloc alloc;
+	void* ud;
+	size_t allocated;
+};
+
+static void* CountingAlloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	CountingAllocator* counter = (CountingAllocator*)ud;
+	size_t old = ptr != NULL ? osize : 0;
+	if (nsize > old)
+		counter->allocated += nsize - old;
+	return counter->alloc(counter->ud, ptr, osize, nsize);
+}
+
+static void CountAllocations(lua_State* L, CountingAllocator& counter)
+{
+	counter.alloc = lua_getallocf(L, &counter.ud);
+	counter.allocated = 0;
+	lua_setallocf(L, CountingAlloc, &counter);
+}
+
+// The script gets a fresh { x, y, z } table per entity and the new y is read back from it
+static void BobMarshalled(lua_State* L, Registry& world, float dt)
+{
+	ComponentPool<Position>& positions = world.Pool<Position>();
+	lua_getglobal(L, "bob");
+	lua_pushnumber(L, dt);
+	lua_createtable(L, (int)positions.Size(), 0);
+	for (size_t i = 0; i < positions.Size(); i++)
+	{
+		Vector3 value = positions.Data()[i].value;
+		lua_createtable(L, 0, 3);
+		lua_pushnumber(L, value.x);
+		lua_setfield(L, -2, "x");
+		lua_pushnumber(L, value.y);
+		lua_setfield(L, -2, "y");
+		lua_pushnumber(L, value.z);
+		lua_setfield(L, -2, "z");
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+
+	lua_pushvalue(L, -1);
+	lua_insert(L, -4);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+	{
+		DumpError(L);
+		lua_pop(L, 1);
+		return;
+	}
+
+	for (size_t i = 0; i < positions.Size(); i++)
+	{
+		lua_rawgeti(L, -1, (lua_Integer)i + 1);
+		lua_getfield(L, -1, "y");
+		positions.Data()[i].value.y = (float)lua_tonumber(L, -1);
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+}
+
+// ./Application --bench-typed-arrays: adds dt to the y of TYPED_ARRAY_BENCH_ENTITIES positions
+// from Lua through a table per entity, the get/set methods and a Float32Array view, reports the
+// time and the bytes Lua allocated per frame, and checks all three end with the same positions
+// and that the views clamp and reject values like their metamethods say
+int RunTypedArrayBenchmark()
+{
+	const float dt = SIM_FIXED_DT;
+	const char* scripts[] = { bobMethodScript, bobViewScript };
+	const char* names[] = { "get/set methods   ", "typed views       " };
+
+	Registry reference;
+	SpawnMovers(reference, TYPED_ARRAY_BENCH_ENTITIES);
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, marshalledScript);
+	CountingAllocator counter;
+	CountAllocations(L, counter);
+	BobMarshalled(L, reference, dt);
+	size_t marshalledBytes = counter.allocated;
+	double marshalledNs = BestNsPerEntity([&]() { BobMarshalled(L, reference, dt); }, TYPED_ARRAY_BENCH_ENTITIES);
+
+	// The other two run one untimed frame more
+	BobMarshalled(L, reference, dt);
+	lua_close(L);
+
+	std::cout << TYPED_ARRAY_BENCH_ENTITIES << " positions, y += dt, best of " << ECS_BENCH_PASSES << " frames:" << std::endl;
+	std::cout << "  table marshalling  " << marshalledNs * TYPED_ARRAY_BENCH_ENTITIES / 1e6 << " ms/frame, "
+		<< marshalledBytes << " bytes allocated/frame" << std::endl;
+
+	for (int variant = 0; variant < 2; variant++)
+	{
+		Registry world;
+		SpawnMovers(world, TYPED_ARRAY_BENCH_ENTITIES);
+		L = luaL_newstate();
+		luaL_openlibs(L);
+		ScriptSystem system(L, world);
+		system.RunString(scripts[variant]);
+
+		// The first call creates the views, every later one reuses them
+		system.Update(dt);
+		CountAllocations(L, counter);
+		system.Update(dt);
+		size_t bytes = counter.allocated;
+		double ns = BestNsPerEntity([&]() { system.Update(dt); }, TYPED_ARRAY_BENCH_ENTITIES);
+		std::cout << "  " << names[variant] << ns * TYPED_ARRAY_BENCH_ENTITIES / 1e6 << " ms/frame, " << bytes
+			<< " bytes allocated/frame (" << marshalledNs / ns << "x)" << std::endl;
+
+		bool same = SamePositions(world, reference);
+		system.Clear();
+		lua_close(L);
+		if (!same)
+		{
+			std::cout << "FAILED: " << names[variant] << "and table marshalling moved the positions differently" << std::endl;
+			return 1;
+		}
+	}
+
+	// Writes that do not fit the element type go through the metamethods
+	float floats[2] = { 0.0f, 0.0f };
+	int32_t ints[2] = { 0, 0 };
+	unsigned char bytes[4] = { 0, 0, 0, 0 };
+	L = luaL_newstate();
+	luaL_openlibs(L);
+	RegisterTypedArrays(L);
+	PushTypedArray(L, TYPED_ARRAY_FLOAT32, floats, 2, sizeof(float));
+	lua_setglobal(L, "f");
+	PushTypedArray(L, TYPED_ARRAY_INT32, ints, 2, sizeof(int32_t));
+	lua_setglobal(L, "n");
+	PushTypedArray(L, TYPED_ARRAY_UINT8, bytes, 4, 1);
+	lua_setglobal(L, "u");
+	bool converted = luaL_dostring(L, "f[1] = 1e300 f[2] = 0.5 n[1] = -7 n[2] = 2.0 u[1] = 300 u[2] = -5 u[3] = 0/0 u[4] = 7.9") == LUA_OK &&
+		floats[0] == INFINITY && floats[1] == 0.5f && ints[0] == -7 && ints[1] == 2 &&
+		bytes[0] == 255 && bytes[1] == 0 && bytes[2] == 0 && bytes[3] == 7;
+	bool rejected = FailsWith(L, "n[1] = 2^40", "out of Int32Array range") && FailsWith(L, "n[1] = 0.5", "number has no integer representation") &&
+		FailsWith(L, "f[3] = 1", "out of range") && FailsWith(L, "return f.x", "index must be an integer");
+	lua_close(L);
+	if (!converted || !rejected)
+	{
+		std::cout << "FAILED: typed array writes were not converted or rejected as expected" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Entity-like tables with 16 fields each. check builds the same objects with the keys in
+// other orders and some rehashed by an extra key, so one instruction sees many node sizes
+// and slots, and compares what frame leaves behind with a rawget/rawset replica.
+static const char* fieldHeavyScript = R"(
+local function spawn(i)
+	return { px = i, py = 0, pz = 0, vx = 1, vy = 0.5, vz = -1, hp = 100, armor = 3,
+		speed = 2, range = 10, team = i % 2, state = 0, timer = 0, target = 0, ammo = 30, heat = 1 }
+end
+
+local function spawnReversed(i)
+	return { heat = 1, ammo = 30, target = 0, timer = 0, state = 0, team = i % 2, range = 10, speed = 2,
+		armor = 3, hp = 100, vz = -1, vy = 0.5, vx = 1, pz = 0, py = 0, px = i }
+end
+
+function setup(count)
+	objects = {}
+	for i = 1, count do objects[i] = spawn(i) end
+end
+
+function frame(dt)
+	for i = 1, #objects do
+		local o = objects[i]
+		o.px = o.px + o.vx * dt
+		o.py = o.py + o.vy * dt
+		o.pz = o.pz + o.vz * dt
+		o.heat = o.heat * 0.9
+		o.timer = o.timer + dt
+	end
+end
+
+local function replicaFrame(list, dt)
+	for i = 1, #list do
+		local o = list[i]
+		rawset(o, "px", rawget(o, "px") + rawget(o, "vx") * dt)
+		rawset(o, "py", rawget(o, "py") + rawget(o, "vy") * dt)
+		rawset(o, "pz", rawget(o, "pz") + rawget(o, "vz") * dt)
+		rawset(o, "heat", rawget(o, "heat") * 0.9)
+		rawset(o, "timer", rawget(o, "timer") + dt)
+	end
+end
+
+function check(frames)
+	local replica = {}
+	objects = {}
+	for i = 1, 300 do
+		local o = i % 3 == 0 and spawnReversed(i) or spawn(i)
+		if i % 3 == 2 then o.extra = i end
+		local copy = {}
+		for k, v in pairs(o) do copy[k] = v end
+		objects[i], replica[i] = o, copy
+	end
+	for f = 1, frames do
+		frame(1 / 60)
+		replicaFrame(replica, 1 / 60)
+	end
+	for i = 1, #objects do
+		for k, v in pairs(replica[i]) do
+			if objects[i][k] ~= v then return false end
+		end
+	end
+	return true
+end
+)";
+
+// Small objects with methods from a shared metatable and nested position/velocity tables.
+// check replaces a method and swaps a metatable, the next call must see both.
+static const char* methodHeavyScript = R"(
+local Mover = {}
+Mover.__index = Mover
+
+function Mover.new(i)
+	return setmetatable({ pos = { x = i, y = 0, z = 0 }, vel = { x = 1, y = 0.5, z = -1 }, speed = 1 }, Mover)
+end
+
+function Mover:step(dt)
+	local p, v = self.pos, self.vel
+	p.x = p.x + v.x * self.speed * dt
+	p.y = p.y + v.y * self.speed * dt
+	p.z = p.z + v.z * self.speed * dt
+end
+
+function Mover:energy()
+	local v = self.vel
+	return (v.x * v.x + v.y * v.y + v.z * v.z) * self.speed
+end
+
+function setup(count)
+	movers = {}
+	for i = 1, count do movers[i] = Mover.new(i) end
+end
+
+function frame(dt)
+	local total = 0
+	for i = 1, #movers do
+		local m = movers[i]
+		m:step(dt)
+		total = total + m:energy()
+	end
+	return total
+end
+
+function check()
+	local m = Mover.new(1)
+	for i = 1, 100 do m:step(1) end
+	local moved = m.pos.x == 101
+	local step = Mover.step
+	Mover.step = function(self) self.pos.x = -1 end
+	for i = 1, 2 do m:step(1) end
+	local replaced = m.pos.x == -1
+	Mover.step = step
+	setmetatable(m, { __index = { step = function(self) self.pos.x = -2 end } })
+	m:step(1)
+	return moved and replaced and m.pos.x == -2
+end
+)";
+
+// ./Application --bench-fields: per-frame time of the two field-heavy scripts on
+// FIELD_BENCH_OBJECTS objects, then checks the field caches against changing tables.
+// Build the Lua library with -DLUAI_INLINECACHE=0 to compare against no caches.
+int RunFieldBenchmark()
+{
+	const char* scripts[] = { fieldHeavyScript, methodHeavyScript };
+	const char* names[] = { "16 fields, 5 updated per object ", "methods and nested vectors      " };
+
+	std::cout << FIELD_BENCH_OBJECTS << " objects, best of " << ECS_BENCH_PASSES << " frames, ms per frame:" << std::endl;
+	for (int variant = 0; variant < 2; variant++)
+	{
+		lua_State* L = luaL_newstate();
+		luaL_openlibs(L);
+		if (luaL_dostring(L, scripts[variant]) != LUA_OK)
+		{
+			DumpError(L);
+			lua_close(L);
+			return 1;
+		}
+		lua_getglobal(L, "setup");
+		lua_pushinteger(L, FIELD_BENCH_OBJECTS);
+		lua_call(L, 1, 0);
+
+		double ns = BestNsPerEntity([&]()
+		{
+			lua_getglobal(L, "frame");
+			lua_pushnumber(L, SIM_FIXED_DT);
+			lua_call(L, 1, 0);
+		}, FIELD_BENCH_OBJECTS);
+		std::cout << "  " << names[variant] << ns * FIELD_BENCH_OBJECTS / 1e6 << std::endl;
+
+		lua_getglobal(L, "check");
+		lua_pushinteger(L, FIELD_BENCH_CHECK_FRAMES);
+		bool passed = lua_pcall(L, 1, 1, 0) == LUA_OK && lua_toboolean(L, -1);
+		lua_close(L);
+		if (!passed)
+		{
+			std::cout << "FAILED: " << names[variant] << "read a field from the wrong slot" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Entity tables of a few kinds. Kind 1 is only the list holding them, subtracted from the
+// others; the last kind gives every table a key of its own, so each needs a new shape.
+static const char* entityKindsScript = R"(
+kinds = {
+	function(i) return true end,
+	function(i) return { x = i, y = 0, z = 0 } end,
+	function(i) return { x = i, y = 0, z = 0, hp = 100, team = 1, state = 0, timer = 0, speed = 2 } end,
+	function(i)
+		local e = {}
+		e.x = i e.y = 0 e.z = 0 e.hp = 100 e.team = 1 e.state = 0 e.timer = 0 e.speed = 2
+		return e
+	end,
+	function(i) return { pos = { x = i, y = 0, z = 0 }, vel = { x = 1, y = 0, z = 0 }, hp = 100, team = 1, speed = 2 } end,
+	function(i) return { x = i, ["tag" .. i] = true } end,
+}
+
+function spawn(kind, count)
+	local make = kinds[kind]
+	entities = {}
+	for i = 1, count do entities[i] = make(i) end
+end
+)";
+
+// Collects until nothing more is freed: keys that only a freed shape held go one collection
+// later, and the string and shape hash tables only halve per collection
+static size_t LuaBytesInUse(lua_State* L)
+{
+	size_t bytes = (size_t)-1;
+	for (;;)
+	{
+		lua_gc(L, LUA_GCCOLLECT);
+		size_t now = (size_t)lua_gc(L, LUA_GCCOUNT) * 1024 + (size_t)lua_gc(L, LUA_GCCOUNTB);
+		if (now >= bytes)
+			return now;
+		bytes = now;
+	}
+}
+
+// ./Application --memory-report: bytes held by MEMORY_REPORT_ENTITIES entity tables of each
+// kind, and what is still held after they are dropped and collected. Build the Lua library
+// with -DLUAI_SHAPES=0 to compare against tables without shapes.
+int RunMemoryReport()
+{
+	const char* names[MEMORY_REPORT_KINDS] = { "", "{x,y,z}                   ", "8 fields                  ",
+		"built with assignments    ", "nested pos/vel + 3 fields ", "a key of its own          " };
+
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, entityKindsScript);
+
+	std::cout << "per " << MEMORY_REPORT_ENTITIES << " entity tables, after a full collection:" << std::endl;
+	size_t listBytes = 0;
+	for (int kind = 1; kind <= MEMORY_REPORT_KINDS; kind++)
+	{
+		size_t before = LuaBytesInUse(L);
+		lua_getglobal(L, "spawn");
+		lua_pushinteger(L, kind);
+		lua_pushinteger(L, MEMORY_REPORT_ENTITIES);
+		lua_call(L, 2, 0);
+		size_t held = LuaBytesInUse(L) - before;
+
+		lua_pushnil(L);
+		lua_setglobal(L, "entities");
+		size_t left = LuaBytesInUse(L) - before;
+		if (kind == 1)
+		{
+			listBytes = held;
+			continue;
+		}
+
+		std::cout << "  " << names[kind - 1] << (held - listBytes) / 1e6 << " MB, " << (held - listBytes) / MEMORY_REPORT_ENTITIES
+			<< " B per entity, " << left << " B left once dropped" << std::endl;
+
+		// Shapes go with their last table, and with them the keys only they held
+		if (left > (size_t)MEMORY_REPORT_ENTITIES)
+		{
+			std::cout << "FAILED: dropped " << names[kind - 1] << "tables left memory behind" << std::endl;
+			lua_close(L);
+			return 1;
+		}
+	}
+	lua_close(L);
+	return 0;
+}
+
+// Idle coroutines of a few kinds. Kind 1 is only the list holding them, subtracted from the
+// others; kind 4 went 200 calls deep before it yielded, so its stack grew and has to shrink back.
+static const char* idleCoroutinesScript = R"(
+local function idle()
+	coroutine.yield()
+end
+
+local function deep(n)
+	if n > 0 then return deep(n - 1) + 1 end
+	return 0
+end
+
+local function deepThenIdle()
+	deep(200)
+	coroutine.yield()
+end
+
+local function sleeper()
+	while true do coroutine.sleep(1e9) end
+end
+
+function spawn(kind, n)
+	coroutines = {}
+	for i = 1, n do
+		local co = false
+		if kind == 2 then
+			co = coroutine.create(idle)
+		elseif kind == 3 then
+			co = coroutine.create(idle)
+			coroutine.resume(co)
+		elseif kind == 4 then
+			co = coroutine.create(deepThenIdle)
+			coroutine.resume(co)
+		elseif kind == 5 then
+			co = coroutine.spawn(sleeper)
+		end
+		coroutines[i] = co
+	end
+end
+)";
+
+// ./Application --memory-report-coroutines: bytes held by each of COROUTINE_REPORT_COUNT idle
+// coroutines after a full collection, which trims the stacks of suspended ones. Build the Lua
+// library with another -DLUAI_THREADSTACK to compare initial stack sizes.
+int RunCoroutineMemoryReport()
+{
+	const char* names[COROUTINE_REPORT_KINDS] = { "", "created, never resumed          ", "suspended at its first yield    ",
+		"suspended after 200 deep calls  ", "coroutine.spawn task, sleeping  " };
+
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, idleCoroutinesScript);
+
+	std::cout << "per idle coroutine, " << COROUTINE_REPORT_COUNT << " of each kind, after a full collection:" << std::endl;
+	size_t listBytes = 0;
+	for (int kind = 1; kind <= COROUTINE_REPORT_KINDS; kind++)
+	{
+		size_t before = LuaBytesInUse(L);
+		lua_getglobal(L, "spawn");
+		lua_pushinteger(L, kind);
+		lua_pushinteger(L, COROUTINE_REPORT_COUNT);
+		lua_call(L, 2, 0);
+		size_t held = LuaBytesInUse(L) - before;
+
+		lua_pushnil(L);
+		lua_setglobal(L, "coroutines");
+		size_t left = LuaBytesInUse(L) - before;
+		if (kind == 1)
+		{
+			listBytes = held;
+			continue;
+		}
+
+		std::cout << "  " << names[kind - 1] << (held - listBytes) / COROUTINE_REPORT_COUNT << " B";
+		// The scheduler keeps spawned tasks until they end, so only the others have to go
+		if (kind == COROUTINE_REPORT_KINDS)
+		{
+			std::cout << std::endl;
+			continue;
+		}
+		std::cout << ", " << left << " B left once dropped, pooled threads included" << std::endl;
+		if (left > (held - listBytes) / COROUTINE_REPORT_COUNT * COROUTINE_REPORT_POOLED + COROUTINE_REPORT_COUNT)
+		{
+			std::cout << "FAILED: dropped coroutines " << names[kind - 1] << "left memory behind" << std::endl;
+			lua_close(L);
+			return 1;
+		}
+	}
+	lua_close(L);
+	return 0;
+}
+
+// Behaviors run as a coroutine per entity: one that runs to its end in two resumes, and one that
+// sleeps a few times on the scheduler before it ends
+static const char* coroutineChurnScript = R"(
+local function behavior(i)
+	local x = coroutine.yield(i)
+	return x + i
+end
+
+function churn(n)
+	local create, resume = coroutine.create, coroutine.resume
+	for i = 1, n do
+		local co = create(behavior)
+		resume(co, i)
+		resume(co, i)
+	end
+end
+
+local function sleeper(waits)
+	for w = 1, waits do coroutine.sleep(w) end
+end
+
+function schedule(n, waits)
+	for i = 1, n do coroutine.spawn(sleeper, i % waits + 1) end
+	local now, ran = 0, 0
+	while coroutine.pending() > 0 do
+		now = now + 1
+		ran = ran + coroutine.update(now)
+	end
+	return ran
+end
+)";
+
+// ./Application --bench-coroutines: creates, resumes and finishes COROUTINE_BENCH_COUNT coroutines
+// per pass, first by hand and then through coroutine.spawn/sleep/update, and reports the time
+// and the bytes Lua allocated per coroutine. Build the Lua library with -DLUAI_THREADPOOL=0 to
+// compare against threads that are freed instead of pooled.
+int RunCoroutineBenchmark()
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, coroutineChurnScript);
+	CountingAllocator counter;
+	CountAllocations(L, counter);
+
+	std::cout << COROUTINE_BENCH_COUNT << " coroutines per pass, best of " << ECS_BENCH_PASSES << " passes:" << std::endl;
+
+	double churnNs = BestNsPerEntity([&]()
+	{
+		lua_getglobal(L, "churn");
+		lua_pushinteger(L, COROUTINE_BENCH_COUNT);
+		lua_call(L, 1, 0);
+	}, COROUTINE_BENCH_COUNT);
+	counter.allocated = 0;
+	lua_getglobal(L, "churn");
+	lua_pushinteger(L, COROUTINE_BENCH_COUNT);
+	lua_call(L, 1, 0);
+	std::cout << "  create/resume/finish  " << churnNs << " ns, " << counter.allocated / COROUTINE_BENCH_COUNT
+		<< " B allocated per coroutine" << std::endl;
+
+	// Every task sleeps 1 to COROUTINE_BENCH_WAITS times, so the scheduler resumes each one
+	// about COROUTINE_BENCH_WAITS / 2 + 1 times
+	long long expected = 0;
+	for (int i = 1; i <= COROUTINE_BENCH_COUNT; i++)
+		expected += i % COROUTINE_BENCH_WAITS + 1;
+	long long ran = 0;
+	double scheduleNs = BestNsPerEntity([&]()
+	{
+		lua_getglobal(L, "schedule");
+		lua_pushinteger(L, COROUTINE_BENCH_COUNT);
+		lua_pushinteger(L, COROUTINE_BENCH_WAITS);
+		lua_call(L, 2, 1);
+		ran = (long long)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}, COROUTINE_BENCH_COUNT);
+	counter.allocated = 0;
+	lua_getglobal(L, "schedule");
+	lua_pushinteger(L, COROUTINE_BENCH_COUNT);
+	lua_pushinteger(L, COROUTINE_BENCH_WAITS);
+	lua_call(L, 2, 1);
+	lua_pop(L, 1);
+	std::cout << "  spawn/sleep/update    " << scheduleNs << " ns, " << counter.allocated / COROUTINE_BENCH_COUNT
+		<< " B allocated per coroutine, " << (double)expected / COROUTINE_BENCH_COUNT << " wakes each" << std::endl;
+	lua_close(L);
+
+	if (ran != expected)
+	{
+		std::cout << "FAILED: the scheduler resumed " << ran << " tasks, expected " << expected << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Every frame, each entity makes a temporary vector, every fourth one an event table, and all of
+// them a formatted label; once in a while a label and a vector escape into the entity
+static const char* frameGcScript = R"(
+entities = {}
+
+function spawn(n)
+	for i = 1, n do
+		entities[i] = { id = i, pos = { x = i, y = 0, z = 0 }, vel = { x = 1, y = 0.5, z = 0 } }
+	end
+end
+
+function frame(f)
+	local events = {}
+	for i = 1, #entities do
+		local e = entities[i]
+		local p, v = e.pos, e.vel
+		local moved = { x = p.x + v.x * 0.016, y = p.y + v.y * 0.016, z = p.z + v.z * 0.016 }
+		if i % 4 == 0 then
+			events[#events + 1] = { kind = "moved", entity = e, at = moved }
+		end
+		local label = string.format("%d: %.2f %.2f", e.id, moved.x, moved.y)
+		p.x, p.y, p.z = moved.x, moved.y % 10, moved.z
+		if (f + i) % 997 == 0 then
+			e.label, e.last = label, moved
+		end
+	end
+	return #events
+end
+)";
+
+// Frame times of one run of frameGcScript, in milliseconds, with the collector in 'mode' (see
+// RunFrameGcBenchmark); sets heapKb to the heap once the last frame ends
+static std::vector<double> FrameGcRun(int mode, int& heapKb)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_dostring(L, frameGcScript);
+	lua_getglobal(L, "spawn");
+	lua_pushinteger(L, FRAME_GC_BENCH_ENTITIES);
+	lua_call(L, 1, 0);
+	if (mode >= 2)
+		lua_gc(L, LUA_GCGEN, 0, 0);
+	lua_gc(L, LUA_GCCOLLECT);
+	if (mode == 0)
+		lua_gc(L, LUA_GCSTOP);
+
+	std::vector<double> times;
+	for (int f = 0; f < FRAME_GC_BENCH_FRAMES; f++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (mode == 3)
+			lua_beginframe(L);
+		lua_getglobal(L, "frame");
+		lua_pushinteger(L, f);
+		lua_call(L, 1, 0);
+		if (mode == 3)
+			lua_endframe(L);
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+		// Out of the timing, and often enough that the stopped heap stays in the same pages
+		if (mode == 0)
+		{
+			lua_gc(L, LUA_GCRESTART);
+			lua_gc(L, LUA_GCCOLLECT);
+			lua_gc(L, LUA_GCSTOP);
+		}
+	}
+	heapKb = lua_gc(L, LUA_GCCOUNT, 0);
+	lua_close(L);
+	return times;
+}
+
+// ./Application --bench-frame-gc: frame times of FRAME_GC_BENCH_ENTITIES Lua entities that make
+// short-lived garbage every frame, with the collector stopped (collecting after every frame, out
+// of the timing), incremental, generational, and generational with each frame a frame region.
+// The time the collector takes per frame is the difference to the stopped run. The modes take
+// turns for FRAME_GC_BENCH_RUNS rounds and each keeps its best round, so that a slow stretch of
+// this noisy machine does not land on one mode only.
+int RunFrameGcBenchmark()
+{
+	const char* names[] = { "collector stopped         ", "incremental               ", "generational              ",
+		"generational, frame region" };
+	double bestMs[4];
+	double bestP99[4];
+	int heapKb[4];
+	for (int mode = 0; mode < 4; mode++)
+		bestMs[mode] = 1e30;
+
+	for (int run = 0; run < FRAME_GC_BENCH_RUNS; run++)
+	{
+		for (int mode = 0; mode < 4; mode++)
+		{
+			int heap;
+			std::vector<double> times = FrameGcRun(mode, heap);
+			double sum = 0.0;
+			for (double t : times)
+				sum += t;
+			if (sum / times.size() < bestMs[mode])
+			{
+				bestMs[mode] = sum / times.size();
+				std::sort(times.begin(), times.end());
+				bestP99[mode] = Percentile(times, 0.99);
+				heapKb[mode] = heap;
+			}
+		}
+	}
+
+	std::cout << FRAME_GC_BENCH_ENTITIES << " entities, " << FRAME_GC_BENCH_FRAMES << " frames, best of " << FRAME_GC_BENCH_RUNS << " rounds:" << std::endl;
+	for (int mode = 0; mode < 4; mode++)
+	{
+		std::cout << "  " << names[mode] << "  " << bestMs[mode] << " ms/frame, p99 " << bestP99[mode] << " ms";
+		if (mode != 0)
+			std::cout << ", GC " << bestMs[mode] - bestMs[0] << " ms/frame, heap " << heapKb[mode] / 1024.0 << " MB at the end";
+		std::cout << std::endl;
+	}
+	return 0;
+}
+
+// Each frame makes tables, closures with their upvalues and short strings, and keeps a few of
+// them in a ring so that some survive a while
+static const char* poolChurnScript = R"(
+local ring, at = {}, 0
+
+function frame(f, n)
+	for i = 1, n do
+		local t = { i, f, x = i * 0.5 }
+		local counter = i
+		local bump = function() counter = counter + 1 return counter end
+		local key = "k" .. (i % 97) .. "_" .. (f % 13)
+		if i % 50 == 0 then
+			at = at % 256 + 1
+			ring[at] = { t, bump, key }
+		end
+	end
+end
+
+function drop()
+	ring = {}
+end
+)";
+
+// Seconds POOL_BENCH_FRAMES frames take on L
+static double PoolChurn(lua_State* L)
+{
+	luaL_openlibs(L);
+	luaL_dostring(L, poolChurnScript);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int f = 0; f < POOL_BENCH_FRAMES; f++)
+	{
+		lua_getglobal(L, "frame");
+		lua_pushinteger(L, f);
+		lua_pushinteger(L, POOL_BENCH_OBJECTS);
+		lua_call(L, 2, 0);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void PrintPoolStats(const char* when, const luaL_PoolStats& stats)
+{
+	std::cout << "  " << when << stats.requested / 1024 << " KB requested in " << stats.blockbytes / 1024 << " KB of blocks on "
+		<< stats.pages << " pages (" << stats.pagebytes / 1024 << " KB), internal fragmentation "
+		<< 100.0 * (stats.blockbytes - stats.requested) / std::max<size_t>(stats.blockbytes, 1) << "%, external "
+		<< 100.0 * (stats.pagebytes - stats.blockbytes) / std::max<size_t>(stats.pagebytes, 1) << "%, " << stats.emptypages
+		<< " empty pages kept, " << stats.pagesreleased << " released, " << stats.largebytes / 1024 << " KB in large blocks" << std::endl;
+}
+
+// ./Application --bench-pool: POOL_BENCH_FRAMES frames of POOL_BENCH_OBJECTS tables, closures,
+// upvalues and short strings each, on a luaL_newstate state (realloc/free) and on a
+// luaL_newpoolstate one, taking turns so that noise hits both, then the pool's fragmentation at
+// the end of a run and after a full collection
+int RunPoolBenchmark()
+{
+	double systemSeconds = 1e30;
+	double poolSeconds = 1e30;
+	lua_State* L = nullptr;
+	for (int run = 0; run < POOL_BENCH_RUNS; run++)
+	{
+		lua_State* system = luaL_newstate();
+		systemSeconds = std::min(systemSeconds, PoolChurn(system));
+		lua_close(system);
+
+		if (L != nullptr)
+			lua_close(L);
+		L = luaL_newpoolstate();
+		poolSeconds = std::min(poolSeconds, PoolChurn(L));
+	}
+
+	std::cout << POOL_BENCH_FRAMES << " frames of " << POOL_BENCH_OBJECTS << " objects, best of " << POOL_BENCH_RUNS << " runs:" << std::endl;
+	std::cout << "  realloc/free  " << systemSeconds << " s" << std::endl;
+	std::cout << "  pool          " << poolSeconds << " s (" << poolSeconds / systemSeconds << "x)" << std::endl;
+
+	luaL_PoolStats stats;
+	if (!luaL_poolstats(L, &stats))
+	{
+		std::cout << "FAILED: luaL_newpoolstate made a state without a pool" << std::endl;
+		lua_close(L);
+		return 1;
+	}
+	PrintPoolStats("end of run:       ", stats);
+	size_t runPages = stats.pages;
+	lua_gc(L, LUA_GCCOLLECT);
+	luaL_poolstats(L, &stats);
+	PrintPoolStats("after collecting: ", stats);
+	size_t collectedPages = stats.pages;
+	lua_getglobal(L, "drop");
+	lua_call(L, 0, 0);
+	lua_gc(L, LUA_GCCOLLECT);
+	luaL_poolstats(L, &stats);
+	PrintPoolStats("ring dropped too: ", stats);
+	lua_close(L);
+
+	// Blocks fit in their classes and pages, and collecting garbage does not take more pages
+	if (stats.requested > stats.blockbytes || stats.blockbytes > stats.pagebytes || collectedPages > runPages || stats.pages > collectedPages)
+	{
+		std::cout << "FAILED: the pool figures do not add up" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+struct BenchEntity
+{
+	double x;
+	double y;
+};
+
+// The binding as written before typed functions: luaL_checkudata looks the metatable up by name
+// in the registry, and every luaL_checknumber dispatches on the type again
+static int MoveChecked(lua_State* L)
+{
+	BenchEntity* entity = (BenchEntity*)luaL_checkudata(L, 1, BINDING_BENCH_METATABLE);
+	entity->x += luaL_checknumber(L, 2);
+	entity->y += luaL_checknumber(L, 3);
+	return 0;
+}
+
+// The same binding registered as "udata:BenchEntity, number, number", checked before it runs
+static int MoveTyped(lua_State* L)
+{
+	BenchEntity* entity = (BenchEntity*)lua_touserdata(L, 1);
+	entity->x += lua_tonumber(L, 2);
+	entity->y += lua_tonumber(L, 3);
+	return 0;
+}
+
+static const char* bindingBenchScript = R"(
+function run(move, entity, n)
+	for i = 1, n do
+		move(entity, 0.5, 0.25)
+	end
+end
+)";
+
+// Seconds BINDING_BENCH_CALLS calls of the global function 'move' take, on the entity in the
+// global 'entity' moved back to the origin first
+static double TimeBinding(lua_State* L, const char* move, const char* entity)
+{
+	lua_getglobal(L, "run");
+	lua_getglobal(L, move);
+	lua_getglobal(L, entity);
+	BenchEntity* moved = (BenchEntity*)lua_touserdata(L, -1);
+	moved->x = moved->y = 0.0;
+	lua_pushinteger(L, BINDING_BENCH_CALLS);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	lua_call(L, 3, 0);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchEntity* NewBenchEntity(lua_State* L, const char* global)
+{
+	BenchEntity* entity = (BenchEntity*)lua_newuserdatauv(L, sizeof(BenchEntity), 0);
+	entity->x = entity->y = 0.0;
+	luaL_setmetatable(L, BINDING_BENCH_METATABLE);
+	lua_setglobal(L, global);
+	return entity;
+}
+
+// ./Application --bench-bindings: BINDING_BENCH_CALLS calls from Lua of a 3-argument binding
+// (udata:BenchEntity, number, number), checked with luaL_checkudata and luaL_checknumber and
+// as a typed C function, taking turns; checks both move the entity the same and reject bad
+// arguments with the same message
+int RunBindingBenchmark()
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_newmetatable(L, BINDING_BENCH_METATABLE);
+	lua_pop(L, 1);
+	lua_pushcfunction(L, MoveChecked);
+	lua_setglobal(L, "moveChecked");
+	luaL_pushtypedfunction(L, MoveTyped, "udata:" BINDING_BENCH_METATABLE ", number, number", 0);
+	lua_setglobal(L, "moveTyped");
+	luaL_dostring(L, bindingBenchScript);
+
+	BenchEntity* checked = NewBenchEntity(L, "checkedEntity");
+	BenchEntity* typed = NewBenchEntity(L, "typedEntity");
+
+	double checkedSeconds = 1e30;
+	double typedSeconds = 1e30;
+	for (int run = 0; run < BINDING_BENCH_RUNS; run++)
+	{
+		checkedSeconds = std::min(checkedSeconds, TimeBinding(L, "moveChecked", "checkedEntity"));
+		typedSeconds = std::min(typedSeconds, TimeBinding(L, "moveTyped", "typedEntity"));
+	}
+
+	std::cout << BINDING_BENCH_CALLS << " calls of move(entity, number, number), best of " << BINDING_BENCH_RUNS << " runs:" << std::endl;
+	std::cout << "  luaL_checkudata + luaL_checknumber  " << checkedSeconds << " s, " << checkedSeconds * 1e9 / BINDING_BENCH_CALLS << " ns/call" << std::endl;
+	std::cout << "  typed function                      " << typedSeconds << " s, " << typedSeconds * 1e9 / BINDING_BENCH_CALLS
+		<< " ns/call (" << typedSeconds / checkedSeconds << "x)" << std::endl;
+
+	bool same = checked->x == typed->x && checked->y == typed->y && checked->x == 0.5 * BINDING_BENCH_CALLS;
+	bool rejects = FailsWith(L, "moveChecked({}, 1, 2)", "#1 to 'moveChecked' (" BINDING_BENCH_METATABLE " expected, got table)") &&
+		FailsWith(L, "moveTyped({}, 1, 2)", "#1 to 'moveTyped' (" BINDING_BENCH_METATABLE " expected, got table)") &&
+		FailsWith(L, "moveTyped(io.stdout, 1, 2)", "#1 to 'moveTyped' (" BINDING_BENCH_METATABLE " expected, got FILE*)") &&
+		FailsWith(L, "moveTyped(typedEntity, 1, 'x')", "#3 to 'moveTyped' (number expected, got string)");
+	lua_close(L);
+	if (!same)
+	{
+		std::cout << "FAILED: the checked and typed bindings moved the entity differently" << std::endl;
+		return 1;
+	}
+	if (!rejects)
+	{
+		std::cout << "FAILED: a binding took or misreported a bad argument" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Benchmarks and measurement runs, each started by its own command line switch in main. They
+// print their results and return the process exit code, nonzero when a result check fails.
+
+// --script-scaling
+int RunScriptScaling();
+// --gc-sweep
+int RunGcSweep();
+// --gc-budget
+int RunGcBudget();
+// --bench-ecs
+int RunEcsBenchmark();
+// --bench-spatial-hash
+int RunSpatialHashBenchmark();
+// --bench-bvh
+int RunBvhBenchmark();
+// --bench-box-batch
+int RunBoxBatchBenchmark();
+// --bench-culling
+int RunCullingBenchmark();
+// --bench-script-systems
+int RunScriptSystemBenchmark();
+// --bench-typed-arrays
+int RunTypedArrayBenchmark();
+// --bench-fields
+int RunFieldBenchmark();
+// --memory-report
+int RunMemoryReport();
+// --memory-report-coroutines
+int RunCoroutineMemoryReport();
+// --bench-coroutines
+int RunCoroutineBenchmark();
+// --bench-frame-gc
+int RunFrameGcBenchmark();
+// --bench-pool
+int RunPoolBenchmark();
+// --bench-bindings
+int RunBindingBenchmark();
@@ -0,0 +1,302 @@
+#include "BoxBatch.h"
+
+#include <cfloat>
+#include <cstring>
+
+// The AVX kernel is always built on x86. Unless the whole build already targets AVX, it is
+// compiled for AVX on its own and only picked when the CPU and OS support it, so the default
+// SSE2 build still runs everywhere.
+#if defined(__AVX__)
+#define BOX_BATCH_USE_AVX 1
+#define BOX_BATCH_AVX_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BOX_BATCH_USE_AVX 1
+#define BOX_BATCH_AVX_DISPATCH 1
+#define BOX_BATCH_AVX_TARGET __attribute__((target("avx")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BOX_BATCH_USE_AVX 1
+#define BOX_BATCH_AVX_DISPATCH 1
+#define BOX_BATCH_AVX_TARGET
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOX_BATCH_USE_SSE 1
+#endif
+
+#if defined(BOX_BATCH_USE_AVX) || defined(BOX_BATCH_USE_SSE)
+#include <immintrin.h>
+#endif
+
+// Keeps the arrays, refilling a batch every tick then costs only the stores in Push
+void BoxBatch::Clear()
+{
+	count = 0;
+}
+
+void BoxBatch::Reserve(size_t capacity)
+{
+	size_t padded = (capacity + BOX_BATCH_BLOCK - 1) / BOX_BATCH_BLOCK * BOX_BATCH_BLOCK;
+	minX.reserve(padded); minY.reserve(padded); minZ.reserve(padded);
+	maxX.reserve(padded); maxY.reserve(padded); maxZ.reserve(padded);
+	ids.reserve(padded);
+}
+
+void BoxBatch::Push(BoundingBox box, uint32_t id)
+{
+	// Grow a whole block at a time. The slots past count hold inverted boxes or whatever an
+	// earlier fill left there, so every kernel ignores them: the overlap kernels clear their
+	// bits afterwards and CullBoxes skips lanes past Size().
+	if (count == minX.size())
+	{
+		size_t padded = count + BOX_BATCH_BLOCK;
+		minX.resize(padded, FLT_MAX); minY.resize(padded, FLT_MAX); minZ.resize(padded, FLT_MAX);
+		maxX.resize(padded, -FLT_MAX); maxY.resize(padded, -FLT_MAX); maxZ.resize(padded, -FLT_MAX);
+		ids.resize(padded, 0);
+	}
+
+	minX[count] = box.min.x; minY[count] = box.min.y; minZ[count] = box.min.z;
+	maxX[count] = box.max.x; maxY[count] = box.max.y; maxZ[count] = box.max.z;
+	ids[count] = id;
+	count++;
+}
+
+BoundingBox BoxBatch::GetBox(size_t i) const
+{
+	return BoundingBox{ { minX[i], minY[i], minZ[i] }, { maxX[i], maxY[i], maxZ[i] } };
+}
+
+// Eight boxes per block, four blocks per mask word
+static void StoreBits(uint32_t* mask, size_t first, uint32_t bits)
+{
+	mask[first / 32] |= bits << (first % 32);
+}
+
+#if defined(BOX_BATCH_USE_AVX)
+
+struct QueryLanesAvx
+{
+	__m256 minX, minY, minZ;
+	__m256 maxX, maxY, maxZ;
+};
+
+BOX_BATCH_AVX_TARGET static inline QueryLanesAvx LoadQueryAvx(BoundingBox query)
+{
+	QueryLanesAvx lanes;
+	lanes.minX = _mm256_set1_ps(query.min.x); lanes.minY = _mm256_set1_ps(query.min.y); lanes.minZ = _mm256_set1_ps(query.min.z);
+	lanes.maxX = _mm256_set1_ps(query.max.x); lanes.maxY = _mm256_set1_ps(query.max.y); lanes.maxZ = _mm256_set1_ps(query.max.z);
+	return lanes;
+}
+
+BOX_BATCH_AVX_TARGET static inline uint32_t TestBlockAvx(const QueryLanesAvx& q, __m256 minX, __m256 minY, __m256 minZ, __m256 maxX, __m256 maxY, __m256 maxZ)
+{
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(q.maxX, minX, _CMP_GE_OQ), _mm256_cmp_ps(q.minX, maxX, _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(q.maxY, minY, _CMP_GE_OQ), _mm256_cmp_ps(q.minY, maxY, _CMP_LE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(q.maxZ, minZ, _CMP_GE_OQ), _mm256_cmp_ps(q.minZ, maxZ, _CMP_LE_OQ)));
+	return (uint32_t)_mm256_movemask_ps(hit);
+}
+
+// One pass over the batch for all Queries queries, every block is loaded once
+template <int Queries>
+BOX_BATCH_AVX_TARGET static void OverlapAvx(const BoxBatch& batch, const BoundingBox* queries, uint32_t* const* masks)
+{
+	QueryLanesAvx q[Queries];
+	for (int k = 0; k < Queries; k++)
+		q[k] = LoadQueryAvx(queries[k]);
+
+	for (size_t i = 0; i < batch.Size(); i += BOX_BATCH_BLOCK)
+	{
+		__m256 minX = _mm256_loadu_ps(batch.MinX() + i), minY = _mm256_loadu_ps(batch.MinY() + i), minZ = _mm256_loadu_ps(batch.MinZ() + i);
+		__m256 maxX = _mm256_loadu_ps(batch.MaxX() + i), maxY = _mm256_loadu_ps(batch.MaxY() + i), maxZ = _mm256_loadu_ps(batch.MaxZ() + i);
+		for (int k = 0; k < Queries; k++)
+		{
+			uint32_t bits = TestBlockAvx(q[k], minX, minY, minZ, maxX, maxY, maxZ);
+			if (bits)
+				StoreBits(masks[k], i, bits);
+		}
+	}
+	// MSVC does not insert this itself, and the SSE code after it would pay for the switch
+	_mm256_zeroupper();
+}
+
+#endif
+
+#if defined(BOX_BATCH_AVX_DISPATCH)
+
+// AVX needs the OS to save the ymm registers too, which cpuid alone does not tell
+static bool DetectAvx()
+{
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	bool osxsave = (regs[2] & (1 << 27)) != 0, avx = (regs[2] & (1 << 28)) != 0;
+	return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx");
+#endif
+}
+
+static bool UseAvx()
+{
+	static const bool supported = DetectAvx();
+	return supported;
+}
+
+#endif
+
+#if defined(BOX_BATCH_USE_SSE)
+
+struct QueryLanes
+{
+	__m128 minX, minY, minZ;
+	__m128 maxX, maxY, maxZ;
+};
+
+static QueryLanes LoadQuery(BoundingBox query)
+{
+	QueryLanes lanes;
+	lanes.minX = _mm_set1_ps(query.min.x); lanes.minY = _mm_set1_ps(query.min.y); lanes.minZ = _mm_set1_ps(query.min.z);
+	lanes.maxX = _mm_set1_ps(query.max.x); lanes.maxY = _mm_set1_ps(query.max.y); lanes.maxZ = _mm_set1_ps(query.max.z);
+	return lanes;
+}
+
+static uint32_t TestHalf(const QueryLanes& q, __m128 minX, __m128 minY, __m128 minZ, __m128 maxX, __m128 maxY, __m128 maxZ)
+{
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(q.maxX, minX), _mm_cmple_ps(q.minX, maxX));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(q.maxY, minY), _mm_cmple_ps(q.minY, maxY)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(q.maxZ, minZ), _mm_cmple_ps(q.minZ, maxZ)));
+	return (uint32_t)_mm_movemask_ps(hit);
+}
+
+// SSE covers a block of eight boxes as two halves of four
+struct Block
+{
+	__m128 minX[2], minY[2], minZ[2];
+	__m128 maxX[2], maxY[2], maxZ[2];
+};
+
+static uint32_t TestBlock(const QueryLanes& q, const Block& b)
+{
+	return TestHalf(q, b.minX[0], b.minY[0], b.minZ[0], b.maxX[0], b.maxY[0], b.maxZ[0]) |
+		(TestHalf(q, b.minX[1], b.minY[1], b.minZ[1], b.maxX[1], b.maxY[1], b.maxZ[1]) << 4);
+}
+
+static Block LoadBlock(const BoxBatch& batch, size_t i)
+{
+	Block b;
+	for (int h = 0; h < 2; h++)
+	{
+		b.minX[h] = _mm_loadu_ps(batch.MinX() + i + h * 4); b.minY[h] = _mm_loadu_ps(batch.MinY() + i + h * 4); b.minZ[h] = _mm_loadu_ps(batch.MinZ() + i + h * 4);
+		b.maxX[h] = _mm_loadu_ps(batch.MaxX() + i + h * 4); b.maxY[h] = _mm_loadu_ps(batch.MaxY() + i + h * 4); b.maxZ[h] = _mm_loadu_ps(batch.MaxZ() + i + h * 4);
+	}
+	return b;
+}
+
+template <int Queries>
+static void OverlapBase(const BoxBatch& batch, const BoundingBox* queries, uint32_t* const* masks)
+{
+	QueryLanes q[Queries];
+	for (int k = 0; k < Queries; k++)
+		q[k] = LoadQuery(queries[k]);
+
+	for (size_t i = 0; i < batch.Size(); i += BOX_BATCH_BLOCK)
+	{
+		Block block = LoadBlock(batch, i);
+		for (int k = 0; k < Queries; k++)
+		{
+			uint32_t bits = TestBlock(q[k], block);
+			if (bits)
+				StoreBits(masks[k], i, bits);
+		}
+	}
+}
+
+#else
+
+static uint32_t TestBlock(const BoxBatch& batch, size_t first, BoundingBox q)
+{
+	uint32_t bits = 0;
+	for (size_t lane = 0; lane < BOX_BATCH_BLOCK; lane++)
+	{
+		size_t i = first + lane;
+		if (q.max.x >= batch.MinX()[i] && q.min.x <= batch.MaxX()[i] &&
+			q.max.y >= batch.MinY()[i] && q.min.y <= batch.MaxY()[i] &&
+			q.max.z >= batch.MinZ()[i] && q.min.z <= batch.MaxZ()[i])
+			bits |= 1u << lane;
+	}
+	return bits;
+}
+
+template <int Queries>
+static void OverlapBase(const BoxBatch& batch, const BoundingBox* queries, uint32_t* const* masks)
+{
+	for (size_t i = 0; i < batch.Size(); i += BOX_BATCH_BLOCK)
+	{
+		for (int k = 0; k < Queries; k++)
+		{
+			uint32_t bits = TestBlock(batch, i, queries[k]);
+			if (bits)
+				StoreBits(masks[k], i, bits);
+		}
+	}
+}
+
+#endif
+
+// Drops the bits of the padding boxes past the end of the batch
+static void ClearPadding(uint32_t* mask, size_t count)
+{
+	if (count % 32 != 0)
+		mask[count / 32] &= (1u << (count % 32)) - 1;
+}
+
+template <int Queries>
+static void Overlap(const BoxBatch& batch, const BoundingBox* queries, uint32_t* const* masks)
+{
+	size_t words = batch.MaskWords();
+	if (words == 0)
+		return;
+	for (int k = 0; k < Queries; k++)
+		memset(masks[k], 0, words * sizeof(uint32_t));
+
+#if defined(BOX_BATCH_AVX_DISPATCH)
+	if (UseAvx())
+		OverlapAvx<Queries>(batch, queries, masks);
+	else
+		OverlapBase<Queries>(batch, queries, masks);
+#elif defined(BOX_BATCH_USE_AVX)
+	OverlapAvx<Queries>(batch, queries, masks);
+#else
+	OverlapBase<Queries>(batch, queries, masks);
+#endif
+
+	for (int k = 0; k < Queries; k++)
+		ClearPadding(masks[k], batch.Size());
+}
+
+void BoxBatchOverlap(const BoxBatch& batch, BoundingBox query, uint32_t* mask)
+{
+	Overlap<1>(batch, &query, &mask);
+}
+
+void BoxBatchOverlap3(const BoxBatch& batch, const BoundingBox queries[3], uint32_t* masks[3])
+{
+	Overlap<3>(batch, queries, masks);
+}
+
+const char* BoxBatchKernel()
+{
+#if defined(BOX_BATCH_USE_AVX) && !defined(BOX_BATCH_AVX_DISPATCH)
+	return "AVX";
+#else
+#if defined(BOX_BATCH_AVX_DISPATCH)
+	if (UseAvx())
+		return "AVX";
+#endif
+#if defined(BOX_BATCH_USE_SSE)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+#endif
+}
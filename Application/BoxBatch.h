@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "raylib.h"
+
+// Boxes per SIMD block, the arrays are padded to a multiple of this. Padding lanes are
+// loaded by the kernels but never reported.
+#define BOX_BATCH_BLOCK 8
+
+// Axis aligned boxes stored as separate min/max arrays per axis so the overlap kernels can
+// load eight boxes per axis with one AVX instruction (two with SSE2) instead of gathering
+// BoundingBox structs
+class BoxBatch
+{
+public:
+	void Clear();
+	void Reserve(size_t capacity);
+	void Push(BoundingBox box, uint32_t id);
+
+	size_t Size() const { return count; }
+	uint32_t GetId(size_t i) const { return ids[i]; }
+	BoundingBox GetBox(size_t i) const;
+
+	// Words needed for a hit mask over this batch, one bit per box
+	size_t MaskWords() const { return (count + 31) / 32; }
+
+	const float* MinX() const { return minX.data(); }
+	const float* MinY() const { return minY.data(); }
+	const float* MinZ() const { return minZ.data(); }
+	const float* MaxX() const { return maxX.data(); }
+	const float* MaxY() const { return maxY.data(); }
+	const float* MaxZ() const { return maxZ.data(); }
+
+private:
+	size_t count = 0;
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+	std::vector<uint32_t> ids;
+};
+
+// Sets bit i of mask when box i overlaps the query, with the same inclusive rule as
+// CheckCollisionBoxes. mask must hold batch.MaskWords() words and is overwritten; bits past
+// Size() are always clear, whatever the query.
+void BoxBatchOverlap(const BoxBatch& batch, BoundingBox query, uint32_t* mask);
+
+// Tests three queries in one pass over the batch, so every box is loaded once for all
+// the per-axis sweeps of a collision step
+void BoxBatchOverlap3(const BoxBatch& batch, const BoundingBox queries[3], uint32_t* masks[3]);
+
+// Instruction set the overlap kernels run with on this machine: "AVX", "SSE2" or "scalar"
+const char* BoxBatchKernel();
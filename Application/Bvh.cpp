@@ -0,0 +1,542 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// Past this depth the builder stops trusting SAH and splits at the median, which keeps the
+// traversal stack within BVH_STACK_SIZE for any realistic input
+#define BVH_MAX_SAH_DEPTH 48
+#define BVH_STACK_SIZE 256
+
+static float SurfaceArea(BoundingBox box)
+{
+	float dx = box.max.x - box.min.x;
+	float dy = box.max.y - box.min.y;
+	float dz = box.max.z - box.min.z;
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static BoundingBox EmptyBox()
+{
+	return BoundingBox{ { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+
+static void GrowBox(BoundingBox& box, BoundingBox other)
+{
+	box.min.x = std::min(box.min.x, other.min.x);
+	box.min.y = std::min(box.min.y, other.min.y);
+	box.min.z = std::min(box.min.z, other.min.z);
+	box.max.x = std::max(box.max.x, other.max.x);
+	box.max.y = std::max(box.max.y, other.max.y);
+	box.max.z = std::max(box.max.z, other.max.z);
+}
+
+static float Axis(Vector3 v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Reciprocal that stays finite for axis aligned rays so the slab test never sees 0 * inf
+static float SafeInverse(float d)
+{
+	if (std::fabs(d) < 1e-12f)
+		return d < 0.0f ? -1e12f : 1e12f;
+	return 1.0f / d;
+}
+
+// Fixed traversal stack that spills to the heap instead of overflowing. Entries past the
+// array are pushed last, so popping them first keeps the order.
+class TraversalStack
+{
+public:
+	TraversalStack() : top(0) {}
+
+	void Push(uint32_t node)
+	{
+		if (top < BVH_STACK_SIZE)
+			local[top++] = node;
+		else
+			spilled.push_back(node);
+	}
+
+	uint32_t Pop()
+	{
+		if (!spilled.empty())
+		{
+			uint32_t node = spilled.back();
+			spilled.pop_back();
+			return node;
+		}
+		return local[--top];
+	}
+
+	bool Empty() const { return top == 0; }
+
+private:
+	uint32_t local[BVH_STACK_SIZE];
+	int top;
+	std::vector<uint32_t> spilled;
+};
+
+void Bvh::Clear()
+{
+	nodes.clear();
+	primBoxes.clear();
+	primIds.clear();
+}
+
+void Bvh::Build(const BoundingBox* boxes, const uint32_t* ids, size_t count)
+{
+	Clear();
+	if (count == 0)
+		return;
+
+	std::vector<BoundingBox> input(boxes, boxes + count);
+	std::vector<Vector3> centers(count);
+	std::vector<uint32_t> order(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		centers[i] = { (boxes[i].min.x + boxes[i].max.x) * 0.5f, (boxes[i].min.y + boxes[i].max.y) * 0.5f, (boxes[i].min.z + boxes[i].max.z) * 0.5f };
+		order[i] = (uint32_t)i;
+	}
+
+	std::vector<BuildNode> build;
+	build.reserve(count / 2 + 1);
+	uint32_t root = BuildRecursive(build, order, input, centers, 0, (uint32_t)count, 0);
+
+	// Leaves index straight into these, so store the primitives in tree order
+	primBoxes.resize(count);
+	primIds.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		primBoxes[i] = input[order[i]];
+		primIds[i] = ids[order[i]];
+	}
+
+	nodes.reserve(build.size() / 2 + 1);
+	if (build[root].count > 0)
+	{
+		// Tiny scene, a single leaf under the root node
+		Node node = {};
+		for (int lane = 0; lane < 4; lane++)
+		{
+			node.minX[lane] = node.minY[lane] = node.minZ[lane] = FLT_MAX;
+			node.maxX[lane] = node.maxY[lane] = node.maxZ[lane] = -FLT_MAX;
+			node.child[lane] = BVH_INVALID;
+		}
+		BoundingBox bounds = build[root].bounds;
+		node.minX[0] = bounds.min.x; node.minY[0] = bounds.min.y; node.minZ[0] = bounds.min.z;
+		node.maxX[0] = bounds.max.x; node.maxY[0] = bounds.max.y; node.maxZ[0] = bounds.max.z;
+		node.child[0] = build[root].first;
+		node.primCount[0] = build[root].count;
+		node.childCount = 1;
+		nodes.push_back(node);
+	}
+	else
+	{
+		Collapse(build, root);
+	}
+}
+
+uint32_t Bvh::BuildRecursive(std::vector<BuildNode>& build, std::vector<uint32_t>& order,
+	const std::vector<BoundingBox>& boxes, const std::vector<Vector3>& centers, uint32_t first, uint32_t count, int depth)
+{
+	BoundingBox bounds = EmptyBox();
+	BoundingBox centerBounds = EmptyBox();
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		GrowBox(bounds, boxes[order[i]]);
+		GrowBox(centerBounds, BoundingBox{ centers[order[i]], centers[order[i]] });
+	}
+
+	uint32_t index = (uint32_t)build.size();
+	build.push_back(BuildNode{ bounds, BVH_INVALID, BVH_INVALID, first, count });
+
+	if (count <= BVH_MAX_LEAF_SIZE)
+		return index;
+
+	Vector3 extent = Vector3{ centerBounds.max.x - centerBounds.min.x, centerBounds.max.y - centerBounds.min.y, centerBounds.max.z - centerBounds.min.z };
+	int axis = 0;
+	if (extent.y > Axis(extent, axis))
+		axis = 1;
+	if (extent.z > Axis(extent, axis))
+		axis = 2;
+
+	float axisMin = Axis(centerBounds.min, axis);
+	float axisExtent = Axis(extent, axis);
+	uint32_t* begin = order.data() + first;
+	uint32_t* end = begin + count;
+	uint32_t* middle = nullptr;
+
+	if (axisExtent > 0.0f && depth < BVH_MAX_SAH_DEPTH)
+	{
+		BoundingBox binBounds[BVH_SAH_BINS];
+		uint32_t binCounts[BVH_SAH_BINS] = { 0 };
+		for (int b = 0; b < BVH_SAH_BINS; b++)
+			binBounds[b] = EmptyBox();
+
+		float scale = BVH_SAH_BINS / axisExtent;
+		auto binOf = [&](uint32_t prim)
+		{
+			int b = (int)((Axis(centers[prim], axis) - axisMin) * scale);
+			return std::min(std::max(b, 0), BVH_SAH_BINS - 1);
+		};
+
+		for (uint32_t* p = begin; p != end; p++)
+		{
+			int b = binOf(*p);
+			binCounts[b]++;
+			GrowBox(binBounds[b], boxes[*p]);
+		}
+
+		// Sweep from the right once so every split plane costs O(1) to evaluate
+		float rightArea[BVH_SAH_BINS];
+		uint32_t rightCount[BVH_SAH_BINS];
+		BoundingBox accumulated = EmptyBox();
+		uint32_t accumulatedCount = 0;
+		for (int b = BVH_SAH_BINS - 1; b > 0; b--)
+		{
+			GrowBox(accumulated, binBounds[b]);
+			accumulatedCount += binCounts[b];
+			rightArea[b] = accumulatedCount > 0 ? SurfaceArea(accumulated) : 0.0f;
+			rightCount[b] = accumulatedCount;
+		}
+
+		float bestCost = FLT_MAX;
+		int bestSplit = -1;
+		accumulated = EmptyBox();
+		accumulatedCount = 0;
+		for (int b = 0; b < BVH_SAH_BINS - 1; b++)
+		{
+			GrowBox(accumulated, binBounds[b]);
+			accumulatedCount += binCounts[b];
+			if (accumulatedCount == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			float cost = accumulatedCount * SurfaceArea(accumulated) + rightCount[b + 1] * rightArea[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		if (bestSplit >= 0)
+			middle = std::partition(begin, end, [&](uint32_t prim) { return binOf(prim) <= bestSplit; });
+	}
+
+	if (middle == nullptr || middle == begin || middle == end)
+	{
+		// Centers coincide or SAH gave up, fall back to an even split along the axis
+		middle = begin + count / 2;
+		std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) { return Axis(centers[a], axis) < Axis(centers[b], axis); });
+	}
+
+	uint32_t leftCount = (uint32_t)(middle - begin);
+	uint32_t left = BuildRecursive(build, order, boxes, centers, first, leftCount, depth + 1);
+	uint32_t right = BuildRecursive(build, order, boxes, centers, first + leftCount, count - leftCount, depth + 1);
+
+	build[index].left = left;
+	build[index].right = right;
+	build[index].count = 0;
+	return index;
+}
+
+// Pulls grandchildren up into the parent until it has four children, always opening the
+// inner child with the largest surface area since it is the most likely to be visited
+uint32_t Bvh::Collapse(const std::vector<BuildNode>& build, uint32_t buildIndex)
+{
+	uint32_t lanes[4] = { build[buildIndex].left, build[buildIndex].right, BVH_INVALID, BVH_INVALID };
+	uint32_t laneCount = 2;
+
+	while (laneCount < 4)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for (uint32_t i = 0; i < laneCount; i++)
+		{
+			const BuildNode& candidate = build[lanes[i]];
+			if (candidate.count == 0 && SurfaceArea(candidate.bounds) > bestArea)
+			{
+				bestArea = SurfaceArea(candidate.bounds);
+				best = (int)i;
+			}
+		}
+
+		if (best < 0)
+			break;
+
+		uint32_t opened = lanes[best];
+		lanes[best] = build[opened].left;
+		lanes[laneCount++] = build[opened].right;
+	}
+
+	uint32_t index = (uint32_t)nodes.size();
+	nodes.push_back(Node{});
+
+	uint32_t children[4];
+	for (uint32_t i = 0; i < laneCount; i++)
+		children[i] = build[lanes[i]].count > 0 ? build[lanes[i]].first : Collapse(build, lanes[i]);
+
+	// Filled in after recursing since the node array may have been reallocated
+	Node& node = nodes[index];
+	for (uint32_t lane = 0; lane < 4; lane++)
+	{
+		if (lane < laneCount)
+		{
+			const BuildNode& child = build[lanes[lane]];
+			node.minX[lane] = child.bounds.min.x; node.minY[lane] = child.bounds.min.y; node.minZ[lane] = child.bounds.min.z;
+			node.maxX[lane] = child.bounds.max.x; node.maxY[lane] = child.bounds.max.y; node.maxZ[lane] = child.bounds.max.z;
+			node.child[lane] = children[lane];
+			node.primCount[lane] = child.count;
+		}
+		else
+		{
+			node.minX[lane] = node.minY[lane] = node.minZ[lane] = FLT_MAX;
+			node.maxX[lane] = node.maxY[lane] = node.maxZ[lane] = -FLT_MAX;
+			node.child[lane] = BVH_INVALID;
+			node.primCount[lane] = 0;
+		}
+	}
+	node.childCount = laneCount;
+
+	return index;
+}
+
+// Bit per child lane whose box overlaps the query box
+static int OverlapMask4(const float* minX, const float* minY, const float* minZ,
+	const float* maxX, const float* maxY, const float* maxZ, BoundingBox box)
+{
+#if defined(BVH_USE_SSE)
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(_mm_set1_ps(box.max.x), _mm_loadu_ps(minX)), _mm_cmple_ps(_mm_set1_ps(box.min.x), _mm_loadu_ps(maxX)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(_mm_set1_ps(box.max.y), _mm_loadu_ps(minY)), _mm_cmple_ps(_mm_set1_ps(box.min.y), _mm_loadu_ps(maxY))));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(_mm_set1_ps(box.max.z), _mm_loadu_ps(minZ)), _mm_cmple_ps(_mm_set1_ps(box.min.z), _mm_loadu_ps(maxZ))));
+	return _mm_movemask_ps(hit);
+#else
+	int mask = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		if (box.max.x >= minX[lane] && box.min.x <= maxX[lane] &&
+			box.max.y >= minY[lane] && box.min.y <= maxY[lane] &&
+			box.max.z >= minZ[lane] && box.min.z <= maxZ[lane])
+			mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
+
+// Slab test of one ray against four boxes grown by 'grow' on every side (zero for plain rays,
+// the half extents of the moving box for sweeps). Writes the entry distance of every lane.
+static int RayMask4(const float* minX, const float* minY, const float* minZ,
+	const float* maxX, const float* maxY, const float* maxZ,
+	Vector3 origin, Vector3 inverse, Vector3 grow, float maxDistance, float* entry)
+{
+#if defined(BVH_USE_SSE)
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(minX), _mm_set1_ps(grow.x)), _mm_set1_ps(origin.x)), _mm_set1_ps(inverse.x));
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(maxX), _mm_set1_ps(grow.x)), _mm_set1_ps(origin.x)), _mm_set1_ps(inverse.x));
+	__m128 tNear = _mm_min_ps(t1, t2);
+	__m128 tFar = _mm_max_ps(t1, t2);
+
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(minY), _mm_set1_ps(grow.y)), _mm_set1_ps(origin.y)), _mm_set1_ps(inverse.y));
+	t2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(maxY), _mm_set1_ps(grow.y)), _mm_set1_ps(origin.y)), _mm_set1_ps(inverse.y));
+	tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+	tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+	t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(minZ), _mm_set1_ps(grow.z)), _mm_set1_ps(origin.z)), _mm_set1_ps(inverse.z));
+	t2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(maxZ), _mm_set1_ps(grow.z)), _mm_set1_ps(origin.z)), _mm_set1_ps(inverse.z));
+	tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+	tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+	tNear = _mm_max_ps(tNear, _mm_setzero_ps());
+	tFar = _mm_min_ps(tFar, _mm_set1_ps(maxDistance));
+	_mm_storeu_ps(entry, tNear);
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+	int mask = 0;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		float t1 = (minX[lane] - grow.x - origin.x) * inverse.x;
+		float t2 = (maxX[lane] + grow.x - origin.x) * inverse.x;
+		float tNear = std::min(t1, t2);
+		float tFar = std::max(t1, t2);
+
+		t1 = (minY[lane] - grow.y - origin.y) * inverse.y;
+		t2 = (maxY[lane] + grow.y - origin.y) * inverse.y;
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+
+		t1 = (minZ[lane] - grow.z - origin.z) * inverse.z;
+		t2 = (maxZ[lane] + grow.z - origin.z) * inverse.z;
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+
+		tNear = std::max(tNear, 0.0f);
+		tFar = std::min(tFar, maxDistance);
+		entry[lane] = tNear;
+		if (tNear <= tFar)
+			mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
+
+static bool RayBox(BoundingBox box, Vector3 origin, Vector3 inverse, Vector3 grow, float maxDistance, float& entry)
+{
+	float t1 = (box.min.x - grow.x - origin.x) * inverse.x;
+	float t2 = (box.max.x + grow.x - origin.x) * inverse.x;
+	float tNear = std::min(t1, t2);
+	float tFar = std::max(t1, t2);
+
+	t1 = (box.min.y - grow.y - origin.y) * inverse.y;
+	t2 = (box.max.y + grow.y - origin.y) * inverse.y;
+	tNear = std::max(tNear, std::min(t1, t2));
+	tFar = std::min(tFar, std::max(t1, t2));
+
+	t1 = (box.min.z - grow.z - origin.z) * inverse.z;
+	t2 = (box.max.z + grow.z - origin.z) * inverse.z;
+	tNear = std::max(tNear, std::min(t1, t2));
+	tFar = std::min(tFar, std::max(t1, t2));
+
+	entry = std::max(tNear, 0.0f);
+	return entry <= std::min(tFar, maxDistance);
+}
+
+void Bvh::QueryOverlap(BoundingBox box, std::vector<uint32_t>& out) const
+{
+	if (nodes.empty())
+		return;
+
+	TraversalStack stack;
+	stack.Push(0);
+
+	while (!stack.Empty())
+	{
+		const Node& node = nodes[stack.Pop()];
+		int mask = OverlapMask4(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, box);
+		mask &= (1 << node.childCount) - 1;
+
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+
+			if (node.primCount[lane] == 0)
+			{
+				stack.Push(node.child[lane]);
+				continue;
+			}
+
+			uint32_t first = node.child[lane];
+			for (uint32_t i = first; i < first + node.primCount[lane]; i++)
+			{
+				const BoundingBox& prim = primBoxes[i];
+				if (box.max.x >= prim.min.x && box.min.x <= prim.max.x &&
+					box.max.y >= prim.min.y && box.min.y <= prim.max.y &&
+					box.max.z >= prim.min.z && box.min.z <= prim.max.z)
+					out.push_back(primIds[i]);
+			}
+		}
+	}
+}
+
+bool Bvh::Raycast(Ray ray, float maxDistance, BvhHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	Vector3 inverse = { SafeInverse(ray.direction.x), SafeInverse(ray.direction.y), SafeInverse(ray.direction.z) };
+	Vector3 grow = { 0.0f, 0.0f, 0.0f };
+	float closest = maxDistance;
+	bool found = false;
+
+	TraversalStack stack;
+	stack.Push(0);
+
+	while (!stack.Empty())
+	{
+		const Node& node = nodes[stack.Pop()];
+		float entry[4];
+		int mask = RayMask4(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, ray.position, inverse, grow, closest, entry);
+		mask &= (1 << node.childCount) - 1;
+
+		// Push far children first so the nearest one is popped next and shrinks 'closest' early
+		int laneOrder[4] = { 0, 1, 2, 3 };
+		std::sort(laneOrder, laneOrder + 4, [&](int a, int b) { return entry[a] > entry[b]; });
+
+		for (int lane : laneOrder)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+
+			if (node.primCount[lane] == 0)
+			{
+				stack.Push(node.child[lane]);
+				continue;
+			}
+
+			uint32_t first = node.child[lane];
+			for (uint32_t i = first; i < first + node.primCount[lane]; i++)
+			{
+				float distance;
+				if (RayBox(primBoxes[i], ray.position, inverse, grow, closest, distance))
+				{
+					closest = distance;
+					hit.id = primIds[i];
+					hit.distance = distance;
+					found = true;
+				}
+			}
+		}
+	}
+
+	return found;
+}
+
+// The moving box is shrunk to its center and every stored box grown by its half extents,
+// which turns the sweep into a ray cast over t in [0, 1]
+void Bvh::QuerySwept(BoundingBox box, Vector3 delta, std::vector<BvhHit>& out) const
+{
+	if (nodes.empty())
+		return;
+
+	Vector3 origin = { (box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f };
+	Vector3 grow = { (box.max.x - box.min.x) * 0.5f, (box.max.y - box.min.y) * 0.5f, (box.max.z - box.min.z) * 0.5f };
+	Vector3 inverse = { SafeInverse(delta.x), SafeInverse(delta.y), SafeInverse(delta.z) };
+
+	TraversalStack stack;
+	stack.Push(0);
+
+	while (!stack.Empty())
+	{
+		const Node& node = nodes[stack.Pop()];
+		float entry[4];
+		int mask = RayMask4(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, origin, inverse, grow, 1.0f, entry);
+		mask &= (1 << node.childCount) - 1;
+
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				continue;
+
+			if (node.primCount[lane] == 0)
+			{
+				stack.Push(node.child[lane]);
+				continue;
+			}
+
+			uint32_t first = node.child[lane];
+			for (uint32_t i = first; i < first + node.primCount[lane]; i++)
+			{
+				float time;
+				if (RayBox(primBoxes[i], origin, inverse, grow, 1.0f, time))
+					out.push_back(BvhHit{ primIds[i], time });
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "raylib.h"
+
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_SAH_BINS 12
+#define BVH_INVALID 0xffffffffu
+
+struct BvhHit
+{
+	uint32_t id;
+	float distance;     // Ray distance for Raycast, time of impact in [0, 1] for QuerySwept
+};
+
+// Bounding volume hierarchy for static boxes. Built once with a binned surface area heuristic,
+// then collapsed into 4-wide nodes stored in one flat array so every node visit tests four
+// child boxes at once (SSE when available, plain loops otherwise).
+class Bvh
+{
+public:
+	// Rebuilds the tree from scratch, ids are returned by the queries
+	void Build(const BoundingBox* boxes, const uint32_t* ids, size_t count);
+	void Clear();
+
+	// Appends the id of every box overlapping the query box
+	void QueryOverlap(BoundingBox box, std::vector<uint32_t>& out) const;
+
+	// Closest box hit by the ray within maxDistance, for picking
+	bool Raycast(Ray ray, float maxDistance, BvhHit& hit) const;
+
+	// Every box touched by the query box while it moves by delta, with the time of first contact
+	void QuerySwept(BoundingBox box, Vector3 delta, std::vector<BvhHit>& out) const;
+
+	size_t Size() const { return primIds.size(); }
+	size_t NodeCount() const { return nodes.size(); }
+
+private:
+	// Child boxes in SoA order so the four lanes load straight into one register per axis
+	struct Node
+	{
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4];      // Node index for inner children, first primitive for leaves
+		uint32_t primCount[4];  // 0 for inner children
+		uint32_t childCount;
+	};
+
+	struct BuildNode
+	{
+		BoundingBox bounds;
+		uint32_t left;
+		uint32_t right;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	uint32_t BuildRecursive(std::vector<BuildNode>& build, std::vector<uint32_t>& order,
+		const std::vector<BoundingBox>& boxes, const std::vector<Vector3>& centers, uint32_t first, uint32_t count, int depth);
+	uint32_t Collapse(const std::vector<BuildNode>& build, uint32_t buildIndex);
+
+	std::vector<Node> nodes;
+	std::vector<BoundingBox> primBoxes;
+	std::vector<uint32_t> primIds;
+};
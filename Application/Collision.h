@@ -0,0 +1,27 @@
+#pragma once
+
+#include "raylib.h"
+
+// Same inclusive test as raylib's CheckCollisionBoxes, kept here so the simulation does not link raylib
+inline bool BoxesOverlap(BoundingBox a, BoundingBox b)
+{
+	return (a.max.x >= b.min.x) && (a.min.x <= b.max.x) &&
+		(a.max.y >= b.min.y) && (a.min.y <= b.max.y) &&
+		(a.max.z >= b.min.z) && (a.min.z <= b.max.z);
+}
+
+inline BoundingBox BoxAround(Vector3 center, Vector3 size)
+{
+	return BoundingBox{
+		Vector3{ center.x - size.x / 2, center.y - size.y / 2, center.z - size.z / 2 },
+		Vector3{ center.x + size.x / 2, center.y + size.y / 2, center.z + size.z / 2 }
+	};
+}
+
+inline BoundingBox BoxUnion(BoundingBox a, BoundingBox b)
+{
+	return BoundingBox{
+		Vector3{ a.min.x < b.min.x ? a.min.x : b.min.x, a.min.y < b.min.y ? a.min.y : b.min.y, a.min.z < b.min.z ? a.min.z : b.min.z },
+		Vector3{ a.max.x > b.max.x ? a.max.x : b.max.x, a.max.y > b.max.y ? a.max.y : b.max.y, a.max.z > b.max.z ? a.max.z : b.max.z }
+	};
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "raylib.h"
+
+// Plain data components stored in the Registry, one dense array per type
+
+struct Position
+{
+	Vector3 value;
+};
+
+// Full extents of an axis aligned box centered on the Position
+struct BoxShape
+{
+	Vector3 size;
+};
+
+struct Tint
+{
+	Color color;
+};
+
+// Tag for boxes that may move after spawning, their broad-phase entry is refreshed every tick
+struct Dynamic
+{
+};
+
+// Units per second, integrated by scripted behaviors
+struct Velocity
+{
+	Vector3 value;
+};
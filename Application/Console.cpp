@@ -0,0 +1,121 @@
+#include "Console.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "ScriptSystem.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Only touched on the main thread, from Execute and the hook it installs
+static Clock::time_point commandDeadline;
+
+static void TimeoutHook(lua_State* L, lua_Debug* ar)
+{
+	(void)ar;
+	if (Clock::now() > commandDeadline)
+		luaL_error(L, "console command ran longer than %d ms and was aborted", (int)CONSOLE_COMMAND_TIMEOUT_MS);
+}
+
+// Calls the chunk and joins its results into one tab separated string, nothing if it returned
+// nothing. The conversion runs inside the pcall too, so an erroring or endless __tostring is
+// reported and aborted like any other error.
+static int CallAndFormat(lua_State* L)
+{
+	lua_call(L, 0, LUA_MULTRET);
+	int results = lua_gettop(L);
+	if (results == 0)
+		return 0;
+
+	luaL_Buffer buffer;
+	luaL_buffinit(L, &buffer);
+	for (int i = 1; i <= results; i++)
+	{
+		if (i > 1)
+			luaL_addchar(&buffer, '\t');
+		luaL_tolstring(L, i, NULL);
+		luaL_addvalue(&buffer);
+	}
+	luaL_pushresult(&buffer);
+	return 1;
+}
+
+// Like the standalone interpreter, a line is first tried as an expression so typing a value
+// prints it, then as a statement
+static void RunLine(lua_State* L, const std::string& line)
+{
+	int top = lua_gettop(L);
+	lua_pushcfunction(L, CallAndFormat);
+	std::string expression = "return " + line;
+	if (luaL_loadbuffer(L, expression.c_str(), expression.size(), "=console") != LUA_OK)
+	{
+		lua_settop(L, top + 1);
+		if (luaL_loadbuffer(L, line.c_str(), line.size(), "=console") != LUA_OK)
+		{
+			DumpError(L);
+			lua_settop(L, top);
+			return;
+		}
+	}
+
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+	{
+		DumpError(L);
+		lua_settop(L, top);
+		return;
+	}
+
+	if (!lua_isnil(L, -1))
+		std::cout << lua_tostring(L, -1) << std::endl;
+	lua_settop(L, top);
+}
+
+void Console::Start()
+{
+	if (shared)
+		return;
+
+	shared = std::make_shared<Shared>();
+	std::thread(ReadLines, shared).detach();
+	std::cout << "> " << std::flush;
+}
+
+void Console::ReadLines(std::shared_ptr<Shared> shared)
+{
+	std::string line;
+	while (std::getline(std::cin, line))
+	{
+		// Full means the main loop is behind, wait for it instead of dropping the line
+		while (!shared->lines.TryPush(std::move(line)))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+int Console::Execute(lua_State* L, double budgetMs)
+{
+	if (!shared)
+		return 0;
+
+	Clock::time_point start = Clock::now();
+	std::chrono::duration<double, std::milli> budget(budgetMs);
+	std::chrono::duration<double, std::milli> timeout(CONSOLE_COMMAND_TIMEOUT_MS);
+
+	// At least one line runs per frame even with a zero budget, so the queue always drains
+	int executed = 0;
+	std::string line;
+	while (shared->lines.TryPop(line))
+	{
+		commandDeadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout);
+		lua_sethook(L, TimeoutHook, LUA_MASKCOUNT, 1000);
+		RunLine(L, line);
+		lua_sethook(L, NULL, 0, 0);
+
+		executed++;
+		std::cout << "> " << std::flush;
+
+		if (Clock::now() - start >= budget)
+			break;
+	}
+	return executed;
+}
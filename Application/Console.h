@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "lua.hpp"
+
+#include "SpscQueue.h"
+
+#define CONSOLE_QUEUE_SIZE 64
+
+// Time the main loop spends on console commands per frame
+#define CONSOLE_FRAME_BUDGET_MS 1.0
+
+// A single command running longer than this is aborted, so a stray infinite loop typed into
+// the console can't hang the game
+#define CONSOLE_COMMAND_TIMEOUT_MS 250.0
+
+// Live Lua console. A background thread only reads lines from stdin and pushes them into a
+// lock-free queue, it never touches the lua_State. The main loop calls Execute once per frame
+// at a fixed point, which runs queued lines until the frame budget is used up.
+class Console
+{
+public:
+	// Starts the reader thread, it runs until stdin closes and is detached so shutdown never
+	// waits on a blocking read
+	void Start();
+
+	// Runs queued lines on L, returns how many were run. Lines left over wait for next frame.
+	int Execute(lua_State* L, double budgetMs = CONSOLE_FRAME_BUDGET_MS);
+
+private:
+	// Shared with the reader thread so it can outlive the Console while blocked on stdin
+	struct Shared
+	{
+		SpscQueue<std::string, CONSOLE_QUEUE_SIZE> lines;
+	};
+
+	static void ReadLines(std::shared_ptr<Shared> shared);
+
+	std::shared_ptr<Shared> shared;
+};
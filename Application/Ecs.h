@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Sparse-set entity component system. Every component type gets its own pool with the
+// component values packed in one dense array, so a system that touches a component
+// walks contiguous memory no matter how entities were created or destroyed.
+
+#define ECS_INVALID_INDEX 0xffffffffu
+#define ECS_ALIGN_BLOCK 256
+
+// Stable handle, the generation is bumped when the slot is reused so old handles go stale
+struct Entity
+{
+	uint32_t index;
+	uint32_t generation;
+
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+static const Entity NULL_ENTITY = { ECS_INVALID_INDEX, 0 };
+
+class ComponentPoolBase
+{
+public:
+	virtual ~ComponentPoolBase() {}
+	virtual void Remove(uint32_t entityIndex) = 0;
+
+	// Exchanges two dense slots, entity and component together
+	virtual void SwapDense(uint32_t a, uint32_t b) = 0;
+
+	bool Contains(uint32_t entityIndex) const
+	{
+		return entityIndex < sparse.size() && sparse[entityIndex] != ECS_INVALID_INDEX;
+	}
+
+	// Dense position of the entity's component, ECS_INVALID_INDEX if it has none
+	uint32_t DenseIndex(uint32_t entityIndex) const
+	{
+		return entityIndex < sparse.size() ? sparse[entityIndex] : ECS_INVALID_INDEX;
+	}
+
+	size_t Size() const { return entities.size(); }
+	const uint32_t* Entities() const { return entities.data(); }
+
+protected:
+	std::vector<uint32_t> sparse;     // entity index -> dense index
+	std::vector<uint32_t> entities;   // dense index -> entity index
+};
+
+template <typename T>
+class ComponentPool : public ComponentPoolBase
+{
+public:
+	T& Add(uint32_t entityIndex, const T& value)
+	{
+		if (entityIndex >= sparse.size())
+			sparse.resize(entityIndex + 1, ECS_INVALID_INDEX);
+
+		if (sparse[entityIndex] != ECS_INVALID_INDEX)
+			return data[sparse[entityIndex]] = value;
+
+		sparse[entityIndex] = (uint32_t)entities.size();
+		entities.push_back(entityIndex);
+		data.push_back(value);
+		return data.back();
+	}
+
+	// Swap-and-pop keeps the dense array hole free
+	void Remove(uint32_t entityIndex) override
+	{
+		if (!Contains(entityIndex))
+			return;
+
+		uint32_t dense = sparse[entityIndex];
+		uint32_t last = (uint32_t)entities.size() - 1;
+
+		if (dense != last)
+		{
+			data[dense] = data[last];
+			entities[dense] = entities[last];
+			sparse[entities[dense]] = dense;
+		}
+
+		data.pop_back();
+		entities.pop_back();
+		sparse[entityIndex] = ECS_INVALID_INDEX;
+	}
+
+	void SwapDense(uint32_t a, uint32_t b) override
+	{
+		if (a == b)
+			return;
+
+		std::swap(data[a], data[b]);
+		std::swap(entities[a], entities[b]);
+		sparse[entities[a]] = a;
+		sparse[entities[b]] = b;
+	}
+
+	// The entity must have the component
+	T& Get(uint32_t entityIndex) { assert(Contains(entityIndex)); return data[sparse[entityIndex]]; }
+	const T& Get(uint32_t entityIndex) const { assert(Contains(entityIndex)); return data[sparse[entityIndex]]; }
+
+	T* Data() { return data.data(); }
+	const T* Data() const { return data.data(); }
+
+	void Reserve(size_t count)
+	{
+		entities.reserve(count);
+		data.reserve(count);
+	}
+
+private:
+	std::vector<T> data;
+};
+
+// Iterates every entity that has all of the listed components. The smallest pool drives the
+// loop; when the other pools store the same entity at the same dense slot (the usual case
+// for entities spawned together) they are read linearly without going through the sparse array.
+// The leading run of such slots is found up front and walked as plain arrays.
+template <typename... Components>
+class View
+{
+public:
+	View(ComponentPool<Components>*... pools)
+		: pools(pools...)
+	{
+		lead = nullptr;
+		ComponentPoolBase* candidates[] = { pools... };
+		for (ComponentPoolBase* pool : candidates)
+		{
+			if (pool == nullptr)
+			{
+				lead = nullptr;
+				return;
+			}
+			if (lead == nullptr || pool->Size() < lead->Size())
+				lead = pool;
+		}
+	}
+
+	template <typename Func>
+	void Each(Func func)
+	{
+		if (lead == nullptr)
+			return;
+
+		const uint32_t* leadEntities = lead->Entities();
+		size_t count = lead->Size();
+
+		size_t aligned = count;
+		size_t prefixes[] = { AlignedPrefix(std::get<ComponentPool<Components>*>(pools), leadEntities, count)... };
+		for (size_t prefix : prefixes)
+			aligned = std::min(aligned, prefix);
+
+		std::tuple<Components*...> data(std::get<ComponentPool<Components>*>(pools)->Data()...);
+		for (size_t i = 0; i < aligned; i++)
+			func(leadEntities[i], std::get<Components*>(data)[i]...);
+
+		for (size_t i = aligned; i < count; i++)
+		{
+			uint32_t entity = leadEntities[i];
+			if (!HasAll(entity, i))
+				continue;
+
+			func(entity, Fetch<Components>(entity, i)...);
+		}
+	}
+
+private:
+	// Number of leading slots where the pool stores the same entities as the lead
+	static size_t AlignedPrefix(const ComponentPoolBase* pool, const uint32_t* leadEntities, size_t count)
+	{
+		const uint32_t* entities = pool->Entities();
+		size_t n = std::min(count, pool->Size());
+
+		// memcmp over blocks is far faster than comparing one entity at a time
+		size_t i = 0;
+		while (i + ECS_ALIGN_BLOCK <= n && memcmp(leadEntities + i, entities + i, ECS_ALIGN_BLOCK * sizeof(uint32_t)) == 0)
+			i += ECS_ALIGN_BLOCK;
+		while (i < n && leadEntities[i] == entities[i])
+			i++;
+		return i;
+	}
+
+	// A pool that stores the entity at the lead's slot has it, which saves the sparse lookup
+	template <typename T>
+	static bool Aligned(const ComponentPool<T>* pool, uint32_t entity, size_t leadIndex)
+	{
+		return leadIndex < pool->Size() && pool->Entities()[leadIndex] == entity;
+	}
+
+	bool HasAll(uint32_t entity, size_t leadIndex) const
+	{
+		bool has[] = { Aligned(std::get<ComponentPool<Components>*>(pools), entity, leadIndex) ||
+			std::get<ComponentPool<Components>*>(pools)->Contains(entity)... };
+		for (bool h : has)
+		{
+			if (!h)
+				return false;
+		}
+		return true;
+	}
+
+	template <typename T>
+	T& Fetch(uint32_t entity, size_t leadIndex)
+	{
+		ComponentPool<T>* pool = std::get<ComponentPool<T>*>(pools);
+		if (Aligned(pool, entity, leadIndex))
+			return pool->Data()[leadIndex];
+		return pool->Get(entity);
+	}
+
+	std::tuple<ComponentPool<Components>*...> pools;
+	ComponentPoolBase* lead;
+};
+
+class Registry
+{
+public:
+	Entity Create()
+	{
+		if (!freeList.empty())
+		{
+			uint32_t index = freeList.back();
+			freeList.pop_back();
+			return Entity{ index, generations[index] };
+		}
+
+		generations.push_back(0);
+		return Entity{ (uint32_t)generations.size() - 1, 0 };
+	}
+
+	void Destroy(Entity entity)
+	{
+		if (!IsAlive(entity))
+			return;
+
+		for (auto& pool : pools)
+		{
+			if (pool)
+				pool->Remove(entity.index);
+		}
+
+		generations[entity.index]++;
+		freeList.push_back(entity.index);
+	}
+
+	bool IsAlive(Entity entity) const
+	{
+		return entity.index < generations.size() && generations[entity.index] == entity.generation;
+	}
+
+	// Turns a dense entity index from a view back into a full handle
+	Entity HandleOf(uint32_t entityIndex) const
+	{
+		return Entity{ entityIndex, generations[entityIndex] };
+	}
+
+	size_t AliveCount() const { return generations.size() - freeList.size(); }
+
+	template <typename T>
+	T& Add(Entity entity, const T& value)
+	{
+		return Pool<T>().Add(entity.index, value);
+	}
+
+	template <typename T>
+	void Remove(Entity entity)
+	{
+		if (ComponentPool<T>* pool = FindPool<T>())
+			pool->Remove(entity.index);
+	}
+
+	template <typename T>
+	bool Has(Entity entity) const
+	{
+		const ComponentPool<T>* pool = FindPool<T>();
+		return IsAlive(entity) && pool != nullptr && pool->Contains(entity.index);
+	}
+
+	// The entity must be alive and have the component, see TryGet otherwise
+	template <typename T>
+	T& Get(Entity entity)
+	{
+		assert(Has<T>(entity));
+		return FindPool<T>()->Get(entity.index);
+	}
+
+	template <typename T>
+	const T& Get(Entity entity) const
+	{
+		assert(Has<T>(entity));
+		return FindPool<T>()->Get(entity.index);
+	}
+
+	// Null if the entity is dead or has no T
+	template <typename T>
+	T* TryGet(Entity entity)
+	{
+		return Has<T>(entity) ? &FindPool<T>()->Get(entity.index) : nullptr;
+	}
+
+	template <typename T>
+	const T* TryGet(Entity entity) const
+	{
+		return Has<T>(entity) ? &FindPool<T>()->Get(entity.index) : nullptr;
+	}
+
+	template <typename T>
+	ComponentPool<T>& Pool()
+	{
+		size_t id = ComponentTypeId<T>();
+		if (id >= pools.size())
+			pools.resize(id + 1);
+		if (!pools[id])
+			pools[id].reset(new ComponentPool<T>());
+		return *static_cast<ComponentPool<T>*>(pools[id].get());
+	}
+
+	template <typename T>
+	ComponentPool<T>* FindPool()
+	{
+		size_t id = ComponentTypeId<T>();
+		return id < pools.size() ? static_cast<ComponentPool<T>*>(pools[id].get()) : nullptr;
+	}
+
+	template <typename T>
+	const ComponentPool<T>* FindPool() const
+	{
+		size_t id = ComponentTypeId<T>();
+		return id < pools.size() ? static_cast<const ComponentPool<T>*>(pools[id].get()) : nullptr;
+	}
+
+	// Reorders the pools so the entities that have every one of them sit at the front of each
+	// pool, in the same order. Returns how many there are; slot i of each pool's Data() then
+	// belongs to the same entity for i < count, which lets callers hand out plain arrays.
+	// Nearly free when nothing changed since the last call.
+	size_t GroupPools(ComponentPoolBase* const* groupPools, size_t poolCount)
+	{
+		if (poolCount == 0 || groupPools[0] == nullptr)
+			return 0;
+
+		ComponentPoolBase* lead = groupPools[0];
+		uint32_t grouped = 0;
+
+		for (size_t i = 0; i < lead->Size(); i++)
+		{
+			uint32_t entity = lead->Entities()[i];
+			bool inAll = true;
+			for (size_t p = 1; p < poolCount && inAll; p++)
+				inAll = groupPools[p] != nullptr && groupPools[p]->Contains(entity);
+
+			if (!inAll)
+				continue;
+
+			lead->SwapDense((uint32_t)i, grouped);
+			for (size_t p = 1; p < poolCount; p++)
+				groupPools[p]->SwapDense(groupPools[p]->DenseIndex(entity), grouped);
+			grouped++;
+		}
+
+		return grouped;
+	}
+
+	template <typename... Components>
+	size_t Group()
+	{
+		ComponentPoolBase* groupPools[] = { &Pool<Components>()... };
+		return GroupPools(groupPools, sizeof...(Components));
+	}
+
+	template <typename... Components>
+	View<Components...> GetView()
+	{
+		return View<Components...>(FindPool<Components>()...);
+	}
+
+	template <typename... Components, typename Func>
+	void Each(Func func)
+	{
+		View<Components...>(FindPool<Components>()...).Each(func);
+	}
+
+private:
+	static size_t NextTypeId()
+	{
+		static size_t counter = 0;
+		return counter++;
+	}
+
+	template <typename T>
+	static size_t ComponentTypeId()
+	{
+		static const size_t id = NextTypeId();
+		return id;
+	}
+
+	std::vector<uint32_t> generations;
+	std::vector<uint32_t> freeList;
+	std::vector<std::unique_ptr<ComponentPoolBase>> pools;
+};
@@ -0,0 +1,122 @@
+#include "FrustumCulling.h"
+
+#include <cmath>
+
+#include "raymath.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+static Vector4 NormalizePlane(float a, float b, float c, float d)
+{
+	float length = sqrtf(a * a + b * b + c * c);
+	return Vector4{ a / length, b / length, c / length, d / length };
+}
+
+// raylib matrices are uploaded column-major, so row r of the clip transform is (m[r], m[4 + r], m[8 + r], m[12 + r])
+Frustum FrustumFromMatrix(Matrix m)
+{
+	Frustum frustum;
+	frustum.planes[0] = NormalizePlane(m.m3 + m.m0, m.m7 + m.m4, m.m11 + m.m8, m.m15 + m.m12);     // Left
+	frustum.planes[1] = NormalizePlane(m.m3 - m.m0, m.m7 - m.m4, m.m11 - m.m8, m.m15 - m.m12);     // Right
+	frustum.planes[2] = NormalizePlane(m.m3 + m.m1, m.m7 + m.m5, m.m11 + m.m9, m.m15 + m.m13);     // Bottom
+	frustum.planes[3] = NormalizePlane(m.m3 - m.m1, m.m7 - m.m5, m.m11 - m.m9, m.m15 - m.m13);     // Top
+	frustum.planes[4] = NormalizePlane(m.m3 + m.m2, m.m7 + m.m6, m.m11 + m.m10, m.m15 + m.m14);    // Near
+	frustum.planes[5] = NormalizePlane(m.m3 - m.m2, m.m7 - m.m6, m.m11 - m.m10, m.m15 - m.m14);    // Far
+	return frustum;
+}
+
+Frustum FrustumFromCamera(Camera camera, float aspect)
+{
+	Matrix projection;
+	if (camera.projection == CAMERA_ORTHOGRAPHIC)
+	{
+		double top = camera.fovy / 2.0;
+		double right = top * aspect;
+		projection = MatrixOrtho(-right, right, -top, top, FRUSTUM_NEAR_PLANE, FRUSTUM_FAR_PLANE);
+	}
+	else
+	{
+		projection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, FRUSTUM_NEAR_PLANE, FRUSTUM_FAR_PLANE);
+	}
+
+	Matrix view = MatrixLookAt(camera.position, camera.target, camera.up);
+	return FrustumFromMatrix(MatrixMultiply(view, projection));
+}
+
+// A box is outside when its corner furthest along a plane normal is still behind that plane.
+// With center c and half extents e that corner's distance is dot(n, c) + dot(|n|, e) + d.
+void CullBoxes(const BoxBatch& boxes, const Frustum& frustum, Vector3 eye, float maxDistance, std::vector<uint32_t>& visible)
+{
+	const float* minX = boxes.MinX();
+	const float* minY = boxes.MinY();
+	const float* minZ = boxes.MinZ();
+	const float* maxX = boxes.MaxX();
+	const float* maxY = boxes.MaxY();
+	const float* maxZ = boxes.MaxZ();
+	bool distanceCull = maxDistance > 0.0f;
+	size_t count = boxes.Size();
+
+#if defined(FRUSTUM_USE_SSE)
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 eyeX = _mm_set1_ps(eye.x), eyeY = _mm_set1_ps(eye.y), eyeZ = _mm_set1_ps(eye.z);
+	const __m128 maxDistanceSq = _mm_set1_ps(distanceCull ? maxDistance * maxDistance : INFINITY);
+
+	// Batch storage is padded to a whole block, so reading four at a time never runs off the end
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 lowX = _mm_loadu_ps(minX + i), lowY = _mm_loadu_ps(minY + i), lowZ = _mm_loadu_ps(minZ + i);
+		__m128 highX = _mm_loadu_ps(maxX + i), highY = _mm_loadu_ps(maxY + i), highZ = _mm_loadu_ps(maxZ + i);
+		__m128 centerX = _mm_mul_ps(_mm_add_ps(lowX, highX), half);
+		__m128 centerY = _mm_mul_ps(_mm_add_ps(lowY, highY), half);
+		__m128 centerZ = _mm_mul_ps(_mm_add_ps(lowZ, highZ), half);
+		__m128 extentX = _mm_mul_ps(_mm_sub_ps(highX, lowX), half);
+		__m128 extentY = _mm_mul_ps(_mm_sub_ps(highY, lowY), half);
+		__m128 extentZ = _mm_mul_ps(_mm_sub_ps(highZ, lowZ), half);
+
+		__m128 dx = _mm_sub_ps(centerX, eyeX), dy = _mm_sub_ps(centerY, eyeY), dz = _mm_sub_ps(centerZ, eyeZ);
+		__m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 inside = _mm_cmple_ps(distanceSq, maxDistanceSq);
+
+		for (int p = 0; p < 6 && _mm_movemask_ps(inside) != 0; p++)
+		{
+			Vector4 plane = frustum.planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(fabsf(plane.x))), _mm_mul_ps(extentY, _mm_set1_ps(fabsf(plane.y)))),
+				_mm_mul_ps(extentZ, _mm_set1_ps(fabsf(plane.z))));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; mask != 0 && lane < 4; lane++)
+		{
+			if ((mask & (1 << lane)) && i + lane < count)
+				visible.push_back(boxes.GetId(i + lane));
+		}
+	}
+#else
+	for (size_t i = 0; i < count; i++)
+	{
+		Vector3 center = { (minX[i] + maxX[i]) * 0.5f, (minY[i] + maxY[i]) * 0.5f, (minZ[i] + maxZ[i]) * 0.5f };
+		Vector3 extent = { (maxX[i] - minX[i]) * 0.5f, (maxY[i] - minY[i]) * 0.5f, (maxZ[i] - minZ[i]) * 0.5f };
+
+		if (distanceCull && Vector3DistanceSqr(center, eye) > maxDistance * maxDistance)
+			continue;
+
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			Vector4 plane = frustum.planes[p];
+			float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			float reach = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+			inside = distance + reach >= 0.0f;
+		}
+
+		if (inside)
+			visible.push_back(boxes.GetId(i));
+	}
+#endif
+}
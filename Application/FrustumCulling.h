@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "raylib.h"
+
+#include "BoxBatch.h"
+
+// Same clip distances BeginMode3D uses
+#define FRUSTUM_NEAR_PLANE 0.01f
+#define FRUSTUM_FAR_PLANE 1000.0f
+
+// Columns further than this from the camera are culled even inside the frustum
+#define COLUMN_DRAW_DISTANCE 200.0f
+
+// Six planes (left, right, bottom, top, near, far) as (normal, d) with normals pointing
+// inwards, so a point p is inside when dot(normal, p) + d >= 0 for every plane
+struct Frustum
+{
+	Vector4 planes[6];
+};
+
+// Gribb/Hartmann plane extraction from a raylib view * projection matrix
+Frustum FrustumFromMatrix(Matrix viewProjection);
+
+// Frustum of the camera as BeginMode3D would set it up for the given aspect ratio
+Frustum FrustumFromCamera(Camera camera, float aspect);
+
+// Appends the id of every box in the batch that is at least partly inside the frustum.
+// When maxDistance > 0, boxes whose center is further than that from eye are dropped too.
+void CullBoxes(const BoxBatch& boxes, const Frustum& frustum, Vector3 eye, float maxDistance, std::vector<uint32_t>& visible);
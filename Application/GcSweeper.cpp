@@ -0,0 +1,75 @@
+#include "GcSweeper.h"
+
+GcSweeper::~GcSweeper()
+{
+	Detach();
+}
+
+bool GcSweeper::Attach(lua_State* L)
+{
+	luaL_PoolStats stats;
+	if (this->L != nullptr || luaL_poolstats(L, &stats))
+		return false;
+
+	this->L = L;
+	stopping = false;
+	thread = std::thread(&GcSweeper::Run, this);
+	lua_setsweeper(L, Take, this);
+	return true;
+}
+
+void GcSweeper::Detach()
+{
+	if (L == nullptr)
+		return;
+
+	// Hands over what is still queued in the state, everything after that is freed inline
+	lua_setsweeper(L, nullptr, nullptr);
+	L = nullptr;
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		drained.wait(guard, [this] { return pending == 0; });
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+}
+
+// Runs inside the collector, on the state's thread, so it only queues
+void GcSweeper::Take(void* ud, void* batch)
+{
+	GcSweeper* self = (GcSweeper*)ud;
+	{
+		std::lock_guard<std::mutex> guard(self->lock);
+		self->batches.push_back(batch);
+		self->pending++;
+	}
+	self->wake.notify_one();
+}
+
+void GcSweeper::Run()
+{
+	std::vector<void*> taken;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this] { return stopping || !batches.empty(); });
+			if (batches.empty())
+				return;
+			taken.swap(batches);
+		}
+
+		for (void* batch : taken)
+			lua_freebatch(batch);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			pending -= (int)taken.size();
+			batchesFreed += taken.size();
+		}
+		drained.notify_all();
+		taken.clear();
+	}
+}
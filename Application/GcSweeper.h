@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lua.hpp"
+
+// Frees the Lua collector's dead objects on a background thread (see lua_setsweeper). The
+// collector still finds them and unlinks them from its lists on the thread running the state,
+// the sweeper thread only gives their memory back, and it never runs a finalizer (objects with
+// __gc are finalized before they are swept). The state's allocator has to accept a free from
+// another thread while the state keeps allocating, which luaL_newstate's does and the pool of
+// luaL_newpoolstate doesn't, Attach refuses pool states.
+class GcSweeper
+{
+public:
+	~GcSweeper();
+
+	// Returns false if L has a pool allocator or another state is already attached
+	bool Attach(lua_State* L);
+
+	// Hands what the collector still holds over to the thread and waits until every batch is
+	// freed. Call before lua_close, handing over needs the state.
+	void Detach();
+
+	uint64_t BatchesFreed() const { return batchesFreed; }
+
+private:
+	static void Take(void* ud, void* batch);
+	void Run();
+
+	lua_State* L = nullptr;
+	std::thread thread;
+
+	std::mutex lock;
+	std::condition_variable wake;       // The thread sleeps on it while batches is empty
+	std::condition_variable drained;    // Detach sleeps on it until pending is zero
+	std::vector<void*> batches;
+	int pending = 0;                    // Batches taken and not freed yet
+	bool stopping = false;
+	uint64_t batchesFreed = 0;
+};
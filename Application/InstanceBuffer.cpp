@@ -0,0 +1,75 @@
+#include "InstanceBuffer.h"
+
+#include <cstring>
+
+void InstanceBuffer::Begin()
+{
+	cursor = 0;
+}
+
+void InstanceBuffer::Add(Vector3 position, Vector3 size, Color color)
+{
+	// Scale then translate, laid out like MatrixToFloatV so the shader reads it as a mat4
+	float transform[INSTANCE_TRANSFORM_FLOATS] = {
+		size.x, 0.0f, 0.0f, 0.0f,
+		0.0f, size.y, 0.0f, 0.0f,
+		0.0f, 0.0f, size.z, 0.0f,
+		position.x, position.y, position.z, 1.0f
+	};
+	unsigned char rgba[INSTANCE_COLOR_BYTES] = { color.r, color.g, color.b, color.a };
+
+	size_t index = cursor++;
+	if (index >= count)
+	{
+		transforms.resize((index + 1) * INSTANCE_TRANSFORM_FLOATS);
+		colors.resize((index + 1) * INSTANCE_COLOR_BYTES);
+		count = index + 1;
+		MarkDirty(index);
+	}
+	else if (memcmp(&transforms[index * INSTANCE_TRANSFORM_FLOATS], transform, sizeof(transform)) == 0 &&
+		memcmp(&colors[index * INSTANCE_COLOR_BYTES], rgba, sizeof(rgba)) == 0)
+	{
+		return;
+	}
+	else
+	{
+		MarkDirty(index);
+	}
+
+	memcpy(&transforms[index * INSTANCE_TRANSFORM_FLOATS], transform, sizeof(transform));
+	memcpy(&colors[index * INSTANCE_COLOR_BYTES], rgba, sizeof(rgba));
+}
+
+void InstanceBuffer::End()
+{
+	// Fewer instances than last frame only shrinks the draw count, nothing to upload
+	count = cursor;
+	transforms.resize(count * INSTANCE_TRANSFORM_FLOATS);
+	colors.resize(count * INSTANCE_COLOR_BYTES);
+
+	if (dirtyEnd > count)
+		dirtyEnd = count;
+	if (dirtyFirst >= dirtyEnd)
+		ClearDirty();
+}
+
+void InstanceBuffer::ClearDirty()
+{
+	dirtyFirst = 0;
+	dirtyEnd = 0;
+}
+
+void InstanceBuffer::MarkDirty(size_t index)
+{
+	if (!IsDirty())
+	{
+		dirtyFirst = index;
+		dirtyEnd = index + 1;
+		return;
+	}
+
+	if (index < dirtyFirst)
+		dirtyFirst = index;
+	if (index + 1 > dirtyEnd)
+		dirtyEnd = index + 1;
+}
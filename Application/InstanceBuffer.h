@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "raylib.h"
+
+#define INSTANCE_TRANSFORM_FLOATS 16
+#define INSTANCE_COLOR_BYTES 4
+
+// CPU side of the instanced renderer, kept free of GL calls so it can be filled and checked
+// without a context. Holds one column-major 4x4 transform and one RGBA8 color per instance in
+// the exact layout the GPU buffers use, and remembers which instances changed since the last
+// upload so the renderer only sends that range.
+class InstanceBuffer
+{
+public:
+	// Rebuild the buffer from scratch each frame with Begin/Add/End; instances written with
+	// the same values as last frame do not count as changed
+	void Begin();
+	void Add(Vector3 position, Vector3 size, Color color);
+	void End();
+
+	size_t Count() const { return count; }
+	const float* Transforms() const { return transforms.data(); }
+	const unsigned char* Colors() const { return colors.data(); }
+
+	// Range of instances [DirtyFirst, DirtyFirst + DirtyCount) that differs from the last upload
+	bool IsDirty() const { return dirtyFirst < dirtyEnd; }
+	size_t DirtyFirst() const { return dirtyFirst; }
+	size_t DirtyCount() const { return IsDirty() ? dirtyEnd - dirtyFirst : 0; }
+	void ClearDirty();
+
+private:
+	void MarkDirty(size_t index);
+
+	size_t count = 0;
+	size_t cursor = 0;
+	size_t dirtyFirst = 0;
+	size_t dirtyEnd = 0;
+	std::vector<float> transforms;
+	std::vector<unsigned char> colors;
+};
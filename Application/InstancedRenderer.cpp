@@ -0,0 +1,283 @@
+#include "InstancedRenderer.h"
+
+#include "raymath.h"
+#include "rlgl.h"
+
+// Each of the 12 cube edges is a quad of two triangles, widened in screen space by the shader
+#define CUBE_EDGE_COUNT 12
+#define CUBE_EDGE_VERTICES (CUBE_EDGE_COUNT * 6)
+#define CUBE_EDGE_VERTEX_FLOATS 7
+#define EDGE_LINE_WIDTH 1.5f
+
+static const char* instancedVertexShader = R"(
+#version 330
+in vec3 vertexPosition;
+in vec3 vertexNormal;
+in mat4 instanceTransform;
+in vec4 instanceColor;
+
+uniform mat4 mvp;
+uniform vec4 colorOverride;
+
+out vec4 fragColor;
+
+void main()
+{
+    // Simple directional shade so faces stay readable without a lighting pass
+    float shade = 0.75 + 0.25*dot(vertexNormal, normalize(vec3(0.3, 1.0, 0.5)));
+    vec4 color = mix(instanceColor, colorOverride, colorOverride.a);
+    fragColor = vec4(color.rgb*mix(shade, 1.0, colorOverride.a), color.a);
+    gl_Position = mvp*instanceTransform*vec4(vertexPosition, 1.0);
+}
+)";
+
+static const char* instancedFragmentShader = R"(
+#version 330
+in vec4 fragColor;
+out vec4 finalColor;
+
+void main()
+{
+    finalColor = fragColor;
+}
+)";
+
+// rlgl only draws triangles, and wire mode over the triangulated cube would also show the face
+// diagonals. So every edge is stored as a quad whose vertices carry both endpoints, and the
+// shader pushes them apart perpendicular to the edge as it appears on screen.
+static const char* edgeVertexShader = R"(
+#version 330
+in vec3 vertexPosition;
+in vec3 edgeOther;
+in float edgeSide;
+in mat4 instanceTransform;
+
+uniform mat4 mvp;
+uniform vec2 viewportSize;
+uniform float lineWidth;
+
+void main()
+{
+    vec4 point = mvp*instanceTransform*vec4(vertexPosition, 1.0);
+    vec4 other = mvp*instanceTransform*vec4(edgeOther, 1.0);
+
+    // Direction of the edge in pixels, then half the line width to either side of it
+    vec2 direction = (other.xy/other.w - point.xy/point.w)*viewportSize;
+    vec2 normal = normalize(vec2(-direction.y, direction.x) + vec2(1e-6, 0.0));
+    point.xy += normal*edgeSide*lineWidth/viewportSize*point.w;
+
+    // Pull the lines slightly forward so they win the depth test against their own faces
+    point.z -= 0.0005*point.w;
+    gl_Position = point;
+}
+)";
+
+static const char* edgeFragmentShader = R"(
+#version 330
+out vec4 finalColor;
+
+uniform vec4 lineColor;
+
+void main()
+{
+    finalColor = lineColor;
+}
+)";
+
+// Vertex layout: this endpoint, the other endpoint, side of the edge to move to. Both
+// endpoints of a quad use the same physical side, so the far one stores it negated.
+static void BuildCubeEdges(float* vertices)
+{
+	int v = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int corner = 0; corner < 4; corner++)
+		{
+			float a[3], b[3];
+			a[axis] = -0.5f;
+			b[axis] = 0.5f;
+			a[(axis + 1) % 3] = b[(axis + 1) % 3] = (corner & 1) ? 0.5f : -0.5f;
+			a[(axis + 2) % 3] = b[(axis + 2) % 3] = (corner & 2) ? 0.5f : -0.5f;
+
+			const float* points[6] = { a, a, b, b, a, b };
+			const float* others[6] = { b, b, a, a, b, a };
+			const float sides[6] = { 1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 1.0f };
+			for (int i = 0; i < 6; i++, v++)
+			{
+				float* out = vertices + v * CUBE_EDGE_VERTEX_FLOATS;
+				out[0] = points[i][0]; out[1] = points[i][1]; out[2] = points[i][2];
+				out[3] = others[i][0]; out[4] = others[i][1]; out[5] = others[i][2];
+				out[6] = sides[i];
+			}
+		}
+	}
+}
+
+void InstancedRenderer::Load()
+{
+	cube = GenMeshCube(1.0f, 1.0f, 1.0f);
+	shader = LoadShaderFromMemory(instancedVertexShader, instancedFragmentShader);
+	mvpLoc = GetShaderLocation(shader, "mvp");
+	colorOverrideLoc = GetShaderLocation(shader, "colorOverride");
+	transformAttrib = GetShaderLocationAttrib(shader, "instanceTransform");
+	colorAttrib = GetShaderLocationAttrib(shader, "instanceColor");
+
+	edgeShader = LoadShaderFromMemory(edgeVertexShader, edgeFragmentShader);
+	edgeMvpLoc = GetShaderLocation(edgeShader, "mvp");
+	edgeColorLoc = GetShaderLocation(edgeShader, "lineColor");
+	edgeViewportLoc = GetShaderLocation(edgeShader, "viewportSize");
+	edgeWidthLoc = GetShaderLocation(edgeShader, "lineWidth");
+	edgeTransformAttrib = GetShaderLocationAttrib(edgeShader, "instanceTransform");
+
+	float vertices[CUBE_EDGE_VERTICES * CUBE_EDGE_VERTEX_FLOATS];
+	BuildCubeEdges(vertices);
+
+	int stride = CUBE_EDGE_VERTEX_FLOATS * sizeof(float);
+	int pointAttrib = GetShaderLocationAttrib(edgeShader, "vertexPosition");
+	int otherAttrib = GetShaderLocationAttrib(edgeShader, "edgeOther");
+	int sideAttrib = GetShaderLocationAttrib(edgeShader, "edgeSide");
+
+	edgeVao = rlLoadVertexArray();
+	rlEnableVertexArray(edgeVao);
+	edgeVbo = rlLoadVertexBuffer(vertices, (int)sizeof(vertices), false);
+	rlEnableVertexAttribute(pointAttrib);
+	rlSetVertexAttribute(pointAttrib, 3, RL_FLOAT, false, stride, 0);
+	rlEnableVertexAttribute(otherAttrib);
+	rlSetVertexAttribute(otherAttrib, 3, RL_FLOAT, false, stride, 3 * sizeof(float));
+	rlEnableVertexAttribute(sideAttrib);
+	rlSetVertexAttribute(sideAttrib, 1, RL_FLOAT, false, stride, 6 * sizeof(float));
+	rlDisableVertexBuffer();
+	rlDisableVertexArray();
+}
+
+void InstancedRenderer::Unload()
+{
+	if (transformVbo != 0)
+		rlUnloadVertexBuffer(transformVbo);
+	if (colorVbo != 0)
+		rlUnloadVertexBuffer(colorVbo);
+	transformVbo = 0;
+	colorVbo = 0;
+	capacity = 0;
+
+	rlUnloadVertexArray(edgeVao);
+	rlUnloadVertexBuffer(edgeVbo);
+	edgeVao = 0;
+	edgeVbo = 0;
+	UnloadShader(edgeShader);
+
+	UnloadShader(shader);
+	UnloadMesh(cube);
+}
+
+// (Re)creates both instance buffers and wires them into the cube's vertex array as
+// per-instance attributes, the same setup DrawMeshInstanced does on every call. The
+// transforms are wired into the edge vertex array as well.
+void InstancedRenderer::CreateInstanceBuffers(const InstanceBuffer& instances, size_t newCapacity)
+{
+	if (transformVbo != 0)
+		rlUnloadVertexBuffer(transformVbo);
+	if (colorVbo != 0)
+		rlUnloadVertexBuffer(colorVbo);
+
+	capacity = newCapacity;
+
+	// Allocate the full capacity, then fill what exists now
+	rlEnableVertexArray(cube.vaoId);
+
+	transformVbo = rlLoadVertexBuffer(nullptr, (int)(capacity * INSTANCE_TRANSFORM_FLOATS * sizeof(float)), true);
+	rlUpdateVertexBuffer(transformVbo, instances.Transforms(), (int)(instances.Count() * INSTANCE_TRANSFORM_FLOATS * sizeof(float)), 0);
+	for (int column = 0; column < 4; column++)
+	{
+		rlEnableVertexAttribute(transformAttrib + column);
+		rlSetVertexAttribute(transformAttrib + column, 4, RL_FLOAT, false, INSTANCE_TRANSFORM_FLOATS * sizeof(float), column * 4 * sizeof(float));
+		rlSetVertexAttributeDivisor(transformAttrib + column, 1);
+	}
+
+	colorVbo = rlLoadVertexBuffer(nullptr, (int)(capacity * INSTANCE_COLOR_BYTES), true);
+	rlUpdateVertexBuffer(colorVbo, instances.Colors(), (int)(instances.Count() * INSTANCE_COLOR_BYTES), 0);
+	rlEnableVertexAttribute(colorAttrib);
+	rlSetVertexAttribute(colorAttrib, 4, RL_UNSIGNED_BYTE, true, INSTANCE_COLOR_BYTES, 0);
+	rlSetVertexAttributeDivisor(colorAttrib, 1);
+
+	rlEnableVertexArray(edgeVao);
+	rlEnableVertexBuffer(transformVbo);
+	for (int column = 0; column < 4; column++)
+	{
+		rlEnableVertexAttribute(edgeTransformAttrib + column);
+		rlSetVertexAttribute(edgeTransformAttrib + column, 4, RL_FLOAT, false, INSTANCE_TRANSFORM_FLOATS * sizeof(float), column * 4 * sizeof(float));
+		rlSetVertexAttributeDivisor(edgeTransformAttrib + column, 1);
+	}
+
+	rlDisableVertexBuffer();
+	rlDisableVertexArray();
+}
+
+void InstancedRenderer::Upload(InstanceBuffer& instances)
+{
+	if (instances.Count() > capacity)
+	{
+		// Grow geometrically so a slowly growing world does not reallocate every frame
+		size_t newCapacity = capacity == 0 ? 64 : capacity;
+		while (newCapacity < instances.Count())
+			newCapacity *= 2;
+
+		CreateInstanceBuffers(instances, newCapacity);
+		instances.ClearDirty();
+		return;
+	}
+
+	if (!instances.IsDirty())
+		return;
+
+	size_t first = instances.DirtyFirst();
+	size_t count = instances.DirtyCount();
+
+	rlUpdateVertexBuffer(transformVbo, instances.Transforms() + first * INSTANCE_TRANSFORM_FLOATS,
+		(int)(count * INSTANCE_TRANSFORM_FLOATS * sizeof(float)), (int)(first * INSTANCE_TRANSFORM_FLOATS * sizeof(float)));
+	rlUpdateVertexBuffer(colorVbo, instances.Colors() + first * INSTANCE_COLOR_BYTES,
+		(int)(count * INSTANCE_COLOR_BYTES), (int)(first * INSTANCE_COLOR_BYTES));
+
+	instances.ClearDirty();
+}
+
+void InstancedRenderer::DrawPass(int instanceCount, Vector4 colorOverride)
+{
+	rlSetUniform(colorOverrideLoc, &colorOverride, RL_SHADER_UNIFORM_VEC4, 1);
+	if (cube.indices != nullptr)
+		rlDrawVertexArrayElementsInstanced(0, cube.triangleCount * 3, 0, instanceCount);
+	else
+		rlDrawVertexArrayInstanced(0, cube.vertexCount, instanceCount);
+}
+
+void InstancedRenderer::Draw(const InstanceBuffer& instances, Color wireColor)
+{
+	if (instances.Count() == 0 || capacity == 0)
+		return;
+
+	// Anything queued in the immediate mode batch must reach the GPU before our own draw
+	rlDrawRenderBatchActive();
+
+	Matrix modelView = MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview());
+	Matrix mvp = MatrixMultiply(modelView, rlGetMatrixProjection());
+
+	rlEnableShader(shader.id);
+	rlSetUniformMatrix(mvpLoc, mvp);
+	rlEnableVertexArray(cube.vaoId);
+	DrawPass((int)instances.Count(), Vector4{ 0.0f, 0.0f, 0.0f, 0.0f });
+
+	Vector4 lineColor = ColorNormalize(wireColor);
+	Vector2 viewport = { (float)rlGetFramebufferWidth(), (float)rlGetFramebufferHeight() };
+	float lineWidth = EDGE_LINE_WIDTH;
+
+	rlEnableShader(edgeShader.id);
+	rlSetUniformMatrix(edgeMvpLoc, mvp);
+	rlSetUniform(edgeColorLoc, &lineColor, RL_SHADER_UNIFORM_VEC4, 1);
+	rlSetUniform(edgeViewportLoc, &viewport, RL_SHADER_UNIFORM_VEC2, 1);
+	rlSetUniform(edgeWidthLoc, &lineWidth, RL_SHADER_UNIFORM_FLOAT, 1);
+	rlEnableVertexArray(edgeVao);
+	rlDrawVertexArrayInstanced(0, CUBE_EDGE_VERTICES, (int)instances.Count());
+
+	rlDisableVertexArray();
+	rlDisableShader();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "raylib.h"
+
+#include "InstanceBuffer.h"
+
+// Draws every instance of a unit cube in one instanced draw call. Works like DrawMeshInstanced,
+// but keeps the per-instance transform and color buffers alive on the GPU between frames and
+// only re-uploads the range the InstanceBuffer marked as changed. Needs a GL context, so
+// create it after InitWindow and call Unload before CloseWindow.
+class InstancedRenderer
+{
+public:
+	void Load();
+	void Unload();
+
+	// Sends the changed instances to the GPU and clears the buffer's dirty range
+	void Upload(InstanceBuffer& instances);
+
+	// Must be called inside BeginMode3D, draws filled cubes and then their 12 edges in wireColor
+	void Draw(const InstanceBuffer& instances, Color wireColor);
+
+private:
+	void CreateInstanceBuffers(const InstanceBuffer& instances, size_t capacity);
+	void DrawPass(int instanceCount, Vector4 colorOverride);
+
+	Mesh cube = { 0 };
+	Shader shader = { 0 };
+	int mvpLoc = -1;
+	int colorOverrideLoc = -1;
+	int transformAttrib = -1;
+	int colorAttrib = -1;
+
+	// Instanced line mesh of the cube's edges, sharing the transform buffer with the cube
+	Shader edgeShader = { 0 };
+	int edgeMvpLoc = -1;
+	int edgeColorLoc = -1;
+	int edgeViewportLoc = -1;
+	int edgeWidthLoc = -1;
+	int edgeTransformAttrib = -1;
+	unsigned int edgeVao = 0;
+	unsigned int edgeVbo = 0;
+
+	unsigned int transformVbo = 0;
+	unsigned int colorVbo = 0;
+	size_t capacity = 0;
+};
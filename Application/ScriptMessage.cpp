@@ -0,0 +1,171 @@
+#include "ScriptMessage.h"
+
+#include <cstdint>
+#include <cstring>
+
+// One tag byte per value, followed by its payload in native byte order (both ends are always
+// the same process). Tables are a pair count and then alternating keys and values.
+enum MessageTag
+{
+	MESSAGE_NIL,
+	MESSAGE_FALSE,
+	MESSAGE_TRUE,
+	MESSAGE_INTEGER,
+	MESSAGE_FLOAT,
+	MESSAGE_STRING,
+	MESSAGE_VECTOR,
+	MESSAGE_TABLE
+};
+
+template <typename T>
+static void Append(std::string& bytes, const T& value)
+{
+	bytes.append((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+static T Read(const char*& cursor)
+{
+	T value;
+	memcpy(&value, cursor, sizeof(value));
+	cursor += sizeof(value);
+	return value;
+}
+
+static bool EncodeScalar(lua_State* L, int index, std::string& bytes, std::string& error)
+{
+	switch (lua_type(L, index))
+	{
+	case LUA_TNIL:
+		bytes.push_back(MESSAGE_NIL);
+		return true;
+	case LUA_TBOOLEAN:
+		bytes.push_back(lua_toboolean(L, index) ? MESSAGE_TRUE : MESSAGE_FALSE);
+		return true;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, index))
+		{
+			bytes.push_back(MESSAGE_INTEGER);
+			Append(bytes, lua_tointeger(L, index));
+		}
+		else
+		{
+			bytes.push_back(MESSAGE_FLOAT);
+			Append(bytes, lua_tonumber(L, index));
+		}
+		return true;
+	case LUA_TSTRING:
+	{
+		size_t length;
+		const char* s = lua_tolstring(L, index, &length);
+		bytes.push_back(MESSAGE_STRING);
+		Append(bytes, (uint32_t)length);
+		bytes.append(s, length);
+		return true;
+	}
+	case LUA_TVECTOR:
+	{
+		float v[3];
+		lua_tovector(L, index, v);
+		bytes.push_back(MESSAGE_VECTOR);
+		bytes.append((const char*)v, sizeof(v));
+		return true;
+	}
+	default:
+		error = std::string("can't send a ") + luaL_typename(L, index) + " value";
+		return false;
+	}
+}
+
+bool EncodeMessage(lua_State* L, int index, ScriptMessage& message, std::string& error)
+{
+	message.bytes.clear();
+	if (lua_type(L, index) != LUA_TTABLE)
+		return EncodeScalar(L, index, message.bytes, error);
+
+	index = lua_absindex(L, index);
+	if (!lua_checkstack(L, 3))
+	{
+		error = "stack overflow";
+		return false;
+	}
+
+	// The pair count is patched in once the traversal knows it
+	message.bytes.push_back(MESSAGE_TABLE);
+	size_t countAt = message.bytes.size();
+	Append(message.bytes, (uint32_t)0);
+
+	uint32_t count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0)
+	{
+		if (lua_type(L, -2) == LUA_TTABLE || lua_type(L, -1) == LUA_TTABLE)
+		{
+			error = "can't send nested tables";
+			lua_pop(L, 2);
+			return false;
+		}
+		if (!EncodeScalar(L, -2, message.bytes, error) || !EncodeScalar(L, -1, message.bytes, error))
+		{
+			lua_pop(L, 2);
+			return false;
+		}
+		count++;
+		lua_pop(L, 1);
+	}
+	memcpy(&message.bytes[countAt], &count, sizeof(count));
+	return true;
+}
+
+static void PushScalar(lua_State* L, const char*& cursor)
+{
+	switch (*cursor++)
+	{
+	case MESSAGE_FALSE: lua_pushboolean(L, 0); break;
+	case MESSAGE_TRUE: lua_pushboolean(L, 1); break;
+	case MESSAGE_INTEGER: lua_pushinteger(L, Read<lua_Integer>(cursor)); break;
+	case MESSAGE_FLOAT: lua_pushnumber(L, Read<lua_Number>(cursor)); break;
+	case MESSAGE_STRING:
+	{
+		uint32_t length = Read<uint32_t>(cursor);
+		lua_pushlstring(L, cursor, length);
+		cursor += length;
+		break;
+	}
+	case MESSAGE_VECTOR:
+	{
+		float x = Read<float>(cursor);
+		float y = Read<float>(cursor);
+		float z = Read<float>(cursor);
+		lua_pushvector(L, x, y, z);
+		break;
+	}
+	default: lua_pushnil(L); break;
+	}
+}
+
+void PushMessage(lua_State* L, const ScriptMessage& message)
+{
+	const char* cursor = message.bytes.data();
+	if (message.bytes.empty())
+	{
+		lua_pushnil(L);
+		return;
+	}
+	if (*cursor != MESSAGE_TABLE)
+	{
+		PushScalar(L, cursor);
+		return;
+	}
+
+	cursor++;
+	uint32_t count = Read<uint32_t>(cursor);
+	luaL_checkstack(L, 3, "message table");
+	lua_createtable(L, 0, (int)count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PushScalar(L, cursor);
+		PushScalar(L, cursor);
+		lua_rawset(L, -3);
+	}
+}
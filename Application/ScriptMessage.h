@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "lua.hpp"
+
+// One Lua value copied out of a lua_State as bytes, so it can cross to another state on any
+// thread without the two ever sharing memory. Only plain data is allowed: nil, booleans,
+// numbers, strings, vectors and flat tables whose keys and values are all of those. Anything
+// that would need identity to survive the trip (functions, userdata, threads, nested tables)
+// is rejected instead of silently dropped.
+struct ScriptMessage
+{
+	std::string bytes;
+};
+
+// Serializes the value at index into message. Returns false and describes the problem in
+// error when the value is not plain data; never raises a Lua error, so C++ callers don't have
+// to worry about a longjmp skipping their destructors.
+bool EncodeMessage(lua_State* L, int index, ScriptMessage& message, std::string& error);
+
+// Pushes a copy of the encoded value onto L
+void PushMessage(lua_State* L, const ScriptMessage& message);
@@ -0,0 +1,300 @@
+#include "ScriptRuntime.h"
+
+#include <functional>
+#include <iostream>
+
+#include "ScriptSystem.h"
+
+// Workers report failing jobs concurrently, one at a time keeps the lines whole
+static std::mutex outputLock;
+
+ScriptRuntime::ScriptRuntime(int workerCount)
+{
+	if (workerCount <= 0)
+		workerCount = (int)std::thread::hardware_concurrency();
+	if (workerCount <= 0)
+		workerCount = 1;
+
+	for (int i = 0; i < workerCount; i++)
+	{
+		Worker* worker = new Worker();
+		worker->runtime = this;
+		worker->index = i;
+		worker->random = 2463534242u + (uint32_t)i * 0x9E3779B9u;
+		// Own allocator pool per state, no locks between workers
+		worker->L = luaL_newpoolstate();
+		luaL_openlibs(worker->L);
+
+		lua_State* L = worker->L;
+		lua_newtable(L);
+		lua_pushlightuserdata(L, worker);
+		lua_pushcclosure(L, Spawn, 1);
+		lua_setfield(L, -2, "spawn");
+		lua_pushlightuserdata(L, worker);
+		lua_pushcclosure(L, Post, 1);
+		lua_setfield(L, -2, "post");
+		lua_pushinteger(L, i + 1);
+		lua_setfield(L, -2, "worker");
+		lua_pushinteger(L, workerCount);
+		lua_setfield(L, -2, "count");
+		lua_setglobal(L, "jobs");
+
+		workers.push_back(worker);
+	}
+
+	// Only once every worker exists, thieves index the whole vector
+	for (Worker* worker : workers)
+		worker->thread = std::thread(&ScriptRuntime::Run, this, std::ref(*worker));
+}
+
+ScriptRuntime::~ScriptRuntime()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (Worker* worker : workers)
+		worker->thread.join();
+
+	// Jobs nobody got to before the stop
+	Job* job;
+	for (Worker* worker : workers)
+	{
+		while (worker->queue.TryPop(job))
+			delete job;
+		lua_close(worker->L);
+		delete worker;
+	}
+	for (Job* leftover : injected)
+		delete leftover;
+}
+
+bool ScriptRuntime::RunFile(const char* path)
+{
+	bool ok = true;
+	for (Worker* worker : workers)
+	{
+		if (luaL_dofile(worker->L, path) != LUA_OK)
+		{
+			DumpError(worker->L);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+bool ScriptRuntime::RunString(const char* code)
+{
+	bool ok = true;
+	for (Worker* worker : workers)
+	{
+		if (luaL_dostring(worker->L, code) != LUA_OK)
+		{
+			DumpError(worker->L);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+void ScriptRuntime::Submit(const char* function, ScriptMessage message)
+{
+	Job* job = new Job();
+	job->function = function;
+	job->message = std::move(message);
+	Enqueue(NULL, job);
+}
+
+void ScriptRuntime::Wait()
+{
+	std::unique_lock<std::mutex> lock(idleLock);
+	idle.wait(lock, [this] { return unfinished.load() == 0; });
+}
+
+bool ScriptRuntime::PollResult(ScriptMessage& message)
+{
+	std::lock_guard<std::mutex> lock(resultsLock);
+	if (results.empty())
+		return false;
+	message = std::move(results.back());
+	results.pop_back();
+	return true;
+}
+
+// From a worker the job goes on its own deque, from the host (or when that deque is full)
+// into the shared list every idle worker looks at
+void ScriptRuntime::Enqueue(Worker* worker, Job* job)
+{
+	unfinished.fetch_add(1);
+	if (worker == NULL || !worker->queue.TryPush(job))
+	{
+		std::lock_guard<std::mutex> lock(injectedLock);
+		injected.push_back(job);
+	}
+	queued.fetch_add(1);
+
+	// Taking the lock orders this against a worker that checked queued and is about to sleep
+	if (sleepers.load() > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepLock);
+		}
+		wake.notify_one();
+	}
+}
+
+bool ScriptRuntime::FindJob(Worker& worker, Job*& job)
+{
+	if (!worker.queue.TryPop(job))
+	{
+		bool found = false;
+		{
+			std::lock_guard<std::mutex> lock(injectedLock);
+			if (!injected.empty())
+			{
+				job = injected.back();
+				injected.pop_back();
+				found = true;
+			}
+		}
+
+		// Start at a random victim so thieves don't all line up behind worker 0
+		if (!found)
+		{
+			worker.random ^= worker.random << 13;
+			worker.random ^= worker.random >> 17;
+			worker.random ^= worker.random << 5;
+			size_t count = workers.size();
+			size_t start = worker.random % count;
+			for (size_t k = 0; k < count && !found; k++)
+			{
+				Worker* victim = workers[(start + k) % count];
+				if (victim != &worker && victim->queue.TrySteal(job))
+				{
+					jobsStolen.fetch_add(1, std::memory_order_relaxed);
+					found = true;
+				}
+			}
+		}
+		if (!found)
+			return false;
+	}
+	queued.fetch_sub(1);
+	return true;
+}
+
+void ScriptRuntime::Run(Worker& worker)
+{
+	for (;;)
+	{
+		Job* job;
+		if (FindJob(worker, job))
+		{
+			Execute(worker, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepLock);
+		sleepers.fetch_add(1);
+		wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+		sleepers.fetch_sub(1);
+		if (stopping)
+			return;
+	}
+}
+
+// Builds the argument from the message (light userdata 2) and calls the job function (1). Runs
+// under the pcall, so running out of memory while decoding fails the job, not the worker.
+static int CallJob(lua_State* L)
+{
+	const ScriptMessage* message = (const ScriptMessage*)lua_touserdata(L, 2);
+	lua_settop(L, 1);
+	PushMessage(L, *message);
+	lua_call(L, 1, 0);
+	return 0;
+}
+
+void ScriptRuntime::Execute(Worker& worker, Job* job)
+{
+	lua_State* L = worker.L;
+	lua_getglobal(L, job->function.c_str());
+	if (lua_type(L, -1) != LUA_TFUNCTION)
+	{
+		lua_pop(L, 1);
+		std::lock_guard<std::mutex> lock(outputLock);
+		std::cout << "Script job '" << job->function << "' is not a function" << std::endl;
+	}
+	else
+	{
+		lua_pushcfunction(L, CallJob);
+		lua_insert(L, -2);
+		lua_pushlightuserdata(L, &job->message);
+		if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+		{
+			std::lock_guard<std::mutex> lock(outputLock);
+			std::cout << "Script job '" << job->function << "' failed on worker " << worker.index + 1 << std::endl;
+			DumpError(L);
+		}
+	}
+	delete job;
+	jobsRun.fetch_add(1, std::memory_order_relaxed);
+
+	if (unfinished.fetch_sub(1) == 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(idleLock);
+		}
+		idle.notify_all();
+	}
+}
+
+// Lua errors longjmp past C++ destructors, so the C++ objects live in a block that ends
+// before lua_error is called with the message left on the stack
+
+// jobs.spawn(name, value)
+int ScriptRuntime::Spawn(lua_State* L)
+{
+	Worker* worker = (Worker*)lua_touserdata(L, lua_upvalueindex(1));
+	size_t length;
+	const char* function = luaL_checklstring(L, 1, &length);
+
+	bool ok;
+	{
+		Job* job = new Job();
+		job->function.assign(function, length);
+		std::string error;
+		ok = EncodeMessage(L, 2, job->message, error);
+		if (ok)
+			worker->runtime->Enqueue(worker, job);
+		else
+		{
+			delete job;
+			lua_pushfstring(L, "jobs.spawn: %s", error.c_str());
+		}
+	}
+	return ok ? 0 : lua_error(L);
+}
+
+// jobs.post(value)
+int ScriptRuntime::Post(lua_State* L)
+{
+	Worker* worker = (Worker*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptRuntime* self = worker->runtime;
+
+	bool ok;
+	{
+		ScriptMessage message;
+		std::string error;
+		ok = EncodeMessage(L, 1, message, error);
+		if (ok)
+		{
+			std::lock_guard<std::mutex> lock(self->resultsLock);
+			self->results.push_back(std::move(message));
+		}
+		else
+			lua_pushfstring(L, "jobs.post: %s", error.c_str());
+	}
+	return ok ? 0 : lua_error(L);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "ScriptMessage.h"
+#include "WorkStealingQueue.h"
+
+#define SCRIPT_WORKER_QUEUE_SIZE 1024
+
+// Runs Lua jobs in parallel on N independent lua_States, one per worker thread. A single
+// lua_State can never run on two cores (lua_lock is a no-op), so instead every worker owns a
+// whole state and nothing Lua is ever shared: a job names a global function and carries one
+// ScriptMessage, which is decoded into the worker's own state. Scripts see
+//
+//     jobs.spawn(name, value)   queue another job, on this worker unless someone steals it
+//     jobs.post(value)          send a result back to the host, read with PollResult
+//     jobs.worker, jobs.count   this worker's 1-based index and the number of workers
+//
+// Each worker pushes and pops its own jobs in LIFO order and, when out of work, takes the next
+// job the host submitted or steals the oldest one from another worker, so the jobs one job
+// spawns can be picked up by idle workers without a central queue.
+class ScriptRuntime
+{
+public:
+	// Zero workers means one per hardware thread
+	explicit ScriptRuntime(int workerCount = 0);
+	~ScriptRuntime();
+
+	int WorkerCount() const { return (int)workers.size(); }
+
+	// Runs the same chunk on every worker's state so all of them define the same job
+	// functions. Only call while no jobs are running, returns false if any worker failed.
+	bool RunFile(const char* path);
+	bool RunString(const char* code);
+
+	// Queues a call of the global function named function with the message as its argument
+	void Submit(const char* function, ScriptMessage message);
+
+	// Blocks until every job, including the ones jobs spawned, has finished
+	void Wait();
+
+	// Takes one message posted by a job, in no particular order
+	bool PollResult(ScriptMessage& message);
+
+	uint64_t JobsRun() const { return jobsRun.load(std::memory_order_relaxed); }
+	uint64_t JobsStolen() const { return jobsStolen.load(std::memory_order_relaxed); }
+
+private:
+	struct Job
+	{
+		std::string function;
+		ScriptMessage message;
+	};
+
+	struct Worker
+	{
+		ScriptRuntime* runtime;
+		int index;
+		lua_State* L;
+		uint32_t random;    // xorshift state for picking steal victims
+		WorkStealingQueue<Job*, SCRIPT_WORKER_QUEUE_SIZE> queue;
+		std::thread thread;
+	};
+
+	static int Spawn(lua_State* L);
+	static int Post(lua_State* L);
+
+	void Run(Worker& worker);
+	bool FindJob(Worker& worker, Job*& job);
+	void Execute(Worker& worker, Job* job);
+	void Enqueue(Worker* worker, Job* job);
+
+	std::vector<Worker*> workers;
+
+	// Jobs from the host, and from workers whose own queue is full
+	std::mutex injectedLock;
+	std::vector<Job*> injected;
+
+	// Workers sleep on wake while nothing is queued anywhere
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<int> queued{ 0 };
+	std::atomic<int> sleepers{ 0 };
+	bool stopping = false;
+
+	// Jobs submitted or spawned but not finished yet, Wait sleeps on idle until it is zero
+	std::mutex idleLock;
+	std::condition_variable idle;
+	std::atomic<int> unfinished{ 0 };
+
+	std::mutex resultsLock;
+	std::vector<ScriptMessage> results;
+
+	std::atomic<uint64_t> jobsRun{ 0 };
+	std::atomic<uint64_t> jobsStolen{ 0 };
+};
@@ -0,0 +1,544 @@
+#include "ScriptSystem.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include "Components.h"
+#include "TypedArray.h"
+
+#define COMPONENT_ARRAY_METATABLE "ComponentArray"
+
+// Typed views a component array hands out by field name, positions.y is the y of every
+// Position in place. The last field of every component is the entity index.
+#define COMPONENT_MAX_FIELDS 5
+
+struct ComponentField
+{
+	const char* name;
+	TypedArrayType type;
+	size_t offset;
+};
+
+struct ComponentLayout
+{
+	int stride;
+	int fieldCount;
+	ComponentField fields[COMPONENT_MAX_FIELDS - 1];
+};
+
+static const ComponentLayout componentLayouts[COMPONENT_KIND_COUNT] = {
+	{ sizeof(Position), 3, { { "x", TYPED_ARRAY_FLOAT32, offsetof(Position, value.x) }, { "y", TYPED_ARRAY_FLOAT32, offsetof(Position, value.y) }, { "z", TYPED_ARRAY_FLOAT32, offsetof(Position, value.z) } } },
+	{ sizeof(Velocity), 3, { { "x", TYPED_ARRAY_FLOAT32, offsetof(Velocity, value.x) }, { "y", TYPED_ARRAY_FLOAT32, offsetof(Velocity, value.y) }, { "z", TYPED_ARRAY_FLOAT32, offsetof(Velocity, value.z) } } },
+	{ sizeof(BoxShape), 3, { { "x", TYPED_ARRAY_FLOAT32, offsetof(BoxShape, size.x) }, { "y", TYPED_ARRAY_FLOAT32, offsetof(BoxShape, size.y) }, { "z", TYPED_ARRAY_FLOAT32, offsetof(BoxShape, size.z) } } },
+	{ sizeof(Tint), 4, { { "r", TYPED_ARRAY_UINT8, offsetof(Tint, color.r) }, { "g", TYPED_ARRAY_UINT8, offsetof(Tint, color.g) }, { "b", TYPED_ARRAY_UINT8, offsetof(Tint, color.b) }, { "a", TYPED_ARRAY_UINT8, offsetof(Tint, color.a) } } }
+};
+
+// What EachEntity needs to run one per-entity system over its group
+struct EachCall
+{
+	const char* name;
+	const ComponentKind* components;
+	int componentCount;
+	void* data[COMPONENT_KIND_COUNT];
+	const uint32_t* entities;
+	int count;
+	float dt;
+};
+
+// Userdata handed to a system, a window onto one pool's dense component array. The same
+// userdata and its field views are reused every frame, only the pointers and count are
+// refreshed before the call and cleared again after it, so a script that keeps one past
+// its call gets an error instead of reading storage that may have moved. The views are
+// also kept as user values so Lua owns them.
+struct ComponentArray
+{
+	void* data;
+	int count;
+	ComponentKind kind;
+	TypedArray* fields[COMPONENT_MAX_FIELDS];
+};
+
+void DumpError(lua_State* L)
+{
+	// Hämta toppen av lua stacken och kolla om det är en sträng
+	if (lua_gettop(L) > 0 && lua_isstring(L, -1))
+	{
+		std::cout << "Lua error: " << lua_tostring(L, -1) << std::endl;
+
+		// Ta bort meddelandet från stacken
+		lua_pop(L, 1);
+	}
+}
+
+static const char* componentNames[COMPONENT_KIND_COUNT] = { "Position", "Velocity", "BoxShape", "Tint" };
+
+// data is only set while the system that received the array runs
+static void CheckAttached(lua_State* L, ComponentArray* array)
+{
+	if (array->data == NULL)
+		luaL_error(L, "%s array used outside the system call that received it", componentNames[array->kind]);
+}
+
+// The methods carry the metatable as an upvalue, comparing against it is much cheaper than
+// luaL_checkudata looking the metatable up by name in the registry on every call
+static ComponentArray* CheckArray(lua_State* L)
+{
+	void* array = lua_touserdata(L, 1);
+	if (array == NULL || !lua_getmetatable(L, 1) || !lua_rawequal(L, -1, lua_upvalueindex(1)))
+		luaL_typeerror(L, 1, COMPONENT_ARRAY_METATABLE);
+	lua_pop(L, 1);
+	CheckAttached(L, (ComponentArray*)array);
+	return (ComponentArray*)array;
+}
+
+// Lua indices are 1-based, the dense arrays are not. Typed methods already know argument 2 is
+// an integer (or converts to one), the others check it here.
+static int ToIndex(lua_State* L, ComponentArray* array)
+{
+	CheckAttached(L, array);
+	lua_Integer index = lua_tointeger(L, 2);
+	luaL_argcheck(L, index >= 1 && index <= array->count, 2, "index out of range");
+	return (int)(index - 1);
+}
+
+static int CheckIndex(lua_State* L, ComponentArray* array)
+{
+	luaL_checkinteger(L, 2);
+	return ToIndex(L, array);
+}
+
+static Vector3& VectorAt(ComponentArray* array, int i)
+{
+	switch (array->kind)
+	{
+	case COMPONENT_POSITION: return ((Position*)array->data)[i].value;
+	case COMPONENT_VELOCITY: return ((Velocity*)array->data)[i].value;
+	default: return ((BoxShape*)array->data)[i].size;
+	}
+}
+
+// array:get(i) -> x, y, z (r, g, b, a for Tint), as multiple returns so no table is built
+static int ArrayGet(lua_State* L)
+{
+	ComponentArray* array = (ComponentArray*)lua_touserdata(L, 1);
+	int i = ToIndex(L, array);
+
+	if (array->kind == COMPONENT_TINT)
+	{
+		Color color = ((Tint*)array->data)[i].color;
+		lua_pushinteger(L, color.r);
+		lua_pushinteger(L, color.g);
+		lua_pushinteger(L, color.b);
+		lua_pushinteger(L, color.a);
+		return 4;
+	}
+
+	Vector3 v = VectorAt(array, i);
+	lua_pushnumber(L, v.x);
+	lua_pushnumber(L, v.y);
+	lua_pushnumber(L, v.z);
+	return 3;
+}
+
+// array:getv(i) -> vec, an unboxed value so nothing is allocated either
+static int ArrayGetVector(lua_State* L)
+{
+	ComponentArray* array = (ComponentArray*)lua_touserdata(L, 1);
+	int i = ToIndex(L, array);
+	luaL_argcheck(L, array->kind != COMPONENT_TINT, 1, "Tint has no vector");
+
+	Vector3 v = VectorAt(array, i);
+	lua_pushvector(L, v.x, v.y, v.z);
+	return 1;
+}
+
+// array:set(i, x, y, z), array:set(i, vec) or array:set(i, r, g, b, a)
+static int ArraySet(lua_State* L)
+{
+	ComponentArray* array = CheckArray(L);
+	int i = CheckIndex(L, array);
+
+	if (array->kind == COMPONENT_TINT)
+	{
+		Color& color = ((Tint*)array->data)[i].color;
+		color.r = (unsigned char)luaL_checkinteger(L, 3);
+		color.g = (unsigned char)luaL_checkinteger(L, 4);
+		color.b = (unsigned char)luaL_checkinteger(L, 5);
+		color.a = (unsigned char)luaL_optinteger(L, 6, 255);
+		return 0;
+	}
+
+	Vector3& v = VectorAt(array, i);
+	float lanes[3];
+	if (lua_tovector(L, 3, lanes))
+	{
+		v = Vector3{ lanes[0], lanes[1], lanes[2] };
+		return 0;
+	}
+	v.x = (float)luaL_checknumber(L, 3);
+	v.y = (float)luaL_checknumber(L, 4);
+	v.z = (float)luaL_checknumber(L, 5);
+	return 0;
+}
+
+static void PushField(lua_State* L, const ComponentField& field, const unsigned char* item)
+{
+	if (field.type == TYPED_ARRAY_UINT8)
+		lua_pushinteger(L, item[field.offset]);
+	else
+		lua_pushnumber(L, *(const float*)(item + field.offset));
+}
+
+// Clamps like a Uint8Array write (NaN to 0), a nil keeps the old value
+static void StoreField(lua_State* L, int index, const ComponentField& field, unsigned char* item, const char* system)
+{
+	if (lua_isnil(L, index))
+		return;
+	int isNumber;
+	lua_Number value = lua_tonumberx(L, index, &isNumber);
+	if (!isNumber)
+		luaL_error(L, "system '%s' returned a %s for field '%s'", system, luaL_typename(L, index), field.name);
+	if (field.type == TYPED_ARRAY_UINT8)
+		item[field.offset] = (unsigned char)(!(value > 0) ? 0 : value > 255 ? 255 : value);
+	else
+		*(float*)(item + field.offset) = (float)value;
+}
+
+// Methods first, then field views: positions:get(i) and positions.x both work
+static int ArrayIndex(lua_State* L)
+{
+	ComponentArray* array = CheckArray(L);
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, lua_upvalueindex(2)) != LUA_TNIL)
+		return 1;
+
+	const char* key = lua_tostring(L, 2);
+	if (key != NULL)
+	{
+		const ComponentLayout& layout = componentLayouts[array->kind];
+		for (int f = 0; f < layout.fieldCount; f++)
+		{
+			if (strcmp(key, layout.fields[f].name) == 0)
+			{
+				lua_getiuservalue(L, 1, f + 1);
+				return 1;
+			}
+		}
+		if (strcmp(key, "entity") == 0)
+		{
+			lua_getiuservalue(L, 1, layout.fieldCount + 1);
+			return 1;
+		}
+	}
+	return luaL_error(L, "%s has no field '%s'", componentNames[array->kind], key ? key : "?");
+}
+
+static int ArrayLength(lua_State* L)
+{
+	lua_pushinteger(L, CheckArray(L)->count);
+	return 1;
+}
+
+// Fixed signatures are declared once and checked in a single pass before the call
+static const luaL_TypedReg componentArrayTypedMethods[] = {
+	{ "get", ArrayGet, "udata:" COMPONENT_ARRAY_METATABLE ", integer" },
+	{ "getv", ArrayGetVector, "udata:" COMPONENT_ARRAY_METATABLE ", integer" },
+	{ NULL, NULL, NULL }
+};
+
+// set takes three shapes of arguments, so it checks them itself
+static const luaL_Reg componentArrayMethods[] = {
+	{ "set", ArraySet },
+	{ NULL, NULL }
+};
+
+ScriptSystem::ScriptSystem(lua_State* L, Registry& world)
+	: L(L), world(world)
+{
+	RegisterTypedArrays(L);
+
+	if (luaL_newmetatable(L, COMPONENT_ARRAY_METATABLE))
+	{
+		lua_createtable(L, 0, 3);
+		luaL_settypedfuncs(L, componentArrayTypedMethods, 0);
+		lua_pushvalue(L, -2);
+		luaL_setfuncs(L, componentArrayMethods, 1);
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_pushcclosure(L, ArrayIndex, 2);
+		lua_setfield(L, -2, "__index");
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, ArrayLength, 1);
+		lua_setfield(L, -2, "__len");
+	}
+	lua_pop(L, 1);
+
+	// ecs.system(name, components, function) and ecs.each(name, components, function)
+	lua_newtable(L);
+	lua_pushlightuserdata(L, this);
+	lua_pushboolean(L, false);
+	lua_pushcclosure(L, RegisterSystem, 2);
+	lua_setfield(L, -2, "system");
+	lua_pushlightuserdata(L, this);
+	lua_pushboolean(L, true);
+	lua_pushcclosure(L, RegisterSystem, 2);
+	lua_setfield(L, -2, "each");
+	lua_setglobal(L, "ecs");
+}
+
+void ScriptSystem::Clear()
+{
+	for (System& system : systems)
+	{
+		luaL_unref(L, LUA_REGISTRYINDEX, system.function);
+		for (int array : system.arrays)
+			luaL_unref(L, LUA_REGISTRYINDEX, array);
+	}
+	systems.clear();
+}
+
+bool ScriptSystem::RunFile(const char* path)
+{
+	if (luaL_dofile(L, path) != LUA_OK)
+	{
+		DumpError(L);
+		return false;
+	}
+	return true;
+}
+
+bool ScriptSystem::RunString(const char* code)
+{
+	if (luaL_dostring(L, code) != LUA_OK)
+	{
+		DumpError(L);
+		return false;
+	}
+	return true;
+}
+
+int ScriptSystem::RegisterSystem(lua_State* L)
+{
+	ScriptSystem* self = (ScriptSystem*)lua_touserdata(L, lua_upvalueindex(1));
+	const char* name = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	System system;
+	system.name = name;
+	system.perEntity = lua_toboolean(L, lua_upvalueindex(2)) != 0;
+	system.enabled = true;
+
+	lua_Integer componentCount = luaL_len(L, 2);
+	for (lua_Integer i = 1; i <= componentCount; i++)
+	{
+		lua_geti(L, 2, i);
+		const char* componentName = lua_tostring(L, -1);
+		int kind = 0;
+		while (kind < COMPONENT_KIND_COUNT && (componentName == NULL || strcmp(componentName, componentNames[kind]) != 0))
+			kind++;
+		if (kind == COMPONENT_KIND_COUNT)
+			return luaL_error(L, "system '%s': unknown component '%s'", name, componentName ? componentName : "?");
+		lua_pop(L, 1);
+
+		system.components.push_back((ComponentKind)kind);
+	}
+
+	if (system.components.empty() || system.components.size() > COMPONENT_KIND_COUNT)
+		return luaL_error(L, "system '%s' needs between 1 and %d components", name, COMPONENT_KIND_COUNT);
+
+	for (ComponentKind kind : system.components)
+	{
+		if (system.perEntity)
+			break;
+		const ComponentLayout& layout = componentLayouts[kind];
+		ComponentArray* array = (ComponentArray*)lua_newuserdatauv(L, sizeof(ComponentArray), layout.fieldCount + 1);
+		array->data = NULL;
+		array->count = 0;
+		array->kind = kind;
+		luaL_setmetatable(L, COMPONENT_ARRAY_METATABLE);
+
+		for (int f = 0; f < layout.fieldCount; f++)
+		{
+			array->fields[f] = PushTypedArray(L, layout.fields[f].type, NULL, 0, layout.stride);
+			lua_setiuservalue(L, -2, f + 1);
+		}
+		array->fields[layout.fieldCount] = PushTypedArray(L, TYPED_ARRAY_INT32, NULL, 0, sizeof(uint32_t));
+		array->fields[layout.fieldCount]->readonly = 1;
+		lua_setiuservalue(L, -2, layout.fieldCount + 1);
+		system.arrays.push_back(luaL_ref(L, LUA_REGISTRYINDEX));
+	}
+
+	lua_pushvalue(L, 3);
+	system.function = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	self->systems.push_back(system);
+	return 0;
+}
+
+ComponentPoolBase* ScriptSystem::PoolOf(ComponentKind kind)
+{
+	switch (kind)
+	{
+	case COMPONENT_POSITION: return &world.Pool<Position>();
+	case COMPONENT_VELOCITY: return &world.Pool<Velocity>();
+	case COMPONENT_BOX_SHAPE: return &world.Pool<BoxShape>();
+	default: return &world.Pool<Tint>();
+	}
+}
+
+void* ScriptSystem::DataOf(ComponentKind kind)
+{
+	switch (kind)
+	{
+	case COMPONENT_POSITION: return world.Pool<Position>().Data();
+	case COMPONENT_VELOCITY: return world.Pool<Velocity>().Data();
+	case COMPONENT_BOX_SHAPE: return world.Pool<BoxShape>().Data();
+	default: return world.Pool<Tint>().Data();
+	}
+}
+
+// Arguments: the EachCall and the system's function. A single pcall around the whole loop is much
+// cheaper than one per entity, which would set up an error handler every time.
+int ScriptSystem::EachEntity(lua_State* L)
+{
+	const EachCall* call = (const EachCall*)lua_touserdata(L, 1);
+	int fieldCount = 0;
+	for (int c = 0; c < call->componentCount; c++)
+		fieldCount += componentLayouts[call->components[c]].fieldCount;
+	luaL_checkstack(L, fieldCount + 3, "too many component fields");
+
+	for (int i = 0; i < call->count; i++)
+	{
+		lua_pushvalue(L, 2);
+		lua_pushnumber(L, call->dt);
+		for (int c = 0; c < call->componentCount; c++)
+		{
+			const ComponentLayout& layout = componentLayouts[call->components[c]];
+			const unsigned char* item = (const unsigned char*)call->data[c] + (size_t)i * layout.stride;
+			for (int f = 0; f < layout.fieldCount; f++)
+				PushField(L, layout.fields[f], item);
+		}
+		lua_pushinteger(L, call->entities[i]);
+		lua_call(L, fieldCount + 2, fieldCount);
+
+		int result = -fieldCount;
+		for (int c = 0; c < call->componentCount; c++)
+		{
+			const ComponentLayout& layout = componentLayouts[call->components[c]];
+			unsigned char* item = (unsigned char*)call->data[c] + (size_t)i * layout.stride;
+			for (int f = 0; f < layout.fieldCount; f++)
+				StoreField(L, result++, layout.fields[f], item, call->name);
+		}
+		lua_pop(L, fieldCount);
+	}
+	return 0;
+}
+
+// The pools may grow or be reordered before the next call, so nothing may point into them
+void ScriptSystem::DetachArray(int reference)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, reference);
+	ComponentArray* array = (ComponentArray*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	array->data = NULL;
+	array->count = 0;
+	const ComponentLayout& layout = componentLayouts[array->kind];
+	for (int f = 0; f <= layout.fieldCount; f++)
+	{
+		array->fields[f]->data = NULL;
+		array->fields[f]->length = 0;
+	}
+}
+
+void ScriptSystem::Update(float dt)
+{
+	ComponentPoolBase* pools[COMPONENT_KIND_COUNT];
+
+	// Nearly all garbage a tick makes is dead when it ends, so collect it right then instead of
+	// in the middle of a system where its temporaries are still alive
+	lua_beginframe(L);
+
+	// Registering a system from inside a system may grow the vector, so index instead of iterating
+	for (size_t s = 0; s < systems.size(); s++)
+	{
+		if (!systems[s].enabled)
+			continue;
+
+		size_t componentCount = systems[s].components.size();
+		for (size_t c = 0; c < componentCount; c++)
+			pools[c] = PoolOf(systems[s].components[c]);
+		int count = (int)world.GroupPools(pools, componentCount);
+
+		if (systems[s].perEntity)
+		{
+			EachCall call;
+			call.name = systems[s].name.c_str();
+			call.components = systems[s].components.data();
+			call.componentCount = (int)componentCount;
+			for (size_t c = 0; c < componentCount; c++)
+				call.data[c] = DataOf(systems[s].components[c]);
+			call.entities = pools[0]->Entities();
+			call.count = count;
+			call.dt = dt;
+
+			lua_pushcfunction(L, EachEntity);
+			lua_pushlightuserdata(L, &call);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, systems[s].function);
+			if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+			{
+				std::cout << "Script system '" << systems[s].name << "' disabled" << std::endl;
+				DumpError(L);
+				systems[s].enabled = false;
+			}
+			continue;
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, systems[s].function);
+		lua_pushinteger(L, count);
+		lua_pushnumber(L, dt);
+		for (size_t c = 0; c < componentCount; c++)
+		{
+			lua_rawgeti(L, LUA_REGISTRYINDEX, systems[s].arrays[c]);
+			ComponentArray* array = (ComponentArray*)lua_touserdata(L, -1);
+			array->data = DataOf(systems[s].components[c]);
+			array->count = count;
+
+			const ComponentLayout& layout = componentLayouts[array->kind];
+			for (int f = 0; f < layout.fieldCount; f++)
+			{
+				array->fields[f]->data = (unsigned char*)array->data + layout.fields[f].offset;
+				array->fields[f]->length = count;
+			}
+			array->fields[layout.fieldCount]->data = (unsigned char*)pools[c]->Entities();
+			array->fields[layout.fieldCount]->length = count;
+		}
+
+		int status = lua_pcall(L, 2 + (int)componentCount, 0, 0);
+		for (size_t c = 0; c < componentCount; c++)
+			DetachArray(systems[s].arrays[c]);
+
+		if (status != LUA_OK)
+		{
+			std::cout << "Script system '" << systems[s].name << "' disabled" << std::endl;
+			DumpError(L);
+			systems[s].enabled = false;
+		}
+	}
+
+	// Then wake every coroutine.spawn task whose coroutine.sleep is over. A failing task is
+	// already dropped by the scheduler, the others still wake up next tick.
+	time += dt;
+	lua_getglobal(L, "coroutine");
+	lua_getfield(L, -1, "update");
+	lua_remove(L, -2);
+	lua_pushnumber(L, time);
+	if (lua_pcall(L, 1, 0, 0) != LUA_OK)
+	{
+		std::cout << "Script task failed" << std::endl;
+		DumpError(L);
+	}
+	lua_endframe(L);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "lua.hpp"
+
+#include "Ecs.h"
+
+// Component types a script system can ask for by name
+enum ComponentKind
+{
+	COMPONENT_POSITION,
+	COMPONENT_VELOCITY,
+	COMPONENT_BOX_SHAPE,
+	COMPONENT_TINT,
+	COMPONENT_KIND_COUNT
+};
+
+// Prints and pops the error message on top of the Lua stack
+void DumpError(lua_State* L);
+
+// Runs entity behaviors written in Lua. Scripts register per-entity systems with
+//
+//     ecs.each(name, { "Position", "Velocity" }, function(dt, x, y, z, vx, vy, vz, entity) ... end)
+//
+// which Update calls once for every entity that has all the components, with the fields of each
+// component as numbers in order and the entity index last. The function returns new values for
+// the fields in the same order, a nil or a missing value leaves that field as it was. The whole
+// group runs inside one lua_pcall, so an error stops the group and disables the system.
+//
+// Batched systems instead get the whole group in one call,
+//
+//     ecs.system(name, { "Position", "Velocity" }, function(count, dt, positions, velocities) ... end)
+//
+// with arrays that point straight into the registry's component storage. Index i of every
+// array belongs to the same entity (see Registry::GroupPools). Fields are read through typed
+// views, positions.x is a Float32Array over every Position's x and positions.entity the entity
+// indices, or one entity at a time with positions:get(i) / positions:set(i, x, y, z).
+// The arrays and views only work during the call, using one kept from an earlier call raises
+// an error. Element access through the views costs more than passing numbers, so for simple
+// per-entity math ecs.each is the faster of the two (see --bench-script-systems).
+// Per-entity sequences that have to wait use coroutine.spawn(f, ...) and coroutine.sleep(seconds)
+// instead, Update resumes the ones that are due after running the systems.
+// Each Update is a Lua frame region (lua_beginframe/lua_endframe). In generational mode, or with
+// a GC time budget, the tick's garbage is collected when it ends; picking the mode is up to the
+// code that creates the state.
+class ScriptSystem
+{
+public:
+	ScriptSystem(lua_State* L, Registry& world);
+
+	// Drops every system and releases its Lua references, call before lua_close
+	void Clear();
+
+	bool RunFile(const char* path);
+	bool RunString(const char* code);
+
+	// One lua_pcall per registered system, a system that errors is reported and disabled
+	void Update(float dt);
+
+	size_t SystemCount() const { return systems.size(); }
+
+private:
+	struct System
+	{
+		std::string name;
+		std::vector<ComponentKind> components;
+		int function;                       // Registry reference to the Lua function
+		std::vector<int> arrays;            // Registry references to the reusable array userdata, batched only
+		bool perEntity;                     // Registered with ecs.each
+		bool enabled;
+	};
+
+	static int RegisterSystem(lua_State* L);
+	static int EachEntity(lua_State* L);
+	void DetachArray(int reference);
+	ComponentPoolBase* PoolOf(ComponentKind kind);
+	void* DataOf(ComponentKind kind);
+
+	lua_State* L;
+	Registry& world;
+	std::vector<System> systems;
+	double time = 0.0;                      // Sum of every Update's dt, the clock of coroutine.sleep
+};
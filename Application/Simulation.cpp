@@ -0,0 +1,302 @@
+#include "Simulation.h"
+
+#include "raymath.h"
+
+#include "Collision.h"
+
+// Tuning is per tick at SIM_TICK_RATE, which matches the old per-frame values at 60 fps
+#define PLAYER_WALK_IMPULSE 0.5f
+#define PLAYER_SPRINT_BONUS 1.0f
+#define PLAYER_JUMP_IMPULSE 30.0f
+#define PLAYER_GROUND_DAMPING 0.9f
+#define PLAYER_GRAVITY 2.0f
+#define PLAYER_MAX_FALL_SPEED -50.0f
+#define PLAYER_GROUND_HEIGHT 1.0f
+#define COLLISION_DAMPING 0.2f
+
+// Small LCG so level generation gives the same result on every platform and standard library
+static unsigned int NextRandom(unsigned int& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+static int RandomRange(unsigned int& state, int min, int max)
+{
+	return min + (int)(NextRandom(state) % (unsigned int)(max - min + 1));
+}
+
+Simulation::Simulation(unsigned int seed, int columnCount)
+	: staticGeometryDirty(false), tick(0)
+{
+	unsigned int rng = seed;
+
+	world.Pool<Position>().Reserve(columnCount);
+	world.Pool<BoxShape>().Reserve(columnCount);
+	world.Pool<Tint>().Reserve(columnCount);
+
+	// Generates some random columns
+	for (int i = 0; i < columnCount; i++)
+	{
+		Vector3 position = { (float)RandomRange(rng, -15, -5), (float)(i + 2.0f), (float)RandomRange(rng, 5, 15) };
+		Color color = { (unsigned char)RandomRange(rng, 20, 255), (unsigned char)RandomRange(rng, 10, 55), 30, 255 };
+		SpawnBox(position, { 2.0f, 1.0f, 2.0f }, color, false);
+	}
+
+	RebuildStaticGeometry();
+
+	playerSize = { 0.8f, 1.8f, 0.8f };
+
+	current.position = { 0.0f, 1.0f, 2.0f };
+	current.resolvedPosition = current.position;
+	current.speed = { 0, 0, 0 };
+	current.airborne = false;
+	previous = current;
+}
+
+Entity Simulation::SpawnBox(Vector3 position, Vector3 size, Color color, bool dynamic)
+{
+	Entity box = world.Create();
+	world.Add(box, Position{ position });
+	world.Add(box, BoxShape{ size });
+	world.Add(box, Tint{ color });
+	if (dynamic)
+	{
+		world.Add(box, Dynamic{});
+		broadphase.Insert(box.index, BoxAround(position, size));
+	}
+	else
+	{
+		staticGeometryDirty = true;
+	}
+
+	return box;
+}
+
+void Simulation::DestroyBox(Entity entity)
+{
+	if (!world.IsAlive(entity))
+		return;
+
+	if (world.Has<Dynamic>(entity))
+		broadphase.Remove(entity.index);
+	else
+		staticGeometryDirty = true;
+
+	world.Destroy(entity);
+}
+
+bool Simulation::PickBox(Ray ray, float maxDistance, Entity& entity, float& distance)
+{
+	// A box destroyed since the last tick would still be in the tree, and its index may
+	// already belong to a new entity
+	if (staticGeometryDirty)
+		RebuildStaticGeometry();
+
+	BvhHit hit;
+	if (!staticGeometry.Raycast(ray, maxDistance, hit))
+		return false;
+
+	entity = world.HandleOf(hit.id);
+	distance = hit.distance;
+	return true;
+}
+
+void Simulation::Step(float dt, const SimInput& input)
+{
+	previous = current;
+
+	if (staticGeometryDirty)
+		RebuildStaticGeometry();
+	SyncDynamicBoxes();
+	IntegratePlayer(dt, input);
+	ResolveCollisions();
+
+	tick++;
+}
+
+Vector3 Simulation::GetInterpolatedPlayerPosition(float alpha) const
+{
+	return Vector3Lerp(previous.position, current.position, alpha);
+}
+
+void Simulation::IntegratePlayer(float dt, const SimInput& input)
+{
+	Vector3& speed = current.speed;
+	float impulse = PLAYER_WALK_IMPULSE + (input.sprint ? PLAYER_SPRINT_BONUS : 0.0f);
+	Vector3 forward = Vector3Scale(input.lookDirection, impulse);
+	Vector3 side = Vector3Scale(Vector3RotateByAxisAngle(input.lookDirection, { 0, 1, 0 }, 90), impulse);
+
+	if (input.forward)
+	{
+		speed.x += forward.x;
+		speed.z += forward.z;
+	}
+	if (input.back)
+	{
+		speed.x -= forward.x;
+		speed.z -= forward.z;
+	}
+	if (input.left)
+	{
+		speed.x += side.x;
+		speed.z += side.z;
+	}
+	if (input.right)
+	{
+		speed.x -= side.x;
+		speed.z -= side.z;
+	}
+	if (input.jump && !current.airborne)
+	{
+		speed.y += PLAYER_JUMP_IMPULSE;
+		current.airborne = true;
+	}
+
+	speed.x *= PLAYER_GROUND_DAMPING;
+	speed.z *= PLAYER_GROUND_DAMPING;
+	speed.y -= PLAYER_GRAVITY;
+
+	if (speed.y <= PLAYER_MAX_FALL_SPEED)
+		speed.y = PLAYER_MAX_FALL_SPEED;
+
+	current.position = Vector3Add(current.position, Vector3Scale(speed, dt));
+
+	if (current.position.y < PLAYER_GROUND_HEIGHT)
+	{
+		speed.y = 0.0f;
+		current.position.y = PLAYER_GROUND_HEIGHT;
+		current.airborne = false;
+	}
+}
+
+void Simulation::RebuildStaticGeometry()
+{
+	std::vector<BoundingBox> boxes;
+	std::vector<uint32_t> ids;
+	boxes.reserve(world.Pool<Position>().Size());
+	ids.reserve(world.Pool<Position>().Size());
+
+	ComponentPool<Dynamic>& dynamic = world.Pool<Dynamic>();
+	world.Each<Position, BoxShape>([&](uint32_t entity, Position& position, BoxShape& shape)
+	{
+		if (dynamic.Contains(entity))
+			return;
+
+		boxes.push_back(BoxAround(position.value, shape.size));
+		ids.push_back(entity);
+	});
+
+	staticGeometry.Build(boxes.data(), ids.data(), boxes.size());
+	staticGeometryDirty = false;
+}
+
+void Simulation::SyncDynamicBoxes()
+{
+	world.Each<Position, BoxShape, Dynamic>([&](uint32_t entity, Position& position, BoxShape& shape, Dynamic&)
+	{
+		broadphase.Update(entity, BoxAround(position.value, shape.size));
+	});
+}
+
+// Tests each axis of the move separately against the last resolved position,
+// so the player slides along walls instead of sticking to them
+void Simulation::ResolveCollisions()
+{
+	Vector3& position = current.position;
+	Vector3& resolved = current.resolvedPosition;
+	Vector3& speed = current.speed;
+
+	BoundingBox sweepX = BoxAround({ position.x, resolved.y, resolved.z }, playerSize);
+	BoundingBox sweepZ = BoxAround({ resolved.x, resolved.y, position.z }, playerSize);
+	BoundingBox sweepY = BoxAround({ resolved.x, position.y, resolved.z }, playerSize);
+
+	bool collisionX = false;
+	bool collisionY = false;
+	bool collisionZ = false;
+
+	// Only boxes touching the box swept by all three axis moves can collide
+	BoundingBox swept = BoxUnion(BoxUnion(sweepX, sweepZ), sweepY);
+	candidates.clear();
+	staticGeometry.QueryOverlap(swept, candidates);
+	broadphase.Query(swept, candidates);
+
+	ComponentPool<Position>& positions = world.Pool<Position>();
+	ComponentPool<BoxShape>& shapes = world.Pool<BoxShape>();
+
+	candidateBoxes.Clear();
+	for (uint32_t entity : candidates)
+		candidateBoxes.Push(BoxAround(positions.Get(entity).value, shapes.Get(entity).size), entity);
+
+	// All three sweeps in one pass over the candidates, one hit bit per box and axis
+	size_t words = candidateBoxes.MaskWords();
+	hitMasks.assign(words * 3, 0);
+	BoundingBox sweeps[3] = { sweepX, sweepZ, sweepY };
+	uint32_t* masks[3] = { hitMasks.data(), hitMasks.data() + words, hitMasks.data() + words * 2 };
+	BoxBatchOverlap3(candidateBoxes, sweeps, masks);
+
+	for (size_t i = 0; i < candidateBoxes.Size(); i++)
+	{
+		uint32_t bit = 1u << (i % 32);
+
+		if (masks[0][i / 32] & bit)
+		{
+			speed.x *= COLLISION_DAMPING;
+			collisionX = true;
+		}
+
+		if (masks[1][i / 32] & bit)
+		{
+			speed.z *= COLLISION_DAMPING;
+			collisionZ = true;
+		}
+
+		if (masks[2][i / 32] & bit)
+		{
+			collisionY = true;
+			if (speed.y < 0)
+				current.airborne = false;
+			else
+				speed.y = 0;
+			speed.y *= COLLISION_DAMPING;
+		}
+	}
+
+	if (collisionX)
+		position.x = resolved.x;
+	else
+		resolved.x = position.x;
+
+	if (collisionZ)
+		position.z = resolved.z;
+	else
+		resolved.z = position.z;
+
+	if (collisionY)
+		position.y = resolved.y;
+	else
+		resolved.y = position.y;
+}
+
+FixedTimestep::FixedTimestep(float dt, int maxStepsPerFrame)
+	: dt(dt), accumulator(0.0f), maxStepsPerFrame(maxStepsPerFrame)
+{
+}
+
+int FixedTimestep::Advance(float frameTime)
+{
+	accumulator += frameTime;
+
+	int steps = 0;
+	while (accumulator >= dt && steps < maxStepsPerFrame)
+	{
+		accumulator -= dt;
+		steps++;
+	}
+
+	// Drop the backlog after a long stall instead of spiralling
+	if (steps == maxStepsPerFrame && accumulator >= dt)
+		accumulator = 0.0f;
+
+	return steps;
+}
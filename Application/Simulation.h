@@ -0,0 +1,103 @@
+#pragma once
+
+#include "raylib.h"
+
+#include "Components.h"
+#include "BoxBatch.h"
+#include "Bvh.h"
+#include "Ecs.h"
+#include "SpatialHash.h"
+
+#define DEFAULT_COLUMN_COUNT 10
+#define SIM_TICK_RATE 60
+#define SIM_FIXED_DT (1.0f / SIM_TICK_RATE)
+
+// One tick of player intent, sampled from the keyboard by the host (or generated by a test driver)
+struct SimInput
+{
+	Vector3 lookDirection;
+	bool forward;
+	bool back;
+	bool left;
+	bool right;
+	bool jump;
+	bool sprint;
+};
+
+struct PlayerState
+{
+	Vector3 position;
+	Vector3 resolvedPosition;   // Last position that was free of collision, per axis
+	Vector3 speed;
+	bool airborne;
+};
+
+// Deterministic game simulation. Only uses raylib types and the header-only raymath,
+// never the window, input or drawing functions, so it can be stepped without a display.
+class Simulation
+{
+public:
+	explicit Simulation(unsigned int seed, int columnCount = DEFAULT_COLUMN_COUNT);
+
+	// Advances the world by exactly one tick
+	void Step(float dt, const SimInput& input);
+
+	// Player position blended between the last two ticks, alpha in [0, 1]
+	Vector3 GetInterpolatedPlayerPosition(float alpha) const;
+
+	const PlayerState& GetPlayer() const { return current; }
+	Vector3 GetPlayerSize() const { return playerSize; }
+	unsigned long long GetTick() const { return tick; }
+
+	// Level geometry lives in the registry as Position + BoxShape (+ Tint) entities
+	Registry& GetWorld() { return world; }
+	const Registry& GetWorld() const { return world; }
+	const SpatialHash& GetBroadphase() const { return broadphase; }
+	const Bvh& GetStaticGeometry() const { return staticGeometry; }
+
+	// Static boxes go into the BVH, which is rebuilt at the start of the next tick after a change.
+	// Dynamic boxes live in the spatial hash and are re-synced every tick.
+	Entity SpawnBox(Vector3 position, Vector3 size, Color color, bool dynamic);
+	void DestroyBox(Entity entity);
+
+	// Closest static box along the ray, for picking. Rebuilds the BVH first if boxes changed.
+	bool PickBox(Ray ray, float maxDistance, Entity& entity, float& distance);
+
+private:
+	void IntegratePlayer(float dt, const SimInput& input);
+	void RebuildStaticGeometry();
+	void SyncDynamicBoxes();
+	void ResolveCollisions();
+
+	Registry world;
+	SpatialHash broadphase;
+	Bvh staticGeometry;
+	bool staticGeometryDirty;
+	std::vector<uint32_t> candidates;
+	BoxBatch candidateBoxes;
+	std::vector<uint32_t> hitMasks;
+
+	Vector3 playerSize;
+	PlayerState previous;
+	PlayerState current;
+	unsigned long long tick;
+};
+
+// Runs the simulation at a fixed rate regardless of the render frame time
+class FixedTimestep
+{
+public:
+	explicit FixedTimestep(float dt, int maxStepsPerFrame = 8);
+
+	// Returns how many ticks to run for this frame
+	int Advance(float frameTime);
+
+	// How far the render frame is between the previous and the current tick
+	float GetAlpha() const { return accumulator / dt; }
+	float GetDt() const { return dt; }
+
+private:
+	float dt;
+	float accumulator;
+	int maxStepsPerFrame;
+};
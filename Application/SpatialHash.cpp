@@ -0,0 +1,187 @@
+#include "SpatialHash.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Collision.h"
+
+bool SpatialHash::CellRange::operator==(const CellRange& other) const
+{
+	return minX == other.minX && minY == other.minY && minZ == other.minZ &&
+		maxX == other.maxX && maxY == other.maxY && maxZ == other.maxZ;
+}
+
+SpatialHash::SpatialHash(float cellSize)
+	: cellSize(cellSize), inverseCellSize(1.0f / cellSize), count(0), currentStamp(0)
+{
+}
+
+// 21 bits per axis, offset so negative coordinates pack without sign extension
+uint64_t SpatialHash::CellKey(int x, int y, int z)
+{
+	const uint64_t mask = (1u << 21) - 1;
+	const int bias = SPATIAL_HASH_CELL_LIMIT;
+	return ((uint64_t)((x + bias) & mask) << 42) | ((uint64_t)((y + bias) & mask) << 21) | (uint64_t)((z + bias) & mask);
+}
+
+// Clamped to the cells CellKey can tell apart, in float so huge, infinite or NaN coordinates
+// never reach the int conversion (NaN ends up in the lowest cell)
+static int CellCoordinate(float value, float inverseCellSize)
+{
+	float cell = std::floor(value * inverseCellSize);
+	if (!(cell >= (float)-SPATIAL_HASH_CELL_LIMIT))
+		return -SPATIAL_HASH_CELL_LIMIT;
+	if (cell > (float)(SPATIAL_HASH_CELL_LIMIT - 1))
+		return SPATIAL_HASH_CELL_LIMIT - 1;
+	return (int)cell;
+}
+
+SpatialHash::CellRange SpatialHash::RangeOf(BoundingBox box) const
+{
+	CellRange range;
+	range.minX = CellCoordinate(box.min.x, inverseCellSize);
+	range.minY = CellCoordinate(box.min.y, inverseCellSize);
+	range.minZ = CellCoordinate(box.min.z, inverseCellSize);
+	range.maxX = CellCoordinate(box.max.x, inverseCellSize);
+	range.maxY = CellCoordinate(box.max.y, inverseCellSize);
+	range.maxZ = CellCoordinate(box.max.z, inverseCellSize);
+	return range;
+}
+
+void SpatialHash::Link(uint32_t id, const CellRange& range)
+{
+	for (int x = range.minX; x <= range.maxX; x++)
+		for (int y = range.minY; y <= range.maxY; y++)
+			for (int z = range.minZ; z <= range.maxZ; z++)
+				cells[CellKey(x, y, z)].push_back(id);
+}
+
+void SpatialHash::Unlink(uint32_t id, const CellRange& range)
+{
+	for (int x = range.minX; x <= range.maxX; x++)
+	{
+		for (int y = range.minY; y <= range.maxY; y++)
+		{
+			for (int z = range.minZ; z <= range.maxZ; z++)
+			{
+				auto cell = cells.find(CellKey(x, y, z));
+				if (cell == cells.end())
+					continue;
+
+				std::vector<uint32_t>& bucket = cell->second;
+				for (size_t i = 0; i < bucket.size(); i++)
+				{
+					if (bucket[i] == id)
+					{
+						bucket[i] = bucket.back();
+						bucket.pop_back();
+						break;
+					}
+				}
+
+				if (bucket.empty())
+					cells.erase(cell);
+			}
+		}
+	}
+}
+
+void SpatialHash::Insert(uint32_t id, BoundingBox box)
+{
+	if (Contains(id))
+	{
+		Update(id, box);
+		return;
+	}
+
+	if (id >= proxies.size())
+	{
+		proxies.resize(id + 1, Proxy{ BoundingBox{}, CellRange{}, false });
+		queryStamps.resize(id + 1, 0);
+	}
+
+	Proxy& proxy = proxies[id];
+	proxy.box = box;
+	proxy.range = RangeOf(box);
+	proxy.active = true;
+	Link(id, proxy.range);
+	count++;
+}
+
+void SpatialHash::Update(uint32_t id, BoundingBox box)
+{
+	if (!Contains(id))
+	{
+		Insert(id, box);
+		return;
+	}
+
+	Proxy& proxy = proxies[id];
+	CellRange range = RangeOf(box);
+	proxy.box = box;
+
+	if (range == proxy.range)
+		return;
+
+	Unlink(id, proxy.range);
+	proxy.range = range;
+	Link(id, range);
+}
+
+void SpatialHash::Remove(uint32_t id)
+{
+	if (!Contains(id))
+		return;
+
+	Unlink(id, proxies[id].range);
+	proxies[id].active = false;
+	count--;
+}
+
+bool SpatialHash::Contains(uint32_t id) const
+{
+	return id < proxies.size() && proxies[id].active;
+}
+
+void SpatialHash::Clear()
+{
+	cells.clear();
+	proxies.clear();
+	queryStamps.clear();
+	count = 0;
+}
+
+void SpatialHash::Query(BoundingBox box, std::vector<uint32_t>& out) const
+{
+	if (++currentStamp == 0)
+	{
+		// Stamp wrapped around, forget every old mark
+		std::fill(queryStamps.begin(), queryStamps.end(), 0);
+		currentStamp = 1;
+	}
+
+	CellRange range = RangeOf(box);
+
+	for (int x = range.minX; x <= range.maxX; x++)
+	{
+		for (int y = range.minY; y <= range.maxY; y++)
+		{
+			for (int z = range.minZ; z <= range.maxZ; z++)
+			{
+				auto cell = cells.find(CellKey(x, y, z));
+				if (cell == cells.end())
+					continue;
+
+				for (uint32_t id : cell->second)
+				{
+					if (queryStamps[id] == currentStamp)
+						continue;
+					queryStamps[id] = currentStamp;
+
+					if (BoxesOverlap(box, proxies[id].box))
+						out.push_back(id);
+				}
+			}
+		}
+	}
+}
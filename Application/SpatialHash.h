@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "raylib.h"
+
+#define SPATIAL_HASH_DEFAULT_CELL_SIZE 4.0f
+#define SPATIAL_HASH_CELL_LIMIT (1 << 20)     // Cell coordinates are clamped to [-limit, limit - 1]
+
+// Uniform grid broad-phase. Boxes are bucketed into every cell they touch, keyed by a hash of
+// the integer cell coordinates so the world does not need fixed bounds. Ids are caller chosen
+// (the simulation uses entity indices) and should be dense since proxies are stored by id.
+class SpatialHash
+{
+public:
+	explicit SpatialHash(float cellSize = SPATIAL_HASH_DEFAULT_CELL_SIZE);
+
+	void Insert(uint32_t id, BoundingBox box);
+
+	// Cheap when the box stays inside the same cells, only the stored bounds change
+	void Update(uint32_t id, BoundingBox box);
+	void Remove(uint32_t id);
+	bool Contains(uint32_t id) const;
+	void Clear();
+
+	// Appends the id of every box overlapping the query box, each id at most once
+	void Query(BoundingBox box, std::vector<uint32_t>& out) const;
+
+	size_t Size() const { return count; }
+	size_t CellCount() const { return cells.size(); }
+	float GetCellSize() const { return cellSize; }
+
+private:
+	struct CellRange
+	{
+		int minX, minY, minZ;
+		int maxX, maxY, maxZ;
+
+		bool operator==(const CellRange& other) const;
+	};
+
+	struct Proxy
+	{
+		BoundingBox box;
+		CellRange range;
+		bool active;
+	};
+
+	CellRange RangeOf(BoundingBox box) const;
+	void Link(uint32_t id, const CellRange& range);
+	void Unlink(uint32_t id, const CellRange& range);
+	static uint64_t CellKey(int x, int y, int z);
+
+	float cellSize;
+	float inverseCellSize;
+	size_t count;
+
+	std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+	std::vector<Proxy> proxies;
+
+	// Boxes spanning several cells show up in several buckets, stamps filter the duplicates
+	mutable std::vector<uint32_t> queryStamps;
+	mutable uint32_t currentStamp;
+};
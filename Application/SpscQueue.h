@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread. Capacity must
+// be a power of two; one slot is kept empty to tell a full queue from an empty one. Each index
+// is written by one side only, the release store publishes the slot and the acquire load on
+// the other side makes its contents visible.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+	// Producer side, returns false without blocking when the queue is full
+	bool TryPush(T&& value)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) & (Capacity - 1);
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+
+		slots[tail] = std::move(value);
+		this->tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, returns false without blocking when the queue is empty
+	bool TryPop(T& value)
+	{
+		size_t head = this->head.load(std::memory_order_relaxed);
+		if (head == tail.load(std::memory_order_acquire))
+			return false;
+
+		value = std::move(slots[head]);
+		this->head.store((head + 1) & (Capacity - 1), std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	T slots[Capacity];
+
+	// On separate cache lines so the two threads don't keep stealing each other's line. Padding
+	// rather than alignas, the queue lives in a make_shared object and C++14 new ignores alignas.
+	char padHead[64];
+	std::atomic<size_t> head{ 0 };
+	char padTail[64 - sizeof(size_t)];
+	std::atomic<size_t> tail{ 0 };
+};
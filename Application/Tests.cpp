@@ -0,0 +1,434 @@
+#include "Tests.h"
+
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "lua.hpp"
+#include "raylib.h"
+
+#include "InstanceBuffer.h"
+#include "Simulation.h"
+
+#define HEADLESS_TICKS 100000
+#define HEADLESS_SEED 12345
+
+#define JIT_TEST_CALLS 400
+
+// Player intent for a headless tick: walks in a slow circle, sprints every other second and jumps
+// now and then, so the run goes through the integration and collision paths of a real session
+static SimInput HeadlessInput(unsigned long long tick)
+{
+	float angle = (float)(tick % 720) * (2.0f * PI / 720.0f);
+
+	SimInput input = {};
+	input.lookDirection = { sinf(angle), 0.0f, cosf(angle) };
+	input.forward = true;
+	input.sprint = (tick / SIM_TICK_RATE) % 2 == 1;
+	input.jump = tick % 90 == 0;
+	return input;
+}
+
+// ./Application --headless [ticks] [columns]: steps the simulation without a window as fast as it
+// goes, twice with the same seed, and fails if the two runs end in different states
+int RunHeadless(int argc, char** argv)
+{
+	long long ticks = argc > 2 ? atoll(argv[2]) : HEADLESS_TICKS;
+	int columns = argc > 3 ? atoi(argv[3]) : DEFAULT_COLUMN_COUNT;
+
+	PlayerState endStates[2];
+	for (int run = 0; run < 2; run++)
+	{
+		Simulation simulation(HEADLESS_SEED, columns);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (long long t = 0; t < ticks; t++)
+			simulation.Step(SIM_FIXED_DT, HeadlessInput(simulation.GetTick()));
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		endStates[run] = simulation.GetPlayer();
+		Vector3 position = endStates[run].position;
+		std::cout << "run " << run + 1 << ": " << ticks << " ticks, " << columns << " columns in " << seconds * 1000.0 << " ms, "
+			<< ticks / seconds << " ticks/s, player at " << position.x << " " << position.y << " " << position.z << std::endl;
+	}
+
+	// Bit for bit, a deterministic step gives exactly the same floats
+	const PlayerState& a = endStates[0];
+	const PlayerState& b = endStates[1];
+	if (memcmp(&a.position, &b.position, sizeof(Vector3)) != 0 || memcmp(&a.speed, &b.speed, sizeof(Vector3)) != 0 || a.airborne != b.airborne)
+	{
+		std::cout << "FAILED: two runs with the same seed and inputs ended in different states" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Transform and color of one instance as the GPU buffer will see them
+static bool InstanceMatches(const InstanceBuffer& instances, size_t index, Vector3 position, Vector3 size, Color color)
+{
+	const float* transform = instances.Transforms() + index * INSTANCE_TRANSFORM_FLOATS;
+	const unsigned char* rgba = instances.Colors() + index * INSTANCE_COLOR_BYTES;
+	float expected[INSTANCE_TRANSFORM_FLOATS] = {
+		size.x, 0.0f, 0.0f, 0.0f,
+		0.0f, size.y, 0.0f, 0.0f,
+		0.0f, 0.0f, size.z, 0.0f,
+		position.x, position.y, position.z, 1.0f
+	};
+	return memcmp(transform, expected, sizeof(expected)) == 0 &&
+		rgba[0] == color.r && rgba[1] == color.g && rgba[2] == color.b && rgba[3] == color.a;
+}
+
+static bool DirtyRangeIs(const InstanceBuffer& instances, size_t first, size_t count)
+{
+	if (count == 0)
+		return !instances.IsDirty();
+	return instances.IsDirty() && instances.DirtyFirst() == first && instances.DirtyCount() == count;
+}
+
+// ./Application --test-instance-buffer: fills the instance buffer from the level the way the
+// frame loop does and checks its contents and dirty ranges, no GL context needed
+int RunInstanceBufferTest()
+{
+	Simulation simulation(HEADLESS_SEED, 100);
+	Registry& world = simulation.GetWorld();
+	InstanceBuffer instances;
+
+	auto fill = [&]()
+	{
+		instances.Begin();
+		world.Each<Position, BoxShape, Tint>([&](uint32_t, Position& position, BoxShape& shape, Tint& tint)
+		{
+			instances.Add(position.value, shape.size, tint.color);
+		});
+		instances.End();
+	};
+
+	fill();
+	if (instances.Count() != 100 || !DirtyRangeIs(instances, 0, 100))
+	{
+		std::cout << "FAILED: the first fill did not mark every instance as changed" << std::endl;
+		return 1;
+	}
+
+	size_t index = 0;
+	bool contentsMatch = true;
+	world.Each<Position, BoxShape, Tint>([&](uint32_t, Position& position, BoxShape& shape, Tint& tint)
+	{
+		contentsMatch = contentsMatch && InstanceMatches(instances, index++, position.value, shape.size, tint.color);
+	});
+	if (!contentsMatch)
+	{
+		std::cout << "FAILED: instance transforms or colors do not match the level" << std::endl;
+		return 1;
+	}
+
+	// Nothing moved, nothing to upload
+	instances.ClearDirty();
+	fill();
+	if (!DirtyRangeIs(instances, 0, 0))
+	{
+		std::cout << "FAILED: an unchanged level was marked as changed" << std::endl;
+		return 1;
+	}
+
+	// Two moved columns give one range spanning both
+	ComponentPool<Position>& positions = world.Pool<Position>();
+	positions.Data()[10].value.y += 1.0f;
+	positions.Data()[20].value.x -= 1.0f;
+	fill();
+	if (!DirtyRangeIs(instances, 10, 11) || !InstanceMatches(instances, 20, positions.Data()[20].value, { 2.0f, 1.0f, 2.0f }, world.Pool<Tint>().Data()[20].color))
+	{
+		std::cout << "FAILED: moving two columns did not mark exactly their range" << std::endl;
+		return 1;
+	}
+
+	// Fewer instances only shrink the draw count, more instances mark the new tail
+	instances.ClearDirty();
+	instances.Begin();
+	for (size_t i = 0; i < 50; i++)
+		instances.Add(positions.Data()[i].value, { 2.0f, 1.0f, 2.0f }, world.Pool<Tint>().Data()[i].color);
+	instances.End();
+	if (instances.Count() != 50 || !DirtyRangeIs(instances, 0, 0))
+	{
+		std::cout << "FAILED: shrinking the buffer marked instances as changed" << std::endl;
+		return 1;
+	}
+
+	fill();
+	if (instances.Count() != 100 || !DirtyRangeIs(instances, 50, 50))
+	{
+		std::cout << "FAILED: growing the buffer did not mark the new instances" << std::endl;
+		return 1;
+	}
+
+	std::cout << "instance buffer checks passed" << std::endl;
+	return 0;
+}
+
+// Every case is called JIT_TEST_CALLS times, long after its function got hot enough to be
+// compiled, and each result is written out exactly: its type, and floats in hex
+static const char* jitCasesScript = R"(
+local cases = {}
+local function case(name, f) cases[#cases + 1] = { name = name, f = f } end
+
+case("integer arithmetic", function(i)
+	local a, b = i * 7919, i - 200
+	local d = b ~= 0 and b or 1
+	return a + b, a - b, a * b, a // d, a % d, -b, math.maxinteger + i, math.mininteger - i,
+		a & b, a | b, a ~ b, a << (i % 70), a >> (i % 70), ~a
+end)
+
+case("float arithmetic", function(i)
+	local x, y = i / 7, (i - 200) * 0.5
+	return x + y, x - y, x * y, x / y, x // 2.5, x % -3, -x % 3, x ^ 0.5, x * 1e308,
+		x / 0, -x / 0, 0 / 0, math.huge - math.huge, 1e308 + 1e308 - x
+end)
+
+case("mixed numbers and strings", function(i)
+	return i + 0.5, i * 1.0, i // 1.0, 3 % (i / 10), "10" + i, i .. "", 2 ^ i, i / 3 == i // 3
+end)
+
+case("errors", function(i)
+	local ok1, e1 = pcall(function() return i // 0 end)
+	local ok2, e2 = pcall(function() return i % 0 end)
+	local ok3, e3 = pcall(function() return i + {} end)
+	return ok1, e1, ok2, e2, ok3, (e3:gsub("^.-:%d+: ", ""))
+end)
+
+case("comparisons", function(i)
+	local n, f = 0 / 0, i + 0.0
+	return i < 2^53, i == f, math.maxinteger < math.maxinteger + 0.0, n == n, n < 1, 1 <= n,
+		i <= 100.5, i > 300, f >= 200, "a" .. i < "a" .. (i + 1), i ~= f, -0.0 == 0
+end)
+
+case("numeric for loops", function(i)
+	local s, c, down = 0, 0, 0
+	for x = 1, i / 10, 0.25 do s = s + x end
+	for k = math.maxinteger - 2, math.maxinteger do c = c + 1 end
+	for k = math.mininteger + 2, math.mininteger, -1 do c = c + 1 end
+	for k = i, 1, -3 do down = down + k end
+	for k = 1, 0 do c = c + 100 end
+	for x = 0.1, 1, 0.1 do c = c + 1 end
+	return s, c, down
+end)
+
+local Vector = {}
+Vector.__index = Vector
+Vector.__add = function(a, b) return setmetatable({ x = a.x + b.x, y = a.y + b.y }, Vector) end
+Vector.__eq = function(a, b) return a.x == b.x and a.y == b.y end
+Vector.__len = function(v) return v.x * v.x + v.y * v.y end
+function Vector:scaled(k) return setmetatable({ x = self.x * k, y = self.y * k }, Vector) end
+
+case("tables, shapes and methods", function(i)
+	local o = { x = i, y = 2 * i, z = 0 }
+	o.z = o.x + o.y
+	o.w = o.z * 2
+	if i % 3 == 0 then o.y = nil end
+	if i % 5 == 0 then o[1] = "array" o.extra = true end
+	local list = {}
+	for k = 1, i % 17 do list[k] = k * k end
+	list[2.0] = "two"
+	local v = setmetatable({ x = i, y = 1 }, Vector)
+	local sum = v + v:scaled(0.5)
+	return o.x, o.y, o.z, o.w, o[1], o.extra, #list, list[2], list[i % 17], list[100],
+		sum.x, sum.y, #sum, sum == v:scaled(1.5), rawlen(list)
+end)
+
+local counter = 0
+total = 0
+case("upvalues and globals", function(i)
+	counter = counter + i
+	total = total + counter % 7
+	local function add(k) counter = counter + k return counter end
+	local sumsq = 0
+	for k = 1, 10 do sumsq = sumsq + add(k) % 11 end
+	return counter, total, sumsq
+end)
+
+case("strings and length", function(i)
+	local s = ("x"):rep(i % 5) .. i
+	return #s, s:upper(), s:sub(2, 3), #{ 1, 2, 3, nil, 5 } >= 3, tostring(i / 2)
+end)
+
+local function show(v)
+	if math.type(v) == "float" then return "float", string.format("%a", v) end
+	return math.type(v) or type(v), tostring(v)
+end
+
+function run(calls)
+	local out = {}
+	for _, c in ipairs(cases) do
+		for i = 1, calls do
+			local results = table.pack(c.f(i))
+			local line = { c.name, i }
+			for r = 1, results.n do
+				local kind, text = show(results[r])
+				line[#line + 1] = kind .. " " .. (text or "")
+			end
+			out[#out + 1] = table.concat(line, " | ")
+		end
+	end
+	return table.concat(out, "\n")
+end
+)";
+
+static void NoHook(lua_State* L, lua_Debug* ar)
+{
+	(void)L;
+	(void)ar;
+}
+
+// Runs jitCasesScript and returns its output, or the error. Machine code is never entered while
+// a hook is set, so with interpretOnly every instruction runs in the interpreter.
+static std::string RunJitCases(bool interpretOnly)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	if (interpretOnly)
+		lua_sethook(L, NoHook, LUA_MASKCOUNT, INT_MAX);
+
+	std::string output;
+	if (luaL_dostring(L, jitCasesScript) != LUA_OK)
+		output = std::string("error: ") + lua_tostring(L, -1);
+	else
+	{
+		lua_getglobal(L, "run");
+		lua_pushinteger(L, JIT_TEST_CALLS);
+		if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+			output = std::string("error: ") + lua_tostring(L, -1);
+		else
+			output = lua_tostring(L, -1);
+	}
+	lua_close(L);
+	return output;
+}
+
+// ./Application --test-jit: runs the same cases with and without machine code and checks every
+// result matches, down to integer vs float and the bits of each float
+int RunJitTest()
+{
+	std::string interpreted = RunJitCases(true);
+	std::string compiled = RunJitCases(false);
+	if (interpreted.compare(0, 6, "error:") == 0)
+	{
+		std::cout << "FAILED: " << interpreted << std::endl;
+		return 1;
+	}
+
+	// Both print the same lines up to the first difference, show that line from each
+	size_t at = 0;
+	while (at < interpreted.size() && at < compiled.size() && interpreted[at] == compiled[at])
+		at++;
+	if (at < interpreted.size() || at < compiled.size())
+	{
+		size_t lineStart = at == 0 ? 0 : interpreted.rfind('\n', at - 1) + 1;
+		std::cout << "FAILED: the interpreter and the JIT disagree" << std::endl;
+		std::cout << "  interpreter: " << interpreted.substr(lineStart, interpreted.find('\n', lineStart) - lineStart) << std::endl;
+		std::cout << "  JIT:         " << compiled.substr(lineStart, compiled.find('\n', lineStart) - lineStart) << std::endl;
+		return 1;
+	}
+
+	std::cout << std::count(interpreted.begin(), interpreted.end(), '\n') + 1 << " results match between the interpreter and the JIT" << std::endl;
+	return 0;
+}
+
+// Each case is a chunk that errors when the scheduler misbehaves. A task resumed by hand that
+// runs the scheduler itself used to have its own heap entry resumed while it was running
+static const char* coroutineCases[][2] = {
+	{ "a task resumed by hand calls update", R"(
+		local ok, err
+		local task = coroutine.spawn(function()
+			coroutine.sleep(10)
+			ok, err = pcall(coroutine.update, 50)
+			coroutine.sleep(1)
+		end)
+		assert(coroutine.resume(task))
+		assert(ok and err == 0, "update resumed a running task")
+		assert(coroutine.status(task) == "suspended")
+		assert(coroutine.update(100) == 0, "the stale heap entry ran")
+		assert(coroutine.pending() == 0)
+	)" },
+	{ "a task finished by hand is dropped", R"(
+		local task = coroutine.spawn(function() coroutine.sleep(10) end)
+		assert(coroutine.resume(task))
+		assert(coroutine.status(task) == "dead")
+		assert(coroutine.update(100) == 0 and coroutine.pending() == 0)
+	)" },
+	{ "a closed task is dropped", R"(
+		local task = coroutine.spawn(function() coroutine.sleep(10) end)
+		assert(coroutine.close(task))
+		assert(coroutine.update(100) == 0 and coroutine.pending() == 0)
+	)" },
+	{ "a NaN sleep time fails", R"(
+		local ok, err = pcall(coroutine.spawn, function() coroutine.yield(0 / 0) end)
+		assert(not ok and err:find("not a number"), err)
+		assert(coroutine.pending() == 0)
+	)" },
+	{ "a negative sleep time wakes on the next update", R"(
+		local woke = false
+		coroutine.spawn(function() coroutine.sleep(-5) woke = true end)
+		assert(coroutine.update(0) == 1 and woke)
+	)" },
+};
+
+int RunCoroutineTest()
+{
+	int failed = 0;
+	for (const auto& test : coroutineCases)
+	{
+		lua_State* L = luaL_newstate();
+		luaL_openlibs(L);
+		if (luaL_dostring(L, test[1]) != LUA_OK)
+		{
+			std::cout << "FAILED: " << test[0] << ": " << lua_tostring(L, -1) << std::endl;
+			failed++;
+		}
+		lua_close(L);
+	}
+	if (failed == 0)
+		std::cout << sizeof(coroutineCases) / sizeof(coroutineCases[0]) << " scheduler cases pass" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
+
+// Profiles the same allocations at a few sampling intervals, down to every byte, which used to
+// hang: with an interval of 1 the distance to the next sample came out as 0
+static const char* memProfileScript = R"(
+if not collectgarbage("profile").types then return "off" end
+for _, interval in ipairs({ 1, 2, 3, 4096 }) do
+	keep = nil
+	collectgarbage()
+	local before = collectgarbage("profile", interval).types.table.count
+	keep = {}
+	for i = 1, 20000 do keep[i] = { i } end
+	local profile = collectgarbage("profile")
+	assert(profile.types.table.count - before == 20001, "table count")
+	assert(profile.sample >= interval, "sampling interval shrank")
+	local live = 0
+	for _, site in pairs(profile.sites) do live = live + site.bytes end
+	assert(live > 0, "no live bytes sampled at interval " .. interval)
+end
+collectgarbage("profile", 0)
+return "on"
+)";
+
+int RunMemProfileTest()
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	int status = luaL_dostring(L, memProfileScript);
+	std::string result = lua_tostring(L, -1);
+	lua_close(L);
+	if (status != LUA_OK)
+	{
+		std::cout << "FAILED: " << result << std::endl;
+		return 1;
+	}
+	if (result == "off")
+		std::cout << "Lua was built without LUAI_MEMPROFILE, nothing to check" << std::endl;
+	else
+		std::cout << "memory profile sampling at intervals 1, 2, 3 and 4096 passes" << std::endl;
+	return 0;
+}
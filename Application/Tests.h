@@ -0,0 +1,15 @@
+#pragma once
+
+// Checks run from the command line by main, without a window. They return the process exit
+// code, nonzero when a check fails.
+
+// --headless [ticks] [columns]
+int RunHeadless(int argc, char** argv);
+// --test-instance-buffer
+int RunInstanceBufferTest();
+// --test-jit
+int RunJitTest();
+// --test-coroutines
+int RunCoroutineTest();
+// --test-memprofile
+int RunMemProfileTest();
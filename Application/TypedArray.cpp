@@ -0,0 +1,151 @@
+#include "TypedArray.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+static const char* typedArrayNames[TYPED_ARRAY_TYPE_COUNT] = { "Float32Array", "Int32Array", "Uint8Array" };
+
+// Every metamethod carries its own metatable as upvalue 1, comparing against it is much
+// cheaper than luaL_checkudata looking the metatable up by name on every element access
+static TypedArray* CheckTypedArray(lua_State* L)
+{
+	void* array = lua_touserdata(L, 1);
+	if (array == NULL || !lua_getmetatable(L, 1) || !lua_rawequal(L, -1, lua_upvalueindex(1)))
+		luaL_typeerror(L, 1, "typed array");
+	lua_pop(L, 1);
+	return (TypedArray*)array;
+}
+
+// The owner clears data once the storage may have moved
+static void CheckAttached(lua_State* L, TypedArray* array)
+{
+	if (array->data == NULL)
+		luaL_error(L, "%s used after its storage was detached", typedArrayNames[array->type]);
+}
+
+// Lua indices are 1-based, the memory is not. Only integer keys exist, anything else errors
+// so that a typo like a.lenght is caught instead of silently reading nil.
+static unsigned char* CheckElement(lua_State* L, TypedArray* array, bool write)
+{
+	CheckAttached(L, array);
+	if (write && array->readonly)
+		luaL_error(L, "%s is read only", typedArrayNames[array->type]);
+
+	int isInteger;
+	lua_Integer index = lua_tointegerx(L, 2, &isInteger);
+	if (!isInteger)
+		luaL_error(L, "%s index must be an integer", typedArrayNames[array->type]);
+	if (index < 1 || index > array->length)
+		luaL_error(L, "%s index %d out of range 1..%d", typedArrayNames[array->type], (int)index, array->length);
+	return (unsigned char*)array->data + (size_t)(index - 1) * array->stride;
+}
+
+static int Float32Index(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	float value;
+	memcpy(&value, CheckElement(L, array, false), sizeof(value));
+	lua_pushnumber(L, value);
+	return 1;
+}
+
+// Doubles past the float range become infinities instead of an undefined conversion
+static int Float32NewIndex(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	lua_Number number = luaL_checknumber(L, 3);
+	float value = number > FLT_MAX ? INFINITY : number < -FLT_MAX ? -INFINITY : (float)number;
+	memcpy(CheckElement(L, array, true), &value, sizeof(value));
+	return 0;
+}
+
+static int Int32Index(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	int32_t value;
+	memcpy(&value, CheckElement(L, array, false), sizeof(value));
+	lua_pushinteger(L, value);
+	return 1;
+}
+
+static int Int32NewIndex(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	lua_Integer number = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, number >= INT32_MIN && number <= INT32_MAX, 3, "value out of Int32Array range");
+	int32_t value = (int32_t)number;
+	memcpy(CheckElement(L, array, true), &value, sizeof(value));
+	return 0;
+}
+
+static int Uint8Index(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	lua_pushinteger(L, *CheckElement(L, array, false));
+	return 1;
+}
+
+// Values are clamped like a Uint8ClampedArray, colors computed in Lua tend to overshoot.
+// Clamped as a double before converting, NaN stores 0.
+static int Uint8NewIndex(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	lua_Number value = luaL_checknumber(L, 3);
+	value = value >= 0.0 ? (value <= 255.0 ? value : 255.0) : 0.0;
+	*CheckElement(L, array, true) = (unsigned char)value;
+	return 0;
+}
+
+// The VM answers # for attached views, this only runs for detached ones
+static int TypedArrayLength(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	CheckAttached(L, array);
+	lua_pushinteger(L, array->length);
+	return 1;
+}
+
+static int TypedArrayToString(lua_State* L)
+{
+	TypedArray* array = CheckTypedArray(L);
+	lua_pushfstring(L, "%s(%d): %p", typedArrayNames[array->type], array->length, array->data);
+	return 1;
+}
+
+void RegisterTypedArrays(lua_State* L)
+{
+	static const lua_CFunction indexers[TYPED_ARRAY_TYPE_COUNT] = { Float32Index, Int32Index, Uint8Index };
+	static const lua_CFunction newIndexers[TYPED_ARRAY_TYPE_COUNT] = { Float32NewIndex, Int32NewIndex, Uint8NewIndex };
+
+	for (int type = 0; type < TYPED_ARRAY_TYPE_COUNT; type++)
+	{
+		if (!luaL_newmetatable(L, typedArrayNames[type]))
+		{
+			lua_pop(L, 1);
+			continue;
+		}
+
+		const luaL_Reg metamethods[] = {
+			{ "__index", indexers[type] },
+			{ "__newindex", newIndexers[type] },
+			{ "__len", TypedArrayLength },
+			{ "__tostring", TypedArrayToString },
+			{ NULL, NULL }
+		};
+		lua_pushvalue(L, -1);
+		luaL_setfuncs(L, metamethods, 1);
+		lua_pop(L, 1);
+	}
+}
+
+TypedArray* PushTypedArray(lua_State* L, TypedArrayType type, void* data, int length, int stride)
+{
+	TypedArray* array = lua_newview(L, type, 0);
+	array->data = data;
+	array->length = length;
+	array->stride = stride;
+	luaL_setmetatable(L, typedArrayNames[type]);
+	return array;
+}
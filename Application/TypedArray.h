@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+#include "lua.hpp"
+
+enum TypedArrayType
+{
+	TYPED_ARRAY_FLOAT32 = LUA_VIEWFLOAT32,
+	TYPED_ARRAY_INT32 = LUA_VIEWINT32,
+	TYPED_ARRAY_UINT8 = LUA_VIEWUINT8,
+	TYPED_ARRAY_TYPE_COUNT = LUA_NUMVIEWS
+};
+
+// A view onto memory owned by C++, indexed from Lua like a plain array (a[i], a[i] = v, #a)
+// without copying anything into Lua. stride is in bytes so one field of an array of structs,
+// like the y of every Position, can be viewed in place. The owner must keep data valid and
+// refresh the view whenever the storage moves, and set data to NULL when it goes away; a
+// detached view raises an error on every access. Writes to a readonly view raise an error.
+//
+// It is a lua_View, so the VM reads and writes in-range elements itself. The metatable only
+// sees the rest: errors, non-integer keys, and values it has to convert or clamp.
+typedef lua_View TypedArray;
+
+// Creates the Float32Array, Int32Array and Uint8Array metatables, call once per lua_State
+void RegisterTypedArrays(lua_State* L);
+
+// Pushes a new view userdata, the returned pointer stays valid while Lua holds the userdata
+TypedArray* PushTypedArray(lua_State* L, TypedArrayType type, void* data, int length, int stride);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Lock-free Chase-Lev deque. The owning thread pushes and pops at the bottom, in LIFO order so
+// the job it just spawned is still in its cache; any other thread steals from the top, taking
+// the oldest job. Only the last remaining job is contested, owner and thieves settle it with a
+// compare-exchange on top. Fixed capacity (a power of two), TryPush fails when full. T is
+// stored in atomics since a thief may read a slot while the owner is writing it, so it must
+// be something small and trivially copyable like a pointer.
+template <typename T, size_t Capacity>
+class WorkStealingQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "WorkStealingQueue capacity must be a power of two");
+	static_assert(std::is_trivially_copyable<T>::value, "WorkStealingQueue holds trivially copyable values");
+
+public:
+	// Owner only
+	bool TryPush(T value)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= (int64_t)Capacity)
+			return false;
+
+		slots[b & (Capacity - 1)].store(value, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only
+	bool TryPop(T& value)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			// Empty, undo the reservation
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		value = slots[b & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// Last job, a thief may be taking it at the same time
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// Any thread, returns false when empty or when it lost the race for the top job
+	bool TrySteal(T& value)
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+
+		value = slots[t & (Capacity - 1)].load(std::memory_order_relaxed);
+		return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// Approximate when other threads are pushing or stealing
+	bool Empty() const
+	{
+		return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+	}
+
+private:
+	std::atomic<T> slots[Capacity];
+
+	// On separate cache lines, thieves hammer top while the owner works on bottom. Padding
+	// rather than alignas, the queue lives in heap objects and C++14 new ignores alignas.
+	char padTop[64];
+	std::atomic<int64_t> top{ 0 };
+	char padBottom[64 - sizeof(int64_t)];
+	std::atomic<int64_t> bottom{ 0 };
+};
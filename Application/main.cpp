@@ -1,58 +1,86 @@
+#include <cstring>
 #include <iostream>
-#include <thread>
-#include <string>
+#include <vector>
 
 #include "lua.hpp"
 #include "raylib.h"
 #include "raymath.h"
 
-#define MAX_COLUMNS 10
-#define EPSILON 0.0001f
-
-void DumpError(lua_State* L)
-{
-	//Hmta toppen av lua stacken och kolla om det r en strng
-	if (lua_gettop(L) > 0 && lua_isstring(L, -1))
-	{
-		std::cout << "Lua error: " << lua_tostring(L, -1) << std::endl;
+#include "Benchmarks.h"
+#include "BoxBatch.h"
+#include "Collision.h"
+#include "Console.h"
+#include "FrustumCulling.h"
+#include "InstanceBuffer.h"
+#include "InstancedRenderer.h"
+#include "ScriptSystem.h"
+#include "Simulation.h"
+#include "Tests.h"
 
-		//Ta bort meddelandet frn stacken
-		lua_pop(L, 1);
-	}
-}
+#define EPSILON 0.0001f
 
-//Function som krs parallelt av trd
-void ConsoleThreadFunction(lua_State* L)
+int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--script-scaling") == 0)
+		return RunScriptScaling();
+	if (argc > 1 && strcmp(argv[1], "--gc-sweep") == 0)
+		return RunGcSweep();
+	if (argc > 1 && strcmp(argv[1], "--gc-budget") == 0)
+		return RunGcBudget();
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+		return RunHeadless(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "--bench-ecs") == 0)
+		return RunEcsBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-spatial-hash") == 0)
+		return RunSpatialHashBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-bvh") == 0)
+		return RunBvhBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-box-batch") == 0)
+		return RunBoxBatchBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--test-instance-buffer") == 0)
+		return RunInstanceBufferTest();
+	if (argc > 1 && strcmp(argv[1], "--bench-culling") == 0)
+		return RunCullingBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-script-systems") == 0)
+		return RunScriptSystemBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-typed-arrays") == 0)
+		return RunTypedArrayBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-fields") == 0)
+		return RunFieldBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--memory-report") == 0)
+		return RunMemoryReport();
+	if (argc > 1 && strcmp(argv[1], "--memory-report-coroutines") == 0)
+		return RunCoroutineMemoryReport();
+	if (argc > 1 && strcmp(argv[1], "--bench-coroutines") == 0)
+		return RunCoroutineBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-frame-gc") == 0)
+		return RunFrameGcBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-pool") == 0)
+		return RunPoolBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--bench-bindings") == 0)
+		return RunBindingBenchmark();
+	if (argc > 1 && strcmp(argv[1], "--test-jit") == 0)
+		return RunJitTest();
+	if (argc > 1 && strcmp(argv[1], "--test-coroutines") == 0)
+		return RunCoroutineTest();
+	if (argc > 1 && strcmp(argv[1], "--test-memprofile") == 0)
+		return RunMemProfileTest();
 
-	//Ls console input
-	std::string input;
-	//while (GetConsoleWindow())
-	//{
-	//	std::cout << "> ";
-	//	std::getline(std::cin, input);
-
-	//	//Frsk kra strngen som lua kod
-	//	if (luaL_dostring(L, input.c_str()) != LUA_OK)
-	//	{
-	//		DumpError(L);
-	//	}
-	//}
-}
-
-int main()
-{
 	std::cout << "Hello Bergman!" << std::endl;
 
     // LUA SKIT
 	//Rekommenderat att ha ett men gr att ha flera om det behvs
-	//lua_State* L = luaL_newstate();
+	lua_State* L = luaL_newpoolstate();
+
+	//ppnar standardbibliotek fr lua, gr s att kodstrngen gr att kra
+	luaL_openlibs(L);
 
-	////ppnar standardbibliotek fr lua, gr s att kodstrngen gr att kra
-	//luaL_openlibs(L);
+	//Varje ScriptSystem::Update r en frame region, skrpet frn en tick samlas in nr den slutar i generational mode
+	lua_gc(L, LUA_GCGEN, 0, 0);
 
-	////Skapa trd
-	//std::thread consoleThread(ConsoleThreadFunction, L);
+	//Konsolen lser rader p en egen trd, main loopen kr dem p L en gng per frame
+	Console console;
+	console.Start();
 
 	const int screenWidth = 800 * 2;
 	const int screenHeight = 450 * 2;
@@ -69,29 +97,26 @@ int main()
 
 	int cameraMode = CAMERA_FIRST_PERSON;
 
-	// Generates some random columns
-	float heights[MAX_COLUMNS] = { 0 };
-	Vector3 positions[MAX_COLUMNS] = { 0 };
-	Color colors[MAX_COLUMNS] = { 0 };
-    Vector3 playerSize = { 0.8f, 1.8f, 0.8f };
+	Simulation simulation(GetRandomValue(0, 0x7fffffff));
+	FixedTimestep timestep(SIM_FIXED_DT);
 
-    Vector3 previousPlayerPosition = { 0.0f, 1.0f, 2.0f };
-    Vector3 playerPosition = { 0.0f, 1.0f, 2.0f };
-    Vector3 playerSpeed = { 0, 0, 0 };
-    Vector3 lookDirection = { 0, 0, 1.0f };
-
-    bool collisionX = false;
-    bool collisionY = false;
-    bool collisionZ = false;
-    bool airborne = false;
-
-	for (int i = 0; i < MAX_COLUMNS; i++)
+	// A few moving platforms, driven by the "platforms" system in scripts/behaviors.lua
+	for (int i = 0; i < 3; i++)
 	{
-		heights[i] = 1.0f;
-		positions[i] = { (float)GetRandomValue(-15, -5), (float)(i + 2.0f), (float)GetRandomValue(5, 15)};
-		colors[i] = { (unsigned char)GetRandomValue(20, 255), (unsigned char)GetRandomValue(10, 55), 30, 255 };
+		Entity platform = simulation.SpawnBox({ 4.0f + i * 3.0f, 2.0f + i * 2.0f, 6.0f }, { 2.0f, 0.5f, 2.0f }, SKYBLUE, true);
+		simulation.GetWorld().Add(platform, Velocity{ { 0.0f, 1.5f + i * 0.5f, 0.0f } });
 	}
 
+	ScriptSystem scripts(L, simulation.GetWorld());
+	scripts.RunFile("scripts/behaviors.lua");
+	Vector3 lookDirection = { 0, 0, 1.0f };
+
+	BoxBatch columnBounds;
+	std::vector<uint32_t> visibleColumns;
+	InstanceBuffer columnInstances;
+	InstancedRenderer columnRenderer;
+	columnRenderer.Load();
+
 	DisableCursor();                    // Limit cursor to relative movement inside the window
 
 	SetTargetFPS(60);
@@ -128,174 +153,25 @@ int main()
         lookDirection = Vector3Normalize(camera.target - camera.position);
         camera.target = camera.position + lookDirection;
 
-        if (IsKeyDown(KEY_W))
-        {
-            playerSpeed.x += Vector3Scale(lookDirection, (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).x;
-            playerSpeed.z += Vector3Scale(lookDirection, (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).z;
-
-        }
-        if (IsKeyDown(KEY_S))
-        {
-            
-            playerSpeed.x -= Vector3Scale(lookDirection, (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).x;
-            playerSpeed.z -= Vector3Scale(lookDirection, (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).z;
-
-
-        }
-        if (IsKeyDown(KEY_A))
-        {
-            playerSpeed.x += Vector3Scale(Vector3RotateByAxisAngle(lookDirection, { 0, 1, 0 }, 90), (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).x;
-            playerSpeed.z += Vector3Scale(Vector3RotateByAxisAngle(lookDirection, { 0, 1, 0 }, 90), (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).z;
-
-        }
-        if (IsKeyDown(KEY_D))
-        {
-            playerSpeed.x -= Vector3Scale(Vector3RotateByAxisAngle(lookDirection, { 0, 1, 0 }, 90), (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).x;
-            playerSpeed.z -= Vector3Scale(Vector3RotateByAxisAngle(lookDirection, { 0, 1, 0 }, 90), (0.5f + IsKeyDown(KEY_LEFT_SHIFT))).z;
-
-        }
-        if (IsKeyDown(KEY_SPACE) && !airborne)
-        {
-            playerSpeed.y += 30.0f;
-            airborne = true;
-        }
-
-        playerSpeed.x *= 0.9f;
-        playerSpeed.z *= 0.9f;
-        playerSpeed.y -= 2.0f;
-
-        if (playerSpeed.y <= -50.0f)
-            playerSpeed.y = -50.0f;
+        SimInput input = { 0 };
+        input.lookDirection = lookDirection;
+        input.forward = IsKeyDown(KEY_W);
+        input.back = IsKeyDown(KEY_S);
+        input.left = IsKeyDown(KEY_A);
+        input.right = IsKeyDown(KEY_D);
+        input.jump = IsKeyDown(KEY_SPACE);
+        input.sprint = IsKeyDown(KEY_LEFT_SHIFT);
 
-        playerPosition = Vector3Add(playerPosition, Vector3Scale(playerSpeed, GetFrameTime()));
+        console.Execute(L);
 
-        if (playerPosition.y < 1.0f)
+        int steps = timestep.Advance(GetFrameTime());
+        for (int i = 0; i < steps; i++)
         {
-            playerSpeed.y = 0.0f;
-            playerPosition.y = 1.0f;
-            airborne = false;
+            scripts.Update(timestep.GetDt());
+            simulation.Step(timestep.GetDt(), input);
         }
 
 
-        for (size_t i = 0; i < MAX_COLUMNS; i++)
-        {
-            if (CheckCollisionBoxes(
-                BoundingBox{
-                Vector3 {
-                    playerPosition.x - playerSize.x / 2,
-                        previousPlayerPosition.y - playerSize.y / 2,
-                        previousPlayerPosition.z - playerSize.z / 2
-                    },
-                    Vector3 {
-                    playerPosition.x + playerSize.x / 2,
-                        previousPlayerPosition.y + playerSize.y / 2,
-                        previousPlayerPosition.z + playerSize.z / 2
-                    }
-                },
-                BoundingBox{
-                Vector3 {
-                    float(positions[i].x - 1.0f),
-                    float(positions[i].y - 0.5f),
-                    float(positions[i].z - 1.0f)
-                },
-                Vector3 {
-                    float(positions[i].x + 1.0f),
-                    float(positions[i].y + 0.5f),
-                    float(positions[i].z + 1.0f)
-                }
-                })) 
-            {
-                playerSpeed.x *= 0.2f;
-                collisionX = true;
-            }
-
-            if (CheckCollisionBoxes(
-                BoundingBox{
-                Vector3 {
-                previousPlayerPosition.x - playerSize.x / 2,
-                    previousPlayerPosition.y - playerSize.y / 2,
-                    playerPosition.z - playerSize.z / 2
-                },
-                Vector3 {
-                previousPlayerPosition.x + playerSize.x / 2,
-                    previousPlayerPosition.y + playerSize.y / 2,
-                    playerPosition.z + playerSize.z / 2
-                }
-                },
-                BoundingBox{
-                Vector3 {
-                    float(positions[i].x - 1.0f),
-                    float(positions[i].y - 0.5f),
-                    float(positions[i].z - 1.0f)
-                },
-                    Vector3 {
-                    float(positions[i].x + 1.0f),
-                    float(positions[i].y + 0.5f),
-                    float(positions[i].z + 1.0f)
-                }
-                })) 
-            {
-                playerSpeed.z *= 0.2f;
-                collisionZ = true;
-            }
-
-            if (CheckCollisionBoxes(
-                BoundingBox{
-                Vector3 {
-                previousPlayerPosition.x - playerSize.x / 2,
-                    playerPosition.y - playerSize.y / 2,
-                    previousPlayerPosition.z - playerSize.z / 2
-                },
-                Vector3 {
-                previousPlayerPosition.x + playerSize.x / 2,
-                    playerPosition.y + playerSize.y / 2,
-                    previousPlayerPosition.z + playerSize.z / 2
-                }
-                },
-                BoundingBox{
-                Vector3 {
-                    float(positions[i].x - 1.0f),
-                    float(positions[i].y - 0.5f),
-                    float(positions[i].z - 1.0f)
-                },
-                    Vector3 {
-                    float(positions[i].x + 1.0f),
-                    float(positions[i].y + 0.5f),
-                    float(positions[i].z + 1.0f)
-                }
-                }))
-            {
-                collisionY = true;
-                if (playerSpeed.y < 0)
-                    airborne = false;
-                else
-                    playerSpeed.y = 0;
-                playerSpeed.y *= 0.2f;
-            }
-        }
-        
-
-
-
-        if (collisionX)
-            playerPosition.x = previousPlayerPosition.x;
-        else
-            previousPlayerPosition.x = playerPosition.x;
-
-        if (collisionZ)
-            playerPosition.z = previousPlayerPosition.z;
-        else
-            previousPlayerPosition.z = playerPosition.z;
-        if (collisionY)
-            playerPosition.y = previousPlayerPosition.y;
-        else
-            previousPlayerPosition.y = playerPosition.y;
-
-        collisionX = false;
-        collisionZ = false;
-        collisionY = false;
-
-
         // Switch camera projection
         if (IsKeyPressed(KEY_P))
         {
@@ -359,6 +235,33 @@ int main()
 
         // Draw
         //----------------------------------------------------------------------------------
+        // Pick the column under the crosshair
+        Entity picked = NULL_ENTITY;
+        float pickedDistance = 0.0f;
+        Ray pickRay = GetScreenToWorldRay(Vector2{ screenWidth / 2.0f, screenHeight / 2.0f }, camera);
+        simulation.PickBox(pickRay, 100.0f, picked, pickedDistance);
+
+        // Cull the columns against the camera, then gather the visible ones into the
+        // instance buffer, only changed instances get re-uploaded
+        Registry& world = simulation.GetWorld();
+        columnBounds.Clear();
+        world.Each<Position, BoxShape, Tint>([&](uint32_t entity, Position& position, BoxShape& shape, Tint&)
+        {
+            columnBounds.Push(BoxAround(position.value, shape.size), entity);
+        });
+
+        visibleColumns.clear();
+        CullBoxes(columnBounds, FrustumFromCamera(camera, (float)screenWidth / screenHeight), camera.position, COLUMN_DRAW_DISTANCE, visibleColumns);
+
+        columnInstances.Begin();
+        for (uint32_t entity : visibleColumns)
+        {
+            //columnInstances.Add(world.Pool<Position>().Get(entity).value, world.Pool<BoxShape>().Get(entity).size, world.Pool<Tint>().Get(entity).color);
+            columnInstances.Add(world.Pool<Position>().Get(entity).value, world.Pool<BoxShape>().Get(entity).size, RED);
+        }
+        columnInstances.End();
+        columnRenderer.Upload(columnInstances);
+
         BeginDrawing();
 
         ClearBackground(RAYWHITE);
@@ -367,15 +270,21 @@ int main()
 
         DrawPlane({ 0.0f, 0.0f, 0.0f }, { 32.0f, 32.0f }, LIGHTGRAY); // Draw ground
 
-        // Draw some cubes around
-        for (int i = 0; i < MAX_COLUMNS; i++)
+        // Draw some cubes around, all columns in one instanced draw
+        columnRenderer.Draw(columnInstances, BLACK);
+
+        // The picked box may have been destroyed since it was picked
+        const Position* pickedPosition = simulation.GetWorld().TryGet<Position>(picked);
+        const BoxShape* pickedShape = simulation.GetWorld().TryGet<BoxShape>(picked);
+        if (pickedPosition != nullptr && pickedShape != nullptr)
         {
-            //DrawCube(positions[i], 2.0f, heights[i], 2.0f, colors[i]);
-            DrawCube(positions[i], 2.0f, heights[i], 2.0f, RED);
-            DrawCubeWires(positions[i], 2.0f, heights[i], 2.0f, BLACK);
+            Vector3 size = pickedShape->size;
+            DrawCubeWires(pickedPosition->value, size.x * 1.02f, size.y * 1.02f, size.z * 1.02f, GOLD);
         }
 
-        // Draw player cube
+        // Draw player cube, blended between the last two simulation ticks
+        Vector3 playerPosition = simulation.GetInterpolatedPlayerPosition(timestep.GetAlpha());
+        Vector3 playerSize = simulation.GetPlayerSize();
         DrawCube(playerPosition, playerSize.x, playerSize.y, playerSize.z, PURPLE);
         DrawCubeWires(playerPosition, playerSize.x, playerSize.y, playerSize.z, DARKPURPLE);
 
@@ -410,7 +319,12 @@ int main()
         EndDrawing();
 	}
 
+	columnRenderer.Unload();
+
 	CloseWindow();
 
+	scripts.Clear();
+	lua_close(L);
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+-- Entity behaviors. An ecs.each system runs once per simulation tick for every entity that
+-- has all the listed components, with their fields as numbers in order and the entity index
+-- last, and returns the new field values in the same order (nil keeps a field as it was).
+--
+-- ecs.system runs once per tick with the whole group instead: positions.y is a Float32Array
+-- over the y of every Position in place and index i of each array is the same entity.
+-- positions:get(i) / positions:set(i, x, y, z) work too but cost a method call per entity, as
+-- do positions:getv(i) / positions:set(i, v) with vec values. For per-entity math like the
+-- one below ecs.each is the faster of the two.
+
+-- Moving platforms: integrate velocity and bounce between two heights
+ecs.each("platforms", { "Position", "Velocity" }, function(dt, x, y, z, vx, vy, vz)
+	local newY = y + vy * dt
+	if (newY > 8 and vy > 0) or (newY < 1.5 and vy < 0) then
+		vy = -vy
+	end
+
+	return x + vx * dt, newY, z + vz * dt, vx, vy, vz
+end)
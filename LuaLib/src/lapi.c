@@ -488,6 +488,53 @@ LUA_API const void *lua_topointer (lua_State *L, int idx) {
 }
 
 
+/*
+** Copies the lanes of the vector at 'idx' into 'v' (which must have
+** room for three floats). Returns 0, leaving 'v' untouched, if the
+** value is not a vector.
+*/
+LUA_API int lua_tovector (lua_State *L, int idx, float *v) {
+  const TValue *o = index2value(L, idx);
+  if (!ttisvector(o))
+    return 0;
+  v[0] = vecx(o); v[1] = vecy(o); v[2] = vecz(o);
+  return 1;
+}
+
+
+/*
+** Checks the first 'n' arguments of the running C function in one pass.
+** 'sig[i]' is the basic type expected for argument i + 1, LUA_SIGINTEGER
+** for an integer or LUA_SIGANY for any value (but not none); a full
+** userdata whose 'mts[i]' is not NULL must have that metatable, compared
+** by pointer (as given by 'lua_topointer'). Returns 0 if every argument
+** matches, or else the index of the first one that doesn't, for the
+** caller to check again the slower way (it may just need a conversion)
+** and to report.
+*/
+LUA_API int lua_checkargs (lua_State *L, int n, const unsigned char *sig,
+                                             const void *const *mts) {
+  StkId base = L->ci->func.p + 1;
+  int nargs = cast_int(L->top.p - base);
+  int i;
+  for (i = 0; i < n; i++) {
+    const TValue *o;
+    if (i >= nargs)
+      return i + 1;  /* missing argument */
+    o = s2v(base + i);
+    if (ttype(o) != sig[i]) {
+      if (sig[i] == LUA_SIGANY || (sig[i] == LUA_SIGINTEGER && ttisinteger(o)))
+        continue;
+      return i + 1;
+    }
+    if (sig[i] == LUA_TUSERDATA && mts[i] != NULL &&
+        uvalue(o)->metatable != mts[i])  /* (LUA_TUSERDATA is always full) */
+      return i + 1;
+  }
+  return 0;
+}
+
+
 
 /*
 ** push functions (C -> stack)
@@ -630,6 +677,14 @@ LUA_API int lua_pushthread (lua_State *L) {
 }
 
 
+LUA_API void lua_pushvector (lua_State *L, float x, float y, float z) {
+  lua_lock(L);
+  setvecvalue(s2v(L->top.p), x, y, z);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 
 /*
 ** get functions (Lua -> stack)
@@ -765,6 +820,13 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   t = luaH_new(L);
   sethvalue2s(L, L->top.p, t);
   api_incr_top(L);
+#if LUAI_SHAPES
+  /* a few fields go to the shape; many make it a dictionary */
+  if (nrec > LUAI_MAXSHAPEKEYS)
+    luaH_noshape(t);
+  else
+    nrec = 0;
+#endif
   if (narray > 0 || nrec > 0)
     luaH_resize(L, t, narray, nrec);
   luaC_checkGC(L);
@@ -1204,6 +1266,7 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
         g->genminormul = minormul;
       if (majormul != 0)
         setgcparam(g->genmajormul, majormul);
+      g->gcbudget = 0;  /* minor collections cannot be time-sliced */
       luaC_changemode(L, KGC_GEN);
       break;
     }
@@ -1221,6 +1284,17 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCBUDGET: {
+      int stepusec = va_arg(argp, int);
+      int frameusec = va_arg(argp, int);
+      res = cast_int(g->gcbudget);
+      g->gcbudget = (stepusec > 0) ? cast(lu_mem, stepusec) : 0;
+      g->gcframebudget = (frameusec > 0) ? cast(lu_mem, frameusec) : 0;
+      g->gcowed = 0;
+      if (g->gcbudget != 0)
+        luaC_changemode(L, KGC_INC);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1229,6 +1303,44 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
 }
 
 
+LUA_API void lua_beginframe (lua_State *L) {
+  if (G(L)->gcstp & GCSTPGC)  /* internal stop? */
+    return;
+  lua_lock(L);
+  luaC_beginframe(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_endframe (lua_State *L) {
+  if (G(L)->gcstp & GCSTPGC)  /* internal stop? */
+    return;
+  lua_lock(L);
+  luaC_endframe(L);
+  lua_unlock(L);
+}
+
+
+/*
+** Objects already handed to the previous sweeper stay with it; the host
+** must let it finish every batch before closing the state.
+*/
+LUA_API void lua_setsweeper (lua_State *L, lua_Sweeper f, void *ud) {
+  lua_lock(L);
+  luaC_setsweeper(L, f, ud);
+  lua_unlock(L);
+}
+
+
+/*
+** May run on any thread, concurrently with the state's own; the state's
+** allocator must allow that (see 'lua_setsweeper' in lua.h).
+*/
+LUA_API void lua_freebatch (void *batch) {
+  luaC_freebatch(batch);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1354,6 +1466,34 @@ LUA_API void *lua_newuserdatauv (lua_State *L, size_t size, int nuvalue) {
 
 
 
+/*
+** A userdata holding a detached view; the host sets 'data', 'length'
+** and 'stride', and gives it a metatable for everything the VM does not
+** handle itself.
+*/
+LUA_API lua_View *lua_newview (lua_State *L, int type, int nuvalue) {
+  Udata *u;
+  lua_View *v;
+  lua_lock(L);
+  api_check(L, 0 <= type && type < LUA_NUMVIEWS, "invalid view type");
+  api_check(L, 0 <= nuvalue && nuvalue < USHRT_MAX, "invalid value");
+  u = luaS_newudata(L, sizeof(lua_View), nuvalue);
+  u->isview = 1;
+  v = (lua_View *)getudatamem(u);
+  v->data = NULL;
+  v->length = 0;
+  v->stride = 0;
+  v->type = type;
+  v->readonly = 0;
+  setuvalue(L, s2v(L->top.p), u);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return v;
+}
+
+
+
 static const char *aux_upvalue (TValue *fi, int n, TValue **val,
                                 GCObject **owner) {
   switch (ttypetag(fi)) {
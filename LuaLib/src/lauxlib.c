@@ -16,6 +16,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
 
 /*
 ** This file uses only the official API of Lua.
@@ -429,6 +433,12 @@ LUALIB_API lua_Number luaL_checknumber (lua_State *L, int arg) {
 }
 
 
+LUALIB_API void luaL_checkvector (lua_State *L, int arg, float *v) {
+  if (l_unlikely(!lua_tovector(L, arg, v)))
+    tag_error(L, arg, LUA_TVECTOR);
+}
+
+
 LUALIB_API lua_Number luaL_optnumber (lua_State *L, int arg, lua_Number def) {
   return luaL_opt(L, luaL_checknumber, arg, def);
 }
@@ -919,6 +929,16 @@ LUALIB_API const char *luaL_tolstring (lua_State *L, int idx, size_t *len) {
       case LUA_TNIL:
         lua_pushliteral(L, "nil");
         break;
+      case LUA_TVECTOR: {
+        float v[3];
+        char lane[3][32];
+        int l;
+        lua_tovector(L, idx, v);
+        for (l = 0; l < 3; l++)  /* 7 digits are enough for a float */
+          l_sprintf(lane[l], sizeof(lane[l]), "%.7g", (LUAI_UACNUMBER)v[l]);
+        lua_pushfstring(L, "vector(%s, %s, %s)", lane[0], lane[1], lane[2]);
+        break;
+      }
       default: {
         int tt = luaL_getmetafield(L, idx, "__name");  /* try name */
         const char *kind = (tt == LUA_TSTRING) ? lua_tostring(L, -1) :
@@ -956,6 +976,189 @@ LUALIB_API void luaL_setfuncs (lua_State *L, const luaL_Reg *l, int nup) {
 }
 
 
+/*
+** {======================================================
+** Typed C functions: the signature is parsed once, when the function
+** is created, and each call checks all arguments with a single
+** 'lua_checkargs', comparing userdata metatables by pointer instead of
+** looking them up by name. Only when that fails do the arguments go
+** through the usual 'luaL_check*' functions, which accept the same
+** conversions as before (e.g., a numeric string for a number) and raise
+** the same errors.
+** =======================================================
+*/
+
+typedef struct TypedFunc {
+  lua_CFunction f;
+  int n;  /* number of declared arguments */
+  unsigned char sig[LUAL_MAXSIGARGS];  /* 'lua_checkargs' codes */
+  unsigned char opt[LUAL_MAXSIGARGS];  /* true if nil or none is also ok */
+  const void *mts[LUAL_MAXSIGARGS];  /* metatables of userdata arguments */
+} TypedFunc;
+
+
+static const struct {
+  const char *name;
+  unsigned char code;
+} sigtypes[] = {
+  {"nil", LUA_TNIL}, {"boolean", LUA_TBOOLEAN},
+  {"lightuserdata", LUA_TLIGHTUSERDATA}, {"number", LUA_TNUMBER},
+  {"integer", LUA_SIGINTEGER}, {"string", LUA_TSTRING},
+  {"table", LUA_TTABLE}, {"function", LUA_TFUNCTION},
+  {"userdata", LUA_TUSERDATA}, {"thread", LUA_TTHREAD},
+  {"vector", LUA_TVECTOR}, {"any", LUA_SIGANY}
+};
+
+
+/*
+** Error for argument 'arg', which should be a full userdata with the
+** metatable kept as user value 'arg' of the signature
+*/
+static int udataerror (lua_State *L, int arg) {
+  const char *tname = "userdata";
+  lua_getiuservalue(L, lua_upvalueindex(1), arg);
+  if (lua_getfield(L, -1, "__name") == LUA_TSTRING)
+    tname = lua_tostring(L, -1);  /* (the metatable keeps it alive) */
+  lua_pop(L, 2);  /* 'arg' may be past the top, and 'none' */
+  return luaL_typeerror(L, arg, tname);
+}
+
+
+/*
+** Slow path, from the first argument 'lua_checkargs' rejected: each
+** argument is checked like the 'luaL_check*' call it replaces.
+*/
+static void checktypedargs (lua_State *L, const TypedFunc *tf, int arg) {
+  for (; arg <= tf->n; arg++) {
+    int code = tf->sig[arg - 1];
+    if (tf->opt[arg - 1] && lua_isnoneornil(L, arg))
+      continue;
+    switch (code) {
+      case LUA_SIGANY: luaL_checkany(L, arg); break;
+      case LUA_SIGINTEGER: luaL_checkinteger(L, arg); break;
+      case LUA_TNUMBER: luaL_checknumber(L, arg); break;
+      case LUA_TSTRING: luaL_checklstring(L, arg, NULL); break;
+      case LUA_TUSERDATA: {
+        if (tf->mts[arg - 1] != NULL) {
+          int ok = 0;
+          if (!lua_islightuserdata(L, arg) && lua_getmetatable(L, arg)) {
+            ok = (lua_topointer(L, -1) == tf->mts[arg - 1]);
+            lua_pop(L, 1);
+          }
+          if (!ok)
+            udataerror(L, arg);
+        }
+        else
+          luaL_checktype(L, arg, LUA_TUSERDATA);
+        break;
+      }
+      default: luaL_checktype(L, arg, code); break;
+    }
+  }
+}
+
+
+static int typedcall (lua_State *L) {
+  const TypedFunc *tf =
+      (const TypedFunc *)lua_touserdata(L, lua_upvalueindex(1));
+  int arg = lua_checkargs(L, tf->n, tf->sig, tf->mts);
+  if (l_unlikely(arg != 0))
+    checktypedargs(L, tf, arg);
+  return tf->f(L);
+}
+
+
+/*
+** Parses one signature item, 's' with length 'l', into argument 'i' of
+** the signature at the top of the stack
+*/
+static void parsesigitem (lua_State *L, TypedFunc *tf, int i,
+                          const char *s, size_t l) {
+  size_t k;
+  while (l > 0 && s[l - 1] == ' ') l--;  /* trailing spaces */
+  tf->opt[i] = (l > 0 && s[l - 1] == '?');
+  if (tf->opt[i]) l--;
+  tf->mts[i] = NULL;
+  if (l > 6 && memcmp(s, "udata:", 6) == 0) {
+    lua_pushlstring(L, s + 6, l - 6);
+    if (lua_rawget(L, LUA_REGISTRYINDEX) != LUA_TTABLE)
+      luaL_error(L, "no metatable named '%s' for a typed function",
+                    lua_pushlstring(L, s + 6, l - 6));
+    tf->sig[i] = LUA_TUSERDATA;
+    tf->mts[i] = lua_topointer(L, -1);
+    lua_setiuservalue(L, -2, i + 1);  /* keep the metatable alive */
+    return;
+  }
+  for (k = 0; k < sizeof(sigtypes) / sizeof(sigtypes[0]); k++) {
+    if (strlen(sigtypes[k].name) == l && memcmp(s, sigtypes[k].name, l) == 0) {
+      tf->sig[i] = sigtypes[k].code;
+      return;
+    }
+  }
+  luaL_error(L, "unknown type '%s' in a typed function signature",
+                lua_pushlstring(L, s, l));
+}
+
+
+/*
+** Pushes a C closure calling 'f' once its arguments match 'signature',
+** a comma-separated list of type names ("number", "integer", "string",
+** "table", "vector", "any", etc., or "udata:Name" for a full userdata
+** with the metatable registered as "Name"), each optionally followed by
+** '?' to also accept nil or none. As 'lua_pushcclosure', it pops 'nup'
+** values as upvalues; 'f' finds them with 'luaL_typedupvalueindex', as
+** the first upvalue holds the parsed signature.
+*/
+LUALIB_API void luaL_pushtypedfunction (lua_State *L, lua_CFunction f,
+                                        const char *signature, int nup) {
+  const char *s = signature;
+  int nuv = 1;
+  TypedFunc *tf;
+  while ((s = strchr(s, ',')) != NULL) {  /* count the items */
+    nuv++;
+    s++;
+  }
+  if (nuv > LUAL_MAXSIGARGS)
+    luaL_error(L, "too many arguments in typed function signature");
+  tf = (TypedFunc *)lua_newuserdatauv(L, sizeof(TypedFunc), nuv);
+  tf->f = f;
+  tf->n = 0;
+  s = signature;
+  while (*s == ' ') s++;
+  if (*s != '\0') {  /* not an empty signature? */
+    for (;;) {
+      size_t l;
+      while (*s == ' ') s++;
+      l = strcspn(s, ",");
+      parsesigitem(L, tf, tf->n++, s, l);
+      if (s[l] == '\0') break;
+      s += l + 1;
+    }
+  }
+  lua_insert(L, -(nup + 1));  /* signature below the other upvalues */
+  lua_pushcclosure(L, typedcall, nup + 1);
+}
+
+
+/*
+** Same as 'luaL_setfuncs', for a list of typed functions
+*/
+LUALIB_API void luaL_settypedfuncs (lua_State *L, const luaL_TypedReg *l,
+                                    int nup) {
+  luaL_checkstack(L, nup + 3, "too many upvalues");
+  for (; l->name != NULL; l++) {
+    int i;
+    for (i = 0; i < nup; i++)  /* copy upvalues to the top */
+      lua_pushvalue(L, -nup);
+    luaL_pushtypedfunction(L, l->func, l->signature, nup);
+    lua_setfield(L, -(nup + 2), l->name);
+  }
+  lua_pop(L, nup);  /* remove upvalues */
+}
+
+/* }====================================================== */
+
+
 /*
 ** ensure that stack[idx][fname] has a table and push that table
 ** into the stack
@@ -1034,6 +1237,322 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================
+** Pool allocator
+** =======================================================
+*/
+
+/*
+** A state made by 'luaL_newpoolstate' takes its small blocks (tables,
+** closures, upvalues, short strings...) from pages holding blocks of a
+** single size class; bigger blocks go to the system. Pages are aligned
+** to their size, so a block finds the header of its page by masking
+** its address. A freed block goes back to the free list of its page;
+** a page whose blocks are all free is kept for reuse, up to
+** LUAL_POOLKEEP of them, and the rest go back to the system (which is
+** what happens to most pages after a full collection). A pool belongs
+** to a single state, so it needs no locks.
+*/
+
+/* size of a page; must be a power of 2 */
+#if !defined(LUAL_POOLPAGE)
+#define LUAL_POOLPAGE		(16 * 1024)
+#endif
+
+/* number of empty pages kept for reuse */
+#if !defined(LUAL_POOLKEEP)
+#define LUAL_POOLKEEP		8
+#endif
+
+
+/* largest block served by the pool */
+#define POOLMAXSMALL	512
+
+#define POOLNCLASSES	16
+
+static const unsigned short classsize[POOLNCLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/* size class for a given size, indexed by the size in 16-byte units */
+static const unsigned char sizeclass[POOLMAXSMALL / 16 + 1] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7,  /* up to 128 */
+  8, 8, 9, 9, 10, 10, 11, 11,  /* up to 256 */
+  12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+};
+
+#define getclass(sz)	sizeclass[((sz) + 15) >> 4]
+
+
+typedef struct PoolPage {
+  struct PoolPage *next, *prev;  /* in the list of pages of its class */
+  void *mem;  /* what the system gave, to give it back */
+  void *free;  /* freed blocks, linked through their first word */
+  unsigned int carved;  /* blocks ever handed out from this page */
+  unsigned int used;  /* blocks in use */
+  unsigned int nblocks;
+  unsigned int cls;
+} PoolPage;
+
+
+/* blocks start after the page header, 16-byte aligned */
+#define PAGEHEADER	((sizeof(PoolPage) + 15) & ~(size_t)15)
+
+#define pageof(p)  \
+	((PoolPage *)((size_t)(p) & ~(size_t)(LUAL_POOLPAGE - 1)))
+
+
+/*
+** A large block shrunk to a small size when the pool cannot get a page
+** for the new size stays where it is, as shrinking must not fail. Such
+** a "kept" block records its size after its first POOLMAXSMALL bytes,
+** which Lua no longer uses, and so large blocks are never smaller than
+** POOLMINLARGE. Kept blocks are linked in a list that small frees and
+** reallocations search while it is not empty, that is, only after the
+** pool ran out of memory.
+*/
+typedef struct KeptBlock {
+  void *next;  /* next kept block */
+  size_t size;  /* its size as a large block */
+} KeptBlock;
+
+#define keptof(b)	((KeptBlock *)((char *)(b) + POOLMAXSMALL))
+
+#define POOLMINLARGE	(POOLMAXSMALL + sizeof(KeptBlock))
+
+#define largesize(n)	((n) < POOLMINLARGE ? POOLMINLARGE : (n))
+
+
+typedef struct Pool {
+  PoolPage *avail[POOLNCLASSES];  /* pages with free blocks, by class */
+  PoolPage *empty;  /* empty pages kept for reuse */
+  void *kept;  /* list of kept blocks */
+  void *first;  /* first block handed out: the state itself */
+  int closing;  /* freeing 'first' destroys the pool */
+  luaL_PoolStats stats;
+} Pool;
+
+
+static void *allocpage (void) {
+#if defined(_WIN32)
+  return _aligned_malloc(LUAL_POOLPAGE, LUAL_POOLPAGE);
+#elif !defined(LUA_USE_C89)
+  void *mem;
+  return (posix_memalign(&mem, LUAL_POOLPAGE, LUAL_POOLPAGE) == 0) ? mem : NULL;
+#else
+  return malloc(2 * LUAL_POOLPAGE);  /* page is aligned inside it */
+#endif
+}
+
+
+static void freepage (PoolPage *page) {
+#if defined(_WIN32)
+  _aligned_free(page->mem);
+#else
+  free(page->mem);
+#endif
+}
+
+
+static PoolPage *newpage (Pool *pool, unsigned int cls) {
+  PoolPage *page = pool->empty;
+  if (page != NULL) {  /* reuse an empty page? */
+    pool->empty = page->next;
+    pool->stats.emptypages--;
+  }
+  else {
+    void *mem = allocpage();
+    if (mem == NULL)
+      return NULL;
+    page = pageof((char *)mem + LUAL_POOLPAGE - 1);
+    page->mem = mem;
+  }
+  page->free = NULL;
+  page->carved = page->used = 0;
+  page->nblocks = (unsigned int)((LUAL_POOLPAGE - PAGEHEADER) / classsize[cls]);
+  page->cls = cls;
+  page->prev = NULL;
+  page->next = pool->avail[cls];
+  if (page->next != NULL)
+    page->next->prev = page;
+  pool->avail[cls] = page;
+  pool->stats.pages++;
+  return page;
+}
+
+
+static void unlinkpage (Pool *pool, PoolPage *page) {
+  if (page->prev != NULL)
+    page->prev->next = page->next;
+  else
+    pool->avail[page->cls] = page->next;
+  if (page->next != NULL)
+    page->next->prev = page->prev;
+}
+
+
+static void *allocsmall (Pool *pool, size_t size) {
+  unsigned int cls = getclass(size);
+  PoolPage *page = pool->avail[cls];
+  void *block;
+  if (page == NULL && (page = newpage(pool, cls)) == NULL)
+    return NULL;
+  if (page->free != NULL) {
+    block = page->free;
+    page->free = *(void **)block;
+  }
+  else
+    block = (char *)page + PAGEHEADER + (size_t)page->carved++ * classsize[cls];
+  if (++page->used == page->nblocks)  /* page is full? */
+    unlinkpage(pool, page);  /* it is at the head of its list */
+  pool->stats.requested += size;
+  pool->stats.blockbytes += classsize[cls];
+  return block;
+}
+
+
+static void freesmall (Pool *pool, void *block, size_t size) {
+  PoolPage *page = pageof(block);
+  *(void **)block = page->free;
+  page->free = block;
+  pool->stats.requested -= size;
+  pool->stats.blockbytes -= classsize[page->cls];
+  if (page->used-- == page->nblocks) {  /* page was full? */
+    page->prev = NULL;  /* it has free blocks again */
+    page->next = pool->avail[page->cls];
+    if (page->next != NULL)
+      page->next->prev = page;
+    pool->avail[page->cls] = page;
+  }
+  else if (page->used == 0) {  /* page is empty? */
+    unlinkpage(pool, page);
+    pool->stats.pages--;
+    if (pool->stats.emptypages < LUAL_POOLKEEP) {
+      page->next = pool->empty;
+      pool->empty = page;
+      pool->stats.emptypages++;
+    }
+    else {
+      freepage(page);
+      pool->stats.pagesreleased++;
+    }
+  }
+}
+
+
+static void destroypool (Pool *pool) {
+  lua_assert(pool->stats.pages == 0 && pool->stats.largebytes == 0);
+  lua_assert(pool->kept == NULL);
+  while (pool->empty != NULL) {
+    PoolPage *page = pool->empty;
+    pool->empty = page->next;
+    freepage(page);
+  }
+  free(pool);
+}
+
+
+/*
+** Reallocates 'ptr' into 'res' if it is a kept block; returns 0 if it is
+** not one. A kept block already has room for any small size.
+*/
+static int reallockept (Pool *pool, void *ptr, size_t nsize, void **res) {
+  void **link = &pool->kept;
+  KeptBlock *kb = keptof(ptr);
+  size_t size;
+  while (*link != ptr) {
+    if (*link == NULL)
+      return 0;
+    link = &keptof(*link)->next;
+  }
+  if (nsize > 0 && nsize <= POOLMAXSMALL) {  /* still fits? */
+    *res = ptr;
+    return 1;
+  }
+  *link = kb->next;  /* the block stops being kept */
+  size = kb->size;
+  if (nsize == 0) {
+    free(ptr);
+    pool->stats.largebytes -= size;
+    *res = NULL;
+  }
+  else if ((*res = realloc(ptr, largesize(nsize))) != NULL)
+    pool->stats.largebytes += nsize - size;
+  else {  /* keep it again */
+    kb->next = pool->kept;
+    pool->kept = ptr;
+  }
+  return 1;
+}
+
+
+static void *l_poolalloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *pool = (Pool *)ud;
+  void *block;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is the kind of object being created */
+  else if (l_unlikely(pool->kept != NULL) && osize <= POOLMAXSMALL &&
+           reallockept(pool, ptr, nsize, &block))
+    return block;
+  if (nsize == 0) {
+    if (ptr == NULL)
+      return NULL;
+    if (osize <= POOLMAXSMALL)
+      freesmall(pool, ptr, osize);
+    else {
+      free(ptr);
+      pool->stats.largebytes -= osize;
+    }
+    if (ptr == pool->first && pool->closing)  /* state was closed? */
+      destroypool(pool);
+    return NULL;
+  }
+  if (osize > POOLMAXSMALL && nsize > POOLMAXSMALL) {  /* stays large? */
+    block = realloc(ptr, largesize(nsize));
+    if (block != NULL)
+      pool->stats.largebytes += nsize - osize;
+    return block;
+  }
+  if (ptr != NULL && osize <= POOLMAXSMALL && nsize <= POOLMAXSMALL &&
+      getclass(nsize) == pageof(ptr)->cls) {  /* same class? */
+    pool->stats.requested += nsize - osize;
+    return ptr;
+  }
+  if (nsize <= POOLMAXSMALL)
+    block = allocsmall(pool, nsize);
+  else if ((block = malloc(largesize(nsize))) != NULL)
+    pool->stats.largebytes += nsize;
+  if (block == NULL) {
+    if (ptr != NULL && nsize < osize) {  /* shrinking must not fail */
+      if (osize <= POOLMAXSMALL)  /* keep the bigger block */
+        pool->stats.requested -= osize - nsize;
+      else {  /* keep the large block */
+        keptof(ptr)->next = pool->kept;
+        keptof(ptr)->size = osize;
+        pool->kept = ptr;
+      }
+      return ptr;
+    }
+    return NULL;
+  }
+  if (ptr != NULL) {
+    memcpy(block, ptr, (osize < nsize) ? osize : nsize);
+    if (osize <= POOLMAXSMALL)
+      freesmall(pool, ptr, osize);
+    else {
+      free(ptr);
+      pool->stats.largebytes -= osize;
+    }
+  }
+  else if (pool->first == NULL)
+    pool->first = block;
+  return block;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Standard panic funcion just prints an error message. The test
 ** with 'lua_type' avoids possible memory errors in 'lua_tostring'.
@@ -1115,6 +1634,42 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** Same as 'luaL_newstate', but the state allocates from a pool of its
+** own (see 'l_poolalloc'), released by 'lua_close'.
+*/
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  lua_State *L;
+  Pool *pool = (Pool *)malloc(sizeof(Pool));
+  if (pool == NULL)
+    return NULL;
+  memset(pool, 0, sizeof(Pool));
+  L = lua_newstate(l_poolalloc, pool);
+  if (l_unlikely(L == NULL)) {
+    destroypool(pool);  /* everything it allocated is already freed */
+    return NULL;
+  }
+  pool->closing = 1;
+  lua_atpanic(L, &panic);
+  lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
+  return L;
+}
+
+
+/*
+** Fills 'stats' with the memory figures of a state made by
+** 'luaL_newpoolstate'; returns 0 if the state has another allocator.
+*/
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *stats) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != l_poolalloc)
+    return 0;
+  *stats = ((Pool *)ud)->stats;
+  stats->pagebytes = stats->pages * LUAL_POOLPAGE;
+  return 1;
+}
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -58,6 +58,7 @@ LUALIB_API const char *(luaL_optlstring) (lua_State *L, int arg,
                                           const char *def, size_t *l);
 LUALIB_API lua_Number (luaL_checknumber) (lua_State *L, int arg);
 LUALIB_API lua_Number (luaL_optnumber) (lua_State *L, int arg, lua_Number def);
+LUALIB_API void (luaL_checkvector) (lua_State *L, int arg, float *v);
 
 LUALIB_API lua_Integer (luaL_checkinteger) (lua_State *L, int arg);
 LUALIB_API lua_Integer (luaL_optinteger) (lua_State *L, int arg,
@@ -100,6 +101,20 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
 
+/* memory figures of a state made by 'luaL_newpoolstate' */
+typedef struct luaL_PoolStats {
+  size_t requested;  /* bytes the state holds in pool blocks */
+  size_t blockbytes;  /* size of those blocks, rounded to their classes */
+  size_t pagebytes;  /* size of the pages holding them */
+  size_t pages;  /* pages holding blocks */
+  size_t emptypages;  /* empty pages kept for reuse */
+  size_t pagesreleased;  /* empty pages given back to the system */
+  size_t largebytes;  /* bytes in blocks too big for the pool */
+} luaL_PoolStats;
+
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *stats);
+
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
 LUALIB_API void (luaL_addgsub) (luaL_Buffer *b, const char *s,
@@ -109,6 +124,24 @@ LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s,
 
 LUALIB_API void (luaL_setfuncs) (lua_State *L, const luaL_Reg *l, int nup);
 
+/* typed C functions, whose arguments are checked before they run */
+typedef struct luaL_TypedReg {
+  const char *name;
+  lua_CFunction func;
+  const char *signature;  /* e.g. "udata:Entity, number, number?" */
+} luaL_TypedReg;
+
+/* most arguments a typed function signature can declare */
+#define LUAL_MAXSIGARGS		16
+
+/* the first upvalue of a typed function holds its signature */
+#define luaL_typedupvalueindex(i)	lua_upvalueindex((i) + 1)
+
+LUALIB_API void (luaL_pushtypedfunction) (lua_State *L, lua_CFunction f,
+                                          const char *signature, int nup);
+LUALIB_API void (luaL_settypedfuncs) (lua_State *L, const luaL_TypedReg *l,
+                                      int nup);
+
 LUALIB_API int (luaL_getsubtable) (lua_State *L, int idx, const char *fname);
 
 LUALIB_API void (luaL_traceback) (lua_State *L, lua_State *L1,
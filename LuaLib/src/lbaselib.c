@@ -196,15 +196,24 @@ static int pushmode (lua_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+/* "profile" is not a 'lua_gc' option (see 'lua_memprofile') */
+#define GCPROFILE	(-1)
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "budget", "profile", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCBUDGET, GCPROFILE};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
+    case GCPROFILE: {
+      lua_Integer sample = luaL_optinteger(L, 2, -1);
+      luaL_argcheck(L, sample <= INT_MAX, 2, "sampling interval too large");
+      lua_memprofile(L, (int)(sample < 0 ? -1 : sample));
+      return 1;
+    }
     case LUA_GCCOUNT: {
       int k = lua_gc(L, o);
       int b = lua_gc(L, LUA_GCCOUNTB);
@@ -244,6 +253,14 @@ static int luaB_collectgarbage (lua_State *L) {
       int stepsize = (int)luaL_optinteger(L, 4, 0);
       return pushmode(L, lua_gc(L, o, pause, stepmul, stepsize));
     }
+    case LUA_GCBUDGET: {
+      int stepusec = (int)luaL_optinteger(L, 2, 0);
+      int frameusec = (int)luaL_optinteger(L, 3, 0);
+      int previous = lua_gc(L, o, stepusec, frameusec);
+      checkvalres(previous);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
     default: {
       int res = lua_gc(L, o);
       checkvalres(res);
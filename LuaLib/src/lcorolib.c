@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <limits.h>
 #include <stdlib.h>
 
 #include "lua.h"
@@ -189,6 +190,264 @@ static int luaB_close (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Scheduler: thousands of coroutines sleeping until a wake time,
+** resumed in wake order by 'coroutine.update(now)' once per frame.
+** A task yielding a number sleeps that long (in the same unit as
+** 'now'); yielding anything else waits for the next update. Closing a
+** sleeping task with 'coroutine.close' cancels it.
+** =======================================================
+*/
+
+
+typedef struct Sleeper {
+  lua_Number wake;  /* time to resume it */
+  lua_Unsigned seq;  /* arrival order; ties wake first in, first out */
+  int ref;  /* the thread, in the scheduler's thread table */
+} Sleeper;
+
+
+typedef struct Scheduler {
+  Sleeper *heap;  /* binary min-heap ordered by ('wake', 'seq') */
+  int n;  /* number of sleepers */
+  int size;  /* size of 'heap' */
+  lua_Number now;  /* time given to the last update */
+  lua_Unsigned seq;  /* next arrival number */
+} Scheduler;
+
+
+/* the scheduler is the only upvalue of its functions */
+#define getsched(L)	((Scheduler *)lua_touserdata(L, lua_upvalueindex(1)))
+
+
+static int earlier (const Sleeper *a, const Sleeper *b) {
+  return a->wake < b->wake || (a->wake == b->wake && a->seq < b->seq);
+}
+
+
+/*
+** Doubles the heap; returns 0 (leaving it untouched) when out of
+** memory, so callers can release what they hold before raising.
+*/
+static int growheap (lua_State *L, Scheduler *s) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  int newsize = (s->size > 0) ? s->size * 2 : 64;
+  void *newheap;
+  if (l_unlikely(s->size > INT_MAX / 2))
+    return 0;
+  newheap = allocf(ud, s->heap, s->size * sizeof(Sleeper),
+                                newsize * sizeof(Sleeper));
+  if (l_unlikely(newheap == NULL))
+    return 0;
+  s->heap = (Sleeper *)newheap;
+  s->size = newsize;
+  return 1;
+}
+
+
+/* inserts a sleeper; the heap must have room for it */
+static void pushsleeper (Scheduler *s, int ref, lua_Number wake) {
+  Sleeper e;
+  int i = s->n++;
+  e.wake = wake;
+  e.seq = s->seq++;
+  e.ref = ref;
+  while (i > 0) {  /* sift up */
+    int parent = (i - 1) / 2;
+    if (!earlier(&e, &s->heap[parent]))
+      break;
+    s->heap[i] = s->heap[parent];
+    i = parent;
+  }
+  s->heap[i] = e;
+}
+
+
+/* removes and returns the earliest sleeper; the heap can't be empty */
+static Sleeper popsleeper (Scheduler *s) {
+  Sleeper first = s->heap[0];
+  Sleeper last = s->heap[--s->n];
+  int i = 0;
+  for (;;) {  /* sift 'last' down from the root */
+    int child = 2 * i + 1;
+    if (child >= s->n)
+      break;
+    if (child + 1 < s->n && earlier(&s->heap[child + 1], &s->heap[child]))
+      child++;
+    if (!earlier(&s->heap[child], &last))
+      break;
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+  if (s->n > 0)
+    s->heap[i] = last;
+  return first;
+}
+
+
+/*
+** Resumes task 'co' (stored under 'ref' in the thread table at index
+** 't') with 'narg' arguments already on its stack. A yield puts it
+** back to sleep for the yielded time; a negative time counts as zero,
+** and NaN, which would never wake and would break the heap order, is an
+** error. Returning releases the task, so the dead thread goes back to
+** the thread pool at the next collection. Errors propagate to the
+** caller after closing the task's pending to-be-closed variables.
+*/
+static void resumetask (lua_State *L, Scheduler *s, int t,
+                        lua_State *co, int ref, int narg) {
+  int nres;
+  int status = lua_resume(co, L, narg, &nres);
+  if (l_likely(status == LUA_YIELD)) {
+    lua_Number dt = (nres > 0) ? lua_tonumber(co, -nres) : 0;
+    lua_pop(co, nres);
+    if (l_unlikely(dt != dt)) {  /* NaN? */
+      lua_closethread(co, L);  /* the task is dropped */
+      luaL_unref(L, t, ref);
+      luaL_error(L, "task yielded a sleep time that is not a number");
+    }
+    if (dt < 0)
+      dt = 0;
+    if (l_unlikely(s->n == s->size && !growheap(L, s))) {
+      luaL_unref(L, t, ref);
+      luaL_error(L, "not enough memory");
+    }
+    pushsleeper(s, ref, s->now + dt);
+  }
+  else if (status == LUA_OK) {  /* task finished */
+    lua_pop(co, nres);
+    luaL_unref(L, t, ref);
+  }
+  else {
+    lua_closethread(co, L);  /* close its tbc variables */
+    lua_xmove(co, L, 1);  /* move error message */
+    luaL_unref(L, t, ref);
+    lua_error(L);  /* propagate error */
+  }
+}
+
+
+/*
+** coroutine.spawn(f, ...): runs 'f(...)' in a new coroutine right away,
+** up to its first yield, and returns the coroutine
+*/
+static int sched_spawn (lua_State *L) {
+  Scheduler *s = getsched(L);
+  int narg = lua_gettop(L) - 1;
+  int ref;
+  lua_State *co;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  if (l_unlikely(s->n == s->size && !growheap(L, s)))
+    return luaL_error(L, "not enough memory");
+  lua_getiuservalue(L, lua_upvalueindex(1), 1);  /* thread table */
+  co = lua_newthread(L);
+  lua_pushvalue(L, -1);
+  ref = luaL_ref(L, -3);  /* anchor the thread while it is scheduled */
+  lua_rotate(L, 1, 2);  /* thread table and thread below 'f' and args */
+  if (l_unlikely(!lua_checkstack(co, narg + 1))) {
+    luaL_unref(L, 1, ref);
+    return luaL_error(L, "too many arguments to spawn");
+  }
+  lua_xmove(L, co, narg + 1);  /* move 'f' and its arguments */
+  resumetask(L, s, 1, co, ref, narg);
+  return 1;  /* the thread */
+}
+
+
+/*
+** coroutine.sleep(dt): suspends the running task for 'dt' time units
+** (the same as yielding 'dt')
+*/
+static int sched_sleep (lua_State *L) {
+  lua_Number dt = luaL_checknumber(L, 1);
+  luaL_argcheck(L, dt == dt, 1, "not a number");  /* NaN never wakes */
+  lua_settop(L, 0);
+  lua_pushnumber(L, dt);
+  return lua_yield(L, 1);
+}
+
+
+/*
+** coroutine.update(now): resumes, in wake order, every task whose wake
+** time is not after 'now'. Tasks that go back to sleep during this call
+** wait at least until the next one, even with a zero delay. A task no
+** longer suspended in a yield (closed with 'coroutine.close', or resumed
+** with 'coroutine.resume' and then finished, failed, or still running)
+** is dropped instead. Returns how many tasks ran.
+*/
+static int sched_update (lua_State *L) {
+  Scheduler *s = getsched(L);
+  lua_Number now = luaL_checknumber(L, 1);
+  lua_Unsigned last = s->seq;  /* first arrival of this update */
+  lua_Integer count = 0;
+  luaL_argcheck(L, now == now, 1, "not a number");  /* wakes go off 'now' */
+  s->now = now;
+  lua_settop(L, 1);
+  lua_getiuservalue(L, lua_upvalueindex(1), 1);  /* thread table */
+  while (s->n > 0 && s->heap[0].wake <= now && s->heap[0].seq < last) {
+    Sleeper e = popsleeper(s);
+    lua_State *co;
+    lua_rawgeti(L, 2, e.ref);
+    co = lua_tothread(L, -1);
+    lua_pop(L, 1);  /* the thread table still anchors it */
+    if (lua_status(co) != LUA_YIELD)  /* not suspended in a yield? */
+      luaL_unref(L, 2, e.ref);  /* closed, dead, or taken over by hand */
+    else {
+      resumetask(L, s, 2, co, e.ref, 0);
+      count++;
+    }
+  }
+  lua_pushinteger(L, count);
+  return 1;
+}
+
+
+/* coroutine.pending(): number of sleeping tasks */
+static int sched_pending (lua_State *L) {
+  lua_pushinteger(L, getsched(L)->n);
+  return 1;
+}
+
+
+static int sched_gc (lua_State *L) {
+  Scheduler *s = (Scheduler *)lua_touserdata(L, 1);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, s->heap, s->size * sizeof(Sleeper), 0);
+  s->heap = NULL;
+  s->n = s->size = 0;
+  return 0;
+}
+
+
+static const luaL_Reg sched_funcs[] = {
+  {"spawn", sched_spawn},
+  {"sleep", sched_sleep},
+  {"update", sched_update},
+  {"pending", sched_pending},
+  {NULL, NULL}
+};
+
+
+static void newscheduler (lua_State *L) {
+  Scheduler *s = (Scheduler *)lua_newuserdatauv(L, sizeof(Scheduler), 1);
+  s->heap = NULL;
+  s->n = s->size = 0;
+  s->now = 0;
+  s->seq = 0;
+  lua_newtable(L);  /* threads of the sleeping tasks */
+  lua_setiuservalue(L, -2, 1);
+  lua_createtable(L, 0, 1);  /* metatable to free the heap */
+  lua_pushcfunction(L, sched_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg co_funcs[] = {
   {"create", luaB_cocreate},
   {"resume", luaB_coresume},
@@ -205,6 +464,8 @@ static const luaL_Reg co_funcs[] = {
 
 LUAMOD_API int luaopen_coroutine (lua_State *L) {
   luaL_newlib(L, co_funcs);
+  newscheduler(L);  /* shared by the scheduler functions */
+  luaL_setfuncs(L, sched_funcs, 1);
   return 1;
 }
 
@@ -454,6 +454,12 @@ static int db_setcstacklimit (lua_State *L) {
 }
 
 
+static int db_opprofile (lua_State *L) {
+  lua_opprofile(L, lua_toboolean(L, 1));
+  return 1;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -472,6 +478,7 @@ static const luaL_Reg dblib[] = {
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
   {"setcstacklimit", db_setcstacklimit},
+  {"opprofile", db_opprofile},
   {NULL, NULL}
 };
 
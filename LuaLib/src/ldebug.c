@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -29,6 +30,10 @@
 #include "ltm.h"
 #include "lvm.h"
 
+#if LUAI_OPPROFILE
+#include "lopnames.h"
+#endif
+
 
 
 #define LuaClosure(f)		((f) != NULL && (f)->c.tt == LUA_VLCL)
@@ -157,6 +162,341 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** Push a table mapping "OPA OPB" to the number of times opcode OPB ran
+** right after opcode OPA, and return the number of pairs in it. The
+** table is empty unless Lua was built with LUAI_OPPROFILE. If 'reset'
+** is true, the counts start again from zero.
+*/
+LUA_API int lua_opprofile (lua_State *L, int reset) {
+  int n = 0;
+  Table *t;
+  lua_lock(L);
+  t = luaH_new(L);
+  sethvalue2s(L, L->top.p, t);
+  api_incr_top(L);
+#if LUAI_OPPROFILE
+  {
+    global_State *g = G(L);
+    int a, b;
+    for (a = 0; a < NUM_OPCODES; a++) {
+      for (b = 0; b < NUM_OPCODES; b++) {
+        if (g->oppairs[a][b] > 0) {
+          TValue count;
+          luaO_pushfstring(L, "%s %s", opnames[a], opnames[b]);
+          setivalue(&count, cast(lua_Integer, g->oppairs[a][b]));
+          luaH_set(L, t, s2v(L->top.p - 1), &count);
+          luaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+          L->top.p--;
+          n++;
+        }
+      }
+    }
+    if (reset)
+      memset(g->oppairs, 0, sizeof(g->oppairs));
+  }
+#else
+  UNUSED(reset);
+#endif
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return n;
+}
+
+
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+#if LUAI_MEMPROFILE
+
+/* a source line where sampled objects were created */
+typedef struct MemSite {
+  char source[LUA_IDSIZE];
+  int line;  /* -1 for allocations outside any Lua function */
+  lu_mem allocs;  /* bytes the samples taken here stand for */
+  lu_mem live;  /* same, for the samples whose objects are not freed yet */
+  lu_mem peak;  /* highest 'live' */
+} MemSite;
+
+
+/* a sampled object not freed yet */
+typedef struct MemSampled {
+  GCObject *o;
+  int site;
+  lu_mem weight;  /* bytes it stands for */
+} MemSampled;
+
+
+typedef struct MemProfile {
+  l_mem interval;  /* mean bytes allocated between two samples */
+  unsigned int rand;
+  int nsites;
+  int nsampled;
+  MemSite sites[LUAI_MEMSITES];
+  MemSampled sampled[LUAI_MEMSAMPLED];
+} MemProfile;
+
+
+/*
+** Bytes until the next sample, uniform in (interval/2, 3*interval/2]
+** so that allocation patterns with a fixed period do not alias with
+** the sampling. It is never 0, which would stall 'luaG_memsample' with
+** an interval of 1.
+*/
+static l_mem nextsample (MemProfile *mp) {
+  mp->rand = mp->rand * 1103515245u + 12345u;
+  return mp->interval / 2 + 1 +
+         cast(l_mem, (mp->rand >> 8) % cast(unsigned int, mp->interval));
+}
+
+
+/*
+** Site of the current allocation: the line running in the innermost
+** Lua function (allocations of C functions go to their Lua caller).
+** When the table is full, its last entry takes all new sites.
+*/
+static int findsite (lua_State *L, MemProfile *mp) {
+  char source[LUA_IDSIZE];
+  int line = -1;
+  int i;
+  CallInfo *ci = L->ci;
+  while (ci != &L->base_ci && !isLua(ci))
+    ci = ci->previous;
+  if (isLua(ci)) {
+    Proto *p = ci_func(ci)->p;
+    if (p->source != NULL)
+      luaO_chunkid(source, getstr(p->source), tsslen(p->source));
+    else
+      strcpy(source, "?");
+    line = getcurrentline(ci);
+  }
+  else
+    strcpy(source, "[C]");
+  for (i = 0; i < mp->nsites; i++) {
+    if (mp->sites[i].line == line && strcmp(mp->sites[i].source, source) == 0)
+      return i;
+  }
+  if (mp->nsites == LUAI_MEMSITES)
+    return LUAI_MEMSITES - 1;
+  if (mp->nsites == LUAI_MEMSITES - 1) {  /* last free entry? */
+    strcpy(source, "(other)");
+    line = -1;
+  }
+  i = mp->nsites++;
+  strcpy(mp->sites[i].source, source);
+  mp->sites[i].line = line;
+  mp->sites[i].allocs = mp->sites[i].live = mp->sites[i].peak = 0;
+  return i;
+}
+
+
+/*
+** Called when the sampled objects fill their table: drops about half of
+** them at random and doubles the weight of the others, which keeps the
+** estimates of live bytes right on average, and samples half as often
+** from then on, so that the table does not fill up again at once.
+*/
+static void thinsamples (MemProfile *mp) {
+  int i = 0;
+  while (i < mp->nsampled) {
+    MemSampled *e = &mp->sampled[i];
+    mp->rand = mp->rand * 1103515245u + 12345u;
+    if (mp->rand & 0x10000u) {  /* keep it? */
+      mp->sites[e->site].live += e->weight;
+      e->weight *= 2;
+      i++;
+    }
+    else {
+      resetbit(e->o->marked, SAMPLEDBIT);
+      mp->sites[e->site].live -= e->weight;
+      *e = mp->sampled[--mp->nsampled];
+    }
+  }
+  if (mp->interval <= MAX_INT / 2)
+    mp->interval *= 2;
+}
+
+
+/*
+** Called by 'luaC_countnew' for the object that crossed the sampling
+** point. It stands for the bytes allocated since the last sample.
+*/
+void luaG_memsample (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  MemProfile *mp = g->memprof;
+  MemSite *site;
+  lu_mem weight = 0;
+  int s;
+  if (mp == NULL) {  /* sampling is off? */
+    g->memsample = MAX_LMEM;
+    return;
+  }
+  do {  /* a big object may cross more than one sampling point */
+    weight += cast(lu_mem, mp->interval);
+    g->memsample += nextsample(mp);
+  } while (g->memsample < 0);
+  s = findsite(L, mp);
+  site = &mp->sites[s];
+  site->allocs += weight;
+  if (mp->nsampled == LUAI_MEMSAMPLED)
+    thinsamples(mp);
+  if (mp->nsampled < LUAI_MEMSAMPLED) {  /* can follow it until freed? */
+    MemSampled *e = &mp->sampled[mp->nsampled++];
+    e->o = o;
+    e->site = s;
+    e->weight = weight;
+    l_setbit(o->marked, SAMPLEDBIT);
+    site->live += weight;
+    if (site->live > site->peak)
+      site->peak = site->live;
+  }
+}
+
+
+void luaG_memunsample (lua_State *L, GCObject *o) {
+  MemProfile *mp = G(L)->memprof;
+  int i;
+  resetbit(o->marked, SAMPLEDBIT);
+  if (mp == NULL)
+    return;
+  for (i = mp->nsampled - 1; i >= 0; i--) {
+    if (mp->sampled[i].o == o) {
+      mp->sites[mp->sampled[i].site].live -= mp->sampled[i].weight;
+      mp->sampled[i] = mp->sampled[--mp->nsampled];
+      return;
+    }
+  }
+}
+
+
+static void clearsamples (MemProfile *mp) {
+  int i;
+  for (i = 0; i < mp->nsampled; i++)
+    resetbit(mp->sampled[i].o->marked, SAMPLEDBIT);
+  mp->nsampled = mp->nsites = 0;
+}
+
+
+void luaG_freememprofile (lua_State *L) {
+  global_State *g = G(L);
+  if (g->memprof != NULL) {
+    clearsamples(g->memprof);
+    luaM_free(L, g->memprof);
+    g->memprof = NULL;
+  }
+  g->memsample = MAX_LMEM;
+}
+
+
+static void setcount (lua_State *L, const char *k, lu_mem v) {
+  lua_pushinteger(L, l_castU2S(v));
+  lua_setfield(L, -2, k);
+}
+
+
+#if defined(LUAI_ASSERT)
+/* the bytes counted as objects come and go match a walk over the heap */
+static int checkmembytes (lua_State *L) {
+  lu_mem bytes[LUA_TOTALTYPES];
+  int t;
+  memset(bytes, 0, sizeof(bytes));
+  luaC_heapsizes(L, bytes);
+  for (t = 0; t <= LUA_TPROTO; t++) {
+    if (bytes[t] != G(L)->membytes[t])
+      return 0;
+  }
+  return 1;
+}
+#endif
+
+#endif
+
+
+/*
+** Push a table with the allocation profile and return the number of
+** source lines in it:
+**   types: for each type, 'count' objects not freed yet, holding
+**     'bytes' (with what they own), the 'peak' of those bytes, and
+**     'allocs' objects created;
+**   sites: for each sampled "source:line", estimated 'bytes' not freed
+**     yet, their 'peak', and 'allocated' bytes;
+**   sample: bytes between samples (0 when sampling is off); it doubles
+**     each time more than LUAI_MEMSAMPLED sampled objects are alive.
+** If 'sample' is not negative, the allocation counts, peaks and sites
+** start again from zero, sampling every 'sample' bytes (0 turns it
+** off). The table is empty unless Lua was built with LUAI_MEMPROFILE.
+*/
+LUA_API int lua_memprofile (lua_State *L, int sample) {
+  int n = 0;
+#if LUAI_MEMPROFILE
+  global_State *g = G(L);
+  MemProfile *mp = g->memprof;
+  lu_mem interval = (mp != NULL) ? cast(lu_mem, mp->interval) : 0;
+  int t, i;
+  lua_assert(checkmembytes(L));
+  lua_createtable(L, 0, 3);
+  lua_createtable(L, 0, 8);
+  for (t = 0; t <= LUA_TPROTO; t++) {
+    if (g->memallocs[t] > 0 || g->memcount[t] > 0) {
+      lua_createtable(L, 0, 4);
+      setcount(L, "count", g->memcount[t]);
+      setcount(L, "bytes", g->membytes[t]);
+      setcount(L, "peak", g->mempeak[t]);
+      setcount(L, "allocs", g->memallocs[t]);
+      lua_setfield(L, -2, ttypename(t));
+    }
+  }
+  lua_setfield(L, -2, "types");
+  lua_newtable(L);
+  if (mp != NULL) {
+    n = mp->nsites;  /* the table may get sites while it is being built */
+    for (i = 0; i < n; i++) {
+      MemSite *site = &mp->sites[i];
+      if (site->line >= 0)
+        lua_pushfstring(L, "%s:%d", site->source, site->line);
+      else
+        lua_pushstring(L, site->source);
+      lua_createtable(L, 0, 3);
+      setcount(L, "bytes", site->live);
+      setcount(L, "peak", site->peak);
+      setcount(L, "allocated", site->allocs);
+      lua_rawset(L, -3);
+    }
+  }
+  lua_setfield(L, -2, "sites");
+  setcount(L, "sample", interval);
+  if (sample >= 0) {  /* start again? */
+    for (t = 0; t <= LUA_TPROTO; t++) {
+      g->memallocs[t] = 0;
+      g->mempeak[t] = g->membytes[t];
+    }
+    if (sample == 0)
+      luaG_freememprofile(L);
+    else {
+      if (g->memprof == NULL) {
+        g->memprof = luaM_new(L, MemProfile);
+        g->memprof->rand = g->seed;
+        g->memprof->nsites = g->memprof->nsampled = 0;
+      }
+      else
+        clearsamples(g->memprof);
+      g->memprof->interval = sample;
+      g->memsample = nextsample(g->memprof);
+    }
+  }
+#else
+  lua_newtable(L);
+  UNUSED(sample);
+#endif
+  return n;
+}
+
+/* }====================================================== */
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
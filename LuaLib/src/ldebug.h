@@ -59,6 +59,11 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC int luaG_traceexec (lua_State *L, const Instruction *pc);
 LUAI_FUNC int luaG_tracecall (lua_State *L);
+#if LUAI_MEMPROFILE
+LUAI_FUNC void luaG_memsample (lua_State *L, GCObject *o);
+LUAI_FUNC void luaG_memunsample (lua_State *L, GCObject *o);
+LUAI_FUNC void luaG_freememprofile (lua_State *L);
+#endif
 
 
 #endif
@@ -229,6 +229,7 @@ int luaD_reallocstack (lua_State *L, int newsize, int raiseerror) {
   L->stack.p = newstack;
   correctstack(L);  /* change offsets back to pointers */
   L->stack_last.p = L->stack.p + newsize;
+  luaC_countthread(L, L, (newsize - oldsize) * cast(l_mem, sizeof(StackValue)));
   for (i = oldsize + EXTRA_STACK; i < newsize + EXTRA_STACK; i++)
     setnilvalue(s2v(newstack + i)); /* erase new segment */
   return 1;
@@ -296,19 +297,45 @@ static int stackinuse (lua_State *L) {
 ** it is not, 'max' (limited by LUAI_MAXSTACK) will be smaller than
 ** stacksize (equal to ERRORSTACKSIZE in this case), and so the stack
 ** will be reduced to a "regular" size.
+** A coroutine that stayed suspended in a C function since the previous
+** collection is cut down to exactly its current use, and loses all its
+** spare CallInfos, as it may well stay idle for much longer. Nothing
+** runs again in the yielding C frame when it has no continuation, so
+** its reserve is first cut back to the LUA_MINSTACK free slots that the
+** C API promises to whoever pushes the values for the next resume.
+** (Coroutines resumed in the meantime keep the usual policy, or every
+** collection would trim stacks that the next resume grows back.)
 */
 void luaD_shrinkstack (lua_State *L) {
-  int inuse = stackinuse(L);
-  int max = (inuse > LUAI_MAXSTACK / 3) ? LUAI_MAXSTACK : inuse * 3;
+  int suspended = (L->status == LUA_YIELD && !isLua(L->ci) && !L->resumed);
+  int inuse, max, nci;
+  L->resumed = 0;
+  if (suspended && L->ci->u.c.k == NULL &&
+      L->ci->top.p - L->top.p > LUA_MINSTACK)
+    L->ci->top.p = L->top.p + LUA_MINSTACK;  /* trim the frame's reserve */
+  inuse = stackinuse(L);
+  if (suspended)
+    max = inuse;
+  else
+    max = (inuse > LUAI_MAXSTACK / 3) ? LUAI_MAXSTACK : inuse * 3;
   /* if thread is currently not handling a stack overflow and its
      size is larger than maximum "reasonable" size, shrink it */
   if (inuse <= LUAI_MAXSTACK && stacksize(L) > max) {
-    int nsize = (inuse > LUAI_MAXSTACK / 2) ? LUAI_MAXSTACK : inuse * 2;
+    int nsize;
+    if (suspended)
+      nsize = inuse;
+    else
+      nsize = (inuse > LUAI_MAXSTACK / 2) ? LUAI_MAXSTACK : inuse * 2;
     luaD_reallocstack(L, nsize, 0);  /* ok if that fails */
   }
   else  /* don't change stack */
     condmovestack(L,{},{});  /* (change only for debugging) */
-  luaE_shrinkCI(L);  /* shrink CI list */
+  nci = L->nci;
+  if (suspended)
+    luaE_freeCI(L);  /* free the whole CI list */
+  else
+    luaE_shrinkCI(L);  /* shrink CI list */
+  luaC_countthread(L, L, (L->nci - nci) * cast(l_mem, sizeof(CallInfo)));
 }
 
 
@@ -848,6 +875,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
   if (getCcalls(L) >= LUAI_MAXCCALLS)
     return resume_error(L, "C stack overflow", nargs);
   L->nCcalls++;
+  L->resumed = 1;
   luai_userstateresume(L, nargs);
   api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
   status = luaD_rawrunprotected(L, resume, &nargs);
@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -257,6 +258,14 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->icache = NULL;
+#if LUAI_JIT
+  f->jit = NULL;
+  f->jithot = LUAI_JITHOT;
+#endif
+#if LUAI_MEMPROFILE
+  f->memsize = sizeof(Proto);  /* as charged by 'luaC_newobj' */
+#endif
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -272,10 +281,33 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, f->sizecode);
+#if LUAI_JIT
+  luaJ_free(L, f);
+#endif
   luaM_free(L, f);
 }
 
 
+/*
+** Create the inline caches of a prototype, once its code is final.
+** An all-zero entry is a valid (empty) cache: it is validated against
+** the key in the slot before use.
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+#if LUAI_INLINECACHE
+  int i;
+  unsigned int *icache = luaM_newvectorchecked(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    icache[i] = 0;
+  f->icache = icache;
+#else
+  UNUSED(L); UNUSED(f);
+#endif
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -34,6 +35,22 @@
 */
 #define GCSWEEPMAX	100
 
+/*
+** Maximum number of slots of a big table or stack to traverse in each
+** single step (see 'traversepartial').
+*/
+#define GCTRAVMAX	1024
+
+/* number of slots of a strong table, in the order they are traversed */
+#define tableslots(h)  \
+	(cast(lu_mem, luaH_realasize(h)) + shapesize(h) + allocsizenode(h))
+
+/*
+** Units of work a step with a time budget does between two readings
+** of the clock.
+*/
+#define GCTIMEWORK	256
+
 /*
 ** Maximum number of finalizers to call in each single step.
 */
@@ -60,6 +77,29 @@
 #define PAUSEADJ		100
 
 
+/*
+** Microseconds since some fixed point, for the time budgets of the
+** collector. Define 'luai_usec' to use another clock.
+*/
+#if !defined(luai_usec)
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+static lu_mem luai_usec (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec) / 1000;
+}
+#elif defined(TIME_UTC)
+static lu_mem luai_usec (void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec) / 1000;
+}
+#else
+#define luai_usec()  (cast(lu_mem, clock()) * 1000000 / CLOCKS_PER_SEC)
+#endif
+#endif
+
+
 /* mask with all color bits */
 #define maskcolors	(bitmask(BLACKBIT) | WHITEBITS)
 
@@ -107,6 +147,8 @@
 static void reallymarkobject (global_State *g, GCObject *o);
 static lu_mem atomic (lua_State *L);
 static void entersweep (lua_State *L);
+static void incstep (lua_State *L, global_State *g);
+static lu_mem objsize (GCObject *o);
 
 
 /*
@@ -225,10 +267,18 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. A big table in incremental
+** mode gets a forward barrier instead: traversing it again would cost
+** the atomic phase (or the step that finds it in 'gray') as much as
+** the first time, for the few entries that changed.
 */
-void luaC_barrierback_ (lua_State *L, GCObject *o) {
+void luaC_barrierback_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
+  if (g->gckind == KGC_INC && o->tt == LUA_VTABLE &&
+      tableslots(gco2t(o)) > GCTRAVMAX) {
+    luaC_barrier_(L, o, v);
+    return;
+  }
   lua_assert(isblack(o) && !isdead(g, o));
   lua_assert((g->gckind == KGC_GEN) == (isold(o) && getage(o) != G_TOUCHED1));
   if (getage(o) == G_TOUCHED2)  /* already in gray list? */
@@ -263,6 +313,7 @@ GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz, size_t offset) {
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  luaC_countnew(L, o, sz);
   return o;
 }
 
@@ -394,14 +445,35 @@ static int remarkupvals (global_State *g) {
 static void cleargraylists (global_State *g) {
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
+  g->gcpartial = NULL;
 }
 
 
+#if LUAI_SHAPES
+/*
+** Table shapes (see ltable.c) are not collectable; each one exists only
+** while some table (maybe dead but not yet freed) or child shape uses
+** it. Keys of existing shapes are kept alive, as the transition table
+** compares them. Each shape marks the key it added; the others are
+** marked by its ancestors.
+*/
+static void markshapes (global_State *g) {
+  int i;
+  for (i = 0; i < g->shapes.size; i++) {
+    Shape *s;
+    for (s = g->shapes.hash[i]; s != NULL; s = s->hnext)
+      markobject(g, s->keys[s->nkeys - 1]);
+  }
+}
+#endif
+
+
 /*
 ** mark root set and reset all gray lists, to start a new collection
 */
 static void restartcollection (global_State *g) {
   cleargraylists(g);
+  g->gcremarked = 0;
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
@@ -448,6 +520,13 @@ static void traverseweakvalue (global_State *g, Table *h) {
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   int hasclears = (h->alimit > 0);
+#if LUAI_SHAPES
+  unsigned int i;
+  for (i = 0; !hasclears && i < shapesize(h); i++) {  /* slot values */
+    if (iscleared(g, gcvalueN(&h->slots[i])))  /* a white value? */
+      hasclears = 1;  /* table will have to be cleared */
+  }
+#endif
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -491,6 +570,16 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+#if LUAI_SHAPES
+  /* slot keys are strings, which are never collected as weak keys, so
+     slot values are strong */
+  for (i = 0; i < shapesize(h); i++) {
+    if (valiswhite(&h->slots[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->slots[i]));
+    }
+  }
+#endif
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
   for (i = 0; i < nsize; i++) {
@@ -520,12 +609,135 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 }
 
 
+/*
+** Big strong tables and stacks met in the propagate phase of an
+** incremental cycle are traversed GCTRAVMAX slots at a time, over
+** several steps, so that no single step gets stuck in one object.
+** There is one such object at a time ('gcpartial'), which
+** 'propagatemark' continues before taking new gray objects. A table is
+** already black, and a barrier on it marks the new value (see
+** 'luaC_barrierback_'). If its parts are reallocated, which can move
+** entries from the slots not traversed yet to the ones already done,
+** or if it became gray again, it goes to 'grayagain' and the atomic
+** phase traverses it whole. Threads go to 'grayagain' anyway.
+*/
+
+#if LUAI_SHAPES
+#define tableshape(h)	cast(const void *, (h)->shape)
+#else
+#define tableshape(h)	NULL
+#endif
+
+
+static void setpartial (global_State *g, GCObject *o) {
+  lua_assert(g->gcpartial == NULL);
+  g->gcpartial = o;
+  g->gcpartialpos = 0;
+  if (o->tt == LUA_VTABLE) {
+    Table *h = gco2t(o);
+    g->gcpartialparts[0] = h->array;
+    g->gcpartialparts[1] = h->node;
+    g->gcpartialparts[2] = tableshape(h);
+    g->gcpartialasize = luaH_realasize(h);
+  }
+}
+
+
+/* true if table 'h' still has the parts it had when it became partial */
+static int samelayout (global_State *g, Table *h) {
+  return (g->gcpartialparts[0] == h->array &&
+          g->gcpartialparts[1] == h->node &&
+          g->gcpartialparts[2] == tableshape(h) &&
+          g->gcpartialasize == luaH_realasize(h));
+}
+
+
+/* traverse the slots from 'i' up to (not including) 'lim' of table 'h' */
+static void traversetableslice (global_State *g, Table *h, lu_mem i,
+                                                           lu_mem lim) {
+  lu_mem asize = luaH_realasize(h);
+  lu_mem nslots = asize + shapesize(h);
+  for (; i < lim && i < asize; i++)
+    markvalue(g, &h->array[i]);
+#if LUAI_SHAPES
+  for (; i < lim && i < nslots; i++)
+    markvalue(g, &h->slots[i - asize]);
+#endif
+  for (; i < lim; i++) {
+    Node *n = gnode(h, i - nslots);
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else {
+      lua_assert(!keyisnil(n));
+      markkey(g, n);
+      markvalue(g, gval(n));
+    }
+  }
+}
+
+
+/*
+** 'luaH_newkey' moved an entry of the table being traversed in pieces
+** to node 'n', which may be one of the slots already traversed.
+*/
+void luaC_nodemoved_ (lua_State *L, Node *n) {
+  global_State *g = G(L);
+  markkey(g, n);
+  markvalue(g, gval(n));
+}
+
+
+/*
+** Traverse the next slice of 'gcpartial'. Returns the work done.
+*/
+static lu_mem traversepartial (global_State *g) {
+  GCObject *o = g->gcpartial;
+  lu_mem start = g->gcpartialpos;
+  lu_mem i = start;
+  lu_mem size, lim;
+  if (o->tt == LUA_VTABLE) {
+    Table *h = gco2t(o);
+    if (!isblack(o) || !samelayout(g, h)) {
+      if (isblack(o))  /* not in 'grayagain' yet? */
+        linkgclist(h, g->grayagain);  /* atomic phase does it whole */
+      g->gcpartial = NULL;
+      return 1;
+    }
+    size = tableslots(h);
+    lim = (size - i > GCTRAVMAX) ? i + GCTRAVMAX : size;
+    traversetableslice(g, h, i, lim);
+  }
+  else {  /* a thread; its stack may have shrunk meanwhile */
+    lua_State *th = gco2th(o);
+    size = cast(lu_mem, th->top.p - th->stack.p);
+    lim = (size > i + GCTRAVMAX) ? i + GCTRAVMAX : size;
+    for (; i < lim; i++)
+      markvalue(g, s2v(th->stack.p + i));
+  }
+  if (lim >= size)  /* done? */
+    g->gcpartial = NULL;
+  else
+    g->gcpartialpos = lim;
+  return 1 + (lim > start ? lim - start : 0);
+}
+
+
+/* true if object 'n' slots long should be traversed in pieces */
+#define inpieces(g,n)  \
+	((g)->gckind == KGC_INC && (g)->gcstate == GCSpropagate && \
+	 (n) > GCTRAVMAX)
+
+
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   unsigned int i;
   unsigned int asize = luaH_realasize(h);
   for (i = 0; i < asize; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
+#if LUAI_SHAPES
+  for (i = 0; i < shapesize(h); i++)  /* traverse slots */
+    markvalue(g, &h->slots[i]);
+#endif
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -556,9 +768,13 @@ static lu_mem traversetable (global_State *g, Table *h) {
     else  /* all weak */
       linkgclist(h, g->allweak);  /* nothing to traverse now */
   }
+  else if (inpieces(g, tableslots(h))) {  /* big strong table? */
+    setpartial(g, obj2gco(h));
+    return 1 + traversepartial(g);
+  }
   else  /* not weak */
     traversestrongtable(g, h);
-  return 1 + h->alimit + 2 * allocsizenode(h);
+  return 1 + h->alimit + shapesize(h) + 2 * allocsizenode(h);
 }
 
 
@@ -635,8 +851,12 @@ static int traversethread (global_State *g, lua_State *th) {
     return 1;  /* stack not completely built yet */
   lua_assert(g->gcstate == GCSatomic ||
              th->openupval == NULL || isintwups(th));
-  for (; o < th->top.p; o++)  /* mark live elements in the stack */
-    markvalue(g, s2v(o));
+  if (inpieces(g, cast(lu_mem, th->top.p - o)))  /* big stack? */
+    setpartial(g, obj2gco(th));  /* 'propagatemark' will traverse it */
+  else {
+    for (; o < th->top.p; o++)  /* mark live elements in the stack */
+      markvalue(g, s2v(o));
+  }
   for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
     markobject(g, uv);  /* open upvalues cannot be collected */
   if (g->gcstate == GCSatomic) {  /* final traversal? */
@@ -650,7 +870,7 @@ static int traversethread (global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  return 1 + stacksize(th);
+  return (g->gcpartial == obj2gco(th)) ? 1 : 1 + stacksize(th);
 }
 
 
@@ -658,7 +878,10 @@ static int traversethread (global_State *g, lua_State *th) {
 ** traverse one gray object, turning it to black.
 */
 static lu_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
+  GCObject *o;
+  if (g->gcpartial != NULL)  /* finish big object first */
+    return traversepartial(g);
+  o = g->gray;
   nw2black(o);
   g->gray = *getgclist(o);  /* remove from 'gray' list */
   switch (o->tt) {
@@ -752,6 +975,13 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, gcvalueN(o)))  /* value was collected? */
         setempty(o);  /* remove entry */
     }
+#if LUAI_SHAPES
+    for (i = 0; i < shapesize(h); i++) {
+      TValue *o = &h->slots[i];
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
+        setempty(o);  /* remove entry (the key stays in the shape) */
+    }
+#endif
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setempty(gval(n));  /* remove entry */
@@ -769,7 +999,16 @@ static void freeupval (lua_State *L, UpVal *uv) {
 }
 
 
+/*
+** Bytes the allocation profiler charged for 'o': prototypes are charged
+** for their vectors only once these are complete (see 'luaC_countproto')
+*/
+#define chargedsize(o)  \
+	((o)->tt == LUA_VPROTO ? gco2p(o)->memsize : objsize(o))
+
+
 static void freeobj (lua_State *L, GCObject *o) {
+  luaC_countfree(L, o, chargedsize(o));
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -814,6 +1053,247 @@ static void freeobj (lua_State *L, GCObject *o) {
 }
 
 
+/*
+** Memory held by an object, including what it owns (parts of tables,
+** stacks of threads, vectors of prototypes), the way 'freeobj' frees
+** it. Machine code from the JIT is not counted.
+*/
+static lu_mem objsize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_VPROTO: {
+      Proto *f = gco2p(o);
+      lu_mem sz = sizeof(Proto) + f->sizecode * sizeof(Instruction) +
+                  f->sizep * sizeof(Proto *) + f->sizek * sizeof(TValue) +
+                  f->sizelineinfo * sizeof(ls_byte) +
+                  f->sizeabslineinfo * sizeof(AbsLineInfo) +
+                  f->sizelocvars * sizeof(LocVar) +
+                  f->sizeupvalues * sizeof(Upvaldesc);
+      if (f->icache != NULL)
+        sz += f->sizecode * sizeof(unsigned int);
+      return sz;
+    }
+    case LUA_VUPVAL:
+      return sizeof(UpVal);
+    case LUA_VLCL:
+      return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_VCCL:
+      return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_VTABLE: {
+      Table *t = gco2t(o);
+      return sizeof(Table) + luaH_realasize(t) * sizeof(TValue) +
+             allocsizenode(t) * sizeof(Node) + shapesize(t) * sizeof(TValue);
+    }
+    case LUA_VTHREAD: {
+      lua_State *th = gco2th(o);
+      lu_mem sz = LUA_EXTRASPACE + sizeof(lua_State) +
+                  th->nci * sizeof(CallInfo);
+      if (th->stack.p != NULL)
+        sz += cast(lu_mem, stacksize(th) + EXTRA_STACK) * sizeof(StackValue);
+      return sz;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      return sizeudata(u->nuvalue, u->len);
+    }
+    case LUA_VSHRSTR:
+      return sizelstring(gco2ts(o)->shrlen);
+    case LUA_VLNGSTR:
+      return sizelstring(gco2ts(o)->u.lnglen);
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+/*
+** {======================================================
+** Background sweep
+** =======================================================
+*/
+
+/*
+** With a sweeper set, a dead object is only unlinked and accounted for
+** by the collector; its memory goes to 'sweepq' and, in batches, to the
+** sweeper, which frees it with 'luaC_freebatch', usually on another
+** thread. That function sees nothing but the batch, so whatever else
+** an object's release touches is done here first: short strings leave
+** the string table, open upvalues their thread's list and tables their
+** shape (with the slots, whose size only the shape knows). Threads and
+** prototypes (which also release pooled threads and machine code) are
+** freed at once.
+*/
+
+typedef struct SweepBatch {
+  lua_Alloc frealloc;
+  void *ud;
+  GCObject *list;  /* dead objects, linked by their 'next' fields */
+} SweepBatch;
+
+
+static void freedetached (lua_Alloc f, void *ud, GCObject *o) {
+  switch (o->tt) {
+    case LUA_VUPVAL:
+      (*f)(ud, o, sizeof(UpVal), 0);
+      break;
+    case LUA_VLCL:
+      (*f)(ud, o, sizeLclosure(gco2lcl(o)->nupvalues), 0);
+      break;
+    case LUA_VCCL:
+      (*f)(ud, o, sizeCclosure(gco2ccl(o)->nupvalues), 0);
+      break;
+    case LUA_VTABLE: {
+      Table *t = gco2t(o);
+      if (!isdummy(t))
+        (*f)(ud, t->node, cast_sizet(sizenode(t)) * sizeof(Node), 0);
+#if LUAI_SHAPES
+      lua_assert(t->shape == NULL);  /* slots freed by 'releaseobj' */
+#endif
+      (*f)(ud, t->array, luaH_realasize(t) * sizeof(TValue), 0);
+      (*f)(ud, t, sizeof(Table), 0);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      (*f)(ud, o, sizeudata(u->nuvalue, u->len), 0);
+      break;
+    }
+    case LUA_VSHRSTR:
+      (*f)(ud, o, sizelstring(gco2ts(o)->shrlen), 0);
+      break;
+    case LUA_VLNGSTR:
+      (*f)(ud, o, sizelstring(gco2ts(o)->u.lnglen), 0);
+      break;
+    default: lua_assert(0);
+  }
+}
+
+
+static void freedetachedlist (lua_Alloc f, void *ud, GCObject *o) {
+  while (o != NULL) {
+    GCObject *next = o->next;
+    freedetached(f, ud, o);
+    o = next;
+  }
+}
+
+
+/*
+** Hand the objects in 'sweepq' to the sweeper. (If there is no memory
+** for the batch, they are freed here.)
+*/
+static void flushsweep (lua_State *L) {
+  global_State *g = G(L);
+  if (g->sweepq != NULL) {
+    SweepBatch *b = cast(SweepBatch *,
+                         (*g->frealloc)(g->ud, NULL, 0, sizeof(SweepBatch)));
+    if (b == NULL)
+      freedetachedlist(g->frealloc, g->ud, g->sweepq);
+    else {
+      b->frealloc = g->frealloc;
+      b->ud = g->ud;
+      b->list = g->sweepq;
+      (*g->sweepf)(g->sweepud, b);
+    }
+    g->sweepq = NULL;
+    g->nsweepq = 0;
+  }
+}
+
+
+/*
+** Free the objects still in 'sweepq' right here.
+*/
+static void freesweepq (global_State *g) {
+  freedetachedlist(g->frealloc, g->ud, g->sweepq);
+  g->sweepq = NULL;
+  g->nsweepq = 0;
+}
+
+
+/*
+** Release a dead object already removed from its list. Emergency
+** collections free at once, as the memory is needed now.
+*/
+static void releaseobj (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  if (g->sweepf == NULL || g->gcemergency ||
+      o->tt == LUA_VTHREAD || o->tt == LUA_VPROTO) {
+    freeobj(L, o);
+    return;
+  }
+  luaC_countfree(L, o, chargedsize(o));
+  if (o->tt == LUA_VSHRSTR)
+    luaS_remove(L, gco2ts(o));
+  else if (o->tt == LUA_VUPVAL && upisopen(gco2upv(o)))
+    luaF_unlinkupval(gco2upv(o));
+#if LUAI_SHAPES
+  else if (o->tt == LUA_VTABLE)
+    luaH_dropshape(L, gco2t(o));
+#endif
+  g->GCdebt -= objsize(o);
+  o->next = g->sweepq;
+  g->sweepq = o;
+  if (++g->nsweepq >= LUAI_SWEEPBATCH)
+    flushsweep(L);
+}
+
+
+void luaC_setsweeper (lua_State *L, lua_Sweeper f, void *ud) {
+  global_State *g = G(L);
+  if (g->sweepf != NULL)
+    flushsweep(L);  /* the old sweeper takes what is pending */
+  g->sweepf = f;
+  g->sweepud = ud;
+}
+
+
+void luaC_freebatch (void *batch) {
+  SweepBatch *b = cast(SweepBatch *, batch);
+  lua_Alloc f = b->frealloc;
+  void *ud = b->ud;
+  freedetachedlist(f, ud, b->list);
+  (*f)(ud, b, sizeof(SweepBatch), 0);
+}
+
+/* }====================================================== */
+
+
+#if LUAI_MEMPROFILE
+
+/*
+** Charges prototype 'f' for the vectors it got since it was last
+** charged. The parser and 'luaU_undump' call it once they are complete.
+*/
+void luaC_countproto (lua_State *L, Proto *f) {
+  lu_mem sz = objsize(obj2gco(f));
+  luaC_countbytes(L, LUA_TPROTO, sz - f->memsize);
+  f->memsize = sz;
+}
+
+
+static void listsizes (global_State *g, GCObject *o, lu_mem *bytes) {
+  for (; o != NULL; o = o->next) {
+    if (o != obj2gco(g->mainthread))
+      bytes[novariant(o->tt)] += chargedsize(o);
+  }
+}
+
+
+/*
+** Adds to 'bytes' (indexed by type) the memory of all objects not
+** freed yet, the way the profiler charged it, which includes dead ones
+** the collector did not reach.
+*/
+void luaC_heapsizes (lua_State *L, lu_mem *bytes) {
+  global_State *g = G(L);
+  listsizes(g, g->allgc, bytes);
+  listsizes(g, g->finobj, bytes);
+  listsizes(g, g->tobefnz, bytes);
+  listsizes(g, g->fixedgc, bytes);
+}
+
+#endif
+
+
 /*
 ** sweep at most 'countin' elements from a list of GCObjects erasing dead
 ** objects, where a dead object is one marked with the old (non current)
@@ -832,7 +1312,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
     int marked = curr->marked;
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      releaseobj(L, curr);  /* erase 'curr' */
     }
     else {  /* change mark to 'white' */
       curr->marked = cast_byte((marked & ~maskgcbits) | white);
@@ -875,6 +1355,13 @@ static void checkSizes (lua_State *L, global_State *g) {
       luaS_resize(L, g->strt.size / 2);
       g->GCestimate += g->GCdebt - olddebt;  /* correct estimate */
     }
+#if LUAI_SHAPES
+    {
+      l_mem olddebt = g->GCdebt;
+      luaH_checkshapes(L);  /* transition table too big? */
+      g->GCestimate += g->GCdebt - olddebt;  /* correct estimate */
+    }
+#endif
   }
 }
 
@@ -1067,6 +1554,7 @@ static void setpause (global_State *g) {
   debt = gettotalbytes(g) - threshold;
   if (debt > 0) debt = 0;
   luaE_setdebt(g, debt);
+  g->gcowed = 0;  /* a new cycle owes nothing */
 }
 
 
@@ -1083,7 +1571,7 @@ static void sweep2old (lua_State *L, GCObject **p) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      releaseobj(L, curr);  /* erase 'curr' */
     }
     else {  /* all surviving objects become old */
       setage(curr, G_OLD);
@@ -1129,7 +1617,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(!isold(curr) && isdead(g, curr));
       *p = curr->next;  /* remove 'curr' from list */
-      freeobj(L, curr);  /* erase 'curr' */
+      releaseobj(L, curr);  /* erase 'curr' */
     }
     else {  /* correct mark and age */
       if (getage(curr) == G_NEW) {  /* new objects go back to white */
@@ -1360,8 +1848,10 @@ static void enterinc (global_State *g) {
 void luaC_changemode (lua_State *L, int newmode) {
   global_State *g = G(L);
   if (newmode != g->gckind) {
-    if (newmode == KGC_GEN)  /* entering generational mode? */
+    if (newmode == KGC_GEN) {  /* entering generational mode? */
       entergen(L, g);
+      flushsweep(L);
+    }
     else
       enterinc(g);  /* entering incremental mode */
   }
@@ -1420,6 +1910,26 @@ static void stepgenfull (lua_State *L, global_State *g) {
 }
 
 
+/*
+** Does a major collection in generational mode and checks whether
+** it was a bad one (see 'genstep').
+*/
+static void genmajor (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+  lu_mem majorinc = (majorbase / 100) * getgcparam(g->genmajormul);
+  lu_mem numobjs = fullgen(L, g);  /* do a major collection */
+  if (gettotalbytes(g) < majorbase + (majorinc / 2)) {
+    /* collected at least half of memory growth since last major
+       collection; keep doing minor collections. */
+    lua_assert(g->lastatomic == 0);
+  }
+  else {  /* bad collection */
+    g->lastatomic = numobjs;  /* signal that last collection was bad */
+    setpause(g);  /* do a long wait for next (major) collection */
+  }
+}
+
+
 /*
 ** Does a generational "step".
 ** Usually, this means doing a minor collection and setting the debt to
@@ -1445,18 +1955,8 @@ static void genstep (lua_State *L, global_State *g) {
   else {
     lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
     lu_mem majorinc = (majorbase / 100) * getgcparam(g->genmajormul);
-    if (g->GCdebt > 0 && gettotalbytes(g) > majorbase + majorinc) {
-      lu_mem numobjs = fullgen(L, g);  /* do a major collection */
-      if (gettotalbytes(g) < majorbase + (majorinc / 2)) {
-        /* collected at least half of memory growth since last major
-           collection; keep doing minor collections. */
-        lua_assert(g->lastatomic == 0);
-      }
-      else {  /* bad collection */
-        g->lastatomic = numobjs;  /* signal that last collection was bad */
-        setpause(g);  /* do a long wait for next (major) collection */
-      }
-    }
+    if (g->GCdebt > 0 && gettotalbytes(g) > majorbase + majorinc)
+      genmajor(L, g);  /* do a major collection */
     else {  /* regular case; do a minor collection */
       youngcollection(L, g);
       setminordebt(g);
@@ -1466,6 +1966,82 @@ static void genstep (lua_State *L, global_State *g) {
   lua_assert(isdecGCmodegen(g));
 }
 
+
+/*
+** Frame regions. A frame is a span of work (a game tick) whose garbage
+** is nearly all dead by its end. Regions ride on the generational
+** mode: what a frame creates is young, and 'luaC_endframe' reclaims it
+** in bulk with a minor collection, which sweeps only the young lists.
+** Young objects that escape into old ones are caught by the
+** generational barriers ('luaC_barrier_' ages them, 'luaC_barrierback_'
+** makes the old object touched), so they survive and get promoted.
+** Inside a frame, 'luaC_step' leaves minor collections to the frame's
+** end: a collection in the middle would find the frame's temporaries
+** alive and promote them. Only a frame that allocates enough to make a
+** major collection due gets a collection before its end. Objects
+** cannot be moved, so there is no separate arena. Frames do not change
+** the collector's mode: in incremental mode without a time budget they
+** change nothing, so the host picks generational mode (or a budget)
+** when it sets up the state.
+*/
+
+/* memory at which a major collection is due */
+#define majorlimit(g)  \
+	((g)->GCestimate + ((g)->GCestimate / 100) * getgcparam((g)->genmajormul))
+
+
+/*
+** Called instead of a generational step; returns true if the step
+** must wait for the end of the current frame.
+*/
+static int framedefer (global_State *g) {
+  lu_mem limit = majorlimit(g);
+  if (!g->gcframe || g->lastatomic != 0 || gettotalbytes(g) >= limit)
+    return 0;
+  luaE_setdebt(g, -cast(l_mem, limit - gettotalbytes(g)));  /* check again there */
+  return 1;
+}
+
+
+void luaC_beginframe (lua_State *L) {
+  global_State *g = G(L);
+  g->gcframespent = 0;
+  g->gcframe = 1;
+}
+
+
+/*
+** Collects the frame's garbage first, so that it does not count for
+** the decision about a major collection.
+*/
+void luaC_endframe (lua_State *L) {
+  global_State *g = G(L);
+  if (g->gcbudget != 0) {  /* time-sliced frame? */
+    if (gcrunning(g) && g->gcowed > 0)
+      incstep(L, g);  /* catch up with the rest of the frame's budget */
+    g->gcframe = 0;
+    flushsweep(L);
+    return;
+  }
+  g->gcframe = 0;
+  if (!gcrunning(g) || !isdecGCmodegen(g))
+    return;
+  if (g->lastatomic != 0) {  /* waiting after a bad collection? */
+    if (g->GCdebt > 0)
+      genstep(L, g);
+  }
+  else {
+    lu_mem majorbase = g->GCestimate;
+    youngcollection(L, g);
+    g->GCestimate = majorbase;  /* preserve base value */
+    if (gettotalbytes(g) > majorlimit(g))
+      genmajor(L, g);
+    else
+      setminordebt(g);
+  }
+  flushsweep(L);
+}
+
 /* }====================================================== */
 
 
@@ -1486,6 +2062,7 @@ static void genstep (lua_State *L, global_State *g) {
 static void entersweep (lua_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
+  g->gcpartial = NULL;  /* everything turns white anyway */
   lua_assert(g->sweepgc == NULL);
   g->sweepgc = sweeptolive(L, &g->allgc);
 }
@@ -1511,6 +2088,8 @@ static void deletelist (lua_State *L, GCObject *p, GCObject *limit) {
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
   g->gcstp = GCSTPCLS;  /* no extra finalizers after here */
+  freesweepq(g);
+  g->sweepf = NULL;  /* free everything else here, too */
   luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
@@ -1529,12 +2108,16 @@ static lu_mem atomic (lua_State *L) {
   GCObject *grayagain = g->grayagain;  /* save original list */
   g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
+  lua_assert(g->gcpartial == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSatomic;
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+#if LUAI_SHAPES
+  markshapes(g);
+#endif
   work += propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
@@ -1595,8 +2178,15 @@ static lu_mem singlestep (lua_State *L) {
       break;
     }
     case GCSpropagate: {
-      if (g->gray == NULL) {  /* no more gray objects? */
-        g->gcstate = GCSenteratomic;  /* finish propagate phase */
+      if (g->gray == NULL && g->gcpartial == NULL) {  /* nothing to do? */
+        if (g->gcbudget != 0 && !g->gcremarked) {  /* time-sliced? */
+          /* traverse 'grayagain' here, in steps, so atomic has less */
+          g->gray = g->grayagain;
+          g->grayagain = NULL;
+          g->gcremarked = 1;
+        }
+        else
+          g->gcstate = GCSenteratomic;  /* finish propagate phase */
         work = 0;
       }
       else
@@ -1657,6 +2247,79 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 
 
 
+/*
+** Time budgets. With a budget set ('lua_gc' with LUA_GCBUDGET), an
+** incremental step stops when it runs out of time instead of when it
+** has paid its debt, and the work left is owed to the next steps
+** ('gcowed'). Inside a frame ('lua_beginframe'), steps also share the
+** frame's budget, and 'lua_endframe' spends what is left of it on owed
+** work. Single steps are short (big objects are traversed in pieces,
+** sweeps do GCSWEEPMAX objects), but the atomic phase and finalizers
+** cannot be split, so they may overrun a budget. To keep the atomic
+** phase short, the propagate phase traverses 'grayagain' once in steps
+** before entering it, leaving it only what changed after that. A
+** budget too small for the program's allocation rate makes memory grow,
+** up to LUAI_GCBACKSTOP times the size that started the cycle; past
+** that, steps pay their debt whatever it takes (see 'overbackstop').
+*/
+
+/*
+** Time the next step may take, in microseconds.
+*/
+static lu_mem steptime (global_State *g) {
+  lu_mem t = g->gcbudget;
+  if (g->gcframe && g->gcframebudget != 0) {
+    lu_mem left = (g->gcframebudget > g->gcframespent)
+                ? g->gcframebudget - g->gcframespent : 0;
+    if (left < t)
+      t = left;
+  }
+  return t;
+}
+
+
+/*
+** True if the heap outgrew LUAI_GCBACKSTOP times the threshold that
+** started the current cycle (as computed by 'setpause').
+*/
+static int overbackstop (global_State *g) {
+  int mul = getgcparam(g->gcpause) * LUAI_GCBACKSTOP;
+  l_mem estimate = g->GCestimate / PAUSEADJ;
+  l_mem limit = (estimate > 0 && mul < MAX_LMEM / estimate)
+              ? estimate * mul
+              : MAX_LMEM;
+  return gettotalbytes(g) > cast(lu_mem, limit);
+}
+
+
+/*
+** Run single steps until paying 'debt' (that is, reaching 'stepsize'
+** of credit), finishing a cycle, or running out of time. Returns the
+** debt left.
+*/
+static l_mem timedsteps (lua_State *L, global_State *g, l_mem debt,
+                                                        l_mem stepsize) {
+  lu_mem limit = steptime(g);
+  lu_mem start, elapsed = 0;
+  lu_mem work = 0;
+  if (limit == 0)  /* frame budget used up? */
+    return debt;
+  start = luai_usec();
+  do {
+    lu_mem w = singlestep(L);
+    debt -= w;
+    work += w;
+    if (work >= GCTIMEWORK) {  /* time to look at the clock? */
+      work = 0;
+      elapsed = luai_usec() - start;
+    }
+  } while (debt > -stepsize && g->gcstate != GCSpause && elapsed < limit);
+  if (g->gcframe)
+    g->gcframespent += luai_usec() - start;
+  return debt;
+}
+
+
 /*
 ** Performs a basic incremental step. The debt and step size are
 ** converted from bytes to "units of work"; then the function loops
@@ -1666,16 +2329,27 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 */
 static void incstep (lua_State *L, global_State *g) {
   int stepmul = (getgcparam(g->gcstepmul) | 1);  /* avoid division by 0 */
-  l_mem debt = (g->GCdebt / WORK2MEM) * stepmul;
+  l_mem debt = g->gcowed;
   l_mem stepsize = (g->gcstepsize <= log2maxs(l_mem))
                  ? ((cast(l_mem, 1) << g->gcstepsize) / WORK2MEM) * stepmul
                  : MAX_LMEM;  /* overflow; keep maximum value */
-  do {  /* repeat until pause or enough "credit" (negative debt) */
-    lu_mem work = singlestep(L);  /* perform one single step */
-    debt -= work;
-  } while (debt > -stepsize && g->gcstate != GCSpause);
+  if (g->GCdebt > 0)  /* not a catch-up step from 'luaC_endframe'? */
+    debt += (g->GCdebt / WORK2MEM) * stepmul;
+  if (g->gcbudget != 0 && !overbackstop(g))
+    debt = timedsteps(L, g, debt, stepsize);
+  else {
+    do {  /* repeat until pause or enough "credit" (negative debt) */
+      lu_mem work = singlestep(L);  /* perform one single step */
+      debt -= work;
+    } while (debt > -stepsize && g->gcstate != GCSpause);
+  }
+  g->gcowed = 0;
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
+  else if (debt > -stepsize) {  /* ran out of time? */
+    g->gcowed = debt + stepsize;  /* next steps must do it */
+    luaE_setdebt(g, -(stepsize / stepmul) * WORK2MEM);
+  }
   else {
     debt = (debt / stepmul) * WORK2MEM;  /* convert 'work units' to bytes */
     luaE_setdebt(g, debt);
@@ -1692,10 +2366,13 @@ void luaC_step (lua_State *L) {
   if (!gcrunning(g))  /* not running? */
     luaE_setdebt(g, -2000);
   else {
-    if(isdecGCmodegen(g))
-      genstep(L, g);
+    if(isdecGCmodegen(g)) {
+      if (!framedefer(g))
+        genstep(L, g);
+    }
     else
       incstep(L, g);
+    flushsweep(L);
   }
 }
 
@@ -1735,6 +2412,10 @@ void luaC_fullgc (lua_State *L, int isemergency) {
     fullinc(L, g);
   else
     fullgen(L, g);
+  if (isemergency)
+    freesweepq(g);  /* do not wait for the sweeper */
+  else
+    flushsweep(L);
   g->gcemergency = 0;
 }
 
@@ -78,6 +78,8 @@
 #define FINALIZEDBIT	6  /* object has been marked for finalization */
 
 #define TESTBIT		7
+/* outside the test library, bit 7 marks objects sampled by 'luaG_memsample' */
+#define SAMPLEDBIT	TESTBIT
 
 
 
@@ -140,6 +142,12 @@
 /* how much to allocate before next GC step (log2) */
 #define LUAI_GCSTEPSIZE 13      /* 8 KB */
 
+/*
+** with a time budget, steps ignore it while the heap is more than this
+** many times the size at which the current cycle started
+*/
+#define LUAI_GCBACKSTOP	2
+
 
 /*
 ** Check whether the declared GC mode is generational. While in
@@ -172,6 +180,40 @@
 #define luaC_checkGC(L)		luaC_condGC(L,(void)0,(void)0)
 
 
+/*
+** Allocation profiler counts of an object 'o' of 'sz' bytes being
+** created or freed, and of the memory of objects of type 't' growing by
+** 'd' bytes (negative when it shrinks). What an object owns is charged
+** as it grows: parts of tables and stacks and CallInfos of threads
+** where they are resized, and vectors of prototypes once complete. The
+** main thread, which is never freed, is not counted.
+*/
+#if LUAI_MEMPROFILE
+#define luaC_countbytes(L,t,d) { global_State *g_ = G(L); \
+	g_->membytes[t] += cast(lu_mem, d); \
+	if (g_->membytes[t] > g_->mempeak[t]) g_->mempeak[t] = g_->membytes[t]; }
+
+#define luaC_countnew(L,o,sz) { global_State *g_ = G(L); \
+	int t_ = novariant((o)->tt); g_->memallocs[t_]++; g_->memcount[t_]++; \
+	luaC_countbytes(L, t_, sz); \
+	if ((g_->memsample -= cast(l_mem, sz)) < 0) luaG_memsample(L, o); }
+
+#define luaC_countfree(L,o,sz) { global_State *g_ = G(L); \
+	int t_ = novariant((o)->tt); g_->memcount[t_]--; \
+	g_->membytes[t_] -= (sz); \
+	if (testbit((o)->marked, SAMPLEDBIT)) luaG_memunsample(L, o); }
+
+#define luaC_countthread(L,th,d) \
+	{ if ((th) != G(L)->mainthread) luaC_countbytes(L, LUA_TTHREAD, d); }
+#else
+#define luaC_countbytes(L,t,d)	((void)0)
+#define luaC_countnew(L,o,sz)	((void)0)
+#define luaC_countfree(L,o,sz)	((void)0)
+#define luaC_countthread(L,th,d)	((void)(d))
+#define luaC_countproto(L,f)	((void)0)
+#endif
+
+
 #define luaC_objbarrier(L,p,o) (  \
 	(isblack(p) && iswhite(o)) ? \
 	luaC_barrier_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
@@ -180,11 +222,14 @@
 	iscollectable(v) ? luaC_objbarrier(L,p,gcvalue(v)) : cast_void(0))
 
 #define luaC_objbarrierback(L,p,o) (  \
-	(isblack(p) && iswhite(o)) ? luaC_barrierback_(L,p) : cast_void(0))
+	(isblack(p) && iswhite(o)) ? luaC_barrierback_(L,p,o) : cast_void(0))
 
 #define luaC_barrierback(L,p,v) (  \
 	iscollectable(v) ? luaC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
 
+#define luaC_nodemoved(L,t,n) (  \
+	(obj2gco(t) == G(L)->gcpartial) ? luaC_nodemoved_(L,n) : cast_void(0))
+
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
@@ -194,9 +239,18 @@ LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz,
                                                  size_t offset);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
-LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
+LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o, GCObject *v);
+LUAI_FUNC void luaC_nodemoved_ (lua_State *L, Node *n);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC void luaC_beginframe (lua_State *L);
+LUAI_FUNC void luaC_endframe (lua_State *L);
+LUAI_FUNC void luaC_setsweeper (lua_State *L, lua_Sweeper f, void *ud);
+LUAI_FUNC void luaC_freebatch (void *batch);
+#if LUAI_MEMPROFILE
+LUAI_FUNC void luaC_countproto (lua_State *L, Proto *f);
+LUAI_FUNC void luaC_heapsizes (lua_State *L, lu_mem *bytes);
+#endif
 
 
 #endif
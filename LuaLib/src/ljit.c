@@ -0,0 +1,1735 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler of Lua functions to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+/* 'MAP_ANONYMOUS' is not in POSIX */
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "llimits.h"
+
+#if LUAI_JIT
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif
+
+#include "lgc.h"
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** A function is translated instruction by instruction, each one into a
+** fixed template, with the virtual registers kept in the Lua stack.
+** Templates only handle the common cases (numbers of the expected
+** types, raw table accesses): anything else (metamethods, errors,
+** calls, allocation) makes the code return the index of the current
+** instruction and the interpreter runs it from there, going back to
+** native code at its next jump, loop, call or return. So native code
+** never raises errors, allocates, calls Lua or yields, and all state
+** it leaves behind is the one the interpreter expects.
+**
+** Machine registers while the code runs: 'rbx' has the base of the
+** Lua registers, 'r12' has 'L' and 'r13' has the closure.
+*/
+
+
+/* machine registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RSI	6
+#define RDI	7
+#define R8	8
+#define R9	9
+#define R12	12
+#define R13	13
+
+#define XMM0	0
+#define XMM1	1
+#define XMM2	2
+
+
+/* times an entry can miss soon after it before it is disabled */
+#define JITMAXMISSES	100
+
+/* a run of at most this many instructions before a miss is short */
+#define JITSHORTMISS	16
+
+/* fewest instructions worth entering native code for (see 'shortruns') */
+#if !defined(JITMINRUN)
+#define JITMINRUN	4
+#endif
+
+
+/* registers with the arguments of a call, and stack space it needs */
+#if defined(_WIN32)
+#define ARG0	RCX
+#define ARG1	RDX
+#define ARG2	R8
+#define ARG3	R9
+#define SHADOWSPACE	32
+#else
+#define ARG0	RDI
+#define ARG1	RSI
+#define ARG2	RDX
+#define ARG3	RCX
+#define SHADOWSPACE	0
+#endif
+
+
+/* condition codes (second byte of a 'jcc rel32') */
+#define JB	0x82
+#define JAE	0x83
+#define JE	0x84
+#define JNE	0x85
+#define JBE	0x86
+#define JA	0x87
+#define JNS	0x89
+#define JL	0x8C
+#define JGE	0x8D
+#define JLE	0x8E
+#define JG	0x8F
+
+#define JMP	0xE9	/* (not a condition) unconditional jump */
+
+/* condition that is true when 'cc' is false */
+#define negcc(cc)	((cc) ^ 1)
+
+
+/*
+** offsets of the value, of the tag and of the third vector lane of Lua
+** register 'r' from 'base'
+*/
+#define VAL(r)	((r) * cast_int(sizeof(StackValue)) + \
+                 cast_int(offsetof(TValue, value_)))
+#define TAG(r)	((r) * cast_int(sizeof(StackValue)) + \
+                 cast_int(offsetof(TValue, tt_)))
+#define VZ(r)	((r) * cast_int(sizeof(StackValue)) + \
+                 cast_int(offsetof(TValue, vz_)))
+
+
+/*
+** Helpers called from native code for table accesses and other
+** instructions that are too long to inline. They get the instruction
+** and return 0 when it needs the interpreter (leaving everything as it
+** was), nonzero when it was done.
+*/
+typedef int (*JitHelper) (lua_State *L, StkId base, LClosure *cl,
+                          const Instruction *pc);
+
+
+typedef struct Fixup {
+  size_t at;  /* position of a 32-bit jump displacement */
+  int pc;  /* instruction it goes to */
+  int exit;  /* true when it goes to the exit of 'pc' instead */
+} Fixup;
+
+
+typedef struct JitState {
+  lua_State *L;
+  Proto *p;
+  unsigned char *code;  /* code being generated */
+  size_t size;
+  size_t capacity;
+  size_t *pcpos;  /* position of the code of each instruction */
+  size_t *exitpos;  /* position of the exit to each instruction (or 0) */
+  Fixup *fixups;
+  int nfixups;
+  int sizefixups;
+  size_t epilogue;  /* position of the code returning to the interpreter */
+  int failed;  /* true after a memory error */
+} JitState;
+
+
+/*
+** The compiler can run in the middle of an instruction, so it cannot
+** raise errors nor collect garbage: its buffers come straight from the
+** allocator and a failure just gives up the compilation.
+*/
+static void *jitrealloc (JitState *J, void *block, size_t osize,
+                                                   size_t nsize) {
+  global_State *g = G(J->L);
+  void *newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (newblock == NULL && nsize > 0)
+    J->failed = 1;
+  return newblock;
+}
+
+#define freebuffer(J,b,size)  \
+	{ if ((b) != NULL) jitrealloc(J, b, size, 0); }
+
+
+/*
+** {======================================================
+** Machine code encoding
+** =======================================================
+*/
+
+static void emitbyte (JitState *J, int b) {
+  if (J->failed)
+    return;
+  if (J->size == J->capacity) {
+    unsigned char *newcode = cast(unsigned char *,
+                  jitrealloc(J, J->code, J->capacity, J->capacity * 2));
+    if (newcode == NULL)
+      return;
+    J->code = newcode;
+    J->capacity *= 2;
+  }
+  J->code[J->size++] = cast_byte(b);
+}
+
+
+static void emit32 (JitState *J, l_uint32 x) {
+  int i;
+  for (i = 0; i < 4; i++, x >>= 8)
+    emitbyte(J, cast_int(x & 0xFF));
+}
+
+
+static void emit64 (JitState *J, lua_Unsigned x) {
+  emit32(J, cast(l_uint32, x & 0xFFFFFFFFu));
+  emit32(J, cast(l_uint32, x >> 32));
+}
+
+
+/*
+** Optional prefix ('0x66', '0xF2'), REX prefix and opcode of an
+** instruction ('op' greater than 0xFF has a 0x0F escape byte)
+*/
+static void emitop (JitState *J, int prefix, int w, int op, int reg,
+                                                          int rm) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (prefix != 0)
+    emitbyte(J, prefix);
+  if (rex != 0x40)
+    emitbyte(J, rex);
+  if (op > 0xFF)
+    emitbyte(J, op >> 8);
+  emitbyte(J, op & 0xFF);
+}
+
+
+/* 'op reg, [base + disp]' (or the other way around, depending on 'op') */
+static void insmem (JitState *J, int prefix, int w, int op, int reg,
+                                 int base, int disp) {
+  int small = (-128 <= disp && disp <= 127);
+  emitop(J, prefix, w, op, reg, base);
+  emitbyte(J, (small ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)  /* 'rsp' and 'r12' need a SIB byte */
+    emitbyte(J, 0x24);
+  if (small)
+    emitbyte(J, disp & 0xFF);
+  else
+    emit32(J, cast(l_uint32, disp));
+}
+
+
+/* 'op reg, rm' between registers */
+static void insreg (JitState *J, int prefix, int w, int op, int reg,
+                                 int rm) {
+  emitop(J, prefix, w, op, reg, rm);
+  emitbyte(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* mov reg, imm64 */
+static void movimm (JitState *J, int reg, lua_Unsigned imm) {
+  emitop(J, 0, 1, 0xB8 + (reg & 7), 0, reg);
+  emit64(J, imm);
+}
+
+
+#define loadq(J,reg,base,disp)	insmem(J, 0, 1, 0x8B, reg, base, disp)
+#define storeq(J,reg,base,disp)	insmem(J, 0, 1, 0x89, reg, base, disp)
+#define movreg(J,dst,src)	insreg(J, 0, 1, 0x89, src, dst)
+#define movsdload(J,x,base,disp)  insmem(J, 0xF2, 0, 0x0F10, x, base, disp)
+#define movsdstore(J,x,base,disp)  insmem(J, 0xF2, 0, 0x0F11, x, base, disp)
+/* cvtsi2sd x, qword [base + disp] */
+#define cvtload(J,x,base,disp)	insmem(J, 0xF2, 1, 0x0F2A, x, base, disp)
+/* movq x, reg */
+#define movqx(J,x,reg)		insreg(J, 0x66, 1, 0x0F6E, x, reg)
+/* ucomisd x, y */
+#define ucomisd(J,x,y)		insreg(J, 0x66, 0, 0x0F2E, x, y)
+
+/* SSE2 scalar double operations (with the 0xF2 prefix) */
+#define SSE_ADD		0x0F58
+#define SSE_MUL		0x0F59
+#define SSE_SUB		0x0F5C
+#define SSE_DIV		0x0F5E
+
+/* integer operations 'op reg, r/m' */
+#define INT_ADD		0x03
+#define INT_OR		0x0B
+#define INT_AND		0x23
+#define INT_SUB		0x2B
+#define INT_XOR		0x33
+#define INT_CMP		0x3B
+#define INT_IMUL	0x0FAF
+
+
+/* cmp byte [rbx + TAG(r)], tag */
+static void cmptag (JitState *J, int r, int tag) {
+  insmem(J, 0, 0, 0x80, 7, RBX, TAG(r));
+  emitbyte(J, tag);
+}
+
+
+/* mov byte [rbx + TAG(r)], tag */
+static void settag (JitState *J, int r, int tag) {
+  insmem(J, 0, 0, 0xC6, 0, RBX, TAG(r));
+  emitbyte(J, tag);
+}
+
+
+/* copy the value at [base + disp] into Lua register 'r' */
+static void copyvalue (JitState *J, int r, int base, int disp) {
+  loadq(J, RCX, base, disp + cast_int(offsetof(TValue, value_)));
+  storeq(J, RCX, RBX, VAL(r));
+  insmem(J, 0, 0, 0x0FB6, RCX, base,  /* movzx ecx, byte [tag] */
+            disp + cast_int(offsetof(TValue, tt_)));
+  insmem(J, 0, 0, 0x88, RCX, RBX, TAG(r));  /* mov [tag], cl */
+  insmem(J, 0, 0, 0x8B, RCX, base,  /* mov ecx, [vz] */
+            disp + cast_int(offsetof(TValue, vz_)));
+  insmem(J, 0, 0, 0x89, RCX, RBX, VZ(r));  /* mov [vz], ecx */
+}
+
+
+/* load the number 'n' into SSE register 'x' */
+static void loadfloat (JitState *J, int x, lua_Number n) {
+  lua_Unsigned bits;
+  memcpy(&bits, &n, sizeof(bits));
+  movimm(J, RAX, bits);
+  movqx(J, x, RAX);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Jumps
+** =======================================================
+*/
+
+#define NOJUMP	(~(size_t)0)
+
+
+static void emitjump (JitState *J, int cc) {
+  if (cc == JMP)
+    emitbyte(J, JMP);
+  else {
+    emitbyte(J, 0x0F);
+    emitbyte(J, cc);
+  }
+}
+
+
+/* jump forward inside a template, to where 'here' is called */
+static size_t jumpfwd (JitState *J, int cc) {
+  size_t at;
+  emitjump(J, cc);
+  at = J->size;
+  emit32(J, 0);
+  return at;
+}
+
+
+static void patch (JitState *J, size_t at, size_t target) {
+  l_uint32 rel = cast(l_uint32, target - (at + 4));
+  int i;
+  for (i = 0; i < 4; i++, rel >>= 8)
+    J->code[at + i] = cast_byte(rel & 0xFF);
+}
+
+
+static void here (JitState *J, size_t at) {
+  if (at != NOJUMP && !J->failed)
+    patch(J, at, J->size);
+}
+
+
+static void addfixup (JitState *J, int cc, int pc, int exit) {
+  Fixup *f;
+  emitjump(J, cc);
+  if (J->nfixups == J->sizefixups) {
+    int newsize = J->sizefixups * 2;
+    Fixup *newfixups = cast(Fixup *, jitrealloc(J, J->fixups,
+                              J->sizefixups * sizeof(Fixup),
+                              newsize * sizeof(Fixup)));
+    if (newfixups == NULL)
+      return;
+    J->fixups = newfixups;
+    J->sizefixups = newsize;
+  }
+  f = &J->fixups[J->nfixups++];
+  f->at = J->size;
+  f->pc = pc;
+  f->exit = exit;
+  emit32(J, 0);
+}
+
+
+/* jump to the code of instruction 'pc' */
+#define jumppc(J,cc,pc)		addfixup(J, cc, pc, 0)
+
+/* leave to the interpreter at the slow path of instruction 'pc' */
+#define jumpexit(J,cc,pc)	addfixup(J, cc, pc, 1)
+
+
+static void codeexit (JitState *J, int pc, int miss);
+
+
+/*
+** Jump from instruction 'pc' to instruction 'target'. Backward jumps
+** leave to the interpreter when a hook was set (by a signal, say), so
+** that loops can still be interrupted.
+*/
+static void jumpto (JitState *J, int cc, int pc, int target) {
+  if (target > pc)
+    jumppc(J, cc, target);
+  else {
+    size_t skip = (cc == JMP) ? NOJUMP : jumpfwd(J, negcc(cc));
+    /* cmp dword [r12 + hookmask], 0 */
+    insmem(J, 0, 0, 0x83, 7, R12, cast_int(offsetof(lua_State, hookmask)));
+    emitbyte(J, 0);
+    jumppc(J, JE, target);
+    codeexit(J, target, 0);
+    here(J, skip);
+  }
+}
+
+
+/*
+** Leave to the interpreter, which continues at instruction 'pc'. The
+** result is coded as '~pc' when the exit is a 'miss', a slow path of
+** an instruction that has native code (see 'countmiss').
+*/
+static void codeexit (JitState *J, int pc, int miss) {
+  emitbyte(J, 0xB8);  /* mov eax, pc */
+  emit32(J, cast(l_uint32, miss ? ~pc : pc));
+  emitbyte(J, JMP);
+  emit32(J, cast(l_uint32, J->epilogue - (J->size + 4)));
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Helpers
+** =======================================================
+*/
+
+#define hRA(i)	(base + GETARG_A(i))
+#define hRB(i)	s2v(base + GETARG_B(i))
+#define hKB(i)	(cl->p->k + GETARG_B(i))
+#define hKC(i)	(cl->p->k + GETARG_C(i))
+#define hRKC(i)	(TESTARG_k(i) ? hKC(i) : s2v(base + GETARG_C(i)))
+
+
+/* raw access to a field with a short-string key */
+#if LUAI_INLINECACHE
+#define getfield(L,t,key,slot)  luaV_fastgetcache(L,t,key,slot, \
+	cl->p->icache + (pc - cl->p->code))
+#else
+#define getfield(L,t,key,slot)	luaV_fastget(L,t,key,slot,luaH_getshortstr)
+#endif
+
+
+/* raw access to any key */
+#define getany(L,t,key,slot)  \
+	(ttisinteger(key) ? luaV_fastgeti(L,t,ivalue(key),slot) \
+	                  : luaV_fastget(L,t,key,slot,luaH_get))
+
+
+static int jit_gettabup (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
+  if (!getfield(L, upval, tsvalue(hKC(i)), slot))
+    return 0;
+  setobj2s(L, hRA(i), slot);
+  return 1;
+}
+
+
+static int jit_gettable (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *rc = s2v(base + GETARG_C(i));
+  UNUSED(cl);
+  if (!getany(L, hRB(i), rc, slot))
+    return 0;
+  setobj2s(L, hRA(i), slot);
+  return 1;
+}
+
+
+static int jit_geti (lua_State *L, StkId base, LClosure *cl,
+                     const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  UNUSED(cl);
+  if (!luaV_fastgeti(L, hRB(i), GETARG_C(i), slot))
+    return 0;
+  setobj2s(L, hRA(i), slot);
+  return 1;
+}
+
+
+static int jit_getfield (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  if (!getfield(L, hRB(i), tsvalue(hKC(i)), slot))
+    return 0;
+  setobj2s(L, hRA(i), slot);
+  return 1;
+}
+
+
+static int jit_settabup (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
+  if (!getfield(L, upval, tsvalue(hKB(i)), slot))
+    return 0;
+  luaV_finishfastset(L, upval, slot, hRKC(i));
+  return 1;
+}
+
+
+static int jit_settable (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *t = s2v(hRA(i));
+  if (!getany(L, t, hRB(i), slot))
+    return 0;
+  luaV_finishfastset(L, t, slot, hRKC(i));
+  return 1;
+}
+
+
+static int jit_seti (lua_State *L, StkId base, LClosure *cl,
+                     const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *t = s2v(hRA(i));
+  if (!luaV_fastgeti(L, t, GETARG_B(i), slot))
+    return 0;
+  luaV_finishfastset(L, t, slot, hRKC(i));
+  return 1;
+}
+
+
+static int jit_setfield (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *t = s2v(hRA(i));
+  if (!getfield(L, t, tsvalue(hKB(i)), slot))
+    return 0;
+  luaV_finishfastset(L, t, slot, hRKC(i));
+  return 1;
+}
+
+
+static int jit_setupval (lua_State *L, StkId base, LClosure *cl,
+                         const Instruction *pc) {
+  UpVal *uv = cl->upvals[GETARG_B(*pc)];
+  TValue *ra = s2v(hRA(*pc));
+  setobj(L, uv->v.p, ra);
+  luaC_barrier(L, uv, ra);
+  return 1;
+}
+
+
+/* same lookups as OP_SELF in the interpreter, without the slow path */
+static int jit_self (lua_State *L, StkId base, LClosure *cl,
+                     const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *slot;
+  TValue *rb = hRB(i);
+  TString *key = tsvalue(hRKC(i));
+  StkId ra = hRA(i);
+#if LUAI_INLINECACHE
+  if (TESTARG_k(i) && ttistable(rb) && key->tt == LUA_VSHRSTR) {
+    Table *h = hvalue(rb);
+    const TValue *tm;
+    slot = luaH_getshortstr(h, key);
+    if (isempty(slot)) {
+      if (h->metatable == NULL ||
+          (tm = fasttm(L, h->metatable, TM_INDEX)) == NULL ||
+          !ttistable(tm) || !getfield(L, tm, key, slot))
+        return 0;
+    }
+  }
+  else
+#endif
+  if (!luaV_fastget(L, rb, key, slot, luaH_getstr))
+    return 0;
+  setobj2s(L, ra + 1, rb);
+  setobj2s(L, ra, slot);
+  return 1;
+}
+
+
+static int jit_len (lua_State *L, StkId base, LClosure *cl,
+                    const Instruction *pc) {
+  TValue *rb = hRB(*pc);
+  lua_Integer n;
+  UNUSED(cl);
+  switch (ttypetag(rb)) {
+    case LUA_VTABLE: {
+      Table *h = hvalue(rb);
+      if (fasttm(L, h->metatable, TM_LEN) != NULL)
+        return 0;  /* metamethod */
+      n = l_castU2S(luaH_getn(h));
+      break;
+    }
+    case LUA_VSHRSTR: case LUA_VLNGSTR: {
+      n = cast(lua_Integer, tsslen(tsvalue(rb)));
+      break;
+    }
+    default: return 0;
+  }
+  setivalue(s2v(hRA(*pc)), n);
+  return 1;
+}
+
+
+/*
+** Arithmetic without inline code ('%', '^', '//', and shifts); integer
+** division by zero goes to the interpreter, which raises the error.
+** (The order of the opcodes follows the order of the LUA_OP* codes.)
+*/
+static int jit_arith (lua_State *L, StkId base, LClosure *cl,
+                      const Instruction *pc) {
+  Instruction i = *pc;
+  const TValue *v1 = hRB(i);
+  const TValue *v2;
+  TValue imm;
+  int op;
+  switch (GET_OPCODE(i)) {
+    case OP_MODK: case OP_POWK: case OP_IDIVK: {
+      v2 = hKC(i);
+      op = GET_OPCODE(i) - OP_ADDK + LUA_OPADD;
+      break;
+    }
+    case OP_SHRI: {
+      setivalue(&imm, GETARG_sC(i));
+      v2 = &imm;
+      op = LUA_OPSHR;
+      break;
+    }
+    case OP_SHLI: {  /* immediate is the first operand */
+      setivalue(&imm, GETARG_sC(i));
+      v2 = v1;
+      v1 = &imm;
+      op = LUA_OPSHL;
+      break;
+    }
+    default: {
+      v2 = s2v(base + GETARG_C(i));
+      op = GET_OPCODE(i) - OP_ADD + LUA_OPADD;
+      break;
+    }
+  }
+  if ((op == LUA_OPMOD || op == LUA_OPIDIV) &&
+      ttisinteger(v1) && ttisinteger(v2) && ivalue(v2) == 0)
+    return 0;
+  return luaO_rawarith(L, op, v1, v2, s2v(hRA(i)));
+}
+
+
+/*
+** Integer loops only, like 'forprep' in lvm.c. Returns 1 to run the
+** loop and 2 to skip it.
+*/
+static int jit_forprep (lua_State *L, StkId base, LClosure *cl,
+                        const Instruction *pc) {
+  StkId ra = hRA(*pc);
+  TValue *pinit = s2v(ra);
+  TValue *plimit = s2v(ra + 1);
+  TValue *pstep = s2v(ra + 2);
+  lua_Integer init, limit, step;
+  lua_Unsigned count;
+  UNUSED(L); UNUSED(cl);
+  if (!ttisinteger(pinit) || !ttisinteger(plimit) || !ttisinteger(pstep))
+    return 0;
+  init = ivalue(pinit);
+  limit = ivalue(plimit);
+  step = ivalue(pstep);
+  if (step == 0)
+    return 0;  /* error */
+  setivalue(s2v(ra + 3), init);  /* control variable */
+  if (step > 0 ? init > limit : init < limit)
+    return 2;  /* skip the loop */
+  if (step > 0) {
+    count = l_castS2U(limit) - l_castS2U(init);
+    if (step != 1)
+      count /= l_castS2U(step);
+  }
+  else {
+    count = l_castS2U(init) - l_castS2U(limit);
+    count /= l_castS2U(-(step + 1)) + 1u;
+  }
+  setivalue(plimit, l_castU2S(count));
+  return 1;
+}
+
+
+/* call 'h' for instruction 'pc'; leave to the interpreter if it fails */
+static void callhelper (JitState *J, int pc, JitHelper h) {
+  movreg(J, ARG0, R12);
+  movreg(J, ARG1, RBX);
+  movreg(J, ARG2, R13);
+  movimm(J, ARG3, cast(lua_Unsigned, cast(size_t, &J->p->code[pc])));
+  movimm(J, RAX, cast(lua_Unsigned, cast(size_t, h)));
+  insreg(J, 0, 0, 0xFF, 2, RAX);  /* call rax */
+  insreg(J, 0, 0, 0x85, RAX, RAX);  /* test eax, eax */
+  jumpexit(J, JE, pc);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/*
+** Inline fast paths of table accesses. They leave in 'rax' the address
+** of a non-empty slot for the key, or take one of the jumps in 'm'
+** (towards the helper of the instruction, which does the whole access).
+*/
+#define MAXMISSES	6
+
+typedef struct Misses {
+  size_t jumps[MAXMISSES];
+  int n;
+} Misses;
+
+
+static void miss (JitState *J, Misses *m, int cc) {
+  lua_assert(m->n < MAXMISSES);
+  m->jumps[m->n++] = jumpfwd(J, cc);
+}
+
+
+static void checkslot (JitState *J, Misses *m) {
+  insmem(J, 0, 0, 0x0FB6, RDX, RAX,  /* movzx edx, tag of the slot */
+            cast_int(offsetof(TValue, tt_)));
+  insreg(J, 0, 0, 0xF6, 0, RDX);  /* test dl, 0x0F (empty?) */
+  emitbyte(J, 0x0F);
+  miss(J, m, JE);
+}
+
+
+/*
+** Field of table R[t] whose shape is the one in the inline cache of
+** instruction 'pc' (see 'luaH_cacheslot'). Returns 0 when there are no
+** such caches.
+*/
+static int fieldslot (JitState *J, int pc, int t, Misses *m) {
+#if LUAI_SHAPES && LUAI_INLINECACHE
+  if (J->p->icache == NULL)
+    return 0;
+  cmptag(J, t, ctb(LUA_VTABLE));
+  jumpexit(J, JNE, pc);  /* no raw access without a table */
+  movimm(J, RDX, cast(lua_Unsigned, cast(size_t, J->p->icache + pc)));
+  insmem(J, 0, 0, 0x8B, RCX, RDX, 0);  /* mov ecx, cache */
+  insreg(J, 0, 0, 0x85, RCX, RCX);  /* test ecx, ecx */
+  miss(J, m, JNS);  /* not a shape entry */
+  loadq(J, RAX, RBX, VAL(t));
+  loadq(J, RDX, RAX, cast_int(offsetof(Table, shape)));
+  insreg(J, 0, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+  miss(J, m, JE);
+  insreg(J, 0, 0, 0x89, RCX, R8);  /* mov r8d, ecx */
+  insreg(J, 0, 0, 0xC1, 5, R8);  /* shr r8d, 8 */
+  emitbyte(J, 8);
+  insreg(J, 0, 0, 0x81, 4, R8);  /* and r8d, ICIDMASK ('icshapeid') */
+  emit32(J, ICIDMASK);
+  insmem(J, 0, 0, INT_CMP, R8, RDX, cast_int(offsetof(Shape, id)));
+  miss(J, m, JNE);
+  insreg(J, 0, 0, 0x0FB6, RCX, RCX);  /* movzx ecx, cl ('icshapeslot') */
+  insreg(J, 0, 0, 0x6B, RCX, RCX);  /* imul ecx, ecx, sizeof(TValue) */
+  emitbyte(J, sizeof(TValue));
+  loadq(J, RAX, RAX, cast_int(offsetof(Table, slots)));
+  insreg(J, 0, 1, INT_ADD, RAX, RCX);
+  checkslot(J, m);
+  return 1;
+#else
+  UNUSED(J); UNUSED(pc); UNUSED(t); UNUSED(m);
+  return 0;
+#endif
+}
+
+
+/* integer key 'rcx' in the array part of R[t], a table */
+static void arrayslot (JitState *J, int t, Misses *m) {
+  loadq(J, RAX, RBX, VAL(t));
+  insreg(J, 0, 1, 0xFF, 1, RCX);  /* dec rcx */
+  insmem(J, 0, 0, 0x8B, RDX, RAX,  /* mov edx, alimit */
+            cast_int(offsetof(Table, alimit)));
+  insreg(J, 0, 1, INT_CMP, RCX, RDX);
+  miss(J, m, JAE);
+  loadq(J, RAX, RAX, cast_int(offsetof(Table, array)));
+  insreg(J, 0, 1, 0x6B, RCX, RCX);  /* imul rcx, rcx, sizeof(TValue) */
+  emitbyte(J, sizeof(TValue));
+  insreg(J, 0, 1, INT_ADD, RAX, RCX);
+  checkslot(J, m);
+}
+
+
+/* slot of the key of a get/set instruction whose table is R[t] */
+static int accessslot (JitState *J, int pc, int t, Misses *m) {
+  Instruction i = J->p->code[pc];
+  switch (GET_OPCODE(i)) {
+    case OP_GETFIELD: case OP_SETFIELD:
+      return fieldslot(J, pc, t, m);
+    case OP_GETI: case OP_SETI: {
+      cmptag(J, t, ctb(LUA_VTABLE));
+      jumpexit(J, JNE, pc);
+      movimm(J, RCX, cast(lua_Unsigned,
+                 (GET_OPCODE(i) == OP_GETI) ? GETARG_C(i) : GETARG_B(i)));
+      break;
+    }
+    default: {  /* OP_GETTABLE, OP_SETTABLE */
+      int key = (GET_OPCODE(i) == OP_GETTABLE) ? GETARG_C(i) : GETARG_B(i);
+      cmptag(J, t, ctb(LUA_VTABLE));
+      jumpexit(J, JNE, pc);
+      cmptag(J, key, LUA_VNUMINT);
+      miss(J, m, JNE);
+      loadq(J, RCX, RBX, VAL(key));
+      break;
+    }
+  }
+  arrayslot(J, t, m);
+  return 1;
+}
+
+
+/* the fast path ends here; the helper 'h' handles the misses */
+static void finishaccess (JitState *J, int pc, JitHelper h, Misses *m) {
+  size_t done = jumpfwd(J, JMP);
+  int n;
+  for (n = 0; n < m->n; n++)
+    here(J, m->jumps[n]);
+  callhelper(J, pc, h);
+  here(J, done);
+}
+
+
+/* R[A] := R[B][key] */
+static void codeget (JitState *J, int pc, JitHelper h) {
+  Instruction i = J->p->code[pc];
+  Misses m;
+  m.n = 0;
+  if (!accessslot(J, pc, GETARG_B(i), &m)) {
+    callhelper(J, pc, h);
+    return;
+  }
+  copyvalue(J, GETARG_A(i), RAX, 0);
+  finishaccess(J, pc, h, &m);
+}
+
+
+/*
+** R[A][key] := RK(C). Only values that are not collectable are stored
+** inline, as they need no GC barrier.
+*/
+static void codeset (JitState *J, int pc, JitHelper h) {
+  Instruction i = J->p->code[pc];
+  const TValue *kc = TESTARG_k(i) ? J->p->k + GETARG_C(i) : NULL;
+  Misses m;
+  m.n = 0;
+  if ((kc != NULL && iscollectable(kc)) ||
+      !accessslot(J, pc, GETARG_A(i), &m)) {
+    callhelper(J, pc, h);
+    return;
+  }
+  if (kc != NULL) {
+    lua_Unsigned bits;
+    memcpy(&bits, &kc->value_, sizeof(bits));
+    movimm(J, RCX, bits);
+    storeq(J, RCX, RAX, cast_int(offsetof(TValue, value_)));
+    insmem(J, 0, 0, 0xC6, 0, RAX, cast_int(offsetof(TValue, tt_)));
+    emitbyte(J, rawtt(kc));
+  }
+  else {
+    int c = GETARG_C(i);
+    insmem(J, 0, 0, 0xF6, 0, RBX, TAG(c));  /* test tag, collectable bit */
+    emitbyte(J, BIT_ISCOLLECTABLE);
+    miss(J, &m, JNE);
+    loadq(J, RCX, RBX, VAL(c));
+    storeq(J, RCX, RAX, cast_int(offsetof(TValue, value_)));
+    insmem(J, 0, 0, 0x0FB6, RCX, RBX, TAG(c));  /* movzx ecx, tag */
+    insmem(J, 0, 0, 0x88, RCX, RAX,  /* mov tag, cl */
+              cast_int(offsetof(TValue, tt_)));
+    insmem(J, 0, 0, 0x8B, RCX, RBX, VZ(c));  /* mov ecx, vz */
+    insmem(J, 0, 0, 0x89, RCX, RAX,  /* mov vz, ecx */
+              cast_int(offsetof(TValue, vz_)));
+  }
+  finishaccess(J, pc, h, &m);
+}
+
+
+/* target of the jump following the test at 'pc' */
+#define testtarget(J,pc)	((pc) + 2 + GETARG_sJ((J)->p->code[(pc) + 1]))
+
+
+/*
+** End of a test whose condition holds when 'cc' holds: go to the
+** target of the next jump when the condition equals 'k', to the
+** instruction after that jump otherwise
+*/
+static void condjump (JitState *J, int pc, int cc, int k) {
+  jumpto(J, k ? cc : negcc(cc), pc, testtarget(J, pc));
+  jumppc(J, JMP, pc + 2);
+}
+
+
+/* same as 'condjump' for a condition known to be 'cond' */
+static void condconst (JitState *J, int pc, int cond, int k) {
+  if (cond == k)
+    jumpto(J, JMP, pc, testtarget(J, pc));
+  else
+    jumppc(J, JMP, pc + 2);
+}
+
+
+/* after 'ucomisd': condition that holds for equal (and ordered) values */
+static int floateq (JitState *J) {
+  insreg(J, 0, 0, 0x0F94, 0, RAX);  /* sete al */
+  insreg(J, 0, 0, 0x0F9B, 0, RCX);  /* setnp cl */
+  insreg(J, 0, 0, 0x20, RCX, RAX);  /* and al, cl */
+  return JNE;
+}
+
+
+/* load number in register 'r' into SSE register 'x' as a float */
+static void loadnumber (JitState *J, int x, int r, int pc) {
+  size_t notfloat, done;
+  cmptag(J, r, LUA_VNUMFLT);
+  notfloat = jumpfwd(J, JNE);
+  movsdload(J, x, RBX, VAL(r));
+  done = jumpfwd(J, JMP);
+  here(J, notfloat);
+  cmptag(J, r, LUA_VNUMINT);
+  jumpexit(J, JNE, pc);
+  cvtload(J, x, RBX, VAL(r));
+  here(J, done);
+}
+
+
+/*
+** R[a] := R[b] op X, with X being R[c] or the constant 'kc' (when not
+** NULL). Two integers give an integer with 'iop' (if there is one), any
+** other two numbers give a float with 'fop'. Done, it skips the
+** OP_MMBIN that follows.
+*/
+static void codearith (JitState *J, int pc, int a, int b, int c,
+                       const TValue *kc, int iop, int fop) {
+  if (iop != 0 && (kc == NULL || ttisinteger(kc))) {
+    size_t notint1, notint2 = NOJUMP;
+    cmptag(J, b, LUA_VNUMINT);
+    notint1 = jumpfwd(J, JNE);
+    if (kc == NULL) {
+      cmptag(J, c, LUA_VNUMINT);
+      notint2 = jumpfwd(J, JNE);
+    }
+    loadq(J, RAX, RBX, VAL(b));
+    if (kc == NULL)
+      insmem(J, 0, 1, iop, RAX, RBX, VAL(c));
+    else {
+      movimm(J, RCX, l_castS2U(ivalue(kc)));
+      insreg(J, 0, 1, iop, RAX, RCX);
+    }
+    storeq(J, RAX, RBX, VAL(a));
+    settag(J, a, LUA_VNUMINT);
+    jumppc(J, JMP, pc + 2);
+    here(J, notint1);
+    here(J, notint2);
+  }
+  if (fop == 0) {  /* only integers? */
+    codeexit(J, pc, 1);
+    return;
+  }
+  loadnumber(J, XMM0, b, pc);
+  if (kc == NULL)
+    loadnumber(J, XMM1, c, pc);
+  else
+    loadfloat(J, XMM1, nvalue(kc));
+  insreg(J, 0xF2, 0, fop, XMM0, XMM1);
+  movsdstore(J, XMM0, RBX, VAL(a));
+  settag(J, a, LUA_VNUMFLT);
+  jumppc(J, JMP, pc + 2);
+}
+
+
+/*
+** R[a] < R[b] (or <=, as given by the integer and float conditions);
+** mixed integer/float comparisons go to the interpreter
+*/
+static void codeorder (JitState *J, int pc, int a, int b, int k,
+                       int icc, int fcc) {
+  size_t notint;
+  cmptag(J, a, LUA_VNUMINT);
+  notint = jumpfwd(J, JNE);
+  cmptag(J, b, LUA_VNUMINT);
+  jumpexit(J, JNE, pc);
+  loadq(J, RAX, RBX, VAL(a));
+  insmem(J, 0, 1, INT_CMP, RAX, RBX, VAL(b));
+  condjump(J, pc, icc, k);
+  here(J, notint);
+  cmptag(J, a, LUA_VNUMFLT);
+  jumpexit(J, JNE, pc);
+  cmptag(J, b, LUA_VNUMFLT);
+  jumpexit(J, JNE, pc);
+  movsdload(J, XMM0, RBX, VAL(b));
+  insmem(J, 0x66, 0, 0x0F2E, XMM0, RBX, VAL(a));  /* ucomisd xmm0, R[a] */
+  condjump(J, pc, fcc, k);
+}
+
+
+/*
+** Comparison of R[a] with the immediate 'im', holding when 'icc' holds
+** after 'cmp R[a], im'; 'swap' tells whether, for floats, the condition
+** 'fcc' applies to 'im' compared with R[a] instead
+*/
+static void codeorderI (JitState *J, int pc, int a, int im, int k,
+                        int icc, int fcc, int swap) {
+  size_t notint;
+  cmptag(J, a, LUA_VNUMINT);
+  notint = jumpfwd(J, JNE);
+  insmem(J, 0, 1, 0x81, 7, RBX, VAL(a));  /* cmp qword R[a], im */
+  emit32(J, cast(l_uint32, im));
+  condjump(J, pc, icc, k);
+  here(J, notint);
+  cmptag(J, a, LUA_VNUMFLT);
+  jumpexit(J, JNE, pc);
+  movsdload(J, XMM0, RBX, VAL(a));
+  loadfloat(J, XMM1, cast_num(im));
+  if (swap)
+    ucomisd(J, XMM1, XMM0);
+  else
+    ucomisd(J, XMM0, XMM1);
+  condjump(J, pc, fcc, k);
+}
+
+
+/* R[a] == R[b] for two integers or two floats */
+static void codeeq (JitState *J, int pc, int a, int b, int k) {
+  size_t notint;
+  cmptag(J, a, LUA_VNUMINT);
+  notint = jumpfwd(J, JNE);
+  cmptag(J, b, LUA_VNUMINT);
+  jumpexit(J, JNE, pc);
+  loadq(J, RAX, RBX, VAL(a));
+  insmem(J, 0, 1, INT_CMP, RAX, RBX, VAL(b));
+  condjump(J, pc, JE, k);
+  here(J, notint);
+  cmptag(J, a, LUA_VNUMFLT);
+  jumpexit(J, JNE, pc);
+  cmptag(J, b, LUA_VNUMFLT);
+  jumpexit(J, JNE, pc);
+  movsdload(J, XMM0, RBX, VAL(a));
+  insmem(J, 0x66, 0, 0x0F2E, XMM0, RBX, VAL(b));
+  condjump(J, pc, floateq(J), k);
+}
+
+
+/*
+** R[a] == number 'n' (an integer if 'isint'); other types are never
+** equal, except for the other number variant, which the interpreter
+** compares
+*/
+static void codeeqnum (JitState *J, int pc, int a, lua_Integer i,
+                       lua_Number n, int isint, int k) {
+  size_t other;
+  int tag = isint ? LUA_VNUMINT : LUA_VNUMFLT;
+  cmptag(J, a, tag);
+  other = jumpfwd(J, JNE);
+  if (isint) {
+    movimm(J, RAX, l_castS2U(i));
+    insmem(J, 0, 1, INT_CMP, RAX, RBX, VAL(a));
+    condjump(J, pc, JE, k);
+  }
+  else {
+    movsdload(J, XMM0, RBX, VAL(a));
+    loadfloat(J, XMM1, n);
+    ucomisd(J, XMM0, XMM1);
+    condjump(J, pc, floateq(J), k);
+  }
+  here(J, other);
+  cmptag(J, a, isint ? LUA_VNUMFLT : LUA_VNUMINT);
+  jumpexit(J, JE, pc);
+  condconst(J, pc, 0, k);
+}
+
+
+/* R[a] == constant 'kb'; returns 0 for constants it does not handle */
+static int codeeqk (JitState *J, int pc, int a, const TValue *kb, int k) {
+  size_t other;
+  if (ttisinteger(kb))
+    codeeqnum(J, pc, a, ivalue(kb), 0, 1, k);
+  else if (ttisfloat(kb))
+    codeeqnum(J, pc, a, 0, fltvalue(kb), 0, k);
+  else if (ttisshrstring(kb) || !iscollectable(kb)) {
+    /* equal only to the same tag (and the same interned string) */
+    cmptag(J, a, rawtt(kb));
+    other = jumpfwd(J, JNE);
+    if (ttisshrstring(kb)) {
+      movimm(J, RAX, cast(lua_Unsigned, cast(size_t, tsvalue(kb))));
+      insmem(J, 0, 1, INT_CMP, RAX, RBX, VAL(a));
+      condjump(J, pc, JE, k);
+    }
+    else
+      condconst(J, pc, 1, k);
+    here(J, other);
+    condconst(J, pc, 0, k);
+  }
+  else
+    return 0;
+  return 1;
+}
+
+
+/* jumps when R[r] is false or nil; 'j2' gets the second jump */
+static size_t testfalse (JitState *J, int r, size_t *j2) {
+  size_t j1;
+  insmem(J, 0, 0, 0x0FB6, RAX, RBX, TAG(r));  /* movzx eax, tag */
+  emitbyte(J, 0x3C);  /* cmp al, LUA_VFALSE */
+  emitbyte(J, LUA_VFALSE);
+  j1 = jumpfwd(J, JE);
+  emitbyte(J, 0xA8);  /* test al, 0x0F (all nil variants have type 0) */
+  emitbyte(J, 0x0F);
+  *j2 = jumpfwd(J, JE);
+  return j1;
+}
+
+
+/*
+** OP_TEST (when 'b' is negative) and OP_TESTSET: go to the next jump
+** (copying R[b] to R[a] for OP_TESTSET) unless the falsity of R[a]
+** equals 'k'
+*/
+static void codetest (JitState *J, int pc, int a, int b, int k) {
+  int target = testtarget(J, pc);
+  size_t j2;
+  size_t j1 = testfalse(J, (b < 0) ? a : b, &j2);
+  /* value is true */
+  if (k) {
+    if (b >= 0) copyvalue(J, a, RBX, VAL(b));
+    jumpto(J, JMP, pc, target);
+  }
+  else
+    jumppc(J, JMP, pc + 2);
+  here(J, j1);
+  here(J, j2);
+  /* value is false */
+  if (!k) {
+    if (b >= 0) copyvalue(J, a, RBX, VAL(b));
+    jumpto(J, JMP, pc, target);
+  }
+  else
+    jumppc(J, JMP, pc + 2);
+}
+
+
+/* same as OP_FORLOOP in the interpreter, for both kinds of loops */
+static void codeforloop (JitState *J, int pc, int a, int bx) {
+  size_t notint, done, down, loop, done1, done2;
+  cmptag(J, a + 2, LUA_VNUMINT);
+  notint = jumpfwd(J, JNE);
+  loadq(J, RAX, RBX, VAL(a + 1));  /* counter */
+  insreg(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  done = jumpfwd(J, JE);
+  insreg(J, 0, 1, 0xFF, 1, RAX);  /* dec rax */
+  storeq(J, RAX, RBX, VAL(a + 1));
+  loadq(J, RAX, RBX, VAL(a));
+  insmem(J, 0, 1, INT_ADD, RAX, RBX, VAL(a + 2));
+  storeq(J, RAX, RBX, VAL(a));
+  storeq(J, RAX, RBX, VAL(a + 3));
+  settag(J, a + 3, LUA_VNUMINT);
+  jumpto(J, JMP, pc, pc + 1 - bx);
+  here(J, notint);  /* float loop ('floatforloop') */
+  movsdload(J, XMM0, RBX, VAL(a));
+  insmem(J, 0xF2, 0, SSE_ADD, XMM0, RBX, VAL(a + 2));  /* idx += step */
+  insreg(J, 0x66, 0, 0x0F57, XMM2, XMM2);  /* xorpd xmm2, xmm2 */
+  insmem(J, 0x66, 0, 0x0F2E, XMM2, RBX, VAL(a + 2));  /* ucomisd 0, step */
+  down = jumpfwd(J, JAE);
+  movsdload(J, XMM1, RBX, VAL(a + 1));
+  ucomisd(J, XMM1, XMM0);  /* limit >= idx? */
+  done1 = jumpfwd(J, JB);
+  loop = jumpfwd(J, JMP);
+  here(J, down);
+  insmem(J, 0x66, 0, 0x0F2E, XMM0, RBX, VAL(a + 1));  /* idx >= limit? */
+  done2 = jumpfwd(J, JB);
+  here(J, loop);
+  movsdstore(J, XMM0, RBX, VAL(a));
+  movsdstore(J, XMM0, RBX, VAL(a + 3));
+  settag(J, a + 3, LUA_VNUMFLT);
+  jumpto(J, JMP, pc, pc + 1 - bx);
+  here(J, done1);
+  here(J, done2);
+  here(J, done);
+}
+
+
+/*
+** Generate the code of instruction 'pc'. Returns 0 when the
+** instruction always goes to the interpreter.
+*/
+static int codeinstruction (JitState *J, int pc) {
+  Proto *p = J->p;
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  TValue imm;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      copyvalue(J, a, RBX, VAL(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADI: {
+      insmem(J, 0, 1, 0xC7, 0, RBX, VAL(a));  /* mov qword R[a], sBx */
+      emit32(J, cast(l_uint32, GETARG_sBx(i)));
+      settag(J, a, LUA_VNUMINT);
+      break;
+    }
+    case OP_LOADF: {
+      loadfloat(J, XMM0, cast_num(GETARG_sBx(i)));
+      movsdstore(J, XMM0, RBX, VAL(a));
+      settag(J, a, LUA_VNUMFLT);
+      break;
+    }
+    case OP_LOADK: {
+      const TValue *kb = p->k + GETARG_Bx(i);
+      lua_Unsigned bits;
+      memcpy(&bits, &kb->value_, sizeof(bits));
+      movimm(J, RAX, bits);
+      storeq(J, RAX, RBX, VAL(a));
+      settag(J, a, rawtt(kb));
+      break;
+    }
+    case OP_LOADFALSE: {
+      settag(J, a, LUA_VFALSE);
+      break;
+    }
+    case OP_LFALSESKIP: {
+      settag(J, a, LUA_VFALSE);
+      jumppc(J, JMP, pc + 2);
+      break;
+    }
+    case OP_LOADTRUE: {
+      settag(J, a, LUA_VTRUE);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, a++, LUA_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      loadq(J, RAX, R13, cast_int(offsetof(LClosure, upvals)) +
+                         GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      loadq(J, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      copyvalue(J, a, RAX, 0);
+      break;
+    }
+    case OP_SETUPVAL: callhelper(J, pc, jit_setupval); break;
+    case OP_GETTABUP: callhelper(J, pc, jit_gettabup); break;
+    case OP_GETTABLE: codeget(J, pc, jit_gettable); break;
+    case OP_GETI: codeget(J, pc, jit_geti); break;
+    case OP_GETFIELD: codeget(J, pc, jit_getfield); break;
+    case OP_SETTABUP: callhelper(J, pc, jit_settabup); break;
+    case OP_SETTABLE: codeset(J, pc, jit_settable); break;
+    case OP_SETI: codeset(J, pc, jit_seti); break;
+    case OP_SETFIELD: codeset(J, pc, jit_setfield); break;
+    case OP_SELF: callhelper(J, pc, jit_self); break;
+    case OP_LEN: callhelper(J, pc, jit_len); break;
+    case OP_MOD: case OP_POW: case OP_IDIV: case OP_SHL: case OP_SHR:
+    case OP_MODK: case OP_POWK: case OP_IDIVK: case OP_SHRI: case OP_SHLI: {
+      callhelper(J, pc, jit_arith);
+      jumppc(J, JMP, pc + 2);  /* skip the MMBIN */
+      break;
+    }
+    case OP_ADDI: {
+      setivalue(&imm, GETARG_sC(i));
+      codearith(J, pc, a, GETARG_B(i), 0, &imm, INT_ADD, SSE_ADD);
+      break;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK: {
+      static const int iops[] = {INT_ADD, INT_SUB, INT_IMUL, 0, 0, 0, 0,
+                                 INT_AND, INT_OR, INT_XOR};
+      static const int fops[] = {SSE_ADD, SSE_SUB, SSE_MUL, 0, 0, SSE_DIV, 0,
+                                 0, 0, 0};
+      int op = GET_OPCODE(i) - OP_ADDK;
+      const TValue *kc = p->k + GETARG_C(i);
+      if (op >= OP_BANDK - OP_ADDK && !ttisinteger(kc))
+        return 0;  /* the interpreter converts (or complains about) it */
+      codearith(J, pc, a, GETARG_B(i), 0, kc, iops[op], fops[op]);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: {
+      static const int iops[] = {INT_ADD, INT_SUB, INT_IMUL, 0, 0, 0, 0,
+                                 INT_AND, INT_OR, INT_XOR};
+      static const int fops[] = {SSE_ADD, SSE_SUB, SSE_MUL, 0, 0, SSE_DIV, 0,
+                                 0, 0, 0};
+      int op = GET_OPCODE(i) - OP_ADD;
+      codearith(J, pc, a, GETARG_B(i), GETARG_C(i), NULL, iops[op], fops[op]);
+      break;
+    }
+    case OP_UNM: {
+      int b = GETARG_B(i);
+      size_t notint;
+      cmptag(J, b, LUA_VNUMINT);
+      notint = jumpfwd(J, JNE);
+      loadq(J, RAX, RBX, VAL(b));
+      insreg(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+      storeq(J, RAX, RBX, VAL(a));
+      settag(J, a, LUA_VNUMINT);
+      jumppc(J, JMP, pc + 1);
+      here(J, notint);
+      cmptag(J, b, LUA_VNUMFLT);
+      jumpexit(J, JNE, pc);
+      loadq(J, RAX, RBX, VAL(b));
+      movimm(J, RCX, l_castS2U(LUA_MININTEGER));  /* sign bit */
+      insreg(J, 0, 1, INT_XOR, RAX, RCX);
+      storeq(J, RAX, RBX, VAL(a));
+      settag(J, a, LUA_VNUMFLT);
+      break;
+    }
+    case OP_BNOT: {
+      int b = GETARG_B(i);
+      cmptag(J, b, LUA_VNUMINT);
+      jumpexit(J, JNE, pc);
+      loadq(J, RAX, RBX, VAL(b));
+      insreg(J, 0, 1, 0xF7, 2, RAX);  /* not rax */
+      storeq(J, RAX, RBX, VAL(a));
+      settag(J, a, LUA_VNUMINT);
+      break;
+    }
+    case OP_NOT: {
+      size_t j2, done;
+      size_t j1 = testfalse(J, GETARG_B(i), &j2);
+      settag(J, a, LUA_VFALSE);
+      done = jumpfwd(J, JMP);
+      here(J, j1);
+      here(J, j2);
+      settag(J, a, LUA_VTRUE);
+      here(J, done);
+      break;
+    }
+    case OP_JMP: {
+      jumpto(J, JMP, pc, pc + 1 + GETARG_sJ(i));
+      break;
+    }
+    case OP_EQ: {
+      codeeq(J, pc, a, GETARG_B(i), GETARG_k(i));
+      break;
+    }
+    case OP_LT: {
+      codeorder(J, pc, a, GETARG_B(i), GETARG_k(i), JL, JA);
+      break;
+    }
+    case OP_LE: {
+      codeorder(J, pc, a, GETARG_B(i), GETARG_k(i), JLE, JAE);
+      break;
+    }
+    case OP_EQK: {
+      if (!codeeqk(J, pc, a, p->k + GETARG_B(i), GETARG_k(i)))
+        return 0;
+      break;
+    }
+    case OP_EQI: {
+      int im = GETARG_sB(i);
+      codeeqnum(J, pc, a, im, cast_num(im), GETARG_C(i) == 0, GETARG_k(i));
+      break;
+    }
+    case OP_LTI: {
+      codeorderI(J, pc, a, GETARG_sB(i), GETARG_k(i), JL, JA, 1);
+      break;
+    }
+    case OP_LEI: {
+      codeorderI(J, pc, a, GETARG_sB(i), GETARG_k(i), JLE, JAE, 1);
+      break;
+    }
+    case OP_GTI: {
+      codeorderI(J, pc, a, GETARG_sB(i), GETARG_k(i), JG, JA, 0);
+      break;
+    }
+    case OP_GEI: {
+      codeorderI(J, pc, a, GETARG_sB(i), GETARG_k(i), JGE, JAE, 0);
+      break;
+    }
+    case OP_TEST: {
+      codetest(J, pc, a, -1, GETARG_k(i));
+      break;
+    }
+    case OP_TESTSET: {
+      codetest(J, pc, a, GETARG_B(i), GETARG_k(i));
+      break;
+    }
+    case OP_FORLOOP: {
+      codeforloop(J, pc, a, GETARG_Bx(i));
+      break;
+    }
+    case OP_FORPREP: {
+      size_t run;
+      callhelper(J, pc, jit_forprep);
+      emitbyte(J, 0x83);  /* cmp eax, 2 */
+      emitbyte(J, 0xF8);
+      emitbyte(J, 2);
+      run = jumpfwd(J, JNE);
+      jumppc(J, JMP, pc + GETARG_Bx(i) + 2);
+      here(J, run);
+      break;
+    }
+    default: return 0;
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Executable memory
+** =======================================================
+*/
+
+static void *newexec (size_t size) {
+#if defined(_WIN32)
+  return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (mem == MAP_FAILED) ? NULL : mem;
+#endif
+}
+
+
+/* make the (already written) memory executable and read-only */
+static int protectexec (void *mem, size_t size) {
+#if defined(_WIN32)
+  DWORD old;
+  return VirtualProtect(mem, size, PAGE_EXECUTE_READ, &old) &&
+         FlushInstructionCache(GetCurrentProcess(), mem, size);
+#else
+  return mprotect(mem, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+
+static void freeexec (void *mem, size_t size) {
+#if defined(_WIN32)
+  UNUSED(size);
+  VirtualFree(mem, 0, MEM_RELEASE);
+#else
+  munmap(mem, size);
+#endif
+}
+
+/* }====================================================== */
+
+
+/*
+** Whether instruction 'pc' stores into the table that an OP_NEWTABLE
+** left in register '*fresh' (which it keeps up to date). Such stores
+** add new keys, which always needs the interpreter, so they get no
+** native code: the interpreter then runs the whole constructor instead
+** of going in and out of native code at each of its keys. The register
+** is forgotten at the first jump or test, so stores in a loop after the
+** constructor are not affected.
+*/
+static int freshstore (Proto *p, int pc, int *fresh) {
+  Instruction i = p->code[pc];
+  OpCode op = GET_OPCODE(i);
+  if (op == OP_NEWTABLE)
+    *fresh = GETARG_A(i);
+  else if (testTMode(op) || op == OP_JMP || op == OP_FORPREP ||
+           op == OP_TFORPREP)
+    *fresh = -1;
+  else if (GETARG_A(i) == *fresh) {
+    if (op == OP_SETFIELD || op == OP_SETI || op == OP_SETTABLE)
+      return 1;
+    else if (testAMode(op))
+      *fresh = -1;
+  }
+  return 0;
+}
+
+
+/*
+** Going in and out of native code costs about as much as interpreting a
+** few instructions, so the code of an instruction is only an entry when
+** at least JITMINRUN instructions with native code follow in a straight
+** line (a jump back means a loop, which is always worth entering). The
+** MMBIN instructions after an arithmetic one do not break a run, as its
+** native code jumps over them. Returns the number of entries left.
+*/
+static int shortruns (Proto *p, lu_byte *native) {
+  int run = 0;
+  int entries = 0;
+  int pc;
+  for (pc = p->sizecode - 1; pc >= 0; pc--) {
+    Instruction i = p->code[pc];
+    OpCode op = GET_OPCODE(i);
+    if (!native[pc]) {
+      if (op < OP_MMBIN || op > OP_MMBINK || pc == 0 || !native[pc - 1])
+        run = 0;
+    }
+    else if (op == OP_FORLOOP || (op == OP_JMP && GETARG_sJ(i) < 0))
+      run = JITMINRUN;
+    else if (run < JITMINRUN)
+      run++;
+    native[pc] = (run >= JITMINRUN);
+    entries += native[pc];
+  }
+  return entries;
+}
+
+
+/* a 'JitCode' with 'n' entries, followed by its 'misses' */
+#define sizejitcode(n)	(offsetof(JitCode, entries) + (n) * sizeof(void *) + (n))
+
+
+/*
+** Entry code: save the registers it uses, set them up and jump to
+** the instruction where execution starts. It is followed by the exit
+** code, which returns the index of the instruction in 'eax'.
+*/
+static void codeprologue (JitState *J) {
+  emitbyte(J, 0x53);  /* push rbx */
+  emitbyte(J, 0x41); emitbyte(J, 0x54);  /* push r12 */
+  emitbyte(J, 0x41); emitbyte(J, 0x55);  /* push r13 */
+  if (SHADOWSPACE > 0) {
+    insreg(J, 0, 1, 0x83, 5, RSP);  /* sub rsp, SHADOWSPACE */
+    emitbyte(J, SHADOWSPACE);
+  }
+  movreg(J, R12, ARG0);
+  movreg(J, RBX, ARG1);
+  movreg(J, R13, ARG2);
+  insreg(J, 0, 0, 0xFF, 4, ARG3);  /* jmp to entry */
+  J->epilogue = J->size;
+  if (SHADOWSPACE > 0) {
+    insreg(J, 0, 1, 0x83, 0, RSP);  /* add rsp, SHADOWSPACE */
+    emitbyte(J, SHADOWSPACE);
+  }
+  emitbyte(J, 0x41); emitbyte(J, 0x5D);  /* pop r13 */
+  emitbyte(J, 0x41); emitbyte(J, 0x5C);  /* pop r12 */
+  emitbyte(J, 0x5B);  /* pop rbx */
+  emitbyte(J, 0xC3);  /* ret */
+}
+
+
+/* generate the exits and resolve all jumps */
+static void finishcode (JitState *J) {
+  int n;
+  for (n = 0; n < J->nfixups && !J->failed; n++) {
+    Fixup *f = &J->fixups[n];
+    size_t target;
+    if (f->pc < 0 || f->pc >= J->p->sizecode) {
+      J->failed = 1;  /* should not happen */
+      break;
+    }
+    if (f->exit) {
+      if (J->exitpos[f->pc] == 0) {
+        J->exitpos[f->pc] = J->size;
+        codeexit(J, f->pc, 1);
+      }
+      target = J->exitpos[f->pc];
+    }
+    else
+      target = J->pcpos[f->pc];
+    if (!J->failed)
+      patch(J, f->at, target);
+  }
+}
+
+
+/* copy the code to executable memory and build the 'JitCode' */
+static JitCode *install (JitState *J, const lu_byte *native) {
+  Proto *p = J->p;
+  JitCode *jc;
+  unsigned char *mem = cast(unsigned char *, newexec(J->size));
+  int pc;
+  if (mem == NULL)
+    return NULL;
+  memcpy(mem, J->code, J->size);
+  jc = cast(JitCode *, jitrealloc(J, NULL, 0, sizejitcode(p->sizecode)));
+  if (jc == NULL || !protectexec(mem, J->size)) {
+    if (jc != NULL)
+      jitrealloc(J, jc, sizejitcode(p->sizecode), 0);
+    freeexec(mem, J->size);
+    return NULL;
+  }
+  jc->run = cast(int (*) (lua_State *, StkId, LClosure *, const void *),
+                 cast(void *, mem));
+  jc->mem = mem;
+  jc->memsize = J->size;
+  jc->misses = cast(lu_byte *, jc->entries + p->sizecode);
+  jc->nentries = 0;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    jc->entries[pc] = native[pc] ? mem + J->pcpos[pc] : NULL;
+    jc->misses[pc] = 0;
+    jc->nentries += native[pc];
+  }
+  return jc;
+}
+
+
+/*
+** Translate 'p' to machine code. Returns whether it succeeded; either
+** way, 'p' is never tried again. Code without any entry worth entering
+** (say, a function that mostly calls others) is dropped, so that the
+** interpreter does not even look for entries in it.
+*/
+int luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  lu_byte *native;
+  int n = p->sizecode;
+  int pc;
+  int fresh = -1;
+  p->jithot = 0;
+  if (n > LUAI_JITMAXCODE || p->jit != NULL)
+    return p->jit != NULL;
+  J.L = L;
+  J.p = p;
+  J.failed = 0;
+  J.size = 0;
+  J.capacity = 256 + cast_sizet(n) * 32;
+  J.nfixups = 0;
+  J.sizefixups = 16 + n * 2;
+  J.code = cast(unsigned char *, jitrealloc(&J, NULL, 0, J.capacity));
+  J.pcpos = cast(size_t *, jitrealloc(&J, NULL, 0, n * sizeof(size_t)));
+  J.exitpos = cast(size_t *, jitrealloc(&J, NULL, 0, n * sizeof(size_t)));
+  J.fixups = cast(Fixup *, jitrealloc(&J, NULL, 0,
+                                      J.sizefixups * sizeof(Fixup)));
+  native = cast(lu_byte *, jitrealloc(&J, NULL, 0, n));
+  if (!J.failed) {
+    codeprologue(&J);
+    for (pc = 0; pc < n; pc++) {
+      J.pcpos[pc] = J.size;
+      native[pc] = cast_byte(!freshstore(p, pc, &fresh) &&
+                             codeinstruction(&J, pc));
+      if (!native[pc])  /* its code is the exit itself */
+        codeexit(&J, pc, 0);
+      J.exitpos[pc] = 0;
+    }
+    finishcode(&J);
+    if (shortruns(p, native) > 0 && !J.failed)
+      p->jit = install(&J, native);
+  }
+  freebuffer(&J, J.code, J.capacity);
+  freebuffer(&J, J.pcpos, n * sizeof(size_t));
+  freebuffer(&J, J.exitpos, n * sizeof(size_t));
+  freebuffer(&J, J.fixups, J.sizefixups * sizeof(Fixup));
+  freebuffer(&J, native, n);
+  return p->jit != NULL;
+}
+
+
+/*
+** Native code entered at instruction 'from' stopped at a slow path,
+** coded in 'res' (see 'codeexit'); returns the instruction where the
+** interpreter continues. The interpreter runs on from there until it
+** tries native code again at its next jump, loop, call, or return. An
+** entry whose runs keep missing after a few instructions, without
+** looping (say, in a loop that indexes a userdata like an array), costs
+** more going in and out than it saves, so it is not entered any more.
+*/
+static int countmiss (Proto *p, int from, int res) {
+  JitCode *jc = p->jit;
+  int pc = ~res;
+  int i;
+  if (pc < from || pc - from > JITSHORTMISS)
+    return pc;
+  for (i = from; i < pc; i++) {
+    Instruction ins = p->code[i];
+    OpCode op = GET_OPCODE(ins);
+    if (op == OP_FORLOOP || op == OP_TFORLOOP ||
+        (op == OP_JMP && GETARG_sJ(ins) < 0))
+      return pc;  /* it may have looped */
+  }
+  if (++jc->misses[from] == JITMAXMISSES) {
+    jc->entries[from] = NULL;
+    jc->nentries--;
+  }
+  return pc;
+}
+
+
+/*
+** Run the native code of instruction 'pc' of closure 'cl', which must
+** be an entry; returns the instruction where the interpreter goes on.
+** Code left without entries is freed, and the function is only
+** interpreted from then on.
+*/
+const Instruction *luaJ_run (lua_State *L, LClosure *cl, StkId base,
+                             const Instruction *pc) {
+  Proto *p = cl->p;
+  int n = p->jit->run(L, base, cl, luaJ_entry(p, pc));
+  if (n < 0) {  /* stopped at a slow path? */
+    n = countmiss(p, cast_int(pc - p->code), n);
+    if (p->jit->nentries == 0)
+      luaJ_free(L, p);
+  }
+  return p->code + n;
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  if (jc != NULL) {
+    global_State *g = G(L);
+    freeexec(jc->mem, jc->memsize);
+    (*g->frealloc)(g->ud, jc, sizejitcode(p->sizecode), 0);
+    p->jit = NULL;
+  }
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler of Lua functions to x86-64 machine code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if LUAI_JIT
+
+/*
+** Native code of a prototype. 'run' enters the code of instruction
+** 'entry' (one of the 'entries') with registers based at 'base' and
+** returns the index of the first instruction it left to the
+** interpreter, as '~pc' when it was a slow path of an instruction with
+** native code (see 'luaJ_run'). An entry is NULL when its instruction
+** always runs in the interpreter.
+*/
+typedef struct JitCode {
+  int (*run) (lua_State *L, StkId base, LClosure *cl, const void *entry);
+  void *mem;  /* executable memory with the code */
+  size_t memsize;
+  lu_byte *misses;  /* count of short runs that missed, per entry */
+  int nentries;  /* number of entries not NULL */
+  const void *entries[1];  /* one per instruction */
+} JitCode;
+
+
+#define luaJ_entry(p,pc)	((p)->jit->entries[(pc) - (p)->code])
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC const Instruction *luaJ_run (lua_State *L, LClosure *cl,
+                                       StkId base, const Instruction *pc);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#endif
+
+#endif
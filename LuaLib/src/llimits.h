@@ -212,6 +212,144 @@ typedef l_uint32 Instruction;
 ** metamethods, as these strings must be internalized;
 ** #("function") = 8, #("__newindex") = 10.)
 */
+/*
+** Inline caches for field access: every OP_GETFIELD, OP_SETFIELD,
+** OP_GETTABUP, OP_SETTABUP and OP_SELF remembers the node slot where it
+** last found its key (see 'luaH_getshortstrcache'). Define it as 0 to
+** turn the caches off.
+*/
+#if !defined(LUAI_INLINECACHE)
+#define LUAI_INLINECACHE	1
+#endif
+
+
+/*
+** Hidden classes ("shapes") for tables: tables with the same short-string
+** keys, added in the same order, share one Shape listing those keys and
+** keep just the values in a dense 'slots' array (see ltable.c). A table
+** with more than LUAI_MAXSHAPEKEYS string keys moves them back into its
+** hash part, and so does a table needing a new shape while LUAI_MAXSHAPES
+** shapes exist. A shape is freed when its last table is; its id is not
+** reused, so a state creates at most 2^23 - 1 shapes in its lifetime.
+** Define LUAI_SHAPES as 0 to keep all keys in the hash part.
+*/
+#if !defined(LUAI_SHAPES)
+#define LUAI_SHAPES		1
+#endif
+
+#if !defined(LUAI_MAXSHAPEKEYS)
+#define LUAI_MAXSHAPEKEYS	32
+#endif
+
+#if !defined(LUAI_MAXSHAPES)
+#define LUAI_MAXSHAPES		65536
+#endif
+
+
+/*
+** Count how many times each opcode runs right after each other one
+** (see 'lua_opprofile'). It costs a counter update per instruction,
+** so it is off by default.
+*/
+#if !defined(LUAI_OPPROFILE)
+#define LUAI_OPPROFILE		0
+#endif
+
+
+/*
+** Allocation profiler (see 'lua_memprofile'). It counts the objects of
+** each type and the bytes they hold, which costs a few increments per
+** object created or resized, so it is on by default; the per-line
+** sampling only runs when asked for. It remembers at most LUAI_MEMSITES
+** source lines and LUAI_MEMSAMPLED sampled objects not yet freed; past
+** that, it keeps a random half of them and samples half as often.
+*/
+#if !defined(LUAI_MEMPROFILE)
+#define LUAI_MEMPROFILE		1
+#endif
+
+#if !defined(LUAI_MEMSITES)
+#define LUAI_MEMSITES		256
+#endif
+
+#if !defined(LUAI_MEMSAMPLED)
+#define LUAI_MEMSAMPLED		2048
+#endif
+
+
+/*
+** With a background sweeper (see 'lua_setsweeper'), dead objects are
+** handed over at the end of each collector step, or as soon as
+** LUAI_SWEEPBATCH of them are waiting.
+*/
+#if !defined(LUAI_SWEEPBATCH)
+#define LUAI_SWEEPBATCH		4096
+#endif
+
+
+/*
+** Baseline JIT (see ljit.c): a function is translated to x86-64 machine
+** code once it has run LUAI_JITHOT times (counting both calls and
+** iterations of its integer loops), unless it has more than
+** LUAI_JITMAXCODE instructions. It needs 64-bit integers and doubles.
+** The Win64 calling convention paths have never been run, so Windows
+** builds stay interpreted unless LUAI_JIT is defined as 1.
+*/
+#if !defined(LUAI_JIT)
+#if (defined(__x86_64__) || defined(_M_X64)) && \
+    !defined(_WIN32) && !defined(_MSC_VER) && \
+    LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && LUA_INT_TYPE == LUA_INT_LONGLONG
+#define LUAI_JIT		1
+#else
+#define LUAI_JIT		0
+#endif
+#endif
+
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT		100
+#endif
+
+#if !defined(LUAI_JITMAXCODE)
+#define LUAI_JITMAXCODE		4000
+#endif
+
+
+/*
+** Coroutines start with a stack of LUAI_THREADSTACK slots (the main
+** thread gets BASIC_STACK_SIZE) and double it when they need more. The
+** default fits a small function plus the LUA_MINSTACK slots of the C
+** function it yields from; anything smaller makes nearly every new
+** coroutine grow its stack on its first yield. The collector trims a
+** coroutine that stays suspended back to the part of its stack it uses
+** and frees its spare CallInfos (see 'luaD_shrinkstack'), so tens of
+** thousands of idle coroutines don't each hold a large stack.
+*/
+#if !defined(LUAI_THREADSTACK)
+#define LUAI_THREADSTACK	32
+#endif
+
+#if LUAI_THREADSTACK < LUA_MINSTACK + 1
+#error "LUAI_THREADSTACK must leave room for LUA_MINSTACK slots"
+#endif
+
+
+/*
+** Dead threads are not freed right away: up to LUAI_THREADPOOL of them
+** wait in a per-state pool, keeping their stacks and CallInfo lists, and
+** 'lua_newthread' takes one from there before allocating. Scripts that
+** create a coroutine per short task then stop paying for a new stack
+** each time. Threads whose stack grew past LUAI_THREADPOOLSTACK slots
+** are freed as usual. Define LUAI_THREADPOOL as 0 to turn the pool off.
+*/
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		256
+#endif
+
+#if !defined(LUAI_THREADPOOLSTACK)
+#define LUAI_THREADPOOLSTACK	(8 * LUA_MINSTACK)
+#endif
+
+
 #if !defined(LUAI_MAXSHORTLEN)
 #define LUAI_MAXSHORTLEN	40
 #endif
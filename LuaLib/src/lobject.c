@@ -123,6 +123,59 @@ int luaO_rawarith (lua_State *L, int op, const TValue *p1, const TValue *p2,
 }
 
 
+/*
+** Lanes of a vector operand; a number is broadcast to all lanes.
+** Returns 0 if 'o' is neither.
+*/
+static int veclanes (const TValue *o, float *l) {
+  if (ttisvector(o)) {
+    l[0] = vecx(o); l[1] = vecy(o); l[2] = vecz(o);
+    return 1;
+  }
+  else if (ttisnumber(o)) {
+    l[0] = l[1] = l[2] = cast(float, nvalue(o));
+    return 1;
+  }
+  else return 0;
+}
+
+
+/*
+** Arithmetic with vectors, lane by lane in single precision: '+' and
+** '-' between two vectors, '*' and '/' between vectors and numbers in
+** any mix, and unary minus. Returns 0 (fail) for anything else.
+*/
+int luaO_vecarith (int op, const TValue *p1, const TValue *p2,
+                   TValue *res) {
+  float a[3], b[3];
+  lua_assert(ttisvector(p1) || ttisvector(p2));
+  if (!veclanes(p1, a) || !veclanes(p2, b))
+    return 0;
+  switch (op) {
+    case LUA_OPADD:
+      if (!ttisvector(p1) || !ttisvector(p2))
+        return 0;  /* no adding numbers to vectors */
+      setvecvalue(res, a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+      return 1;
+    case LUA_OPSUB:
+      if (!ttisvector(p1) || !ttisvector(p2))
+        return 0;
+      setvecvalue(res, a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+      return 1;
+    case LUA_OPMUL:
+      setvecvalue(res, a[0] * b[0], a[1] * b[1], a[2] * b[2]);
+      return 1;
+    case LUA_OPDIV:
+      setvecvalue(res, a[0] / b[0], a[1] / b[1], a[2] / b[2]);
+      return 1;
+    case LUA_OPUNM:
+      setvecvalue(res, -a[0], -a[1], -a[2]);
+      return 1;
+    default: return 0;
+  }
+}
+
+
 void luaO_arith (lua_State *L, int op, const TValue *p1, const TValue *p2,
                  StkId res) {
   if (!luaO_rawarith(L, op, p1, p2, s2v(res))) {
@@ -52,6 +52,7 @@ typedef union Value {
   lua_CFunction f; /* light C functions */
   lua_Integer i;   /* integer numbers */
   lua_Number n;    /* float numbers */
+  float v[2];      /* first two lanes of vectors */
   /* not used, but may avoid warnings for uninitialized value */
   lu_byte ub;
 } Value;
@@ -59,13 +60,16 @@ typedef union Value {
 
 /*
 ** Tagged Values. This is the basic representation of values in Lua:
-** an actual value plus a tag with its type.
+** an actual value plus a tag with its type. The third lane of a vector
+** ('vz_') lives in what would otherwise be the padding after the tag,
+** so a vector fits in a 'TValue' without making it bigger.
 */
 
 #define TValuefields	Value value_; lu_byte tt_
 
 typedef struct TValue {
   TValuefields;
+  float vz_;
 } TValue;
 
 
@@ -118,6 +122,7 @@ typedef struct TValue {
 #define setobj(L,obj1,obj2) \
 	{ TValue *io1=(obj1); const TValue *io2=(obj2); \
           io1->value_ = io2->value_; settt_(io1, io2->tt_); \
+          io1->vz_ = io2->vz_; \
 	  checkliveness(L,io1); lua_assert(!isnonstrictnil(io1)); }
 
 /*
@@ -218,7 +223,7 @@ typedef union {
 
 
 /* macro defining a value corresponding to an absent key */
-#define ABSTKEYCONSTANT		{NULL}, LUA_VABSTKEY
+#define ABSTKEYCONSTANT		{NULL}, LUA_VABSTKEY, 0
 
 
 /* mark an entry as empty */
@@ -253,6 +258,31 @@ typedef union {
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+** Vectors
+** ===================================================================
+*/
+
+/*
+** Immutable 3-lane float vectors: lanes 'x' and 'y' are in the value,
+** lane 'z' is in 'vz_'.
+*/
+#define LUA_VVECTOR	makevariant(LUA_TVECTOR, 0)
+
+#define ttisvector(o)		checktag((o), LUA_VVECTOR)
+
+#define vecx(o)		check_exp(ttisvector(o), val_(o).v[0])
+#define vecy(o)		check_exp(ttisvector(o), val_(o).v[1])
+#define vecz(o)		check_exp(ttisvector(o), (o)->vz_)
+
+#define setvecvalue(obj,x,y,z) \
+  { TValue *io=(obj); val_(io).v[0]=(x); val_(io).v[1]=(y); \
+    io->vz_=(z); settt_(io, LUA_VVECTOR); }
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Threads
@@ -459,6 +489,7 @@ typedef union UValue {
 typedef struct Udata {
   CommonHeader;
   unsigned short nuvalue;  /* number of user values */
+  lu_byte isview;  /* memory starts with a 'lua_View' (see 'lua_newview') */
   size_t len;  /* number of bytes */
   struct Table *metatable;
   GCObject *gclist;
@@ -478,6 +509,7 @@ typedef struct Udata {
 typedef struct Udata0 {
   CommonHeader;
   unsigned short nuvalue;  /* number of user values */
+  lu_byte isview;
   size_t len;  /* number of bytes */
   struct Table *metatable;
   union {LUAI_MAXALIGN;} bindata;
@@ -568,6 +600,14 @@ typedef struct Proto {
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  unsigned int *icache;  /* inline caches, one per instruction (or NULL) */
+#if LUAI_JIT
+  struct JitCode *jit;  /* machine code (or NULL) */
+  int jithot;  /* runs left until it is compiled (0 when never) */
+#endif
+#if LUAI_MEMPROFILE
+  lu_mem memsize;  /* bytes charged to the allocation profiler */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -692,15 +732,18 @@ typedef union Closure {
 /*
 ** Nodes for Hash tables: A pack of two TValue's (key-value pairs)
 ** plus a 'next' field to link colliding entries. The distribution
-** of the key's fields ('key_tt' and 'key_val') not forming a proper
-** 'TValue' allows for a smaller size for 'Node' both in 4-byte
-** and 8-byte alignments.
+** of the key's fields ('key_tt', 'key_vz' and 'key_val') not forming
+** a proper 'TValue' allows for a smaller size for 'Node' both in
+** 4-byte and 8-byte alignments. (The third vector lanes of key and
+** value take it from 24 to 32 bytes.)
 */
 typedef union Node {
   struct NodeKey {
     TValuefields;  /* fields for value */
     lu_byte key_tt;  /* key type */
+    float vz_;  /* third lane of the value, as in 'TValue' */
     int next;  /* for chaining */
+    float key_vz;  /* third lane of the key */
     Value key_val;  /* key value */
   } u;
   TValue i_val;  /* direct access to node's value as a proper 'TValue' */
@@ -711,14 +754,14 @@ typedef union Node {
 #define setnodekey(L,node,obj) \
 	{ Node *n_=(node); const TValue *io_=(obj); \
 	  n_->u.key_val = io_->value_; n_->u.key_tt = io_->tt_; \
-	  checkliveness(L,io_); }
+	  n_->u.key_vz = io_->vz_; checkliveness(L,io_); }
 
 
 /* copy a value from a key */
 #define getnodekey(L,obj,node) \
 	{ TValue *io_=(obj); const Node *n_=(node); \
 	  io_->value_ = n_->u.key_val; io_->tt_ = n_->u.key_tt; \
-	  checkliveness(L,io_); }
+	  io_->vz_ = n_->u.key_vz; checkliveness(L,io_); }
 
 
 /*
@@ -734,6 +777,23 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+/*
+** Hidden class of a table: its short-string keys, in slot order. Shapes
+** form a tree rooted at the empty shape, where each child adds one key
+** to its parent. They are not collectable: a shape is freed as soon as
+** no table and no child shape uses it (see ltable.c).
+*/
+typedef struct Shape {
+  struct Shape *parent;
+  struct Shape *hnext;  /* chain in the transition table */
+  TString **keys;  /* 'nkeys' keys, the last one added by this shape */
+  unsigned int id;  /* unique in the state, 0 for the root */
+  unsigned int hash;  /* hash of ('parent', last key) */
+  int nkeys;
+  int refs;  /* tables and child shapes using it */
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -744,6 +804,10 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position */
   struct Table *metatable;
   GCObject *gclist;
+#if LUAI_SHAPES
+  Shape *shape;  /* keys of 'slots' (NULL if string keys are in 'node') */
+  TValue *slots;  /* values of the short-string keys in 'shape' */
+#endif
 } Table;
 
 
@@ -752,6 +816,7 @@ typedef struct Table {
 */
 #define keytt(node)		((node)->u.key_tt)
 #define keyval(node)		((node)->u.key_val)
+#define keyvz(node)		((node)->u.key_vz)
 
 #define keyisnil(node)		(keytt(node) == LUA_TNIL)
 #define keyisinteger(node)	(keytt(node) == LUA_VNUMINT)
@@ -798,6 +863,8 @@ LUAI_FUNC int luaO_utf8esc (char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2 (unsigned int x);
 LUAI_FUNC int luaO_rawarith (lua_State *L, int op, const TValue *p1,
                              const TValue *p2, TValue *res);
+LUAI_FUNC int luaO_vecarith (int op, const TValue *p1, const TValue *p2,
+                              TValue *res);
 LUAI_FUNC void luaO_arith (lua_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
@@ -769,6 +769,8 @@ static void close_func (LexState *ls) {
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  luaF_initcache(L, f);
+  luaC_countproto(L, f);
   ls->fs = fs->prev;
   luaC_checkGC(L);
 }
@@ -1947,6 +1949,7 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   setclLvalue2s(L, L->top.p, cl);  /* anchor it (to avoid being collected) */
   luaD_inctop(L);
   lexstate.h = luaH_new(L);  /* create table for scanner */
+  luaH_noshape(lexstate.h);  /* a dictionary, and llex.c reads its keys from nodes */
   sethvalue2s(L, L->top.p, lexstate.h);  /* anchor it */
   luaD_inctop(L);
   funcstate.f = cl->p = luaF_newproto(L);
@@ -112,6 +112,7 @@ CallInfo *luaE_extendCI (lua_State *L) {
   ci->next = NULL;
   ci->u.l.trap = 0;
   L->nci++;
+  luaC_countthread(L, L, sizeof(CallInfo));
   return ci;
 }
 
@@ -119,7 +120,7 @@ CallInfo *luaE_extendCI (lua_State *L) {
 /*
 ** free all CallInfo structures not in use by a thread
 */
-static void freeCI (lua_State *L) {
+void luaE_freeCI (lua_State *L) {
   CallInfo *ci = L->ci;
   CallInfo *next = ci->next;
   ci->next = NULL;
@@ -177,18 +178,20 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
+/*
+** erase the whole stack of 'L1' and set up its first ci; any other
+** CallInfo structures still linked after 'base_ci' are kept for reuse
+*/
+static void stack_reset (lua_State *L1) {
   int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  int size = stacksize(L1) + EXTRA_STACK;
   L1->tbclist.p = L1->stack.p;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-    setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
+  for (i = 0; i < size; i++)
+    setnilvalue(s2v(L1->stack.p + i));  /* erase stack */
   L1->top.p = L1->stack.p;
-  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
   /* initialize first ci */
   ci = &L1->base_ci;
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = CIST_C;
   ci->func.p = L1->top.p;
   ci->u.c.k = NULL;
@@ -200,11 +203,21 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L, int size) {
+  /* initialize stack array */
+  L1->stack.p = luaM_newvector(L, size + EXTRA_STACK, StackValue);
+  L1->stack_last.p = L1->stack.p + size;
+  luaC_countthread(L, L1, (size + EXTRA_STACK) * sizeof(StackValue));
+  L1->base_ci.next = NULL;
+  stack_reset(L1);
+}
+
+
 static void freestack (lua_State *L) {
   if (L->stack.p == NULL)
     return;  /* stack not completely built yet */
   L->ci = &L->base_ci;  /* free the entire 'ci' list */
-  freeCI(L);
+  luaE_freeCI(L);
   lua_assert(L->nci == 0);
   luaM_freearray(L, L->stack.p, stacksize(L) + EXTRA_STACK);  /* free stack */
 }
@@ -231,7 +244,7 @@ static void init_registry (lua_State *L, global_State *g) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_STACK_SIZE);  /* init stack */
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -258,6 +271,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->hookmask = 0;
   L->basehookcount = 0;
   L->allowhook = 1;
+  L->resumed = 0;
   resethookcount(L);
   L->openupval = NULL;
   L->status = LUA_OK;
@@ -276,7 +290,19 @@ static void close_state (lua_State *L) {
     luaC_freeallobjects(L);  /* collect all objects */
     luai_userstateclose(L);
   }
+#if LUAI_MEMPROFILE
+  luaG_freememprofile(L);
+#endif
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  while (g->threadpool != NULL) {  /* free pooled threads */
+    lua_State *L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+#if LUAI_SHAPES
+  luaH_freeshapes(L);
+#endif
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
@@ -287,15 +313,38 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g = G(L);
   GCObject *o;
   lua_State *L1;
+  int pooled;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread */
-  o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
-  L1 = gco2th(o);
+  pooled = (g->threadpool != NULL);
+  if (pooled) {  /* reuse a collected thread, with its stack */
+    L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    g->nthreadpool--;
+    o = obj2gco(L1);
+    o->marked = luaC_white(g);  /* link it back as 'luaC_newobj' does */
+    o->next = g->allgc;
+    g->allgc = o;
+    luaC_countnew(L, o, sizeof(LX) + L1->nci * sizeof(CallInfo) +
+                        (stacksize(L1) + EXTRA_STACK) * sizeof(StackValue));
+  }
+  else {  /* create new thread */
+    o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
+    L1 = gco2th(o);
+  }
   /* anchor it on L stack */
   setthvalue2s(L, L->top.p, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
+  if (pooled) {
+    StkIdRel stack = L1->stack, stack_last = L1->stack_last;
+    unsigned short nci = L1->nci;
+    preinit_thread(L1, g);
+    L1->stack = stack;
+    L1->stack_last = stack_last;
+    L1->nci = nci;
+  }
+  else
+    preinit_thread(L1, g);
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
@@ -304,17 +353,34 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (pooled)
+    stack_reset(L1);
+  else
+    stack_init(L1, L, LUAI_THREADSTACK);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+/*
+** Called by the collector for dead threads. Unless the pool is full or
+** the thread's stack grew too much, it keeps its stack and CallInfo list
+** and waits in 'g->threadpool' (linked through 'twups', which is unused
+** outside the 'g->twups' list) for 'lua_newthread' to reuse it.
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   LX *l = fromstate(L1);
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  if (g->nthreadpool < LUAI_THREADPOOL && L1->stack.p != NULL &&
+      stacksize(L1) <= LUAI_THREADPOOLSTACK) {
+    L1->twups = g->threadpool;
+    g->threadpool = L1;
+    g->nthreadpool++;
+    return;
+  }
   freestack(L1);
   luaM_free(L, l);
 }
@@ -381,22 +447,48 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+#if LUAI_SHAPES
+  luaH_initshapes(g);
+#endif
+#if LUAI_OPPROFILE
+  memset(g->oppairs, 0, sizeof(g->oppairs));
+  g->lastop = OP_EXTRAARG;
+#endif
+#if LUAI_MEMPROFILE
+  memset(g->memcount, 0, sizeof(g->memcount));
+  memset(g->membytes, 0, sizeof(g->membytes));
+  memset(g->mempeak, 0, sizeof(g->mempeak));
+  memset(g->memallocs, 0, sizeof(g->memallocs));
+  g->memsample = MAX_LMEM;
+  g->memprof = NULL;
+#endif
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcframe = 0;
+  g->gcremarked = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
+  g->sweepf = NULL;
+  g->sweepud = NULL;
+  g->sweepq = NULL;
+  g->nsweepq = 0;
+  g->gcpartial = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
+  g->gcbudget = g->gcframebudget = g->gcframespent = 0;
+  g->gcowed = 0;
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
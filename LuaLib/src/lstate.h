@@ -15,6 +15,7 @@ typedef struct CallInfo CallInfo;
 
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "ltm.h"
 #include "lzio.h"
 
@@ -159,6 +160,19 @@ typedef struct stringtable {
 } stringtable;
 
 
+/*
+** Table shapes, hashed by (parent, key) to find the transition that
+** adds a key to a given shape
+*/
+typedef struct shapetable {
+  Shape **hash;
+  int nuse;  /* number of shapes besides the root */
+  int size;
+  unsigned int lastid;  /* ids are never reused (see ltable.c) */
+  Shape root;  /* the empty shape */
+} shapetable;
+
+
 /*
 ** Information about a call.
 ** About union 'u':
@@ -258,7 +272,26 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
+  lu_mem gcbudget;  /* time limit of a step, in microseconds (0: none) */
+  lu_mem gcframebudget;  /* time limit of the steps in a frame (0: none) */
+  lu_mem gcframespent;  /* time used by the steps in the current frame */
+  l_mem gcowed;  /* work left undone by steps that ran out of time */
   stringtable strt;  /* hash table for strings */
+#if LUAI_SHAPES
+  shapetable shapes;  /* hidden classes of tables */
+#endif
+#if LUAI_OPPROFILE
+  lu_mem oppairs[NUM_OPCODES][NUM_OPCODES];  /* executed opcode pairs */
+  int lastop;  /* last opcode executed */
+#endif
+#if LUAI_MEMPROFILE
+  lu_mem memcount[LUA_TOTALTYPES];  /* objects of each type not freed yet */
+  lu_mem membytes[LUA_TOTALTYPES];  /* bytes they hold (see 'objsize') */
+  lu_mem mempeak[LUA_TOTALTYPES];  /* highest 'membytes' */
+  lu_mem memallocs[LUA_TOTALTYPES];  /* objects of each type created */
+  l_mem memsample;  /* bytes left before the next sampled object */
+  struct MemProfile *memprof;  /* per-line samples (NULL when off) */
+#endif
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
@@ -270,6 +303,8 @@ typedef struct global_State {
   lu_byte genmajormul;  /* control for major generational collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcframe;  /* true between 'lua_beginframe' and 'lua_endframe' */
+  lu_byte gcremarked;  /* true if this cycle already remarked 'grayagain' */
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
   lu_byte gcstepsize;  /* (log2 of) GC granularity */
@@ -291,7 +326,17 @@ typedef struct global_State {
   GCObject *finobjsur;  /* list of survival objects with finalizers */
   GCObject *finobjold1;  /* list of old1 objects with finalizers */
   GCObject *finobjrold;  /* list of really old objects with finalizers */
+  lua_Sweeper sweepf;  /* frees dead objects in the background (or NULL) */
+  void *sweepud;  /* auxiliary data to 'sweepf' */
+  GCObject *sweepq;  /* dead objects not handed to 'sweepf' yet */
+  int nsweepq;  /* number of objects in 'sweepq' */
+  GCObject *gcpartial;  /* object being traversed in pieces (or NULL) */
+  lu_mem gcpartialpos;  /* where the traversal of 'gcpartial' stopped */
+  const void *gcpartialparts[3];  /* array, hash part and shape it had */
+  unsigned int gcpartialasize;  /* size of its array part */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  struct lua_State *threadpool;  /* dead threads kept for reuse */
+  int nthreadpool;  /* number of threads in 'threadpool' */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
@@ -310,6 +355,7 @@ struct lua_State {
   CommonHeader;
   lu_byte status;
   lu_byte allowhook;
+  lu_byte resumed;  /* resumed since its stack was last shrunk */
   unsigned short nci;  /* number of items in 'ci' list */
   StkIdRel top;  /* first free slot in the stack */
   global_State *l_G;
@@ -396,6 +442,7 @@ union GCUnion {
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
+LUAI_FUNC void luaE_freeCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
 LUAI_FUNC void luaE_checkcstack (lua_State *L);
 LUAI_FUNC void luaE_incCstack (lua_State *L);
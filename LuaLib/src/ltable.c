@@ -92,7 +92,8 @@
 
 static const Node dummynode_ = {
   {{NULL}, LUA_VEMPTY,  /* value's value and type */
-   LUA_VNIL, 0, {NULL}}  /* key type, next, and key value */
+   LUA_VNIL, 0, 0, 0, {NULL}}  /* key type, value's third lane, next,
+                                  key's third lane, and key value */
 };
 
 
@@ -144,6 +145,21 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+/*
+** Hash for vectors: mixes the bits of the three lanes. Adding zero to
+** each lane turns -0 into +0, as they are equal.
+*/
+static Node *hashvector (const Table *t, const TValue *v) {
+  union { float f[3]; unsigned int u[3]; } l;
+  unsigned int h;
+  l.f[0] = vecx(v) + 0.0f;
+  l.f[1] = vecy(v) + 0.0f;
+  l.f[2] = vecz(v) + 0.0f;
+  h = l.u[0] ^ (l.u[1] * 0x9E3779B1u) ^ (l.u[2] * 0x85EBCA6Bu);
+  return hashmod(t, h ^ (h >> 16));
+}
+
+
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -178,6 +194,8 @@ static Node *mainpositionTV (const Table *t, const TValue *key) {
       lua_CFunction f = fvalue(key);
       return hashpointer(t, f);
     }
+    case LUA_VVECTOR:
+      return hashvector(t, key);
     default: {
       GCObject *o = gcvalue(key);
       return hashpointer(t, o);
@@ -228,6 +246,9 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
       return pvalue(k1) == pvalueraw(keyval(n2));
     case LUA_VLCF:
       return fvalue(k1) == fvalueraw(keyval(n2));
+    case LUA_VVECTOR:
+      return (vecx(k1) == keyval(n2).v[0] && vecy(k1) == keyval(n2).v[1] &&
+              vecz(k1) == keyvz(n2));
     case ctb(LUA_VLNGSTR):
       return luaS_eqlngstr(tsvalue(k1), keystrval(n2));
     default:
@@ -323,10 +344,272 @@ static unsigned int arrayindex (lua_Integer k) {
 }
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+#if LUAI_SHAPES
+
+/* shape ids must fit in an inline cache entry (see ltable.h) */
+#define MAXSHAPEID	ICIDMASK
+
+/* ... and so must slots */
+#if LUAI_MAXSHAPEKEYS > 255
+#error "LUAI_MAXSHAPEKEYS must fit in an inline cache entry (255 at most)"
+#endif
+
+#define shapehash(p,k)	(((p)->id * 2654435761u) ^ (k)->hash)
+
+#define hashmodshape(g,h)	(g->shapes.hash[lmod(h, g->shapes.size)])
+
+/* smallest size of the transition table */
+#define MINSHAPETABLE	64
+
+
+void luaH_initshapes (global_State *g) {
+  Shape *root = &g->shapes.root;
+  g->shapes.hash = NULL;
+  g->shapes.nuse = g->shapes.size = 0;
+  g->shapes.lastid = 0;
+  root->parent = root->hnext = NULL;
+  root->keys = NULL;
+  root->id = root->hash = 0;
+  root->nkeys = root->refs = 0;
+}
+
+
+void luaH_freeshapes (lua_State *L) {
+  global_State *g = G(L);
+  int i;
+  for (i = 0; i < g->shapes.size; i++) {
+    Shape *s = g->shapes.hash[i];
+    while (s != NULL) {
+      Shape *next = s->hnext;
+      luaM_freearray(L, s->keys, s->nkeys);
+      luaM_free(L, s);
+      s = next;
+    }
+  }
+  luaM_freearray(L, g->shapes.hash, g->shapes.size);
+  luaH_initshapes(g);
+}
+
+
+/* same as 'tablerehash' in lstring.c, for the transition table */
+static void shapesrehash (Shape **vect, int osize, int nsize) {
+  int i;
+  for (i = osize; i < nsize; i++)  /* clear new elements */
+    vect[i] = NULL;
+  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
+    Shape *s = vect[i];
+    vect[i] = NULL;
+    while (s != NULL) {
+      Shape *next = s->hnext;
+      Shape **slot = &vect[lmod(s->hash, nsize)];
+      s->hnext = *slot;
+      *slot = s;
+      s = next;
+    }
+  }
+}
+
+
+/*
+** Resize the transition table. Returns 0, leaving the table as it was,
+** if the allocation fails.
+*/
+static int resizeshapes (lua_State *L, int nsize) {
+  global_State *g = G(L);
+  int osize = g->shapes.size;
+  Shape **newhash;
+  if (nsize < osize)  /* shrinking table? */
+    shapesrehash(g->shapes.hash, osize, nsize);  /* depopulate shrinking part */
+  newhash = luaM_reallocvector(L, g->shapes.hash, osize, nsize, Shape *);
+  if (l_unlikely(newhash == NULL)) {  /* reallocation failed? */
+    if (nsize < osize)  /* was it shrinking table? */
+      shapesrehash(g->shapes.hash, nsize, osize);  /* restore original size */
+    return 0;
+  }
+  g->shapes.hash = newhash;
+  g->shapes.size = nsize;
+  if (nsize > osize)
+    shapesrehash(newhash, osize, nsize);  /* rehash for new size */
+  return 1;
+}
+
+
+/*
+** Called by the collector: halves the transition table when at most a
+** quarter of it is used, as freed shapes leave it.
+*/
+void luaH_checkshapes (lua_State *L) {
+  global_State *g = G(L);
+  if (g->shapes.size > MINSHAPETABLE && g->shapes.nuse < g->shapes.size / 4)
+    resizeshapes(L, g->shapes.size / 2);
+}
+
+
+/*
+** Shape with the keys of 'parent' plus 'key', created on first use.
+** Returns NULL when the shape would be too large or the state already
+** has too many shapes; the table then keeps its keys in the hash part.
+*/
+static Shape *shapetransition (lua_State *L, Shape *parent, TString *key) {
+  global_State *g = G(L);
+  unsigned int h = shapehash(parent, key);
+  Shape *s;
+  int i;
+  if (g->shapes.size > 0) {
+    for (s = hashmodshape(g, h); s != NULL; s = s->hnext) {
+      if (s->parent == parent && s->keys[s->nkeys - 1] == key)
+        return s;
+    }
+  }
+  if (parent->nkeys >= LUAI_MAXSHAPEKEYS ||
+      g->shapes.nuse >= LUAI_MAXSHAPES || g->shapes.lastid >= MAXSHAPEID)
+    return NULL;
+  if (g->shapes.nuse >= g->shapes.size &&  /* grow transition table? */
+      !resizeshapes(L, g->shapes.size == 0 ? MINSHAPETABLE
+                                           : g->shapes.size * 2))
+    return NULL;
+  s = luaM_new(L, Shape);
+  s->keys = NULL;
+  s->nkeys = 0;
+  s->keys = luaM_newvector(L, parent->nkeys + 1, TString *);
+  for (i = 0; i < parent->nkeys; i++)
+    s->keys[i] = parent->keys[i];
+  s->keys[parent->nkeys] = key;
+  s->nkeys = parent->nkeys + 1;
+  s->refs = 0;
+  s->parent = parent;
+  parent->refs++;  /* (the root is never freed, its count is unused) */
+  s->hash = h;
+  s->id = ++g->shapes.lastid;
+  g->shapes.nuse++;
+  s->hnext = hashmodshape(g, h);
+  hashmodshape(g, h) = s;
+  return s;
+}
+
+
+/*
+** Drops one use of 's'. A shape that no table and no child uses any
+** more leaves the transition table and is freed, which drops a use of
+** its parent. Its id is never given out again, so inline caches and
+** machine code still holding it just miss; once MAXSHAPEID ids were
+** used, new key sets stay in the hash part.
+*/
+static void releaseshape (lua_State *L, Shape *s) {
+  global_State *g = G(L);
+  while (s != &g->shapes.root && --s->refs == 0) {
+    Shape *parent = s->parent;
+    Shape **p = &hashmodshape(g, s->hash);
+    while (*p != s)
+      p = &(*p)->hnext;
+    *p = s->hnext;
+    g->shapes.nuse--;
+    luaM_freearray(L, s->keys, s->nkeys);
+    luaM_free(L, s);
+    s = parent;
+  }
+}
+
+
+/* frees the slots of 't' and drops its use of its shape */
+void luaH_dropshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  if (s != NULL) {
+    luaM_freearray(L, t->slots, s->nkeys);
+    t->shape = NULL;
+    t->slots = NULL;
+    releaseshape(L, s);
+  }
+}
+
+
+/* slot of 'key' in shape 's', or -1 */
+static int shapeslot (const Shape *s, const TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return i;
+  }
+  return -1;
+}
+
+
+static const TValue *getshapestr (Table *t, TString *key) {
+  int i = shapeslot(t->shape, key);
+  return (i < 0) ? &absentkey : &t->slots[i];
+}
+
+
+/*
+** Adds 'key' to the shape of 't', growing 'slots' by one. Returns 0 if
+** there is no shape for the new key set.
+*/
+static int shapeinsert (lua_State *L, Table *t, TString *key,
+                        TValue *value) {
+  Shape *old = t->shape;
+  Shape *s = shapetransition(L, old, key);
+  TValue *slots;
+  if (s == NULL)
+    return 0;
+  slots = luaM_reallocvector(L, t->slots, old->nkeys, s->nkeys, TValue);
+  if (l_unlikely(slots == NULL))
+    luaM_error(L);  /* 's' stays in the transition table for the next try */
+  t->slots = slots;
+  luaC_countbytes(L, LUA_TTABLE,
+                  (s->nkeys - old->nkeys) * cast(l_mem, sizeof(TValue)));
+  s->refs++;
+  t->shape = s;
+  releaseshape(L, old);  /* 's' still uses it */
+  setobj2t(L, &t->slots[s->nkeys - 1], value);
+  return 1;
+}
+
+
+/*
+** Moves the string keys of 't' from its shape into its hash part, for
+** good. The hash part is grown first so that, if that fails, the table
+** is left as it was.
+*/
+static void unshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *slots = t->slots;
+  unsigned int used = 0;
+  int i;
+  for (i = 0; i < cast_int(allocsizenode(t)); i++)
+    used += !isempty(gval(gnode(t, i)));
+  for (i = 0; i < s->nkeys; i++)
+    used += !isempty(&slots[i]);
+  luaH_resize(L, t, luaH_realasize(t), used + 1);  /* +1 for the new key */
+  t->shape = NULL;
+  t->slots = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(&slots[i])) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      luaH_set(L, t, &k, &slots[i]);
+    }
+  }
+  luaM_freearray(L, slots, s->nkeys);
+  luaC_countbytes(L, LUA_TTABLE, -s->nkeys * cast(l_mem, sizeof(TValue)));
+  releaseshape(L, s);
+}
+
+#endif
+
+/* }============================================================= */
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then the slots of its shape, then
+** elements in the hash part. The beginning of a traversal is signaled
+** by 0.
 */
 static unsigned int findindex (lua_State *L, Table *t, TValue *key,
                                unsigned int asize) {
@@ -335,13 +618,22 @@ static unsigned int findindex (lua_State *L, Table *t, TValue *key,
   i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;
   if (i - 1u < asize)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+#if LUAI_SHAPES
+  else if (t->shape != NULL && ttisshrstring(key)) {
+    int s = shapeslot(t->shape, tsvalue(key));
+    if (l_unlikely(s < 0))
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    /* slots are numbered after array elements */
+    return cast_uint(s + 1) + asize;
+  }
+#endif
   else {
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
       luaG_runerror(L, "invalid key to 'next'");  /* key not found */
     i = cast_int(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
-    /* hash elements are numbered after array ones */
-    return (i + 1) + asize;
+    /* hash elements are numbered after array ones (and slots) */
+    return (i + 1) + asize + shapesize(t);
   }
 }
 
@@ -356,6 +648,17 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       return 1;
     }
   }
+#if LUAI_SHAPES
+  for (i -= asize; i < shapesize(t); i++) {  /* then slots */
+    if (!isempty(&t->slots[i])) {
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key + 1, &t->slots[i]);
+      return 1;
+    }
+  }
+  i -= shapesize(t);
+  asize = 0;  /* 'i' is already relative to the hash part */
+#endif
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
@@ -579,6 +882,11 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
   t->alimit = newasize;
+  luaC_countbytes(L, LUA_TTABLE,
+      (cast(l_mem, newasize) - cast(l_mem, oldasize)) *
+        cast(l_mem, sizeof(TValue)) +
+      (cast(l_mem, allocsizenode(t)) - cast(l_mem, allocsizenode(&newt))) *
+        cast(l_mem, sizeof(Node)));
   for (i = oldasize; i < newasize; i++)  /* clear new slice of the array */
      setempty(&t->array[i]);
   /* re-insert elements from old hash part into new parts */
@@ -631,12 +939,19 @@ Table *luaH_new (lua_State *L) {
   t->array = NULL;
   t->alimit = 0;
   setnodevector(L, t, 0);
+#if LUAI_SHAPES
+  t->shape = &G(L)->shapes.root;
+  t->slots = NULL;
+#endif
   return t;
 }
 
 
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
+#if LUAI_SHAPES
+  luaH_dropshape(L, t);
+#endif
   luaM_freearray(L, t->array, luaH_realasize(t));
   luaM_free(L, t);
 }
@@ -678,8 +993,20 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
     else if (l_unlikely(luai_numisnan(f)))
       luaG_runerror(L, "table index is NaN");
   }
+  else if (ttisvector(key)) {
+    if (l_unlikely(luai_numisnan(vecx(key)) || luai_numisnan(vecy(key)) ||
+                   luai_numisnan(vecz(key))))
+      luaG_runerror(L, "table index is NaN");
+  }
   if (ttisnil(value))
     return;  /* do not insert nil values */
+#if LUAI_SHAPES
+  if (t->shape != NULL && ttisshrstring(key)) {
+    if (shapeinsert(L, t, tsvalue(key), value))
+      return;
+    unshape(L, t);  /* no shape for this key set; go on in the hash part */
+  }
+#endif
   mp = mainpositionTV(t, key);
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -702,6 +1029,7 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
         gnext(f) += cast_int(mp - f);  /* correct 'next' */
         gnext(mp) = 0;  /* now 'mp' is free */
       }
+      luaC_nodemoved(L, t, f);
       setempty(gval(mp));
     }
     else {  /* colliding node is in its own main position */
@@ -771,8 +1099,13 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_VSHRSTR);
+#if LUAI_SHAPES
+  if (t->shape != NULL)
+    return getshapestr(t, key);
+#endif
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -786,6 +1119,47 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/*
+** Same as 'luaH_getshortstr', but first tries the slot remembered in
+** '*cache' and records where the key was found. Tables built by the
+** same code (objects of one "class") have their keys in the same slots,
+** so one cache serves all of them without hashing. A slot is only used
+** after checking its key, so a stale cache (the table was rehashed or
+** is another table) is just a miss and needs no invalidation.
+*/
+const TValue *luaH_getshortstrcache (Table *t, TString *key,
+                                     unsigned int *cache) {
+  Node *n;
+  const TValue *slot = luaH_cacheslot(t, key, *cache);
+  lua_assert(key->tt == LUA_VSHRSTR);
+  if (slot != NULL)
+    return slot;
+#if LUAI_SHAPES
+  if (t->shape != NULL) {
+    int i = shapeslot(t->shape, key);
+    if (i < 0)
+      return &absentkey;
+    *cache = icmakeshape(t->shape->id, i);
+    return &t->slots[i];
+  }
+#endif
+  n = hashstr(t, key);
+  for (;;) {  /* check whether 'key' is somewhere in the chain */
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key)) {
+      if (t->lsizenode <= ICIDBITS)  /* node index fits in the entry? */
+        *cache = icmakenode(n - t->node, t->lsizenode);
+      return gval(n);  /* that's it */
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return &absentkey;  /* not found */
+      n += nx;
+    }
+  }
+}
+
+
 const TValue *luaH_getstr (Table *t, TString *key) {
   if (key->tt == LUA_VSHRSTR)
     return luaH_getshortstr(t, key);
@@ -31,6 +31,72 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** Keep all keys of a new, still empty, table in its hash part. For
+** tables known to be used as big dictionaries, which would only create
+** shapes nobody else shares.
+*/
+#if LUAI_SHAPES
+#define luaH_noshape(t)	(lua_assert((t)->shape->nkeys == 0), (t)->shape = NULL)
+#else
+#define luaH_noshape(t)	((void)0)
+#endif
+
+
+/* number of slots (short-string keys) in the shape of a table */
+#if LUAI_SHAPES
+#define shapesize(t)	((t)->shape != NULL ? cast_uint((t)->shape->nkeys) : 0u)
+#else
+#define shapesize(t)	0u
+#endif
+
+
+/*
+** Inline caches (see 'luaH_getshortstrcache'). For a key found in the
+** hash part, an entry holds the node index shifted left by 8 plus the
+** 'lsizenode' of the table; it hits when the table has the same node
+** size and the key in that node is the key being looked up. For a key
+** found in a shape, it holds ICSHAPE, the shape id shifted left by 8
+** and the slot; it hits when the table has that same shape. Shape hits
+** do not compare the key, so a cache must always be used with the same
+** key (a constant of its instruction). Node indices and shape ids both
+** get the ICIDBITS bits between the low byte and ICSHAPE, so only tables
+** with 'lsizenode' up to ICIDBITS are cached.
+*/
+#define ICSHAPE		0x80000000u
+#define ICIDBITS	23
+#define ICIDMASK	((1u << ICIDBITS) - 1)
+
+#if ((ICIDMASK << 8) & ICSHAPE) != 0 || \
+    (ICSHAPE | (ICIDMASK << 8) | 0xffu) != 0xffffffffu
+#error "inline cache fields must fill 32 bits without overlapping"
+#endif
+
+#define icnode(c)		((c) >> 8)
+#define icsizenode(c)		((c) & 0xff)
+#define icmakenode(n,lsize)	((cast_uint(n) << 8) | cast_uint(lsize))
+
+#define icnodeslot(t,k,c) \
+	((icsizenode(c) == (t)->lsizenode && \
+	  keyisshrstr(gnode(t, icnode(c))) && keystrval(gnode(t, icnode(c))) == (k)) \
+	? gval(gnode(t, icnode(c))) : NULL)
+
+#if LUAI_SHAPES
+#define icshapeid(c)		(((c) >> 8) & ICIDMASK)
+#define icshapeslot(c)		((c) & 0xff)
+#define icmakeshape(id,s)	(ICSHAPE | (cast_uint(id) << 8) | cast_uint(s))
+
+/* the cached slot for key 'k' in table 't', or NULL on a miss */
+#define luaH_cacheslot(t,k,c) \
+	(((c) & ICSHAPE) \
+	? (((t)->shape != NULL && (t)->shape->id == icshapeid(c)) \
+	   ? &(t)->slots[icshapeslot(c)] : NULL) \
+	: icnodeslot(t,k,c))
+#else
+#define luaH_cacheslot(t,k,c)	icnodeslot(t,k,c)
+#endif
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v)	cast(Node *, (v))
 
@@ -39,6 +105,8 @@ LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrcache (Table *t, TString *key,
+                                               unsigned int *cache);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
@@ -46,6 +114,12 @@ LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
 LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                        const TValue *slot, TValue *value);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+#if LUAI_SHAPES
+LUAI_FUNC void luaH_initshapes (struct global_State *g);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
+LUAI_FUNC void luaH_dropshape (lua_State *L, Table *t);
+LUAI_FUNC void luaH_checkshapes (lua_State *L);
+#endif
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
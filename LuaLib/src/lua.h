@@ -71,8 +71,9 @@ typedef struct lua_State lua_State;
 #define LUA_TFUNCTION		6
 #define LUA_TUSERDATA		7
 #define LUA_TTHREAD		8
+#define LUA_TVECTOR		9
 
-#define LUA_NUMTYPES		9
+#define LUA_NUMTYPES		10
 
 
 
@@ -131,6 +132,34 @@ typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 typedef void (*lua_WarnFunction) (void *ud, const char *msg, int tocont);
 
 
+/*
+** Type for functions that take batches of dead objects to free them
+** in the background (see 'lua_setsweeper')
+*/
+typedef void (*lua_Sweeper) (void *ud, void *batch);
+
+
+/*
+** Typed views: full userdata whose memory starts with a 'lua_View' over
+** an array owned by the host (see 'lua_newview'). Integer keys in
+** 1..length read and write elements directly in the VM; anything else,
+** and any view with a NULL 'data', goes to the view's metatable.
+*/
+#define LUA_VIEWFLOAT32		0
+#define LUA_VIEWINT32		1
+#define LUA_VIEWUINT8		2
+
+#define LUA_NUMVIEWS		3
+
+typedef struct lua_View {
+  void *data;  /* first element */
+  int length;  /* number of elements */
+  int stride;  /* bytes between elements */
+  int type;  /* LUA_VIEW* */
+  int readonly;  /* writes go to '__newindex' */
+} lua_View;
+
+
 /*
 ** Type used by the debug API to collect debug information
 */
@@ -207,6 +236,14 @@ LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
 LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
 LUA_API lua_State      *(lua_tothread) (lua_State *L, int idx);
 LUA_API const void     *(lua_topointer) (lua_State *L, int idx);
+LUA_API int             (lua_tovector) (lua_State *L, int idx, float *v);
+
+/* argument codes for 'lua_checkargs', besides the basic types */
+#define LUA_SIGINTEGER		LUA_NUMTYPES
+#define LUA_SIGANY		(LUA_NUMTYPES + 1)
+
+LUA_API int   (lua_checkargs) (lua_State *L, int n, const unsigned char *sig,
+                               const void *const *mts);
 
 
 /*
@@ -253,6 +290,7 @@ LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
 LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
+LUA_API void  (lua_pushvector) (lua_State *L, float x, float y, float z);
 
 
 /*
@@ -268,6 +306,7 @@ LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
 LUA_API void *(lua_newuserdatauv) (lua_State *L, size_t sz, int nuvalue);
+LUA_API lua_View *(lua_newview) (lua_State *L, int type, int nuvalue);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
 LUA_API int  (lua_getiuservalue) (lua_State *L, int idx, int n);
 
@@ -338,9 +377,23 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCBUDGET		12
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
+/* frame regions: garbage made inside a frame is reclaimed when it ends
+   in generational mode, or with a time budget; other modes ignore them */
+LUA_API void (lua_beginframe) (lua_State *L);
+LUA_API void (lua_endframe) (lua_State *L);
+
+/* background sweep: the collector hands dead objects to 'f' in batches,
+   and 'lua_freebatch' frees a batch from any thread. It frees them with
+   the state's allocator, which then must accept frees from that thread
+   while the state keeps allocating ('luaL_newstate's does, the pool of
+   'luaL_newpoolstate' does not) and must outlive every batch. */
+LUA_API void (lua_setsweeper) (lua_State *L, lua_Sweeper f, void *ud);
+LUA_API void (lua_freebatch) (void *batch);
+
 
 /*
 ** miscellaneous functions
@@ -387,6 +440,7 @@ LUA_API void (lua_closeslot) (lua_State *L, int idx);
 #define lua_isnil(L,n)		(lua_type(L, (n)) == LUA_TNIL)
 #define lua_isboolean(L,n)	(lua_type(L, (n)) == LUA_TBOOLEAN)
 #define lua_isthread(L,n)	(lua_type(L, (n)) == LUA_TTHREAD)
+#define lua_isvector(L,n)	(lua_type(L, (n)) == LUA_TVECTOR)
 #define lua_isnone(L,n)		(lua_type(L, (n)) == LUA_TNONE)
 #define lua_isnoneornil(L, n)	(lua_type(L, (n)) <= 0)
 
@@ -470,6 +524,9 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+LUA_API int (lua_opprofile) (lua_State *L, int reset);
+LUA_API int (lua_memprofile) (lua_State *L, int sample);
+
 LUA_API int (lua_setcstacklimit) (lua_State *L, unsigned int limit);
 
 struct lua_Debug {
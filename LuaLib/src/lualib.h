@@ -38,6 +38,9 @@ LUAMOD_API int (luaopen_utf8) (lua_State *L);
 #define LUA_MATHLIBNAME	"math"
 LUAMOD_API int (luaopen_math) (lua_State *L);
 
+#define LUA_VECLIBNAME	"vec"
+LUAMOD_API int (luaopen_vec) (lua_State *L);
+
 #define LUA_DBLIBNAME	"debug"
 LUAMOD_API int (luaopen_debug) (lua_State *L);
 
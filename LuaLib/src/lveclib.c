@@ -0,0 +1,210 @@
+/*
+** $Id: lveclib.c $
+** Vector library
+** See Copyright Notice in lua.h
+*/
+
+#define lveclib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <math.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Vectors are immutable values with three float lanes; arithmetic
+** operators work on them directly (see 'luaO_vecarith'). The functions
+** here follow the single-precision semantics of raylib's 'raymath.h'.
+*/
+
+
+static int vec_new (lua_State *L) {
+  lua_pushvector(L, (float)luaL_optnumber(L, 1, 0),
+                    (float)luaL_optnumber(L, 2, 0),
+                    (float)luaL_optnumber(L, 3, 0));
+  return 1;
+}
+
+
+static int vec_unpack (lua_State *L) {
+  float v[3];
+  luaL_checkvector(L, 1, v);
+  lua_pushnumber(L, (lua_Number)v[0]);
+  lua_pushnumber(L, (lua_Number)v[1]);
+  lua_pushnumber(L, (lua_Number)v[2]);
+  return 3;
+}
+
+
+static float dot (const float *a, const float *b) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+
+static int vec_dot (lua_State *L) {
+  float a[3], b[3];
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  lua_pushnumber(L, (lua_Number)dot(a, b));
+  return 1;
+}
+
+
+static int vec_cross (lua_State *L) {
+  float a[3], b[3];
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  lua_pushvector(L, a[1]*b[2] - a[2]*b[1],
+                    a[2]*b[0] - a[0]*b[2],
+                    a[0]*b[1] - a[1]*b[0]);
+  return 1;
+}
+
+
+static int vec_length (lua_State *L) {
+  float v[3];
+  luaL_checkvector(L, 1, v);
+  lua_pushnumber(L, (lua_Number)sqrtf(dot(v, v)));
+  return 1;
+}
+
+
+static int vec_lengthsqr (lua_State *L) {
+  float v[3];
+  luaL_checkvector(L, 1, v);
+  lua_pushnumber(L, (lua_Number)dot(v, v));
+  return 1;
+}
+
+
+/* 'd' gets 'b - a' */
+static void checkdiff (lua_State *L, float *d) {
+  float a[3], b[3];
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  d[0] = b[0] - a[0]; d[1] = b[1] - a[1]; d[2] = b[2] - a[2];
+}
+
+
+static int vec_distance (lua_State *L) {
+  float d[3];
+  checkdiff(L, d);
+  lua_pushnumber(L, (lua_Number)sqrtf(dot(d, d)));
+  return 1;
+}
+
+
+static int vec_distancesqr (lua_State *L) {
+  float d[3];
+  checkdiff(L, d);
+  lua_pushnumber(L, (lua_Number)dot(d, d));
+  return 1;
+}
+
+
+/*
+** A zero vector is returned unchanged, as 'Vector3Normalize' does.
+*/
+static int vec_normalize (lua_State *L) {
+  float v[3];
+  float length;
+  luaL_checkvector(L, 1, v);
+  length = sqrtf(dot(v, v));
+  if (length != 0.0f) {
+    float ilength = 1.0f/length;
+    v[0] *= ilength; v[1] *= ilength; v[2] *= ilength;
+  }
+  lua_pushvector(L, v[0], v[1], v[2]);
+  return 1;
+}
+
+
+static int vec_lerp (lua_State *L) {
+  float a[3], b[3];
+  float t;
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  t = (float)luaL_checknumber(L, 3);
+  lua_pushvector(L, a[0] + t*(b[0] - a[0]),
+                    a[1] + t*(b[1] - a[1]),
+                    a[2] + t*(b[2] - a[2]));
+  return 1;
+}
+
+
+static int vec_min (lua_State *L) {
+  float a[3], b[3];
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  lua_pushvector(L, fminf(a[0], b[0]), fminf(a[1], b[1]),
+                    fminf(a[2], b[2]));
+  return 1;
+}
+
+
+static int vec_max (lua_State *L) {
+  float a[3], b[3];
+  luaL_checkvector(L, 1, a);
+  luaL_checkvector(L, 2, b);
+  lua_pushvector(L, fmaxf(a[0], b[0]), fmaxf(a[1], b[1]),
+                    fmaxf(a[2], b[2]));
+  return 1;
+}
+
+
+static const luaL_Reg veclib[] = {
+  {"new", vec_new},
+  {"unpack", vec_unpack},
+  {"dot", vec_dot},
+  {"cross", vec_cross},
+  {"length", vec_length},
+  {"lengthsqr", vec_lengthsqr},
+  {"distance", vec_distance},
+  {"distancesqr", vec_distancesqr},
+  {"normalize", vec_normalize},
+  {"lerp", vec_lerp},
+  {"min", vec_min},
+  {"max", vec_max},
+  /* placeholders */
+  {"zero", NULL},
+  {"one", NULL},
+  {NULL, NULL}
+};
+
+
+/*
+** Make the library the '__index' of vectors, so that 'v:length()'
+** works. (Lanes 'x', 'y' and 'z' are read before '__index'.)
+*/
+static void createmetatable (lua_State *L) {
+  lua_createtable(L, 0, 1);  /* table to be metatable for vectors */
+  lua_pushvector(L, 0, 0, 0);  /* dummy vector */
+  lua_pushvalue(L, -2);  /* copy table */
+  lua_setmetatable(L, -2);  /* set table as metatable for vectors */
+  lua_pop(L, 1);  /* pop dummy vector */
+  lua_pushvalue(L, -2);  /* get vector library */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = vec */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+
+/*
+** Open vector library
+*/
+LUAMOD_API int luaopen_vec (lua_State *L) {
+  luaL_newlib(L, veclib);
+  lua_pushvector(L, 0, 0, 0);
+  lua_setfield(L, -2, "zero");
+  lua_pushvector(L, 1, 1, 1);
+  lua_setfield(L, -2, "one");
+  createmetatable(L);
+  return 1;
+}
+
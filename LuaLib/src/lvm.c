@@ -22,6 +22,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -281,6 +282,112 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Read lane 'x', 'y' or 'z' of vector 'v' into 'val'. Returns 0 if
+** 'key' does not name a lane.
+*/
+static int veclane (const TValue *v, const TValue *key, StkId val) {
+  if (ttisshrstring(key) && tsvalue(key)->shrlen == 1) {
+    switch (getstr(tsvalue(key))[0]) {
+      case 'x': setfltvalue(s2v(val), cast_num(vecx(v))); return 1;
+      case 'y': setfltvalue(s2v(val), cast_num(vecy(v))); return 1;
+      case 'z': setfltvalue(s2v(val), cast_num(vecz(v))); return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Address of element 'key' of typed view 't', or NULL when the VM does
+** not handle the access itself: 't' is not a view, the view is detached,
+** or 'key' is not an integer in 1..length.
+*/
+static char *viewelement (const TValue *t, const TValue *key) {
+  const lua_View *v;
+  lua_Integer i;
+  if (!ttisfulluserdata(t) || !uvalue(t)->isview || !ttisinteger(key))
+    return NULL;
+  v = (const lua_View *)getudatamem(uvalue(t));
+  i = ivalue(key);
+  if (v->data == NULL || l_castS2U(i) - 1u >= cast(lua_Unsigned, v->length))
+    return NULL;
+  return cast_charp(v->data) + cast_sizet(i - 1) * v->stride;
+}
+
+
+static int viewget (const TValue *t, const TValue *key, StkId val) {
+  char *p = viewelement(t, key);
+  if (p == NULL)
+    return 0;
+  switch (((const lua_View *)getudatamem(uvalue(t)))->type) {
+    case LUA_VIEWFLOAT32: {
+      float f;
+      memcpy(&f, p, sizeof(f));
+      setfltvalue(s2v(val), cast_num(f));
+      break;
+    }
+    case LUA_VIEWINT32: {
+      l_uint32 u;
+      memcpy(&u, p, sizeof(u));
+      /* sign-extend without converting an out-of-range unsigned */
+      setivalue(s2v(val), cast(lua_Integer, u ^ 0x80000000u) -
+                          cast(lua_Integer, 0x80000000u));
+      break;
+    }
+    default: {
+      setivalue(s2v(val), *cast(unsigned char *, p));
+      break;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Store 'val' into a typed view. Only values that fit the element type
+** exactly (finite floats in float range, integers in int32 range, 0..255
+** for bytes) are stored here; others go to '__newindex', which may
+** convert, clamp or raise an error.
+*/
+static int viewset (const TValue *t, const TValue *key, const TValue *val) {
+  const lua_View *v;
+  char *p = viewelement(t, key);
+  if (p == NULL)
+    return 0;
+  v = (const lua_View *)getudatamem(uvalue(t));
+  if (v->readonly)
+    return 0;
+  switch (v->type) {
+    case LUA_VIEWFLOAT32: {
+      lua_Number n;
+      float f;
+      if (!tonumberns(val, n) || !(-FLT_MAX <= n && n <= FLT_MAX))
+        return 0;
+      f = cast(float, n);
+      memcpy(p, &f, sizeof(f));
+      return 1;
+    }
+    case LUA_VIEWINT32: {
+      lua_Integer i;
+      l_uint32 u;
+      if (!ttisinteger(val) || (i = ivalue(val)) < -0x7fffffff - 1 ||
+          i > 0x7fffffff)
+        return 0;
+      u = cast(l_uint32, l_castS2U(i));
+      memcpy(p, &u, sizeof(u));
+      return 1;
+    }
+    default: {
+      if (!ttisinteger(val) || l_castS2U(ivalue(val)) > 255u)
+        return 0;
+      *cast(unsigned char *, p) = cast_byte(ivalue(val));
+      return 1;
+    }
+  }
+}
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
@@ -293,6 +400,10 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
+      if (ttisvector(t) && veclane(t, key, val))
+        return;  /* lanes take precedence over '__index' */
+      if (viewget(t, key, val))
+        return;  /* so do elements of typed views */
       tm = luaT_gettmbyobj(L, t, TM_INDEX);
       if (l_unlikely(notm(tm)))
         luaG_typeerror(L, t, "index");  /* no metamethod */
@@ -347,6 +458,8 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       /* else will try the metamethod */
     }
     else {  /* not a table; check metamethod */
+      if (viewset(t, key, val))
+        return;
       tm = luaT_gettmbyobj(L, t, TM_NEWINDEX);
       if (l_unlikely(notm(tm)))
         luaG_typeerror(L, t, "index");
@@ -588,6 +701,8 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_VNUMFLT: return luai_numeq(fltvalue(t1), fltvalue(t2));
     case LUA_VLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
     case LUA_VLCF: return fvalue(t1) == fvalue(t2);
+    case LUA_VVECTOR: return (vecx(t1) == vecx(t2) && vecy(t1) == vecy(t2) &&
+                              vecz(t1) == vecz(t2));
     case LUA_VSHRSTR: return eqshrstr(tsvalue(t1), tsvalue(t2));
     case LUA_VLNGSTR: return luaS_eqlngstr(tsvalue(t1), tsvalue(t2));
     case LUA_VUSERDATA: {
@@ -705,6 +820,17 @@ void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
       setivalue(s2v(ra), tsvalue(rb)->u.lnglen);
       return;
     }
+    case LUA_VUSERDATA: {
+      Udata *u = uvalue(rb);
+      if (u->isview && ((lua_View *)getudatamem(u))->data != NULL) {
+        setivalue(s2v(ra), ((lua_View *)getudatamem(u))->length);
+        return;
+      }
+      tm = luaT_gettmbyobj(L, rb, TM_LEN);  /* detached or not a view */
+      if (l_unlikely(notm(tm)))
+        luaG_typeerror(L, rb, "get length of");
+      break;
+    }
     default: {  /* try metamethod */
       tm = luaT_gettmbyobj(L, rb, TM_LEN);
       if (l_unlikely(notm(tm)))  /* no metamethod? */
@@ -1071,6 +1197,25 @@ void luaV_finishOp (lua_State *L) {
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
 
+/*
+** Raw access to a field with a short-string key, going through the
+** inline cache of the current instruction when they are enabled
+*/
+#if LUAI_INLINECACHE
+/*
+** 'icache' parallels 'code' and both have 4-byte entries, so the cache
+** of the current instruction is at a fixed byte distance ('icdelta')
+** from it; keeping that distance saves reloading both arrays from 'cl'
+*/
+#define icache()	cast(unsigned int *, cast_charp(pc - 1) + icdelta)
+#define fastgetfield(L,t,key,slot)  luaV_fastgetcache(L,t,key,slot,icache())
+#else
+#define fastgetfield(L,t,key,slot)  luaV_fastget(L,t,key,slot,luaH_getshortstr)
+#endif
+
+
+
+
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
 
@@ -1084,8 +1229,9 @@ void luaV_finishOp (lua_State *L) {
 /*
 ** Execute a jump instruction. The 'updatetrap' allows signals to stop
 ** tight loops. (Without it, the local copy of 'trap' could never change.)
+** A jump starts a new stretch of code, which may have machine code.
 */
-#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
+#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); jitrun(L); }
 
 
 /* for test instructions, execute the jump instruction that follows it */
@@ -1096,7 +1242,8 @@ void luaV_finishOp (lua_State *L) {
 ** was expected (parameter 'k'), else do next instruction, which must
 ** be a jump.
 */
-#define docondjump()	if (cond != GETARG_k(i)) pc++; else donextjump(ci);
+#define docondjump()  \
+	if (cond != GETARG_k(i)) { pc++; jitrun(L); } else donextjump(ci);
 
 
 /*
@@ -1134,6 +1281,16 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+#if LUAI_OPPROFILE
+/* count the pair formed by the previous opcode and the one in 'i' */
+#define opprofile(L,i)  { global_State *g_ = G(L); \
+  int op_ = GET_OPCODE(i); \
+  g_->oppairs[g_->lastop][op_]++; g_->lastop = op_; }
+#else
+#define opprofile(L,i)	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1141,8 +1298,40 @@ void luaV_finishOp (lua_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  opprofile(L, i); \
 }
 
+#if LUAI_JIT
+
+/*
+** Count a call or a loop iteration of the running function, compiling
+** it to machine code when it gets hot. ('luaJ_compile' leaves 'jithot'
+** at zero, so that it is tried only once.)
+*/
+#define jitcount(L,p)  \
+	{ Proto *p_ = (p); \
+	  if (p_->jithot > 0 && --p_->jithot == 0) luaJ_compile(L, p_); }
+
+/*
+** Run the machine code of the instruction at 'pc', if there is any,
+** until it reaches an instruction it leaves to the interpreter. This
+** is tried only where a new stretch of code starts (jumps, loops,
+** calls, and returns), so that straight-line code pays nothing for it.
+** Native code does not handle hooks, so it is not entered with 'trap'.
+*/
+#define jitrun(L)  \
+	{ if (l_unlikely(cl->p->jit != NULL) && !trap && \
+	      luaJ_entry(cl->p, pc) != NULL) { \
+	    pc = luaJ_run(L, cl, base, pc); updatetrap(ci); } }
+
+#else
+
+#define jitcount(L,p)	((void)0)
+#define jitrun(L)	((void)0)
+
+#endif
+
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
@@ -1154,18 +1343,27 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   StkId base;
   const Instruction *pc;
   int trap;
+#if LUAI_INLINECACHE
+  ptrdiff_t icdelta;
+#endif
 #if LUA_USE_JUMPTABLE
 #include "ljumptab.h"
 #endif
  startfunc:
   trap = L->hookmask;
+  jitcount(L, ci_func(ci)->p);
  returning:  /* trap already set */
   cl = ci_func(ci);
   k = cl->p->k;
   pc = ci->u.l.savedpc;
+#if LUAI_INLINECACHE
+  lua_assert(sizeof(Instruction) == sizeof(unsigned int));
+  icdelta = cast_charp(cl->p->icache) - cast_charp(cl->p->code);
+#endif
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
   base = ci->func.p + 1;
+  jitrun(L);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1252,7 +1450,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (fastgetfield(L, upval, key, slot)) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1295,7 +1493,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+        if (fastgetfield(L, rb, key, slot)) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1308,7 +1506,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (fastgetfield(L, upval, key, slot)) {
           luaV_finishfastset(L, upval, slot, rc);
         }
         else
@@ -1351,7 +1549,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
+        if (fastgetfield(L, s2v(ra), key, slot)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
@@ -1370,8 +1568,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
         pc++;  /* skip extra argument */
         L->top.p = ra + 1;  /* correct top in case of emergency GC */
+        savepc(L);  /* for the allocation profiler */
         t = luaH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
+#if LUAI_SHAPES
+        /* a few record fields go to the shape, not to the hash part
+           (other keys grow it when they come); many fields make the
+           table a dictionary */
+        if (b > LUAI_MAXSHAPEKEYS)
+          luaH_noshape(t);
+        else
+          b = 0;
+#endif
         if (b != 0 || c != 0)
           luaH_resize(L, t, c, b);  /* idem */
         checkGC(L, ra + 1);
@@ -1384,6 +1592,30 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobj2s(L, ra + 1, rb);
+#if LUAI_INLINECACHE
+        /* methods usually live in the '__index' table of the object's
+           metatable, so that is the lookup worth caching */
+        if (TESTARG_k(i) && ttistable(rb) && key->tt == LUA_VSHRSTR) {
+          Table *h = hvalue(rb);
+          const TValue *tm;
+          slot = luaH_getshortstr(h, key);
+          if (isempty(slot) && h->metatable != NULL &&
+              (tm = fasttm(L, h->metatable, TM_INDEX)) != NULL &&
+              ttistable(tm)) {
+            const TValue *mslot;
+            if (luaV_fastgetcache(L, tm, key, mslot, icache())) {
+              setobj2s(L, ra, mslot);
+              vmbreak;
+            }
+          }
+          else if (!isempty(slot)) {
+            setobj2s(L, ra, slot);
+            vmbreak;
+          }
+          Protect(luaV_finishget(L, rb, rc, ra, slot));
+          vmbreak;
+        }
+#endif
         if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
           setobj2s(L, ra, slot);
         }
@@ -1679,8 +1911,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(L);  /* in case of errors */
-        if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+        if ((newci = luaD_precall(L, ra, nresults)) == NULL) {
           updatetrap(ci);  /* C call; nothing else to be done */
+          jitrun(L);
+        }
         else {  /* Lua call: run function in this same C frame */
           ci = newci;
           goto startfunc;
@@ -1793,11 +2027,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), idx);  /* update internal index */
             setivalue(s2v(ra + 3), idx);  /* and control variable */
             pc -= GETARG_Bx(i);  /* jump back */
+            jitcount(L, cl->p);
           }
         }
         else if (floatforloop(ra))  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
         updatetrap(ci);  /* allows a signal to break the loop */
+        jitrun(L);
         vmbreak;
       }
       vmcase(OP_FORPREP) {
@@ -1839,6 +2075,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitrun(L);
         }
         vmbreak;
       }}
@@ -1886,6 +2123,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           L->oldpc = 1;  /* next opcode will be seen as a "new" line */
         }
         updatebase(ci);  /* function has new base after adjustment */
+        jitrun(L);
         vmbreak;
       }
       vmcase(OP_EXTRAARG) {
@@ -89,6 +89,19 @@ typedef enum {
       !isempty(slot)))  /* result not empty? */
 
 
+/*
+** Variant of 'luaV_fastget' for short-string keys going through the
+** inline cache 'c' (see 'luaH_getshortstrcache'); a hit is resolved
+** here without calling into ltable.c.
+*/
+#define luaV_fastgetcache(L,t,k,slot,c) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
+   : ((slot = luaH_cacheslot(hvalue(t), k, *(c))) == NULL  \
+              ? (slot = luaH_getshortstrcache(hvalue(t), k, c)) : slot, \
+      !isempty(slot)))  /* result not empty? */
+
+
 /*
 ** Special case of 'luaV_fastget' for integers, inlining the fast case
 ** of 'luaH_getint'.